@@ -28,7 +28,9 @@ public:
 	}
 
 	/**
-	 * Callback invoked by the #Database.
+	 * Callback invoked by the #Database.  If a batch of records
+	 * has been appended, this is only called once for the first
+	 * one; the others can be found by iterating the list.
 	 *
 	 * @return false to remove the listener from the
 	 * #AppendListenerList
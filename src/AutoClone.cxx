@@ -19,6 +19,7 @@
 #include <systemd/sd-daemon.h>
 #endif
 
+#include <cstddef> // for offsetof()
 #include <memory>
 
 #include <net/if.h>
@@ -96,12 +97,20 @@ public:
 		assert(state == State::IDLE);
 
 		state = State::CLONE;
-		pending_clear = true;
+
+		const auto since = operation.GetSince();
+
+		/* if we have records already, clone only the newer
+		   ones and keep ours */
+		pending_clear = since == Net::Log::TimePoint{};
 
 		id = client->MakeId();
 
 		try {
 			client->Send(id, PondRequestCommand::QUERY);
+			if (since != Net::Log::TimePoint{})
+				client->Send(id, PondRequestCommand::FILTER_SINCE,
+					     since.time_since_epoch());
 			client->Send(id, PondRequestCommand::COMMIT);
 		} catch (...) {
 			operation.OnServerError(*this,
@@ -215,7 +224,8 @@ AutoCloneOperation::Server::OnPondDatagram(uint16_t _id,
 	case PondResponseCommand::STATS:
 		if (state == State::STATS) {
 			const auto &stats = *(const PondStatsPayload *)(const void *)payload.data();
-			if (payload.size() < sizeof(stats))
+			/* older servers don't send "n_duplicates" */
+			if (payload.size() < offsetof(PondStatsPayload, n_duplicates))
 				throw SocketProtocolError{"Malformed STATS packet"};
 
 			n_records = FromBE64(stats.n_records);
@@ -224,6 +234,13 @@ AutoCloneOperation::Server::OnPondDatagram(uint16_t _id,
 			operation.OnServerStats(*this);
 		} else
 			throw SocketProtocolError{"Unexpected response packet"};
+		break;
+
+	case PondResponseCommand::RECEIVER_STATS:
+	case PondResponseCommand::RATE_LIMIT_STATS:
+	case PondResponseCommand::SENDER_STATS:
+	case PondResponseCommand::WEIGHTED_LOG_RECORD:
+		throw SocketProtocolError{"Unexpected response packet"};
 	}
 
 	return true;
@@ -232,9 +249,10 @@ AutoCloneOperation::Server::OnPondDatagram(uint16_t _id,
 AutoCloneOperation::AutoCloneOperation(BlockingOperationHandler &_handler,
 				       Database &_db,
 				       Avahi::Client &avahi_client,
-				       const ListenerConfig &listener) noexcept
+				       const ListenerConfig &listener,
+				       Net::Log::TimePoint _since) noexcept
 	:logger("auto_clone"), handler(_handler),
-	 db(_db),
+	 db(_db), since(_since),
 	 explorer(avahi_client, *this,
 		  GetAvahiIfIndex(listener),
 		  listener.zeroconf.protocol,
@@ -10,6 +10,7 @@
 #include "lib/avahi/ExplorerListener.hxx"
 #include "event/CoarseTimerEvent.hxx"
 #include "io/Logger.hxx"
+#include "net/log/Chrono.hxx"
 #include "util/IntrusiveList.hxx"
 
 struct ListenerConfig;
@@ -26,6 +27,13 @@ class AutoCloneOperation final : public BlockingOperation,
 
 	Database &db;
 
+	/**
+	 * If set, then only records since this time are cloned, and
+	 * the #Database is not cleared (e.g. after loading a
+	 * snapshot).
+	 */
+	const Net::Log::TimePoint since;
+
 	Avahi::ServiceExplorer explorer;
 
 	CoarseTimerEvent timeout_event;
@@ -37,10 +45,16 @@ class AutoCloneOperation final : public BlockingOperation,
 	ServerList servers;
 
 public:
+	/**
+	 * @param _since if not Net::Log::TimePoint{}, then only
+	 * records since this time are cloned and added to the
+	 * existing ones
+	 */
 	AutoCloneOperation(BlockingOperationHandler &_handler,
 			   Database &_db,
 			   Avahi::Client &avahi_client,
-			   const ListenerConfig &listener) noexcept;
+			   const ListenerConfig &listener,
+			   Net::Log::TimePoint _since={}) noexcept;
 
 	~AutoCloneOperation() noexcept override;
 
@@ -48,6 +62,10 @@ public:
 		return timeout_event.GetEventLoop();
 	}
 
+	Net::Log::TimePoint GetSince() const noexcept {
+		return since;
+	}
+
 private:
 	void OnTimeout() noexcept;
 
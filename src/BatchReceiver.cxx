@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "BatchReceiver.hxx"
+#include "ReceiverHandler.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+BatchReceiver::BatchReceiver(EventLoop &event_loop,
+			     UniqueSocketDescriptor &&socket,
+			     std::size_t batch_size,
+			     ReceiverStats &_stats,
+			     ReceiverHandler &_handler)
+	:event(event_loop, BIND_THIS_METHOD(OnSocketReady), socket.Release()),
+	 handler(_handler), stats(_stats),
+	 batch(batch_size)
+{
+	event.ScheduleRead();
+}
+
+BatchReceiver::~BatchReceiver() noexcept
+{
+	event.Close();
+}
+
+void
+BatchReceiver::OnSocketReady(unsigned) noexcept
+try {
+	if (!batch.Receive(event.GetSocket()))
+		return;
+
+	stats.n_received += batch.GetReceivedCount();
+	stats.n_dropped += drop_counter.Update(batch.GetDropCounter());
+
+	batch.Parse(&stats.senders, &stats.filter);
+	handler.OnReceiverBatch(batch);
+} catch (...) {
+	handler.OnReceiverError(std::current_exception());
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ReceiverBatch.hxx"
+#include "ReceiverStats.hxx"
+#include "event/SocketEvent.hxx"
+
+class UniqueSocketDescriptor;
+class ReceiverHandler;
+
+/**
+ * Receives batches of datagrams in the main thread (i.e. without a
+ * #ReceiverThread) and passes them to the #ReceiverHandler.
+ */
+class BatchReceiver final {
+	SocketEvent event;
+
+	ReceiverHandler &handler;
+
+	ReceiverStats &stats;
+	DropCounter drop_counter;
+
+	ReceiverBatch batch;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	BatchReceiver(EventLoop &event_loop, UniqueSocketDescriptor &&socket,
+		      std::size_t batch_size,
+		      ReceiverStats &_stats,
+		      ReceiverHandler &_handler);
+	~BatchReceiver() noexcept;
+
+	BatchReceiver(const BatchReceiver &) = delete;
+	BatchReceiver &operator=(const BatchReceiver &) = delete;
+
+private:
+	void OnSocketReady(unsigned events) noexcept;
+};
@@ -95,6 +95,10 @@ CloneOperation::OnPondDatagram(uint16_t _id, PondResponseCommand command,
 		break;
 
 	case PondResponseCommand::STATS:
+	case PondResponseCommand::RECEIVER_STATS:
+	case PondResponseCommand::RATE_LIMIT_STATS:
+	case PondResponseCommand::SENDER_STATS:
+	case PondResponseCommand::WEIGHTED_LOG_RECORD:
 		throw SocketProtocolError{"Unexpected response packet"};
 	}
 
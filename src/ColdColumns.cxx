@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ColdColumns.hxx"
+#include "ColdStore.hxx"
+#include "Filter.hxx"
+
+#include <algorithm> // for std::binary_search()
+#include <numeric> // for std::iota()
+#include <utility> // for std::to_underlying()
+
+void
+ColdColumns::Scan(const Filter &filter, SiteId site,
+		  std::vector<uint_least32_t> &result) const
+{
+	result.resize(timestamps.size());
+	std::iota(result.begin(), result.end(), 0);
+
+	/* each pass reads only one column and removes the
+	   mismatches from the result; the most selective columns
+	   come first */
+
+	if (site != ColdStore::ANY_SITE)
+		std::erase_if(result, [this, site](auto i){
+			return site_ids[i] != site;
+		});
+
+	if (!filter.site_ids.empty())
+		std::erase_if(result, [this, &filter](auto i){
+			return !std::binary_search(filter.site_ids.begin(),
+						   filter.site_ids.end(),
+						   site_ids[i]);
+		});
+
+	if (filter.type != Net::Log::Type::UNSPECIFIED)
+		std::erase_if(result, [this, type = filter.type](auto i){
+			return types[i] != type;
+		});
+
+	if (filter.timestamp)
+		std::erase_if(result, [this, &filter](auto i){
+			const auto t = timestamps[i];
+			return t == Net::Log::TimePoint() ||
+				t < filter.timestamp.since ||
+				t > filter.timestamp.until;
+		});
+
+	if (filter.duration)
+		/* invalid durations are Duration::min() and never
+		   match */
+		std::erase_if(result, [this, &filter](auto i){
+			return durations[i] < filter.duration.longer;
+		});
+
+	if (filter.http_status)
+		std::erase_if(result, [this, &filter](auto i){
+			return !filter.http_status(http_status[i]);
+		});
+
+	if (filter.http_methods != 0)
+		std::erase_if(result, [this, methods = filter.http_methods](auto i){
+			return (methods & uint_least32_t{1} << std::to_underlying(http_methods[i])) == 0;
+		});
+}
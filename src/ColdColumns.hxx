@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "SiteId.hxx"
+#include "net/log/Chrono.hxx"
+#include "net/log/Protocol.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class HttpMethod : uint_least8_t;
+struct Filter;
+
+/**
+ * Some attributes of all records of a #ColdBlock, stored column by
+ * column.  This allows evaluating the cheap parts of a #Filter one
+ * attribute at a time over a contiguous array, without decompressing
+ * the raw datagrams or building #Record instances.
+ */
+struct ColdColumns {
+	/**
+	 * Net::Log::TimePoint() if the record has no time stamp.
+	 */
+	std::vector<Net::Log::TimePoint> timestamps;
+
+	/**
+	 * Net::Log::Duration::min() if the record has no valid
+	 * duration.
+	 */
+	std::vector<Net::Log::Duration> durations;
+
+	std::vector<SiteId> site_ids;
+
+	std::vector<uint16_t> http_status;
+
+	std::vector<HttpMethod> http_methods;
+
+	std::vector<Net::Log::Type> types;
+
+	void reserve(std::size_t n) {
+		timestamps.reserve(n);
+		durations.reserve(n);
+		site_ids.reserve(n);
+		http_status.reserve(n);
+		http_methods.reserve(n);
+		types.reserve(n);
+	}
+
+	/**
+	 * Determine which records may match the given filter.  Only
+	 * site, type, time stamp, duration, HTTP status and HTTP
+	 * method are checked; the caller must apply the #Filter to
+	 * each returned record.
+	 *
+	 * Throws on error.
+	 *
+	 * @param site if not ColdStore::ANY_SITE, then only records
+	 * of this site are returned
+	 * @param result receives the (ascending) indices of all
+	 * matching records
+	 */
+	void Scan(const Filter &filter, SiteId site,
+		  std::vector<uint_least32_t> &result) const;
+};
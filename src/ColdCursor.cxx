@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ColdCursor.hxx"
+#include "Record.hxx"
+
+#include <limits>
+
+inline bool
+ColdCursor::Load(const ColdBlock &b, const Filter &filter) noexcept
+{
+	auto records = store->Load(b, filter, site);
+	if (!records || records->empty())
+		/* no match or decompression has failed; skip this
+		   block */
+		return false;
+
+	block = std::move(records);
+	first_id = b.first_id;
+	last_id = b.last_id;
+	return true;
+}
+
+void
+ColdCursor::LoadForward(const ColdBlock *b,
+			const Filter &filter) noexcept
+{
+	assert(store != nullptr);
+
+	block.reset();
+	pending = Pending::NONE;
+
+	unsigned n_loads = 0;
+	for (; b != nullptr; b = store->FindAfter(b->last_id)) {
+		/* the meta data check is cheap and doesn't count */
+		if (!b->MayMatch(filter, site))
+			continue;
+
+		if (n_loads++ == MAX_LOADS) {
+			/* continue with this block in the next
+			   Resume() call */
+			pending = Pending::FORWARD;
+			last_id = b->first_id - 1;
+			return;
+		}
+
+		if (Load(*b, filter)) {
+			index = 0;
+			return;
+		}
+	}
+}
+
+void
+ColdCursor::LoadBackward(const ColdBlock *b,
+			 const Filter &filter) noexcept
+{
+	assert(store != nullptr);
+
+	block.reset();
+	pending = Pending::NONE;
+
+	unsigned n_loads = 0;
+	for (; b != nullptr; b = store->FindBefore(b->first_id)) {
+		if (!b->MayMatch(filter, site))
+			continue;
+
+		if (n_loads++ == MAX_LOADS) {
+			pending = Pending::BACKWARD;
+			first_id = b->last_id + 1;
+			return;
+		}
+
+		if (Load(*b, filter)) {
+			index = block->size() - 1;
+			return;
+		}
+	}
+}
+
+bool
+ColdCursor::Rewind(const Filter &filter) noexcept
+{
+	LoadForward(store->FindAfter(0), filter);
+	return block != nullptr || IsPending();
+}
+
+bool
+ColdCursor::SeekLast(const Filter &filter) noexcept
+{
+	LoadBackward(store->FindBefore(std::numeric_limits<uint64_t>::max()),
+		     filter);
+	return block != nullptr || IsPending();
+}
+
+void
+ColdCursor::Resume(const Filter &filter) noexcept
+{
+	switch (pending) {
+	case Pending::NONE:
+		assert(false);
+		break;
+
+	case Pending::FORWARD:
+		LoadForward(store->FindAfter(last_id), filter);
+		break;
+
+	case Pending::BACKWARD:
+		LoadBackward(store->FindBefore(first_id), filter);
+		break;
+	}
+}
+
+void
+ColdCursor::Next(const Filter &filter) noexcept
+{
+	assert(block);
+
+	if (++index < block->size())
+		return;
+
+	LoadForward(store->FindAfter(last_id), filter);
+}
+
+void
+ColdCursor::Previous(const Filter &filter) noexcept
+{
+	assert(block);
+
+	if (index > 0) {
+		--index;
+		return;
+	}
+
+	LoadBackward(store->FindBefore(first_id), filter);
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ColdStore.hxx"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * An iterator for records in the #ColdStore.  The current block is
+ * decompressed and kept alive by this object, therefore the
+ * #ColdStore may be modified while an instance exists; blocks which
+ * have been deleted meanwhile are skipped.
+ *
+ * Decompressing is expensive, so each call decompresses at most
+ * #MAX_LOADS blocks.  If no matching record was found by then, the
+ * cursor becomes "pending" and the caller shall call Resume() later.
+ */
+class ColdCursor {
+	/**
+	 * The maximum number of blocks decompressed by one call.
+	 */
+	static constexpr unsigned MAX_LOADS = 1;
+
+	const ColdStore *store = nullptr;
+
+	/**
+	 * If not ColdStore::ANY_SITE, then only records of this site
+	 * are visited.
+	 */
+	SiteId site = ColdStore::ANY_SITE;
+
+	/**
+	 * The matching records of the current block.  If this is
+	 * nullptr, then the cursor is at the end.  This is a shared
+	 * pointer, because Mark() copies it.
+	 */
+	std::shared_ptr<const ColdRecords> block;
+
+	/**
+	 * The record id range of the current block; used to find
+	 * its neighbors in the #ColdStore.  While #pending, this is
+	 * the position where Resume() continues.
+	 */
+	uint64_t first_id, last_id;
+
+	/**
+	 * The position within #block.
+	 */
+	std::size_t index;
+
+	/**
+	 * If not #NONE, then there is no current #block, but the
+	 * search was suspended and shall be continued by Resume().
+	 */
+	enum class Pending : uint_least8_t {
+		NONE,
+		FORWARD,
+		BACKWARD,
+	} pending = Pending::NONE;
+
+public:
+	ColdCursor() noexcept = default;
+
+	ColdCursor(const ColdStore &_store, SiteId _site) noexcept
+		:store(&_store), site(_site) {}
+
+	bool IsEnabled() const noexcept {
+		return store != nullptr;
+	}
+
+	void Clear() noexcept {
+		block.reset();
+		pending = Pending::NONE;
+	}
+
+	/**
+	 * Was the search suspended?  If yes, call Resume().
+	 */
+	bool IsPending() const noexcept {
+		return pending != Pending::NONE;
+	}
+
+	/**
+	 * Was a search towards newer records suspended?
+	 */
+	bool IsPendingForward() const noexcept {
+		return pending == Pending::FORWARD;
+	}
+
+	/**
+	 * Move to the first record in a block which may match the
+	 * filter.
+	 *
+	 * @return true if a record was found or if the search is
+	 * pending
+	 */
+	bool Rewind(const Filter &filter) noexcept;
+
+	/**
+	 * Move to the last record in a block which may match the
+	 * filter.
+	 *
+	 * @return true if a record was found or if the search is
+	 * pending
+	 */
+	bool SeekLast(const Filter &filter) noexcept;
+
+	/**
+	 * Continue a suspended search (in the direction of the call
+	 * which suspended it).  This may suspend it again.
+	 */
+	void Resume(const Filter &filter) noexcept;
+
+	/**
+	 * Opaque struct for Mark() and Restore().  It keeps the
+	 * block alive.
+	 */
+	struct Marker {
+		std::shared_ptr<const ColdRecords> block;
+		uint64_t first_id, last_id;
+		std::size_t index;
+		Pending pending;
+	};
+
+	Marker Mark() const noexcept {
+		return {block, first_id, last_id, index, pending};
+	}
+
+	void Restore(const Marker &marker) noexcept {
+		block = marker.block;
+		first_id = marker.first_id;
+		last_id = marker.last_id;
+		index = marker.index;
+		pending = marker.pending;
+	}
+
+	/**
+	 * Does this instance point to a valid record?
+	 */
+	operator bool() const noexcept {
+		return block != nullptr;
+	}
+
+	const Record &operator*() const noexcept {
+		assert(block);
+
+		return (*block)[index];
+	}
+
+	const Record *operator->() const noexcept {
+		return &**this;
+	}
+
+	/**
+	 * Skip to the next record which may match the filter.  This
+	 * may suspend the search (see IsPending()).
+	 */
+	void Next(const Filter &filter) noexcept;
+
+	/**
+	 * Skip to the previous record which may match the filter.
+	 * This may suspend the search (see IsPending()).
+	 */
+	void Previous(const Filter &filter) noexcept;
+
+private:
+	/**
+	 * Load the records of the given block which may match the
+	 * filter (see ColdStore::Load()).
+	 *
+	 * @return true if at least one was found
+	 */
+	bool Load(const ColdBlock &b, const Filter &filter) noexcept;
+
+	/**
+	 * Load the first matching record from the given block or
+	 * its successors, or suspend the search after #MAX_LOADS
+	 * blocks.
+	 */
+	void LoadForward(const ColdBlock *b,
+			 const Filter &filter) noexcept;
+
+	/**
+	 * Load the last matching record from the given block or its
+	 * predecessors, or suspend the search after #MAX_LOADS
+	 * blocks.
+	 */
+	void LoadBackward(const ColdBlock *b,
+			  const Filter &filter) noexcept;
+};
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ColdDictionary.hxx"
+#include "Record.hxx"
+#include "net/log/Parser.hxx"
+
+#include <algorithm> // for std::sort()
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Strings shorter than this are not worth a dictionary entry;
+ * deflate cannot refer to matches shorter than 3 bytes.
+ */
+static constexpr std::size_t MIN_STRING_LENGTH = 4;
+
+/**
+ * Longer strings are probably unique (e.g. URIs with query strings).
+ */
+static constexpr std::size_t MAX_STRING_LENGTH = 256;
+
+using StringCounter = std::unordered_map<std::string_view, std::size_t>;
+
+static void
+Count(StringCounter &counter, SmallDatagram::StringRef ref,
+      std::span<const std::byte> raw) noexcept
+{
+	if (ref.IsNull() || ref.size < MIN_STRING_LENGTH ||
+	    ref.size > MAX_STRING_LENGTH)
+		return;
+
+	++counter[ref.Get(raw)];
+}
+
+template<typename T>
+static void
+Count(StringCounter &counter, T value,
+      std::span<const std::byte> raw) noexcept
+{
+	Count(counter, SmallDatagram::StringRef{value, raw}, raw);
+}
+
+std::shared_ptr<const ColdDictionary>
+ColdDictionary::Build(std::span<const Record *const> records)
+{
+	StringCounter counter;
+
+	for (const auto *i : records) {
+		const auto raw = i->GetRaw();
+		const auto &parsed = i->GetParsed();
+
+		Count(counter, parsed.site, raw);
+		Count(counter, parsed.host, raw);
+		Count(counter, parsed.generator, raw);
+
+		/* the user agent is not in the SmallDatagram; parse
+		   the datagram fully (this is rare: dictionaries are
+		   built only once in a while) */
+		try {
+			const auto d = Net::Log::ParseDatagram(raw);
+			Count(counter, d.user_agent, raw);
+			Count(counter, d.forwarded_to, raw);
+		} catch (...) {
+		}
+	}
+
+	/* pick the strings which save the most bytes */
+
+	struct Item {
+		std::string_view value;
+		std::size_t benefit;
+	};
+
+	std::vector<Item> items;
+	for (const auto &[value, n] : counter)
+		if (n > 1)
+			items.push_back({value, (n - 1) * value.size()});
+
+	if (items.empty())
+		return nullptr;
+
+	std::sort(items.begin(), items.end(), [](const Item &a, const Item &b){
+		return a.benefit > b.benefit;
+	});
+
+	std::size_t size = 0, n_items = 0;
+	for (const auto &i : items) {
+		if (size + i.value.size() > MAX_SIZE)
+			break;
+
+		size += i.value.size();
+		++n_items;
+	}
+
+	/* zlib recommends putting the most common strings at the
+	   end of the dictionary, where they can be referenced with
+	   shorter distances */
+
+	std::vector<std::byte> data;
+	data.reserve(size);
+
+	for (std::size_t i = n_items; i > 0;) {
+		const auto &value = items[--i].value;
+		const auto *p = reinterpret_cast<const std::byte *>(value.data());
+		data.insert(data.end(), p, p + value.size());
+	}
+
+	return std::make_shared<const ColdDictionary>(std::move(data));
+}
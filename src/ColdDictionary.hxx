@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+
+class Record;
+
+/**
+ * A table of short strings which occur in many records (e.g. site,
+ * host, generator and user agent), used as a zlib preset dictionary
+ * for #ColdBlock instances.  deflate can then refer to these strings
+ * instead of storing them again at the beginning of each block and
+ * whenever they have dropped out of its 32 kB window.
+ *
+ * Instances are reference-counted: each #ColdBlock holds a
+ * reference to the dictionary it was compressed with, and the
+ * dictionary is freed together with the last such block.
+ */
+class ColdDictionary {
+	std::vector<std::byte> data;
+
+public:
+	/**
+	 * The maximum size of a dictionary; zlib cannot make use of
+	 * more than its window size.
+	 */
+	static constexpr std::size_t MAX_SIZE = 32768;
+
+	explicit ColdDictionary(std::vector<std::byte> &&_data) noexcept
+		:data(std::move(_data)) {}
+
+	ColdDictionary(const ColdDictionary &) = delete;
+	ColdDictionary &operator=(const ColdDictionary &) = delete;
+
+	/**
+	 * Collect the most common strings from the given records.
+	 *
+	 * Throws on error.
+	 *
+	 * @return the new dictionary or nullptr if there are no
+	 * repeated strings
+	 */
+	static std::shared_ptr<const ColdDictionary> Build(std::span<const Record *const> records);
+
+	std::span<const std::byte> get() const noexcept {
+		return data;
+	}
+
+	std::size_t GetMemoryUsage() const noexcept {
+		return sizeof(*this) + data.size();
+	}
+};
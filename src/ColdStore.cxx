@@ -0,0 +1,740 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ColdStore.hxx"
+#include "ColdDictionary.hxx"
+#include "FullRecordList.hxx"
+#include "Filter.hxx"
+#include "http/Method.hxx"
+#include "http/Status.hxx"
+#include "lib/zlib/Error.hxx"
+#include "util/ScopeExit.hxx"
+
+#include <zlib.h>
+
+#include <algorithm> // for std::sort(), std::unique()
+#include <cassert>
+#include <new> // for placement new
+#include <type_traits>
+
+#include <string.h> // for memcpy()
+
+/**
+ * The columns of a decompressed block.  Each attribute is stored as
+ * an array (ordered by decreasing alignment), followed by the raw
+ * datagrams.  This compresses better than an array of structs,
+ * because similar values are next to each other, and time stamps
+ * are delta-encoded.
+ *
+ * The #SmallDatagram attributes are stored instead of parsing the
+ * raw datagram again, because they may contain information which is
+ * not in the raw datagram (e.g. the kernel receive time stamp).
+ *
+ * @param B either "std::byte" or "const std::byte"
+ */
+template<typename B>
+struct EncodedColumns {
+	template<typename T>
+	using Column = std::span<std::conditional_t<std::is_const_v<B>, const T, T>>;
+
+	/**
+	 * The size of all columns of one record.
+	 */
+	static constexpr std::size_t RECORD_SIZE =
+		2 * sizeof(int64_t) + 2 * sizeof(uint32_t) + sizeof(SiteId) +
+		4 * sizeof(SmallDatagram::StringRef) +
+		sizeof(uint16_t) + 4 * sizeof(uint8_t);
+
+	/**
+	 * The difference between this time stamp and the previous
+	 * record's (Net::Log::Duration::rep).
+	 */
+	Column<int64_t> timestamp_deltas;
+
+	Column<int64_t> durations;
+
+	/**
+	 * The difference between the record id and
+	 * ColdBlock::first_id.
+	 */
+	Column<uint32_t> id_deltas;
+
+	/**
+	 * The size of each raw datagram.
+	 */
+	Column<uint32_t> sizes;
+
+	Column<SiteId> site_ids;
+
+	Column<SmallDatagram::StringRef> sites, hosts, generators, http_uris;
+
+	Column<uint16_t> http_status;
+
+	Column<uint8_t> http_methods, types, valid_durations, weight_shifts;
+
+	/**
+	 * The raw datagrams (concatenated).
+	 */
+	B *raw;
+
+	EncodedColumns(B *p, std::size_t n) noexcept
+		:timestamp_deltas(Take<int64_t>(p, n)),
+		 durations(Take<int64_t>(p, n)),
+		 id_deltas(Take<uint32_t>(p, n)),
+		 sizes(Take<uint32_t>(p, n)),
+		 site_ids(Take<SiteId>(p, n)),
+		 sites(Take<SmallDatagram::StringRef>(p, n)),
+		 hosts(Take<SmallDatagram::StringRef>(p, n)),
+		 generators(Take<SmallDatagram::StringRef>(p, n)),
+		 http_uris(Take<SmallDatagram::StringRef>(p, n)),
+		 http_status(Take<uint16_t>(p, n)),
+		 http_methods(Take<uint8_t>(p, n)),
+		 types(Take<uint8_t>(p, n)),
+		 valid_durations(Take<uint8_t>(p, n)),
+		 weight_shifts(Take<uint8_t>(p, n)),
+		 raw(p) {}
+
+private:
+	template<typename T>
+	static Column<T> Take(B *&p, std::size_t n) noexcept {
+		assert(reinterpret_cast<uintptr_t>(p) % alignof(T) == 0);
+
+		Column<T> result{reinterpret_cast<typename Column<T>::pointer>(p), n};
+		p += n * sizeof(T);
+		return result;
+	}
+};
+
+static constexpr std::size_t
+AlignRecord(std::size_t size) noexcept
+{
+	return (size + alignof(Record) - 1) & ~(alignof(Record) - 1);
+}
+
+/**
+ * The size of the decompressed columns section of a block with the
+ * given number of records.
+ */
+static constexpr std::size_t
+GetColumnsRawSize(std::size_t n_records) noexcept
+{
+	return n_records * EncodedColumns<std::byte>::RECORD_SIZE;
+}
+
+/**
+ * Compress with the given preset dictionary.
+ *
+ * Throws on error.
+ *
+ * @return the number of bytes written to #dest
+ */
+static std::size_t
+Deflate(std::span<std::byte> dest, std::span<const std::byte> src,
+	const ColdDictionary *dictionary)
+{
+	z_stream z{};
+
+	if (int result = deflateInit(&z, Z_DEFAULT_COMPRESSION);
+	    result != Z_OK)
+		throw ZlibError(result);
+
+	AtScopeExit(&z) { deflateEnd(&z); };
+
+	if (dictionary != nullptr) {
+		const auto d = dictionary->get();
+		if (int result = deflateSetDictionary(&z,
+						      reinterpret_cast<const Bytef *>(d.data()),
+						      d.size());
+		    result != Z_OK)
+			throw ZlibError(result);
+	}
+
+	z.next_in = reinterpret_cast<const Bytef *>(src.data());
+	z.avail_in = src.size();
+	z.next_out = reinterpret_cast<Bytef *>(dest.data());
+	z.avail_out = dest.size();
+
+	if (int result = deflate(&z, Z_FINISH); result != Z_STREAM_END)
+		/* Z_OK means the output buffer was too small */
+		throw ZlibError(result == Z_OK ? Z_BUF_ERROR : result);
+
+	return z.total_out;
+}
+
+/**
+ * Decompress with the given preset dictionary.
+ *
+ * @return true on success
+ */
+static bool
+Inflate(std::span<std::byte> dest, std::span<const std::byte> src,
+	const ColdDictionary *dictionary) noexcept
+{
+	z_stream z{};
+
+	if (inflateInit(&z) != Z_OK)
+		return false;
+
+	AtScopeExit(&z) { inflateEnd(&z); };
+
+	z.next_in = reinterpret_cast<const Bytef *>(src.data());
+	z.avail_in = src.size();
+	z.next_out = reinterpret_cast<Bytef *>(dest.data());
+	z.avail_out = dest.size();
+
+	int result = inflate(&z, Z_FINISH);
+	if (result == Z_NEED_DICT) {
+		if (dictionary == nullptr)
+			return false;
+
+		const auto d = dictionary->get();
+		if (inflateSetDictionary(&z,
+					 reinterpret_cast<const Bytef *>(d.data()),
+					 d.size()) != Z_OK)
+			return false;
+
+		result = inflate(&z, Z_FINISH);
+	}
+
+	return result == Z_STREAM_END && z.total_out == dest.size();
+}
+
+ColdRecords::~ColdRecords() noexcept
+{
+	for (const auto *i : records)
+		i->~Record();
+}
+
+std::size_t
+ColdBlock::GetMemoryUsage() const noexcept
+{
+	std::size_t result = sizeof(*this) + sites.size() * sizeof(SiteId);
+	if (!IsSpilled())
+		result += data_size;
+	return result;
+}
+
+bool
+ColdBlock::MayMatch(const Filter &filter, SiteId site) const noexcept
+{
+	if (filter.timestamp &&
+	    (!has_timestamps || newest < filter.timestamp.since ||
+	     oldest > filter.timestamp.until))
+		return false;
+
+	if (filter.type != Net::Log::Type::UNSPECIFIED &&
+	    (types & TypeBit(filter.type)) == 0)
+		return false;
+
+	if (site != ColdStore::ANY_SITE &&
+	    !std::binary_search(sites.begin(), sites.end(), site))
+		return false;
+
+	if (!filter.site_ids.empty() &&
+	    std::none_of(filter.site_ids.begin(), filter.site_ids.end(),
+			 [this](SiteId i){
+				 return std::binary_search(sites.begin(), sites.end(), i);
+			 }))
+		return false;
+
+	return true;
+}
+
+ColdStore::~ColdStore() noexcept = default;
+
+void
+ColdStore::EnableSpill(const char *path, std::size_t _max_size)
+{
+	assert(IsEnabled());
+	assert(!spill);
+
+	spill = std::make_unique<SpillStore>(path, _max_size);
+}
+
+void
+ColdStore::clear() noexcept
+{
+	blocks.clear();
+	memory_usage = n_records = 0;
+	n_spilled = n_spilled_records = 0;
+
+	if (spill)
+		spill->Clear();
+	dictionary.reset();
+	dictionary_blocks = 0;
+
+	for (auto &i : cache)
+		i = {};
+}
+
+inline std::size_t
+ColdStore::GetAppendMemory(const ColdBlock &block) const noexcept
+{
+	std::size_t result = block.GetMemoryUsage();
+
+	/* blocks sharing a dictionary are consecutive, so it is new
+	   unless the last block refers to it */
+	if (block.dictionary != nullptr &&
+	    (blocks.empty() || blocks.back().dictionary != block.dictionary))
+		result += block.dictionary->GetMemoryUsage();
+
+	return result;
+}
+
+inline void
+ColdStore::ForgetFront() noexcept
+{
+	assert(!blocks.empty());
+
+	const auto &block = blocks.front();
+	memory_usage -= block.GetMemoryUsage();
+	n_records -= block.n_records;
+
+	/* is this the last block which refers to its dictionary?
+	   (spilled blocks still need it) */
+	if (block.dictionary != nullptr &&
+	    (blocks.size() == 1 || blocks[1].dictionary != block.dictionary))
+		memory_usage -= block.dictionary->GetMemoryUsage();
+}
+
+inline void
+ColdStore::PopFront() noexcept
+{
+	assert(!blocks.empty());
+
+	const auto &block = blocks.front();
+
+	if (block.IsSpilled()) {
+		assert(n_spilled > 0);
+		--n_spilled;
+		n_spilled_records -= block.n_records;
+	}
+
+	ForgetFront();
+	blocks.pop_front();
+}
+
+inline void
+ColdStore::DeleteUnspilled() noexcept
+{
+	assert(spill);
+
+	const auto oldest = spill->GetOldestSegment();
+	while (n_spilled > 0 &&
+	       blocks.front().spill_location.segment < oldest)
+		PopFront();
+}
+
+inline void
+ColdStore::SpillOne()
+{
+	assert(spill);
+	assert(n_spilled < blocks.size());
+
+	auto &block = blocks[n_spilled];
+	assert(!block.IsSpilled());
+
+	const auto location = spill->Append({block.data.get(), block.data_size});
+
+	memory_usage -= block.GetMemoryUsage();
+	block.data.reset();
+	block.spill_location = location;
+	memory_usage += block.GetMemoryUsage();
+
+	++n_spilled;
+	n_spilled_records += block.n_records;
+
+	/* the SpillStore may have deleted its oldest segment to
+	   make room */
+	DeleteUnspilled();
+}
+
+void
+ColdStore::DeleteOlderThan(Net::Log::TimePoint t) noexcept
+{
+	while (!blocks.empty() && blocks.front().IsOlderThanOrUnknown(t))
+		PopFront();
+}
+
+std::size_t
+ColdStore::Freeze(const FullRecordList &list, FreezeFilter *filter)
+{
+	assert(IsEnabled());
+
+	/* collect records from the beginning of the list */
+
+	std::vector<const Record *> records;
+	std::size_t raw_size = 0;
+
+	/* the number of records which were skipped (or collected) */
+	std::size_t n_consumed = 0;
+
+	for (const Record *i = list.First();
+	     i != nullptr && n_consumed < MAX_BLOCK_RECORDS;
+	     i = list.Next(*i)) {
+		if (filter != nullptr && filter->ShallDiscard(*i)) {
+			++n_consumed;
+			continue;
+		}
+
+		const std::size_t size = EncodedColumns<std::byte>::RECORD_SIZE +
+			i->GetRaw().size();
+		if (!records.empty() && raw_size + size > MAX_BLOCK_SIZE)
+			break;
+
+		records.push_back(i);
+		raw_size += size;
+		++n_consumed;
+	}
+
+	if (records.empty())
+		return n_consumed;
+
+	/* serialize them */
+
+	ColdBlock block;
+	block.first_id = records.front()->GetId();
+	block.last_id = records.back()->GetId();
+	block.n_records = records.size();
+	block.raw_size = raw_size;
+
+	const std::unique_ptr<std::byte[]> raw{new std::byte[raw_size]};
+	const EncodedColumns<std::byte> columns{raw.get(), records.size()};
+	std::byte *p = columns.raw;
+	Net::Log::Duration::rep previous_timestamp = 0;
+
+	for (std::size_t j = 0; j < records.size(); ++j) {
+		const auto *i = records[j];
+		const auto &parsed = i->GetParsed();
+		const auto r = i->GetRaw();
+
+		const auto timestamp = parsed.timestamp.time_since_epoch().count();
+		columns.timestamp_deltas[j] = timestamp - previous_timestamp;
+		previous_timestamp = timestamp;
+
+		columns.durations[j] = parsed.duration.count();
+		columns.id_deltas[j] = i->GetId() - block.first_id;
+		columns.sizes[j] = r.size();
+		columns.site_ids[j] = parsed.site_id;
+		columns.sites[j] = parsed.site;
+		columns.hosts[j] = parsed.host;
+		columns.generators[j] = parsed.generator;
+		columns.http_uris[j] = parsed.http_uri;
+		columns.http_status[j] = static_cast<uint16_t>(parsed.http_status);
+		columns.http_methods[j] = static_cast<uint8_t>(parsed.http_method);
+		columns.types[j] = static_cast<uint8_t>(parsed.type);
+		columns.valid_durations[j] = parsed.valid_duration;
+		columns.weight_shifts[j] = parsed.weight_shift;
+
+		p = std::copy(r.begin(), r.end(), p);
+
+		if (parsed.HasTimestamp()) {
+			if (!block.has_timestamps) {
+				block.oldest = block.newest = parsed.timestamp;
+				block.has_timestamps = true;
+			} else {
+				block.oldest = std::min(block.oldest, parsed.timestamp);
+				block.newest = std::max(block.newest, parsed.timestamp);
+			}
+		}
+
+		block.types |= ColdBlock::TypeBit(parsed.type);
+		block.sites.push_back(parsed.site_id);
+	}
+
+	std::sort(block.sites.begin(), block.sites.end());
+	block.sites.erase(std::unique(block.sites.begin(), block.sites.end()),
+			  block.sites.end());
+	block.sites.shrink_to_fit();
+
+	/* compress */
+
+	if (dictionary_blocks == 0)
+		dictionary = ColdDictionary::Build(records);
+
+	block.dictionary = dictionary;
+	if (++dictionary_blocks >= DICTIONARY_INTERVAL)
+		dictionary_blocks = 0;
+
+	/* the columns and the payload are compressed separately,
+	   so Load() can scan the columns without decompressing the
+	   payload; the dictionary contains strings from the payload
+	   and is not useful for the columns */
+
+	const std::size_t columns_raw_size = GetColumnsRawSize(records.size());
+	const std::span<const std::byte> columns_raw{raw.get(), columns_raw_size};
+	const std::span<const std::byte> payload_raw{raw.get() + columns_raw_size,
+						     raw_size - columns_raw_size};
+
+	const std::size_t max_compressed_size =
+		compressBound(columns_raw.size()) + compressBound(payload_raw.size());
+	const std::unique_ptr<std::byte[]> compressed{new std::byte[max_compressed_size]};
+	block.columns_size =
+		Deflate({compressed.get(), max_compressed_size},
+			columns_raw, nullptr);
+	const std::size_t compressed_size = block.columns_size +
+		Deflate({compressed.get() + block.columns_size,
+			 max_compressed_size - block.columns_size},
+			payload_raw, block.dictionary.get());
+
+	/* copy to a buffer of the exact size to avoid wasting the
+	   slack of compressBound() */
+	block.data.reset(new std::byte[compressed_size]);
+	memcpy(block.data.get(), compressed.get(), compressed_size);
+	block.data_size = compressed_size;
+
+	Append(std::move(block));
+	return n_consumed;
+}
+
+std::optional<ColdBlock>
+ColdStore::Shift() noexcept
+{
+	while (!blocks.empty() && blocks.front().IsSpilled())
+		PopFront();
+
+	if (blocks.empty())
+		return std::nullopt;
+
+	ForgetFront();
+
+	std::optional<ColdBlock> result{std::move(blocks.front())};
+	blocks.pop_front();
+	return result;
+}
+
+void
+ColdStore::Append(ColdBlock &&block) noexcept
+{
+	assert(IsEnabled());
+	assert(!block.IsSpilled());
+	assert(blocks.empty() || block.first_id > blocks.back().last_id);
+
+	/* make room and insert the new block */
+
+	/* this is evaluated again after each deletion, because
+	   the dictionary may have been deleted together with the
+	   last block */
+	while (!blocks.empty() &&
+	       memory_usage + GetAppendMemory(block) > max_size) {
+		if (spill && n_spilled < blocks.size()) {
+			try {
+				SpillOne();
+				continue;
+			} catch (...) {
+				/* I/O error: delete the block instead
+				   (below) */
+			}
+		}
+
+		PopFront();
+	}
+
+	memory_usage += GetAppendMemory(block);
+	n_records += block.n_records;
+	blocks.emplace_back(std::move(block));
+}
+
+const ColdBlock *
+ColdStore::FindAfter(uint64_t id) const noexcept
+{
+	auto i = std::upper_bound(blocks.begin(), blocks.end(), id,
+				  [](uint64_t _id, const ColdBlock &b){
+					  return _id < b.first_id;
+				  });
+	return i != blocks.end() ? &*i : nullptr;
+}
+
+const ColdBlock *
+ColdStore::FindBefore(uint64_t id) const noexcept
+{
+	auto i = std::lower_bound(blocks.begin(), blocks.end(), id,
+				  [](const ColdBlock &b, uint64_t _id){
+					  return b.last_id < _id;
+				  });
+	return i != blocks.begin() ? &*std::prev(i) : nullptr;
+}
+
+std::shared_ptr<const ColdBlockColumns>
+ColdStore::LoadColumns(const ColdBlock &block, std::span<const std::byte> data)
+{
+	const std::size_t n = block.n_records;
+	const std::size_t columns_raw_size = GetColumnsRawSize(n);
+	if (block.raw_size < columns_raw_size ||
+	    block.columns_size > data.size())
+		return nullptr;
+
+	auto result = std::make_shared<ColdBlockColumns>();
+
+	if (block.columns_size > 0) {
+		result->buffer.reset(new std::byte[columns_raw_size]);
+		if (!Inflate({result->buffer.get(), columns_raw_size},
+			     data.first(block.columns_size), nullptr))
+			return nullptr;
+	} else {
+		/* an old block with only one stream: decompress
+		   everything and use only the columns */
+		result->buffer.reset(new std::byte[block.raw_size]);
+		if (!Inflate({result->buffer.get(), block.raw_size}, data,
+			     block.dictionary.get()))
+			return nullptr;
+	}
+
+	const EncodedColumns<const std::byte> encoded{result->buffer.get(), n};
+
+	auto &offsets = result->offsets;
+	offsets.reserve(n);
+
+	auto &columns = result->columns;
+	columns.reserve(n);
+
+	uint32_t offset = 0;
+	Net::Log::Duration::rep timestamp = 0;
+
+	for (std::size_t i = 0; i < n; ++i) {
+		offsets.push_back(offset);
+		offset += encoded.sizes[i];
+
+		timestamp += encoded.timestamp_deltas[i];
+
+		const bool valid_duration = encoded.valid_durations[i] != 0;
+
+		columns.timestamps.emplace_back(Net::Log::Duration{timestamp});
+		columns.durations.push_back(valid_duration
+					    ? Net::Log::Duration{encoded.durations[i]}
+					    : Net::Log::Duration::min());
+		columns.site_ids.push_back(encoded.site_ids[i]);
+		columns.http_status.push_back(encoded.http_status[i]);
+		columns.http_methods.push_back(static_cast<HttpMethod>(encoded.http_methods[i]));
+		columns.types.push_back(static_cast<Net::Log::Type>(encoded.types[i]));
+	}
+
+	if (offset != block.raw_size - columns_raw_size)
+		/* corrupt block */
+		return nullptr;
+
+	return result;
+}
+
+std::shared_ptr<const std::byte[]>
+ColdStore::LoadPayload(const ColdBlock &block, std::span<const std::byte> data)
+{
+	const std::size_t columns_raw_size = GetColumnsRawSize(block.n_records);
+	assert(block.raw_size >= columns_raw_size);
+
+	if (block.columns_size > 0) {
+		const std::size_t size = block.raw_size - columns_raw_size;
+		std::shared_ptr<std::byte[]> result{new std::byte[size]};
+		if (!Inflate({result.get(), size},
+			     data.subspan(block.columns_size),
+			     block.dictionary.get()))
+			return nullptr;
+
+		return result;
+	} else {
+		/* an old block with only one stream */
+		std::shared_ptr<std::byte[]> result{new std::byte[block.raw_size]};
+		if (!Inflate({result.get(), block.raw_size}, data,
+			     block.dictionary.get()))
+			return nullptr;
+
+		return {result, result.get() + columns_raw_size};
+	}
+}
+
+ColdStore::CacheItem &
+ColdStore::GetCacheItem(const ColdBlock &block) const
+{
+	for (auto &i : cache)
+		if (i.columns && i.first_id == block.first_id)
+			return i;
+
+	auto &item = cache[cache_next];
+	cache_next = (cache_next + 1) % cache.size();
+
+	item = {block.first_id, nullptr, nullptr};
+	return item;
+}
+
+std::shared_ptr<const ColdRecords>
+ColdStore::Load(const ColdBlock &block, const Filter &filter,
+		SiteId site) const noexcept
+try {
+	std::span<const std::byte> data{block.data.get(), block.data_size};
+	if (block.IsSpilled()) {
+		/* this is a memory mapping; only the pages which
+		   are actually decompressed below are read from
+		   disk */
+		data = spill->Read(block.spill_location, block.data_size);
+		if (data.empty())
+			return nullptr;
+	}
+
+	auto &item = GetCacheItem(block);
+
+	if (!item.columns) {
+		item.columns = LoadColumns(block, data);
+		if (!item.columns)
+			return nullptr;
+	}
+
+	const auto &columns = *item.columns;
+
+	std::vector<uint_least32_t> matches;
+	columns.columns.Scan(filter, site, matches);
+	if (matches.empty())
+		/* the payload is not needed */
+		return std::make_shared<const ColdRecords>(nullptr,
+							   std::vector<const Record *>{});
+
+	if (!item.payload) {
+		item.payload = LoadPayload(block, data);
+		if (!item.payload)
+			return nullptr;
+	}
+
+	const std::byte *const payload = item.payload.get();
+	const EncodedColumns<const std::byte> encoded{columns.buffer.get(),
+						      block.n_records};
+
+	/* rebuild only the matching records */
+
+	std::size_t buffer_size = 0;
+	for (const auto i : matches)
+		buffer_size += AlignRecord(sizeof(Record) + encoded.sizes[i]);
+
+	std::unique_ptr<std::byte[]> buffer{new std::byte[buffer_size]};
+	std::vector<const Record *> records;
+	records.reserve(matches.size());
+
+	std::byte *dest = buffer.get();
+
+	for (const auto i : matches) {
+		const std::span<const std::byte> r{payload + columns.offsets[i],
+						   encoded.sizes[i]};
+
+		SmallDatagram parsed;
+		parsed.timestamp = columns.columns.timestamps[i];
+		parsed.duration = Net::Log::Duration{encoded.durations[i]};
+		parsed.site = encoded.sites[i];
+		parsed.host = encoded.hosts[i];
+		parsed.generator = encoded.generators[i];
+		parsed.http_uri = encoded.http_uris[i];
+		parsed.site_id = encoded.site_ids[i];
+		parsed.http_status = static_cast<HttpStatus>(encoded.http_status[i]);
+		parsed.http_method = static_cast<HttpMethod>(encoded.http_methods[i]);
+		parsed.type = static_cast<Net::Log::Type>(encoded.types[i]);
+		parsed.valid_duration = encoded.valid_durations[i] != 0;
+		parsed.weight_shift = encoded.weight_shifts[i];
+
+		records.push_back(new(dest) Record(block.first_id + encoded.id_deltas[i],
+						   r, parsed, parsed.site_id));
+		dest += AlignRecord(sizeof(Record) + r.size());
+	}
+
+	return std::make_shared<const ColdRecords>(std::move(buffer),
+						   std::move(records));
+} catch (...) {
+	return nullptr;
+}
@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ColdColumns.hxx"
+#include "SiteId.hxx"
+#include "SpillStore.hxx"
+#include "net/log/Chrono.hxx"
+#include "net/log/Protocol.hxx"
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+class Record;
+class FullRecordList;
+class ColdDictionary;
+struct Filter;
+
+/**
+ * Decompressed records of a #ColdBlock: an array of #Record
+ * instances which can be used just like the ones in the
+ * #FullRecordList.  It contains only the records which may match
+ * the #Filter passed to ColdStore::Load().
+ */
+class ColdRecords {
+	std::unique_ptr<std::byte[]> buffer;
+
+	std::vector<const Record *> records;
+
+public:
+	ColdRecords(std::unique_ptr<std::byte[]> &&_buffer,
+		    std::vector<const Record *> &&_records) noexcept
+		:buffer(std::move(_buffer)), records(std::move(_records)) {}
+
+	~ColdRecords() noexcept;
+
+	ColdRecords(const ColdRecords &) = delete;
+	ColdRecords &operator=(const ColdRecords &) = delete;
+
+	bool empty() const noexcept {
+		return records.empty();
+	}
+
+	std::size_t size() const noexcept {
+		return records.size();
+	}
+
+	const Record &operator[](std::size_t i) const noexcept {
+		return *records[i];
+	}
+};
+
+/**
+ * The decompressed columns of a #ColdBlock.  They are decompressed
+ * separately from the raw datagrams, so blocks without matching
+ * records can be skipped without decompressing the datagrams.
+ */
+struct ColdBlockColumns {
+	/**
+	 * The decompressed columns section (see #EncodedColumns in
+	 * ColdStore.cxx); it contains the attributes needed to
+	 * rebuild the #Record instances.
+	 */
+	std::unique_ptr<std::byte[]> buffer;
+
+	/**
+	 * The offset of each raw datagram within the decompressed
+	 * payload.
+	 */
+	std::vector<uint32_t> offsets;
+
+	/**
+	 * The attributes used by ColdColumns::Scan().
+	 */
+	ColdColumns columns;
+};
+
+/**
+ * A zlib-compressed block of consecutive records which were moved
+ * out of the #FullRecordList.
+ */
+struct ColdBlock {
+	uint64_t first_id, last_id;
+
+	/**
+	 * The range of known time stamps in this block.  Only
+	 * meaningful if #has_timestamps is set.
+	 */
+	Net::Log::TimePoint oldest, newest;
+
+	bool has_timestamps = false;
+
+	/**
+	 * A bit mask of all #Net::Log::Type values in this block;
+	 * types which don't fit are represented by the most
+	 * significant bit.
+	 */
+	uint_least32_t types = 0;
+
+	/**
+	 * All sites in this block (sorted).
+	 */
+	std::vector<SiteId> sites;
+
+	std::size_t n_records = 0;
+
+	/**
+	 * The size of the decompressed data (columns and payload).
+	 */
+	std::size_t raw_size = 0;
+
+	/**
+	 * The compressed data.  If this is nullptr, then it has been
+	 * moved to the #SpillStore at #spill_location.
+	 */
+	std::unique_ptr<std::byte[]> data;
+	std::size_t data_size = 0;
+
+	/**
+	 * The size of the compressed columns at the beginning of
+	 * #data; they are followed by the compressed payload (the
+	 * raw datagrams), which is compressed with the #dictionary.
+	 * Zero means both were compressed as one stream (by an older
+	 * version, see MoveSnapshot()).
+	 */
+	std::size_t columns_size = 0;
+
+	SpillStore::Location spill_location;
+
+	/**
+	 * The preset dictionary which was used to compress #data
+	 * (or nullptr if none).  Consecutive blocks share it; its
+	 * memory is accounted by the #ColdStore as long as at least
+	 * one block refers to it (see ColdStore::GetAppendMemory()).
+	 */
+	std::shared_ptr<const ColdDictionary> dictionary;
+
+	bool IsSpilled() const noexcept {
+		return data == nullptr;
+	}
+
+	static constexpr uint_least32_t TypeBit(Net::Log::Type type) noexcept {
+		const unsigned i = static_cast<unsigned>(type);
+		return uint_least32_t{1} << (i < 31 ? i : 31);
+	}
+
+	/**
+	 * How much memory does this block occupy?  This does not
+	 * include the #dictionary.
+	 */
+	[[gnu::pure]]
+	std::size_t GetMemoryUsage() const noexcept;
+
+	/**
+	 * Can all records in this block be deleted by
+	 * Database::DeleteOlderThan()?
+	 */
+	bool IsOlderThanOrUnknown(Net::Log::TimePoint t) const noexcept {
+		return !has_timestamps || newest < t;
+	}
+
+	/**
+	 * May this block contain records matching the given filter?
+	 * This is a quick check which uses only the block's meta
+	 * data.
+	 *
+	 * @param site if not #ColdStore::ANY_SITE, then only records
+	 * of this site are considered
+	 */
+	[[gnu::pure]]
+	bool MayMatch(const Filter &filter, SiteId site) const noexcept;
+};
+
+/**
+ * Decides which records are deleted instead of being compressed by
+ * ColdStore::Freeze().
+ */
+class FreezeFilter {
+public:
+	/**
+	 * @return true if the record shall be deleted
+	 */
+	virtual bool ShallDiscard(const Record &record) noexcept = 0;
+};
+
+/**
+ * Keeps old records compressed in memory after they were evicted
+ * from the #FullRecordList.  Log datagrams are very redundant, so
+ * this allows keeping several times more history in the same amount
+ * of memory.
+ *
+ * Blocks are decompressed on demand (see #ColdCursor); a small
+ * cache avoids decompressing the same block over and over when
+ * several clients query the same time range.
+ *
+ * If a #SpillStore is configured, then the data of old blocks is
+ * moved there instead of being deleted; only the block meta data
+ * remains in memory.
+ */
+class ColdStore {
+	/**
+	 * The maximum number of records in one #ColdBlock.
+	 */
+	static constexpr std::size_t MAX_BLOCK_RECORDS = 4096;
+
+public:
+	/**
+	 * The maximum (uncompressed) size of one #ColdBlock.
+	 */
+	static constexpr std::size_t MAX_BLOCK_SIZE = 2 * 1024 * 1024;
+
+private:
+	/**
+	 * The maximum total memory usage of all blocks; zero means
+	 * this store is disabled.
+	 */
+	const std::size_t max_size;
+
+	/**
+	 * Build a new #ColdDictionary after this number of blocks,
+	 * to adapt to changing traffic.
+	 */
+	static constexpr unsigned DICTIONARY_INTERVAL = 64;
+
+	/**
+	 * All blocks, oldest first.  The first #n_spilled blocks
+	 * have been moved to #spill.
+	 */
+	std::deque<ColdBlock> blocks;
+
+	std::size_t n_spilled = 0, n_spilled_records = 0;
+
+	std::unique_ptr<SpillStore> spill;
+
+	/**
+	 * The dictionary for new blocks.
+	 */
+	std::shared_ptr<const ColdDictionary> dictionary;
+
+	/**
+	 * The number of blocks which were compressed with
+	 * #dictionary; if this is zero, a new one is built.
+	 */
+	unsigned dictionary_blocks = 0;
+
+	std::size_t memory_usage = 0, n_records = 0;
+
+	/**
+	 * Recently decompressed blocks, indexed by
+	 * ColdBlock::first_id.  The payload is decompressed only
+	 * when a record matches; it may be nullptr.
+	 */
+	struct CacheItem {
+		uint64_t first_id;
+		std::shared_ptr<const ColdBlockColumns> columns;
+		std::shared_ptr<const std::byte[]> payload;
+	};
+
+	mutable std::array<CacheItem, 4> cache;
+	mutable std::size_t cache_next = 0;
+
+public:
+	/**
+	 * A special #SiteId value for ColdBlock::MayMatch() and
+	 * #ColdCursor which means "all sites".
+	 */
+	static constexpr SiteId ANY_SITE = ~SiteId{};
+
+	explicit ColdStore(std::size_t _max_size) noexcept
+		:max_size(_max_size) {}
+
+	~ColdStore() noexcept;
+
+	ColdStore(const ColdStore &) = delete;
+	ColdStore &operator=(const ColdStore &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return max_size > 0;
+	}
+
+	std::size_t GetMemoryCapacity() const noexcept {
+		return max_size;
+	}
+
+	std::size_t GetMemoryUsage() const noexcept {
+		return memory_usage;
+	}
+
+	std::size_t GetRecordCount() const noexcept {
+		return n_records;
+	}
+
+	/**
+	 * The number of records whose data is in the #SpillStore.
+	 */
+	std::size_t GetSpilledRecordCount() const noexcept {
+		return n_spilled_records;
+	}
+
+	bool empty() const noexcept {
+		return blocks.empty();
+	}
+
+	/**
+	 * Move the data of old blocks to segment files in the given
+	 * directory instead of deleting it.
+	 *
+	 * Throws on error.
+	 *
+	 * @param max_size the maximum total size of all segment
+	 * files
+	 */
+	void EnableSpill(const char *path, std::size_t max_size);
+
+	void clear() noexcept;
+
+	/**
+	 * Delete blocks from the beginning whose records are all
+	 * older than the given time stamp (or have no time stamp).
+	 */
+	void DeleteOlderThan(Net::Log::TimePoint t) noexcept;
+
+	/**
+	 * Compress records from the beginning of the given list into
+	 * a new block.  Old blocks are deleted to make room for it.
+	 * The caller is responsible for removing those records from
+	 * the list.
+	 *
+	 * Throws on error.
+	 *
+	 * @param filter if not nullptr, then records rejected by it
+	 * are skipped (and shall be deleted by the caller)
+	 * @return the number of records from the beginning of the
+	 * list which were moved to the new block or skipped
+	 */
+	std::size_t Freeze(const FullRecordList &list,
+			   FreezeFilter *filter=nullptr);
+
+	/**
+	 * Remove the oldest block from this store and return it,
+	 * e.g. to hand it over to another process.  Blocks whose
+	 * data has been moved to the #SpillStore are deleted
+	 * instead, because the segment files do not outlive this
+	 * process.
+	 *
+	 * @return the block or std::nullopt if there are no more
+	 * blocks in memory
+	 */
+	std::optional<ColdBlock> Shift() noexcept;
+
+	/**
+	 * Add a block which was created by another process (see
+	 * Shift()).  Its record ids must be larger than those of
+	 * all other blocks.  Old blocks are deleted to make room for
+	 * it.
+	 */
+	void Append(ColdBlock &&block) noexcept;
+
+	/**
+	 * Invoke the given function for each #SiteId which occurs
+	 * in a block (possibly more than once).
+	 */
+	void ForEachSite(std::invocable<SiteId> auto f) const noexcept {
+		for (const auto &block : blocks)
+			for (const SiteId i : block.sites)
+				f(i);
+	}
+
+	/**
+	 * Find the first block which begins after the given record
+	 * id.
+	 */
+	[[gnu::pure]]
+	const ColdBlock *FindAfter(uint64_t id) const noexcept;
+
+	/**
+	 * Find the last block which ends before the given record id.
+	 */
+	[[gnu::pure]]
+	const ColdBlock *FindBefore(uint64_t id) const noexcept;
+
+	/**
+	 * Obtain the decompressed records of the given block which
+	 * may match the filter (see ColdColumns::Scan()).  Only the
+	 * columns are decompressed and scanned first; the payload is
+	 * decompressed and the #Record instances are rebuilt only if
+	 * at least one record matches.
+	 *
+	 * @param site if not #ANY_SITE, then only records of this
+	 * site are returned
+	 * @return the records (possibly none) or nullptr on error
+	 */
+	std::shared_ptr<const ColdRecords> Load(const ColdBlock &block,
+						const Filter &filter,
+						SiteId site) const noexcept;
+
+private:
+	/**
+	 * Find the given block in the #cache or add it.
+	 *
+	 * Throws on error.
+	 */
+	CacheItem &GetCacheItem(const ColdBlock &block) const;
+
+	/**
+	 * Decompress the columns of the given block.
+	 *
+	 * Throws on error.
+	 *
+	 * @param data the compressed data of the block
+	 * @return the columns or nullptr if decompression has failed
+	 */
+	static std::shared_ptr<const ColdBlockColumns> LoadColumns(const ColdBlock &block,
+								   std::span<const std::byte> data);
+
+	/**
+	 * Decompress the payload (the raw datagrams) of the given
+	 * block.
+	 *
+	 * Throws on error.
+	 *
+	 * @param data the compressed data of the block
+	 * @return the payload or nullptr if decompression has failed
+	 */
+	static std::shared_ptr<const std::byte[]> LoadPayload(const ColdBlock &block,
+							      std::span<const std::byte> data);
+
+	/**
+	 * How much memory will be added to #memory_usage when the
+	 * given block is appended?  This includes its dictionary if
+	 * no other block refers to it yet.
+	 */
+	[[gnu::pure]]
+	std::size_t GetAppendMemory(const ColdBlock &block) const noexcept;
+
+	/**
+	 * Remove the oldest block from #memory_usage and
+	 * #n_records, including its dictionary if no other block
+	 * refers to it.  The caller removes it from #blocks.
+	 */
+	void ForgetFront() noexcept;
+
+	void PopFront() noexcept;
+
+	/**
+	 * Move the data of the oldest block which is still in
+	 * memory to the #SpillStore.
+	 *
+	 * Throws on error.
+	 */
+	void SpillOne();
+
+	/**
+	 * Delete blocks whose data has been deleted from the
+	 * #SpillStore.
+	 */
+	void DeleteUnspilled() noexcept;
+};
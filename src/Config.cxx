@@ -4,8 +4,11 @@
 
 #include "Config.hxx"
 #include "Port.hxx"
+#include "DatagramBatch.hxx"
+#include "ReceiverFilter.hxx"
 #include "net/Parser.hxx"
 #include "net/log/Protocol.hxx"
+#include "net/log/String.hxx"
 #include "io/config/FileLineParser.hxx"
 #include "io/config/ConfigParser.hxx"
 #include "pg/Interval.hxx"
@@ -17,6 +20,8 @@
 #include "lib/avahi/Check.hxx"
 #endif
 
+#include <algorithm> // for std::ranges::count_if(), std::ranges::any_of()
+
 using std::string_view_literals::operator""sv;
 
 void
@@ -43,11 +48,12 @@ class PondConfigParser final : public NestedConfigParser {
 	protected:
 		/* virtual methods from class ConfigParser */
 		void ParseLine(FileLineParser &line) override;
+		void Finish() override;
 	};
 
 	class Receiver final : public ConfigParser {
 		Config &parent;
-		SocketConfig config;
+		ReceiverConfig config;
 
 	public:
 		explicit Receiver(Config &_parent):parent(_parent) {}
@@ -80,6 +86,151 @@ protected:
 	void ParseLine2(FileLineParser &line) override;
 };
 
+static RateLimitKey
+ParseRateLimitKey(const char *s)
+{
+	if (StringIsEqual(s, "type"))
+		return RateLimitKey::TYPE;
+	else if (StringIsEqual(s, "site"))
+		return RateLimitKey::SITE;
+	else if (StringIsEqual(s, "generator"))
+		return RateLimitKey::GENERATOR;
+	else if (StringIsEqual(s, "host"))
+		return RateLimitKey::HOST;
+	else
+		throw LineParser::Error("Unknown rate limit key");
+}
+
+/**
+ * Parse "KEY TYPE RATE [BURST]".
+ */
+static RateLimitConfig
+ParseRateLimit(LineParser &line)
+{
+	RateLimitConfig config;
+
+	const char *key = line.ExpectWord();
+	config.key = ParseRateLimitKey(key);
+
+	const char *type = line.ExpectValue();
+	if (!StringIsEqual(type, "*")) {
+		config.type = Net::Log::ParseType(type);
+		if (config.type == Net::Log::Type::UNSPECIFIED)
+			throw LineParser::Error("Unknown type");
+	}
+
+	config.name = key;
+	config.name += ' ';
+	config.name += type;
+
+	config.bucket.rate = ParsePositiveLong(line.ExpectValue());
+
+	if (line.IsEnd())
+		config.bucket.burst = 10 * config.bucket.rate;
+	else
+		config.bucket.burst = ParsePositiveLong(line.ExpectValueAndEnd());
+
+	return config;
+}
+
+static Net::Log::Attribute
+ParseStripAttribute(const char *name)
+{
+	using Net::Log::Attribute;
+
+	if (StringIsEqual(name, "remote_host"))
+		return Attribute::REMOTE_HOST;
+	else if (StringIsEqual(name, "forwarded_to"))
+		return Attribute::FORWARDED_TO;
+	else if (StringIsEqual(name, "http_referer"))
+		return Attribute::HTTP_REFERER;
+	else if (StringIsEqual(name, "user_agent"))
+		return Attribute::USER_AGENT;
+	else if (StringIsEqual(name, "message"))
+		return Attribute::MESSAGE;
+	else if (StringIsEqual(name, "analytics_id"))
+		return Attribute::ANALYTICS_ID;
+	else
+		throw LineParser::Error("Attribute cannot be stripped");
+}
+
+/**
+ * Parse "TYPE ATTRIBUTE...".
+ */
+static ProjectionConfig
+ParseProjection(LineParser &line)
+{
+	ProjectionConfig config;
+
+	const char *type = line.ExpectValue();
+	if (!StringIsEqual(type, "*")) {
+		config.type = Net::Log::ParseType(type);
+		if (config.type == Net::Log::Type::UNSPECIFIED)
+			throw LineParser::Error("Unknown type");
+	}
+
+	do {
+		config.strip |= ProjectionConfig::Bit(ParseStripAttribute(line.ExpectWord()));
+	} while (!line.IsEnd());
+
+	return config;
+}
+
+/**
+ * Parse "TYPE SIZE [MAX_AGE]".
+ */
+static RingConfig
+ParseRing(LineParser &line)
+{
+	RingConfig config;
+
+	config.type = Net::Log::ParseType(line.ExpectValue());
+	if (config.type == Net::Log::Type::UNSPECIFIED)
+		throw LineParser::Error("Unknown type");
+
+	config.size = ParseSize(line.ExpectValue());
+	if (config.size < 1024 * 1024)
+		throw LineParser::Error("Ring size is too small");
+
+	if (!line.IsEnd()) {
+		config.max_age = Pg::ParseIntervalS(line.ExpectValueAndEnd());
+		if (config.max_age <= std::chrono::system_clock::duration::zero())
+			throw LineParser::Error("max_age too small");
+	}
+
+	return config;
+}
+
+static ReceiverFilterRule
+ParseReceiverFilterRule(LineParser &line)
+{
+	ReceiverFilterRule rule;
+
+	const char *action = line.ExpectWord();
+	if (StringIsEqual(action, "accept"))
+		rule.accept = true;
+	else if (StringIsEqual(action, "drop"))
+		rule.accept = false;
+	else
+		throw LineParser::Error("'accept' or 'drop' expected");
+
+	const char *key = line.ExpectWord();
+	if (StringIsEqual(key, "type")) {
+		rule.type = Net::Log::ParseType(line.ExpectValueAndEnd());
+		if (rule.type == Net::Log::Type::UNSPECIFIED)
+			throw LineParser::Error("Unknown type");
+	} else if (StringIsEqual(key, "site_prefix")) {
+		rule.site_prefix = line.ExpectValueAndEnd();
+		if (rule.site_prefix.empty())
+			throw LineParser::Error("Empty site_prefix");
+		if (rule.site_prefix.size() > ReceiverFilter::MAX_SITE_PREFIX_LENGTH)
+			throw LineParser::Error("site_prefix is too long");
+	} else
+		throw LineParser::Error("'type' or 'site_prefix' expected");
+
+	return rule;
+}
+
 void
 PondConfigParser::Database::ParseLine(FileLineParser &line)
 {
@@ -89,23 +240,113 @@ PondConfigParser::Database::ParseLine(FileLineParser &line)
 		config.size = ParseSize(line.ExpectValueAndEnd());
 		if (config.size < 64 * 1024)
 			throw LineParser::Error("Database size is too small");
+	} else if (StringIsEqual(word, "max_size")) {
+		config.max_size = ParseSize(line.ExpectValueAndEnd());
 	} else if (StringIsEqual(word, "max_age")) {
 		config.max_age = Pg::ParseIntervalS(line.ExpectValueAndEnd());
 		if (config.max_age <= std::chrono::system_clock::duration::zero())
 			throw LineParser::Error("max_age too small");
 	} else if (StringIsEqual(word, "per_site_message_rate_limit")) {
-		config.per_site_message_rate_limit = ParsePositiveLong(line.ExpectValueAndEnd());
+		/* obsolete shortcut for "rate_limit site http_error" */
+		const double rate = ParsePositiveLong(line.ExpectValueAndEnd());
+		config.rate_limits.push_back({
+			.name = "site http_error",
+			.key = RateLimitKey::SITE,
+			.type = Net::Log::Type::HTTP_ERROR,
+			.bucket = {.rate = rate, .burst = 10 * rate},
+		});
+	} else if (StringIsEqual(word, "rate_limit")) {
+		config.rate_limits.push_back(ParseRateLimit(line));
+	} else if (StringIsEqual(word, "duplicate_window")) {
+		config.duplicate_window = Pg::ParseIntervalS(line.ExpectValueAndEnd());
+		if (config.duplicate_window <= std::chrono::steady_clock::duration::zero())
+			throw LineParser::Error("duplicate_window too small");
+	} else if (StringIsEqual(word, "duplicate_capacity")) {
+		config.duplicate_capacity = ParsePositiveLong(line.ExpectValueAndEnd());
+		if (config.duplicate_capacity > 16 * 1024 * 1024)
+			throw LineParser::Error("duplicate_capacity is too large");
+	} else if (StringIsEqual(word, "strip")) {
+		config.projections.push_back(ParseProjection(line));
+	} else if (StringIsEqual(word, "ring")) {
+		if (config.rings.size() >= MAX_RINGS)
+			throw LineParser::Error("Too many rings");
+
+		const auto ring = ParseRing(line);
+		if (std::ranges::any_of(config.rings, [&ring](const auto &i){
+			return i.type == ring.type;
+		}))
+			throw LineParser::Error("Duplicate ring type");
+
+		config.rings.push_back(ring);
+	} else if (StringIsEqual(word, "cold_size")) {
+		config.cold_size = ParseSize(line.ExpectValueAndEnd());
+		if (config.cold_size < 1024 * 1024)
+			throw LineParser::Error("cold_size is too small");
+	} else if (StringIsEqual(word, "snapshot_path")) {
+		config.snapshot_path = line.ExpectValueAndEnd();
+	} else if (StringIsEqual(word, "snapshot_interval")) {
+		config.snapshot_interval = Pg::ParseIntervalS(line.ExpectValueAndEnd());
+		if (config.snapshot_interval < std::chrono::seconds{10})
+			throw LineParser::Error("snapshot_interval too small");
+	} else if (StringIsEqual(word, "min_coverage")) {
+		config.min_coverage = Pg::ParseIntervalS(line.ExpectValueAndEnd());
+		if (config.min_coverage <= std::chrono::system_clock::duration::zero())
+			throw LineParser::Error("min_coverage too small");
+	} else if (StringIsEqual(word, "max_site_share")) {
+		config.max_site_share = ParsePositiveLong(line.ExpectValueAndEnd());
+		if (config.max_site_share >= 100)
+			throw LineParser::Error("max_site_share must be less than 100");
+	} else if (StringIsEqual(word, "fd_store")) {
+		config.fd_store = line.NextBool();
+		line.ExpectEnd();
+
+#ifndef HAVE_LIBSYSTEMD
+		if (config.fd_store)
+			throw std::runtime_error{"systemd support is disabled"};
+#endif
+	} else if (StringIsEqual(word, "spill_directory")) {
+		config.spill_directory = line.ExpectValueAndEnd();
+	} else if (StringIsEqual(word, "spill_size")) {
+		config.spill_size = ParseSize(line.ExpectValueAndEnd());
+		if (config.spill_size < 64 * 1024 * 1024)
+			throw LineParser::Error("spill_size is too small");
 	} else
 		throw LineParser::Error("Unknown option");
 }
 
+void
+PondConfigParser::Database::Finish()
+{
+	if (config.max_size > 0 && config.max_size < config.size)
+		throw LineParser::Error("max_size is smaller than size");
+
+	if (config.cold_size > 0 &&
+	    (config.cold_size >= config.size ||
+	     config.size - config.cold_size < 4 * 1024 * 1024))
+		throw LineParser::Error("cold_size leaves too little room for uncompressed records");
+
+	if (!config.spill_directory.empty()) {
+		if (config.cold_size == 0)
+			throw LineParser::Error("spill_directory requires cold_size");
+
+		if (config.spill_size == 0)
+			throw LineParser::Error("spill_directory requires spill_size");
+	}
+
+	if (config.max_site_share > 0 && config.cold_size == 0)
+		throw LineParser::Error("max_site_share requires cold_size");
+
+	ConfigParser::Finish();
+}
+
 void
 PondConfigParser::Receiver::ParseLine(FileLineParser &line)
 {
 	const char *word = line.ExpectWord();
 
 	if (StringIsEqual(word, "bind")) {
-		config.bind_address = ParseSocketAddress(line.ExpectValueAndEnd(),
+		config.name = line.ExpectValueAndEnd();
+		config.bind_address = ParseSocketAddress(config.name.c_str(),
 							 Net::Log::DEFAULT_PORT, true);
 	} else if (StringIsEqual(word, "v6only")) {
 		const bool value = line.NextBool();
@@ -123,6 +364,44 @@ PondConfigParser::Receiver::ParseLine(FileLineParser &line)
 	} else if (StringIsEqual(word, "mptcp")) {
 		config.mptcp = line.NextBool();
 		line.ExpectEnd();
+	} else if (StringIsEqual(word, "threads")) {
+		config.threads = ParsePositiveLong(line.ExpectValueAndEnd());
+		if (config.threads > 64)
+			throw LineParser::Error("Too many threads");
+	} else if (StringIsEqual(word, "batch_size")) {
+		config.batch_size = ParsePositiveLong(line.ExpectValueAndEnd());
+		if (config.batch_size > DatagramBatch::MAX_CAPACITY)
+			throw LineParser::Error("batch_size is too large");
+	} else if (StringIsEqual(word, "receive_buffer_size")) {
+		config.receive_buffer_size = ParseSize(line.ExpectValueAndEnd());
+		if (config.receive_buffer_size < 64 * 1024)
+			throw LineParser::Error("receive_buffer_size is too small");
+		if (config.receive_buffer_size > 1024 * 1024 * 1024)
+			throw LineParser::Error("receive_buffer_size is too large");
+	} else if (StringIsEqual(word, "io_uring")) {
+		config.io_uring = line.NextBool();
+		line.ExpectEnd();
+
+#ifndef HAVE_LIBURING
+		if (config.io_uring)
+			throw std::runtime_error{"io_uring support is disabled"};
+#endif
+	} else if (StringIsEqual(word, "filter")) {
+		auto rule = ParseReceiverFilterRule(line);
+		if (!rule.site_prefix.empty() &&
+		    std::size_t(std::ranges::count_if(config.filter, [](const auto &i){
+			    return !i.site_prefix.empty();
+		    })) >= ReceiverFilter::MAX_SITE_PREFIXES)
+			throw LineParser::Error("Too many site_prefix rules");
+
+		config.filter.push_back(std::move(rule));
+	} else if (StringIsEqual(word, "sender_rate_limit")) {
+		config.sender_rate_limit.rate = ParsePositiveLong(line.ExpectValue());
+
+		if (line.IsEnd())
+			config.sender_rate_limit.burst = 10 * config.sender_rate_limit.rate;
+		else
+			config.sender_rate_limit.burst = ParsePositiveLong(line.ExpectValueAndEnd());
 	} else
 		throw LineParser::Error("Unknown option");
 }
@@ -133,6 +412,20 @@ PondConfigParser::Receiver::Finish()
 	if (config.bind_address.IsNull())
 		throw LineParser::Error("Listener has no bind address");
 
+	if (config.threads > 0) {
+		/* with SO_REUSEPORT, each multicast datagram would be
+		   delivered to every thread's socket */
+		if (!config.multicast_group.IsNull())
+			throw LineParser::Error("'threads' cannot be combined with 'multicast_group'");
+
+		if (config.io_uring)
+			throw LineParser::Error("'threads' cannot be combined with 'io_uring'");
+
+		/* each thread has its own socket, and the kernel
+		   distributes datagrams among them */
+		config.reuse_port = true;
+	}
+
 	config.Fixup();
 
 	parent.receivers.emplace_front(std::move(config));
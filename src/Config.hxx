@@ -4,7 +4,10 @@
 
 #pragma once
 
+#include "DatabaseConfig.hxx"
+#include "ReceiverFilterConfig.hxx"
 #include "net/SocketConfig.hxx"
+#include "util/TokenBucket.hxx"
 #include "config.h"
 
 #ifdef HAVE_AVAHI
@@ -13,17 +16,49 @@
 
 #include <chrono>
 #include <forward_list>
+#include <string>
+#include <vector>
 
-struct DatabaseConfig {
-	size_t size = 16 * 1024 * 1024;
+struct ReceiverConfig : SocketConfig {
+	/**
+	 * The "bind" setting as specified in the configuration file;
+	 * used to identify this receiver in statistics.
+	 */
+	std::string name;
+
+	/**
+	 * The maximum number of datagrams received at once.
+	 */
+	std::size_t batch_size = 256;
+
+	/**
+	 * The socket's receive buffer size (SO_RCVBUF).
+	 */
+	std::size_t receive_buffer_size = 4 * 1024 * 1024;
 
 	/**
-	 * A positive value means that records older than this
-	 * duration will be deleted.
+	 * The number of worker threads which receive and parse
+	 * datagrams.  Each thread owns a separate socket bound with
+	 * SO_REUSEPORT.  Zero means datagrams are received in the
+	 * main thread.
 	 */
-	std::chrono::system_clock::duration max_age{};
+	unsigned threads = 0;
 
-	double per_site_message_rate_limit = -1;
+	/**
+	 * Receive datagrams with io_uring (if available)?
+	 */
+	bool io_uring = false;
+
+	/**
+	 * The maximum rate of datagrams accepted from one sender
+	 * address.  A rate of zero disables this limit.
+	 */
+	TokenBucketConfig sender_rate_limit{};
+
+	/**
+	 * Rules which decide which datagrams are accepted.
+	 */
+	std::vector<ReceiverFilterRule> filter;
 };
 
 struct ListenerConfig : SocketConfig {
@@ -41,7 +76,7 @@ struct ListenerConfig : SocketConfig {
 struct Config {
 	DatabaseConfig database;
 
-	std::forward_list<SocketConfig> receivers;
+	std::forward_list<ReceiverConfig> receivers;
 
 	std::forward_list<ListenerConfig> listeners;
 
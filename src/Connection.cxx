@@ -15,8 +15,11 @@
 #include "util/SpanCast.hxx"
 #include "util/UnalignedBigEndian.hxx"
 
+#include <algorithm> // for std::min()
 #include <array>
 
+#include <string.h> // for memcpy()
+
 void
 Connection::Request::Clear() noexcept
 {
@@ -26,6 +29,7 @@ Connection::Request::Clear() noexcept
 	window.max = 0;
 	follow = false;
 	continue_ = false;
+	weights = false;
 	pending_skip_sites = false;
 	selection.reset();
 	address.clear();
@@ -57,6 +61,12 @@ Connection::IsLocalAdmin() const noexcept
 	return cred.IsDefined() && (cred.GetUid() == 0 || cred.GetUid() == geteuid());
 }
 
+/**
+ * The maximum number of senders returned by
+ * PondRequestCommand::SENDER_STATS.
+ */
+static constexpr std::size_t MAX_SENDER_STATS = 32;
+
 static constexpr PondHeader
 MakeHeader(uint16_t id, PondResponseCommand command, size_t size)
 {
@@ -73,10 +83,17 @@ MakeHeader(uint16_t id, PondResponseCommand command, size_t size)
 
 struct PondIovec {
 	PondHeader header;
-	std::array<struct iovec, 2> vec;
+
+	/**
+	 * The weight of a PondResponseCommand::WEIGHTED_LOG_RECORD
+	 * (big-endian).
+	 */
+	uint32_t weight;
+
+	std::array<struct iovec, 3> vec;
 
 	constexpr size_t GetTotalSize() const noexcept {
-		return vec[0].iov_len + vec[1].iov_len;
+		return vec[0].iov_len + vec[1].iov_len + vec[2].iov_len;
 	}
 
 	void Queue(SendQueue &queue, std::size_t sent) noexcept {
@@ -99,9 +116,34 @@ MakeIovec(PondIovec &pi,
 	pi.header = MakeHeader(id, command, payload.size());
 	pi.vec[0] = MakeIovecT(pi.header);
 	pi.vec[1] = MakeIovec(payload);
+	pi.vec[2] = {};
 	return 1u + !payload.empty();
 }
 
+/**
+ * Prepare a #PondResponseCommand::LOG_RECORD packet, or a
+ * #PondResponseCommand::WEIGHTED_LOG_RECORD packet if the record
+ * stands for several datagrams and the client has asked for
+ * weights.
+ */
+static unsigned
+MakeRecordIovec(PondIovec &pi, uint16_t id, const Record &record,
+		bool weights)
+{
+	const auto raw = record.GetRaw();
+	const auto weight = record.GetWeight();
+	if (!weights || weight == 1)
+		return MakeIovec(pi, id, PondResponseCommand::LOG_RECORD, raw);
+
+	pi.weight = ToBE32(weight);
+	pi.header = MakeHeader(id, PondResponseCommand::WEIGHTED_LOG_RECORD,
+			       sizeof(pi.weight) + raw.size());
+	pi.vec[0] = MakeIovecT(pi.header);
+	pi.vec[1] = MakeIovecT(pi.weight);
+	pi.vec[2] = MakeIovec(raw);
+	return 3;
+}
+
 void
 Connection::Send(uint16_t id, PondResponseCommand command,
 		 std::span<const std::byte> payload)
@@ -422,6 +464,67 @@ try {
 
 		return BufferedResult::AGAIN;
 
+	case PondRequestCommand::RECEIVER_STATS:
+		for (const auto &i : instance.GetReceiverStats()) {
+			std::array<std::byte, 1024> buffer;
+
+			PondReceiverStatsPayload p{};
+			p.n_received = ToBE64(i.n_received);
+			p.n_dropped = ToBE64(i.n_dropped);
+			memcpy(buffer.data(), &p, sizeof(p));
+
+			const std::size_t name_size =
+				std::min(i.name.size(), buffer.size() - sizeof(p));
+			memcpy(buffer.data() + sizeof(p), i.name.data(), name_size);
+
+			Send(id, PondResponseCommand::RECEIVER_STATS,
+			     std::span{buffer}.first(sizeof(p) + name_size));
+		}
+
+		Send(id, PondResponseCommand::END, {});
+		return BufferedResult::AGAIN;
+
+	case PondRequestCommand::RATE_LIMIT_STATS:
+		for (const auto &i : instance.GetDatabase().GetRateLimiter().GetPolicies()) {
+			std::array<std::byte, 1024> buffer;
+
+			PondRateLimitStatsPayload p{};
+			p.n_discarded = ToBE64(i.GetDiscardedCount());
+			memcpy(buffer.data(), &p, sizeof(p));
+
+			const auto &name = i.GetName();
+			const std::size_t name_size =
+				std::min(name.size(), buffer.size() - sizeof(p));
+			memcpy(buffer.data() + sizeof(p), name.data(), name_size);
+
+			Send(id, PondResponseCommand::RATE_LIMIT_STATS,
+			     std::span{buffer}.first(sizeof(p) + name_size));
+		}
+
+		Send(id, PondResponseCommand::END, {});
+		return BufferedResult::AGAIN;
+
+	case PondRequestCommand::SENDER_STATS:
+		for (const auto &i : instance.GetTopSenders(MAX_SENDER_STATS)) {
+			std::array<std::byte, 1024> buffer;
+
+			PondSenderStatsPayload p{};
+			p.n_received = ToBE64(i.n_received);
+			p.n_discarded = ToBE64(i.n_discarded);
+			memcpy(buffer.data(), &p, sizeof(p));
+
+			const auto address = i.address.ToString();
+			const std::size_t address_size =
+				std::min(address.size(), buffer.size() - sizeof(p));
+			memcpy(buffer.data() + sizeof(p), address.data(), address_size);
+
+			Send(id, PondResponseCommand::SENDER_STATS,
+			     std::span{buffer}.first(sizeof(p) + address_size));
+		}
+
+		Send(id, PondResponseCommand::END, {});
+		return BufferedResult::AGAIN;
+
 	case PondRequestCommand::WINDOW:
 		if (!current.MatchId(id) ||
 		    current.command != PondRequestCommand::QUERY)
@@ -549,6 +652,20 @@ try {
 		current.last = true;
 		return BufferedResult::AGAIN;
 
+	case PondRequestCommand::WEIGHTS:
+		if (!current.MatchId(id) ||
+		    current.command != PondRequestCommand::QUERY)
+			throw SimplePondError{"Misplaced WEIGHTS"};
+
+		if (current.weights)
+			throw SimplePondError{"Duplicate WEIGHTS"};
+
+		if (!payload.empty())
+			throw SimplePondError{"Malformed WEIGHTS"};
+
+		current.weights = true;
+		return BufferedResult::AGAIN;
+
 	case PondRequestCommand::FILTER_HTTP_METHOD_UNSAFE:
 		if (!current.MatchId(id) ||
 		    current.command != PondRequestCommand::QUERY)
@@ -643,12 +760,14 @@ Connection::OnBufferedClosed() noexcept
 /**
  * @param selection the source of records to be sent; after returning,
  * sent records will be skipped
+ * @param weights send records with a weight as
+ * #PondResponseCommand::WEIGHTED_LOG_RECORD?
  * @param queue push remaining data of a short send to this queue
  */
 static size_t
 SendMulti(SocketDescriptor s, uint16_t id,
 	  Selection &selection, unsigned max_steps,
-	  uint64_t max_records,
+	  uint64_t max_records, bool weights,
 	  SendQueue &queue)
 {
 	constexpr size_t CAPACITY = 256;
@@ -675,9 +794,7 @@ SendMulti(SocketDescriptor s, uint16_t id,
 
 		m.msg_name = nullptr;
 		m.msg_namelen = 0;
-		m.msg_iovlen = MakeIovec(v, id,
-					 PondResponseCommand::LOG_RECORD,
-					 record.GetRaw());
+		m.msg_iovlen = MakeRecordIovec(v, id, record, weights);
 		m.msg_iov = v.vec.data();
 		m.msg_control = nullptr;
 		m.msg_controllen = 0;
@@ -833,7 +950,7 @@ Connection::OnBufferedWrite()
 	if (send_selection) {
 		size_t n = SendMulti(GetSocket(), current.id,
 				     selection, MAX_STEPS,
-				     max_records,
+				     max_records, current.weights,
 				     send_queue);
 
 		if (current.HasWindow()) {
@@ -39,6 +39,11 @@ class Connection final
 		bool follow = false, continue_ = false;
 		bool last = false;
 
+		/**
+		 * Did the client send PondRequestCommand::WEIGHTS?
+		 */
+		bool weights = false;
+
 		/**
 		 * Do we need to handle group_site.skip_sites?
 		 */
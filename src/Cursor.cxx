@@ -22,6 +22,13 @@ Cursor::SetNext(const Record &record) noexcept
 	id = record.GetId();
 }
 
+void
+Cursor::SeekAfter(uint64_t after_id) noexcept
+{
+	LightCursor::SeekAfter(after_id);
+	CheckUpdateId();
+}
+
 void
 Cursor::Rewind() noexcept
 {
@@ -19,6 +19,8 @@ class Cursor
 	uint64_t id;
 
 public:
+	Cursor() noexcept = default;
+
 	explicit Cursor(const AnyRecordList &_list) noexcept
 		:LightCursor(_list) {}
 
@@ -39,6 +41,14 @@ public:
 
 	void SetNext(const Record &record) noexcept;
 
+	/**
+	 * Move to the first record whose id is larger than the given
+	 * one (see LightCursor::SeekAfter()).
+	 */
+	void SeekAfter(uint64_t after_id) noexcept;
+
+	using LightCursor::GetLastId;
+
 	/**
 	 * Rewind to the first record.
 	 */
@@ -6,6 +6,8 @@
 #include "Selection.hxx"
 #include "Filter.hxx"
 #include "AnyList.hxx"
+#include "DatagramScanner.hxx"
+#include "net/log/Chrono.hxx"
 #include "system/HugePage.hxx"
 #include "system/PageAllocator.hxx"
 #include "system/VmaName.hxx"
@@ -13,33 +15,47 @@
 #include "time/ClockCache.hxx"
 #include "util/DeleteDisposer.hxx"
 
+#include <algorithm> // for std::sort(), std::min(), std::max()
+#include <stdexcept>
+
 #include <assert.h>
+#include <stdint.h> // for uintptr_t
+#include <sys/mman.h> // for madvise()
 
-static std::string_view
-NullableStringView(const char *s) noexcept
-{
-	return s != nullptr ? std::string_view{s} : std::string_view{};
-}
+static_assert(1 + MAX_RINGS <= Selection::MAX_LISTS);
 
 void
 Database::PerSite::OnAbandoned() noexcept
 {
-	if (list.IsExpendable())
+	if (AreListsExpendable())
 		delete this;
 }
 
-Database::Database(size_t max_size, double _per_site_message_rate_limit)
-	:allocation(AlignHugePageUp(max_size)),
-	 per_site_message_rate_limit{
-		.rate = _per_site_message_rate_limit,
-		.burst = 10 * _per_site_message_rate_limit, // TODO: make burst configurable
-	 },
+Database::TypeRing::TypeRing(std::size_t _index, const RingConfig &config)
+	:allocation(AlignHugePageUp(config.size)),
+	 records(allocation.get()),
+	 index(_index), type(config.type), max_age(config.max_age)
+{
+	EnableHugePages(allocation);
+	EnablePageFork(allocation, false);
+	SetVmaName(allocation.get(), "PondRing");
+}
+
+Database::Database(const DatabaseConfig &config)
+	:allocation(AlignHugePageUp(std::max(config.size, config.max_size) - config.cold_size)),
+	 ring_limit(AlignHugePageUp(config.size - config.cold_size)),
+	 max_site_share(config.cold_size > 0 ? config.max_site_share : 0),
+	 duplicate_filter(config.duplicate_window, config.duplicate_capacity),
+	 rate_limiter(config.rate_limits),
+	 projection(config.projections),
+	 sampler(std::chrono::duration_cast<Net::Log::Duration>(config.min_coverage)),
+	 cold(config.cold_size),
 	 all_records(allocation.get())
 {
 	EnableHugePages(allocation);
 	EnablePageFork(allocation, false);
 
-	if (max_size > 2ull * 1024 * 1024 * 1024)
+	if (config.size > 2ull * 1024 * 1024 * 1024)
 		/* exclude database memory from core dumps if it's
 		   extremely large, because such a large memory
 		   section usually doesn't fit in the core dump
@@ -48,19 +64,35 @@ Database::Database(size_t max_size, double _per_site_message_rate_limit)
 		EnablePageDump(allocation, false);
 
 	SetVmaName(allocation.get(), "PondDatabase");
+
+	if (!config.spill_directory.empty())
+		cold.EnableSpill(config.spill_directory.c_str(),
+				 config.spill_size);
+
+	UpdateMaxSiteSize();
+
+	assert(config.rings.size() <= MAX_RINGS);
+	for (const auto &i : config.rings)
+		rings.emplace_back(rings.size(), i);
+
+	sampled_ring = FindRing(Net::Log::Type::HTTP_ACCESS);
 }
 
 Database::~Database() noexcept
 {
-	per_site_records.clear_and_dispose(DeleteDisposer{});
+	site_list.clear_and_dispose(DeleteDisposer{});
 	all_records.clear();
+
+	for (auto &i : rings)
+		i.records.clear();
 }
 
 void
 Database::Clear() noexcept
 {
 	for (auto i = site_list.begin(); i != site_list.end();) {
-		i->list.clear();
+		i->Clear();
+		i->hot_size = 0;
 
 		if (i->IsExpendable())
 			i = site_list.erase_and_dispose(i, DeleteDisposer{});
@@ -69,14 +101,25 @@ Database::Clear() noexcept
 	}
 
 	all_records.clear();
+	for (auto &i : rings)
+		i.records.clear();
+	cold.clear();
+	duplicate_filter.Clear();
 
-	// TODO: madvise(MADV_DONTNEED)
+	ReleaseUnusedPages();
 }
 
 void
 Database::Compress() noexcept
 {
 	all_records.Compress();
+	for (auto &i : rings)
+		i.records.Compress();
+	rate_limiter.Compress();
+
+	/* the ring moves on, and the pages it has left behind can
+	   be released */
+	ReleaseUnusedPages();
 
 	for (auto i = site_list.begin(); i != site_list.end();) {
 		i->Compress();
@@ -86,110 +129,878 @@ Database::Compress() noexcept
 		else
 			++i;
 	}
+
+	DeleteUnusedSites();
 }
 
-const Record &
-Database::Emplace(std::span<const std::byte> raw)
+/**
+ * When the #ColdStore is enabled, records are moved there before
+ * #all_records is filled up to this margin, so the #VCircularBuffer
+ * never needs to evict records by itself (which would lose them).
+ * Usually, FreezeAhead() has done this already; MakeRoom() does it
+ * only if FreezeAhead() has fallen behind.
+ */
+static constexpr std::size_t COLD_HEADROOM = 256 * 1024;
+
+/**
+ * FreezeAhead() keeps this much room in #all_records, so MakeRoom()
+ * (which runs while datagrams are being added) does not need to
+ * compress a #ColdBlock.  It is larger than one block, so there is
+ * still room while the next block is compressed.
+ */
+static constexpr std::size_t FREEZE_HEADROOM = 2 * ColdStore::MAX_BLOCK_SIZE;
+
+inline void
+Database::FreezeFront() noexcept
+{
+	std::size_t n = 1;
+
+	if (cold.IsEnabled()) {
+		++freeze_serial;
+
+		try {
+			n = cold.Freeze(all_records,
+					max_site_size > 0 ? this : nullptr);
+		} catch (...) {
+			/* out of memory: delete the oldest
+			   record */
+		}
+	}
+
+	for (; n > 0; --n)
+		PopFront();
+}
+
+inline void
+Database::MakeRoom(std::size_t size) noexcept
+{
+	const bool shrunk = ring_limit < allocation.get().size();
+	if (!cold.IsEnabled() && !shrunk)
+		/* the VCircularBuffer evicts old records by itself
+		   when the allocation is full */
+		return;
+
+	const std::size_t limit = cold.IsEnabled()
+		? ring_limit - COLD_HEADROOM
+		: ring_limit;
+
+	while (!all_records.empty() &&
+	       all_records.GetMemoryUsage() + size > limit)
+		FreezeFront();
+}
+
+bool
+Database::WantsFreeze() const noexcept
+{
+	if (!cold.IsEnabled() || all_records.empty())
+		return false;
+
+	/* small rings (e.g. in unit tests) keep at least half of
+	   their capacity for new records */
+	const std::size_t headroom = std::min(FREEZE_HEADROOM, ring_limit / 2);
+	return all_records.GetMemoryUsage() > ring_limit - headroom;
+}
+
+bool
+Database::FreezeAhead() noexcept
+{
+	if (!WantsFreeze())
+		return false;
+
+	FreezeFront();
+	return WantsFreeze();
+}
+
+inline void
+Database::PopFront() noexcept
 {
-	auto &record = all_records.emplace_back(sizeof(Record) + raw.size(),
-						++last_id, raw);
+	const auto &record = all_records.front();
+
+	if (max_site_size > 0) {
+		auto *per_site = interned_sites[record.GetParsed().site_id].per_site;
+
+		/* the PerSite cannot have been deleted, because its
+		   list still contains this record */
+		assert(per_site != nullptr);
+		assert(per_site->hot_size >= sizeof(record) + record.GetRaw().size());
+
+		per_site->hot_size -= sizeof(record) + record.GetRaw().size();
+	}
 
-	GetPerSiteRecords(NullableStringView(record.GetParsed().site)).push_back(record);
+	const auto *const old_front = reinterpret_cast<const std::byte *>(&record);
+	all_records.pop_front();
 
-	return record;
+	if (ring_limit < allocation.get().size())
+		ReleaseBehindFront(old_front);
 }
 
-namespace {
-struct RateLimitExceeded {};
+bool
+Database::ShallDiscard(const Record &record) noexcept
+{
+	assert(max_site_size > 0);
+
+	auto *per_site = interned_sites[record.GetParsed().site_id].per_site;
+	if (per_site == nullptr)
+		return false;
+
+	if (per_site->discard_serial != freeze_serial) {
+		per_site->discard_serial = freeze_serial;
+		per_site->discarded_size = 0;
+	}
+
+	/* the records discarded by this Freeze() call are still in
+	   the ring, but they no longer count against the site's
+	   share; this way, the site loses only as many records as
+	   necessary, not a whole block */
+	if (per_site->hot_size - per_site->discarded_size <= max_site_size)
+		return false;
+
+	per_site->discarded_size += sizeof(record) + record.GetRaw().size();
+	return true;
 }
 
-static constexpr bool
-IsMessage(const Net::Log::Type type) noexcept
+/**
+ * Only release aligned chunks of this size, to avoid splitting
+ * transparent huge pages.
+ */
+static constexpr std::size_t RELEASE_ALIGNMENT = 2 * 1024 * 1024;
+
+/**
+ * Keep this distance to records, because the #VCircularBuffer may
+ * store a header in front of each one.
+ */
+static constexpr std::size_t RELEASE_MARGIN = 64;
+
+/**
+ * Release all aligned chunks between the two pointers.
+ */
+static void
+ReleasePages(const std::byte *begin, const std::byte *end) noexcept
 {
-	return type == Net::Log::Type::HTTP_ERROR;
+	const auto b = (reinterpret_cast<uintptr_t>(begin) + RELEASE_ALIGNMENT - 1)
+		& ~(RELEASE_ALIGNMENT - 1);
+	const auto e = reinterpret_cast<uintptr_t>(end)
+		& ~(RELEASE_ALIGNMENT - 1);
+
+	if (e > b)
+		madvise(reinterpret_cast<void *>(b), e - b, MADV_DONTNEED);
+}
+
+/**
+ * Release all aligned chunks of the buffer which are not occupied by
+ * the records in the given list.
+ */
+static void
+ReleaseUnusedPages(std::span<const std::byte> buffer,
+		   const FullRecordList &list) noexcept
+{
+	const std::byte *const buffer_end = buffer.data() + buffer.size();
+
+	if (list.empty()) {
+		ReleasePages(buffer.data(), buffer_end);
+		return;
+	}
+
+	const Record &front = list.front(), &back = list.back();
+
+	const auto *const front_begin =
+		reinterpret_cast<const std::byte *>(&front) - RELEASE_MARGIN;
+	const auto *const back_end =
+		reinterpret_cast<const std::byte *>(&back)
+		+ sizeof(back) + back.GetRaw().size() + RELEASE_MARGIN;
+
+	if (&front <= &back) {
+		/* one contiguous range is occupied */
+		ReleasePages(buffer.data(), front_begin);
+		ReleasePages(back_end, buffer_end);
+	} else {
+		/* the ring has wrapped around; the gap between the
+		   newest and the oldest record is free */
+		ReleasePages(back_end, front_begin);
+	}
 }
 
-static constexpr bool
-IsMessage(const SmallDatagram &d) noexcept
+/**
+ * Release all aligned chunks of the buffer between the (just
+ * deleted) old front record and the current front of the list.
+ */
+static void
+ReleaseBehindFront(std::span<const std::byte> buffer,
+		   const FullRecordList &list,
+		   const std::byte *old_front) noexcept
 {
-	return IsMessage(d.type);
+	if (list.empty())
+		/* this is rare; leave it to Compress() */
+		return;
+
+	const auto *const old_begin = old_front - RELEASE_MARGIN;
+	const auto *const new_begin =
+		reinterpret_cast<const std::byte *>(&list.front()) - RELEASE_MARGIN;
+
+	/* ReleasePages() does nothing unless the front has crossed a
+	   RELEASE_ALIGNMENT boundary, so this costs a system call
+	   only once per chunk */
+	if (new_begin >= old_begin) {
+		ReleasePages(old_begin, new_begin);
+	} else {
+		/* the front has wrapped around */
+		ReleasePages(old_begin, buffer.data() + buffer.size());
+		ReleasePages(buffer.data(), new_begin);
+	}
+}
+
+void
+Database::ReleaseBehindFront(const std::byte *old_front) noexcept
+{
+	::ReleaseBehindFront(allocation.get(), all_records, old_front);
+}
+
+void
+Database::ShiftRecord(std::size_t i) noexcept
+{
+	assert(i < GetRecordListCount());
+
+	if (i == 0) {
+		const auto *const old_front =
+			reinterpret_cast<const std::byte *>(&all_records.front());
+		PopFront();
+
+		if (ring_limit >= allocation.get().size())
+			/* PopFront() has not done this already */
+			ReleaseBehindFront(old_front);
+	} else {
+		auto &ring = rings[i - 1];
+		const auto *const old_front =
+			reinterpret_cast<const std::byte *>(&ring.records.front());
+		ring.records.pop_front();
+		::ReleaseBehindFront(ring.allocation.get(), ring.records,
+				     old_front);
+	}
+}
+
+void
+Database::AppendColdBlock(ColdBlock &&block) noexcept
+{
+	last_id = std::max(last_id, block.last_id);
+
+	if (cold.IsEnabled())
+		cold.Append(std::move(block));
+}
+
+void
+Database::RestoreSite(SiteId id, std::string_view name)
+{
+	if (const auto *site = FindSite(name)) {
+		if (site->id != id)
+			throw std::runtime_error{"Site id conflict"};
+		return;
+	}
+
+	/* create unused slots up to this SiteId */
+	while (interned_sites.size() <= id) {
+		free_site_ids.push_back(SiteId(interned_sites.size()));
+		interned_sites.emplace_back(std::string_view{},
+					    free_site_ids.back());
+	}
+
+	auto &site = interned_sites[id];
+	if (!site.name.empty())
+		throw std::runtime_error{"Site id conflict"};
+
+	std::erase(free_site_ids, id);
+	site.name = name;
+	interned_site_map.insert(site);
+}
+
+void
+Database::ReleaseUnusedPages() noexcept
+{
+	::ReleaseUnusedPages(allocation.get(), all_records);
+
+	for (const auto &i : rings)
+		::ReleaseUnusedPages(i.allocation.get(), i.records);
+}
+
+void
+Database::Resize(std::size_t max_size) noexcept
+{
+	assert(max_size <= GetMaxMemoryCapacity());
+
+	/* leave at least this much room for uncompressed records
+	   (see PondConfigParser::Database::Finish()) */
+	constexpr std::size_t MIN_RING_SIZE = 4 * 1024 * 1024;
+
+	const std::size_t cold_capacity = cold.GetMemoryCapacity();
+	const std::size_t ring_size = max_size > cold_capacity + MIN_RING_SIZE
+		? max_size - cold_capacity
+		: MIN_RING_SIZE;
+
+	const std::size_t old_limit = ring_limit;
+	ring_limit = std::min(AlignHugePageUp(ring_size),
+			      allocation.get().size());
+	UpdateMaxSiteSize();
+
+	if (ring_limit < old_limit) {
+		MakeRoom(0);
+		ReleaseUnusedPages();
+	}
+}
+
+void
+Database::DeleteOlderThan(Net::Log::TimePoint t) noexcept
+{
+	cold.DeleteOlderThan(t);
+
+	bool deleted = false;
+	while (!all_records.empty() &&
+	       all_records.front().IsOlderThanOrUnknown(t)) {
+		PopFront();
+		deleted = true;
+	}
+
+	if (deleted)
+		ReleaseUnusedPages();
+}
+
+bool
+Database::HasRingMaxAge() const noexcept
+{
+	for (const auto &i : rings)
+		if (i.max_age > std::chrono::system_clock::duration::zero())
+			return true;
+
+	return false;
+}
+
+void
+Database::DeleteExpiredRingRecords(std::chrono::system_clock::time_point now) noexcept
+{
+	bool deleted = false;
+
+	for (auto &ring : rings) {
+		if (ring.max_age <= std::chrono::system_clock::duration::zero())
+			continue;
+
+		const auto t = Net::Log::FromSystem(now - ring.max_age);
+		while (!ring.records.empty() &&
+		       ring.records.front().IsOlderThanOrUnknown(t)) {
+			ring.records.pop_front();
+			deleted = true;
+		}
+	}
+
+	if (deleted)
+		ReleaseUnusedPages();
+}
+
+/**
+ * Returns the time stamp of the newest record in the list which has
+ * one or Net::Log::TimePoint{} if there is none.
+ */
+[[gnu::pure]]
+static Net::Log::TimePoint
+GetNewestTimestamp(const FullRecordList &list) noexcept
+{
+	for (const Record *i = list.Last(); i != nullptr;
+	     i = list.Previous(*i))
+		if (i->GetParsed().HasTimestamp())
+			return i->GetParsed().timestamp;
+
+	return {};
+}
+
+Net::Log::TimePoint
+Database::GetNewestTimestamp() const noexcept
+{
+	auto result = ::GetNewestTimestamp(all_records);
+
+	for (const auto &i : rings)
+		result = std::max(result, ::GetNewestTimestamp(i.records));
+
+	return result;
+}
+
+inline const Record &
+Database::Append(PerSite &per_site, std::span<const std::byte> raw,
+		 const SmallDatagram &parsed)
+{
+	const std::size_t size = sizeof(Record) + raw.size();
+	const Record *result;
+
+	if (auto *ring = FindRing(parsed.type)) {
+		auto &record = ring->records.emplace_back(size, ++last_id,
+							  raw, parsed,
+							  per_site.site.id);
+		per_site.rings[ring->index].list.push_back(record);
+		result = &record;
+	} else {
+		MakeRoom(size);
+
+		auto &record = all_records.emplace_back(size, ++last_id,
+							raw, parsed,
+							per_site.site.id);
+		per_site.list.push_back(record);
+		AddHotSize(per_site, record);
+		result = &record;
+	}
+
+	merged_listeners.OnAppend(*result);
+	per_site.merged_listeners.OnAppend(*result);
+
+	return *result;
+}
+
+std::size_t
+Database::GetSampledCapacity() const noexcept
+{
+	if (sampled_ring != nullptr)
+		return sampled_ring->allocation.get().size();
+
+	std::size_t result = ring_limit;
+
+	if (cold.IsEnabled()) {
+		/* compressed records are history, too; convert the
+		   ColdStore capacity to uncompressed bytes */
+		double ratio = 1;
+		if (!all_records.empty() && cold.GetMemoryUsage() > 0)
+			ratio = (double(all_records.GetMemoryUsage()) / all_records.size())
+				/ (double(cold.GetMemoryUsage()) / cold.GetRecordCount());
+
+		result += std::size_t(double(cold.GetMemoryCapacity()) * ratio);
+	}
+
+	return result;
+}
+
+bool
+Database::Sample(PerSite &per_site, const TypeRing *ring,
+		 SmallDatagram &parsed, std::size_t size,
+		 std::chrono::steady_clock::time_point now) noexcept
+{
+	assert(sampler.IsEnabled());
+
+	if (ring != sampled_ring)
+		/* this datagram does not compete with HTTP_ACCESS
+		   records for room */
+		return true;
+
+	const bool access = parsed.type == Net::Log::Type::HTTP_ACCESS;
+	if (sampler.Add(now, access, size))
+		sampler.Update(GetSampledCapacity());
+
+	if (!access)
+		/* only HTTP_ACCESS datagrams are sampled */
+		return true;
+
+	const int weight_shift = sampler.Keep(per_site.sample_counter);
+	if (weight_shift < 0)
+		return false;
+
+	parsed.weight_shift = weight_shift;
+	return true;
+}
+
+const Record &
+Database::Emplace(std::span<const std::byte> raw, unsigned weight_shift)
+{
+	auto parsed = ParseSmallDatagram(raw);
+	if (projection.IsEnabled())
+		projection.Apply(raw, parsed);
+
+	parsed.weight_shift = weight_shift;
+
+	auto &per_site = GetPerSite(parsed.site.Get(raw));
+
+	return Append(per_site, raw, parsed);
 }
 
 const Record *
 Database::CheckEmplace(std::span<const std::byte> raw,
 		       const ClockCache<std::chrono::steady_clock> &clock)
-try {
-	if (per_site_message_rate_limit.rate <= 0)
-		/* no rate limit configured */
-		return &Emplace(raw);
+{
+	auto parsed = ParseSmallDatagram(raw);
 
-	auto &record = all_records.check_emplace_back([this, &clock](const Record &r){
-		if (!IsMessage(r.GetParsed()))
-			/* not a message, not affected by the rate
-			   limit */
-			return;
+	if (duplicate_filter.IsEnabled() &&
+	    duplicate_filter.Check(raw, clock.now()))
+		return nullptr;
 
-		const char *site = r.GetParsed().site;
-		if (site == nullptr)
-			return;
+	auto &per_site = GetPerSite(parsed.site.Get(raw));
 
-		const auto now = clock.now();
-		const auto float_now = ToFloatSeconds(now.time_since_epoch());
+	if (!rate_limiter.empty()) {
+		const auto float_now = ToFloatSeconds(clock.now().time_since_epoch());
+		if (!rate_limiter.Check(parsed, raw, per_site.site.id, float_now))
+			return nullptr;
+	}
 
-		auto &per_site = GetPerSite(site);
-		if (!per_site.CheckRateLimit(per_site_message_rate_limit, float_now, 1))
-			throw RateLimitExceeded();
-	}, sizeof(Record) + raw.size(), ++last_id, raw);
+	if (projection.IsEnabled())
+		projection.Apply(raw, parsed);
 
-	GetPerSiteRecords(NullableStringView(record.GetParsed().site)).push_back(record);
+	if (sampler.IsEnabled() &&
+	    !Sample(per_site, FindRing(parsed.type), parsed,
+		    sizeof(Record) + raw.size(), clock.now()))
+		return nullptr;
 
-	return &record;
-} catch (RateLimitExceeded) {
-	return nullptr;
+	return &Append(per_site, raw, parsed);
 }
 
-Database::PerSite &
-Database::GetPerSite(std::string_view site) noexcept
+/**
+ * Determine the first record of a batch which is still in the given
+ * list.  Records at the beginning of a large batch may have been
+ * evicted already to make room for the following ones.
+ *
+ * @param first the first record appended to the list by this batch;
+ * this pointer may be dangling
+ * @param first_id the id of #first
+ */
+template<typename L>
+static const Record *
+FirstOfBatch(const L &list, const Record *first, uint64_t first_id) noexcept
+{
+	const Record *front = list.First();
+	if (front == nullptr || front->GetId() >= first_id)
+		/* "first" has been evicted (or is the front) */
+		return front;
+
+	/* eviction is FIFO, and since there is an older record,
+	   "first" is still valid */
+	return first;
+}
+
+/**
+ * Remember the first record appended to a list by a batch (if
+ * this is the first one).
+ */
+static void
+SetBatchFirst(const Record *&first, uint64_t &first_id,
+	      const Record &record) noexcept
+{
+	if (first == nullptr) {
+		first = &record;
+		first_id = record.GetId();
+	}
+}
+
+/**
+ * Invoke the #AppendListener instances of the given list after a
+ * batch and reset the batch state.
+ *
+ * @return the first record of the batch which is still in the list
+ * or nullptr if there is none
+ */
+template<typename L>
+static const Record *
+NotifyBatch(L &list, const Record *&first, uint64_t first_id) noexcept
+{
+	if (first == nullptr)
+		return nullptr;
+
+	const Record *r = FirstOfBatch(list, first, first_id);
+	first = nullptr;
+
+	if (r != nullptr)
+		list.NotifyAppend(*r);
+
+	return r;
+}
+
+std::size_t
+Database::EmplaceBatch(std::span<const ParsedDatagram> batch,
+		       const ClockCache<std::chrono::steady_clock> &clock)
+{
+	assert(batch_sites.empty());
+
+	const bool check_duplicates = duplicate_filter.IsEnabled();
+	const bool rate_limit = !rate_limiter.empty();
+	const bool project = projection.IsEnabled();
+	std::size_t n_discarded = 0;
+
+	const Record *first = nullptr;
+	uint64_t first_id = 0;
+
+	/* consecutive datagrams often belong to the same site; this
+	   remembers the previous one to avoid hash table lookups */
+	PerSite *per_site = nullptr;
+
+	for (const auto &d : batch) {
+		auto raw = d.raw;
+		auto parsed = d.parsed;
+
+		if (check_duplicates &&
+		    duplicate_filter.Check(d.fingerprint != 0
+					   ? d.fingerprint
+					   : DuplicateFilter::GetFingerprint(raw),
+					   clock.now()))
+			continue;
+
+		const std::string_view site = parsed.site.Get(raw);
+		if (per_site == nullptr || per_site->site.name != site)
+			per_site = &GetPerSite(site);
+
+		if (rate_limit) {
+			const auto float_now = ToFloatSeconds(clock.now().time_since_epoch());
+			if (!rate_limiter.Check(parsed, raw, per_site->site.id,
+						float_now)) {
+				++n_discarded;
+				continue;
+			}
+		}
+
+		/* strip attributes only from datagrams which survived
+		   the rate limiter */
+		if (project)
+			projection.Apply(raw, parsed);
+
+		const std::size_t size = sizeof(Record) + raw.size();
+		auto *const ring = FindRing(parsed.type);
+
+		if (sampler.IsEnabled() &&
+		    !Sample(*per_site, ring, parsed, size, clock.now()))
+			continue;
+
+		if (ring != nullptr) {
+			auto &record = ring->records.EmplaceBackQuiet(size, ++last_id,
+								      raw, parsed,
+								      per_site->site.id);
+			auto &ring_list = per_site->rings[ring->index];
+			ring_list.list.PushBackQuiet(record);
+
+			SetBatchFirst(ring->batch_first, ring->batch_first_id,
+				      record);
+			SetBatchFirst(ring_list.batch_first,
+				      ring_list.batch_first_id, record);
+		} else {
+			MakeRoom(size);
+
+			auto &record = all_records.EmplaceBackQuiet(size, ++last_id,
+								    raw, parsed,
+								    per_site->site.id);
+			per_site->list.PushBackQuiet(record);
+			AddHotSize(*per_site, record);
+
+			SetBatchFirst(first, first_id, record);
+			SetBatchFirst(per_site->batch_first,
+				      per_site->batch_first_id, record);
+		}
+
+		if (!per_site->in_batch) {
+			per_site->in_batch = true;
+			batch_sites.push_back(per_site);
+		}
+	}
+
+	/* now invoke the AppendListeners, once per list; those
+	   which follow several lists get any surviving record of
+	   the batch */
+
+	const Record *any = NotifyBatch(all_records, first, first_id);
+	for (auto &i : rings)
+		if (const auto *r = NotifyBatch(i.records, i.batch_first,
+						i.batch_first_id))
+			any = r;
+
+	if (any != nullptr)
+		merged_listeners.OnAppend(*any);
+
+	for (auto *i : batch_sites) {
+		any = NotifyBatch(i->list, i->batch_first, i->batch_first_id);
+		for (auto &j : i->rings)
+			if (const auto *r = NotifyBatch(j.list, j.batch_first,
+							j.batch_first_id))
+				any = r;
+
+		if (any != nullptr)
+			i->merged_listeners.OnAppend(*any);
+
+		i->in_batch = false;
+	}
+
+	batch_sites.clear();
+
+	return n_discarded;
+}
+
+Database::InternedSite &
+Database::InternSite(std::string_view name) noexcept
 {
-	auto [it, inserted] =
-		per_site_records.insert_check(site);
+	auto [it, inserted] = interned_site_map.insert_check(name);
 	if (inserted) {
-		auto *per_site = new PerSite(site);
-		it = per_site_records.insert_commit(it, *per_site);
-		site_list.push_back(*per_site);
+		InternedSite *site;
+		if (!free_site_ids.empty()) {
+			site = &interned_sites[free_site_ids.back()];
+			free_site_ids.pop_back();
+			site->name = name;
+		} else
+			site = &interned_sites.emplace_back(name,
+							    SiteId(interned_sites.size()));
+
+		it = interned_site_map.insert_commit(it, *site);
 	}
 
 	return *it;
 }
 
-std::pair<AnyRecordList, SharedLease>
-Database::GetList(Filter &filter) noexcept
+Database::InternedSite *
+Database::FindSite(std::string_view name) noexcept
 {
-	if (filter.HasOneSite()) {
-		auto &per_site = GetPerSite(*filter.sites.begin());
+	auto i = interned_site_map.find(name);
+	return i != interned_site_map.end() ? &*i : nullptr;
+}
 
-		/* the PerSiteRecordList is already filtered for site;
-		   we can disable it in the Filter, because that check
-		   would be redundant */
-		filter.sites.clear();
+void
+Database::DeleteUnusedSites() noexcept
+{
+	std::vector<bool> in_cold(interned_sites.size());
+	cold.ForEachSite([&in_cold](SiteId id){
+		in_cold[id] = true;
+	});
+
+	for (auto &i : interned_sites) {
+		if (!i.is_linked() || i.per_site != nullptr || in_cold[i.id])
+			continue;
+
+		/* nothing refers to this SiteId anymore (hot records
+		   and Filters hold the PerSite) */
+		i.unlink();
+		i.name = {};
+		i.name.shrink_to_fit();
+		free_site_ids.push_back(i.id);
+
+		/* don't let the next user of this SiteId inherit
+		   the token buckets */
+		rate_limiter.ForgetSite(i.id);
+	}
+}
+
+Database::PerSite &
+Database::GetPerSite(InternedSite &site) noexcept
+{
+	if (site.per_site == nullptr)
+		site_list.push_back(*new PerSite(site, rings.size()));
 
-		return {per_site.list, per_site};
-	} else
-		return {GetAllRecords(), {}};
+	return *site.per_site;
+}
+
+bool
+Database::InternFilterSites(Filter &filter, bool create,
+			    std::vector<SharedLease> &leases) noexcept
+{
+	assert(filter.site_ids.empty());
+
+	if (filter.sites.empty())
+		return true;
+
+	std::vector<PerSite *> sites;
+	sites.reserve(filter.sites.size());
+
+	for (const auto &i : filter.sites) {
+		auto *site = create ? &InternSite(i) : FindSite(i);
+		if (site != nullptr)
+			sites.push_back(&GetPerSite(*site));
+	}
+
+	/* from here on, only the site ids are used */
+	filter.sites.clear();
+
+	if (sites.empty())
+		return false;
+
+	std::sort(sites.begin(), sites.end(),
+		  [](const PerSite *a, const PerSite *b){
+			  return a->site.id < b->site.id;
+		  });
+
+	leases.reserve(sites.size());
+	filter.site_ids.reserve(sites.size());
+	for (auto *i : sites) {
+		leases.emplace_back(*i);
+		filter.site_ids.push_back(i->site.id);
+	}
+
+	return true;
+}
+
+inline AnyRecordList
+Database::GetList(PerSite *per_site, TypeRing *ring) noexcept
+{
+	if (per_site != nullptr)
+		return ring != nullptr
+			? AnyRecordList{per_site->rings[ring->index].list}
+			: AnyRecordList{per_site->list};
+	else
+		return ring != nullptr
+			? AnyRecordList{ring->records}
+			: AnyRecordList{all_records};
+}
+
+inline Selection
+Database::MakeSelection(PerSite *per_site, Filter &&filter,
+			SharedLease &&lease, bool with_cold) noexcept
+{
+	if (auto *ring = FindRing(filter.type))
+		/* all records of this type are in this ring; there
+		   is no need to look anywhere else */
+		return {GetList(per_site, ring), std::move(filter), std::move(lease)};
+
+	/* without a type filter, the records of all rings need to
+	   be merged */
+	const bool merge = filter.type == Net::Log::Type::UNSPECIFIED;
+
+	Selection selection(GetList(per_site, nullptr), std::move(filter),
+			    std::move(lease));
+
+	if (with_cold && cold.IsEnabled())
+		selection.SetColdStore(cold, per_site != nullptr
+				       ? per_site->site.id
+				       : ColdStore::ANY_SITE);
+
+	if (merge) {
+		auto &listeners = per_site != nullptr
+			? per_site->merged_listeners
+			: merged_listeners;
+
+		for (auto &i : rings)
+			selection.AddList(GetList(per_site, &i), listeners);
+	}
+
+	return selection;
 }
 
 inline Selection
-Database::MakeSelection(const Filter &_filter) noexcept
+Database::MakeSelection(const Filter &_filter, bool with_cold) noexcept
 {
 	Filter filter(_filter);
-	auto [list, lease] = GetList(filter);
-	return Selection(list, std::move(filter), std::move(lease));
+
+	/* only Follow() (without the ColdStore) creates unknown
+	   sites, because their records may arrive later; a query
+	   for existing records must not make the site table grow */
+	std::vector<SharedLease> site_leases;
+	if (!InternFilterSites(filter, !with_cold, site_leases))
+		/* none of the sites is known: an empty selection */
+		return {AnyRecordList{}, std::move(filter), SharedLease{}};
+
+	PerSite *per_site = nullptr;
+	SharedLease lease;
+	if (filter.HasOneSite()) {
+		per_site = interned_sites[filter.site_ids.front()].per_site;
+		lease = std::move(site_leases.front());
+		site_leases.clear();
+
+		/* the PerSiteRecordList is already filtered for site;
+		   we can disable it in the Filter, because that check
+		   would be redundant */
+		filter.site_ids.clear();
+	}
+
+	auto selection = MakeSelection(per_site, std::move(filter),
+				       std::move(lease), with_cold);
+	selection.AddSiteLeases(std::move(site_leases));
+	return selection;
 }
 
 Selection
 Database::Select(const Filter &filter) noexcept
 {
-	auto selection = MakeSelection(filter);
+	auto selection = MakeSelection(filter, true);
 	selection.Rewind();
 	return selection;
 }
@@ -197,7 +1008,7 @@ Database::Select(const Filter &filter) noexcept
 Selection
 Database::SelectLast(const Filter &filter) noexcept
 {
-	auto selection = MakeSelection(filter);
+	auto selection = MakeSelection(filter, true);
 	selection.SeekLast();
 	return selection;
 }
@@ -205,7 +1016,9 @@ Database::SelectLast(const Filter &filter) noexcept
 Selection
 Database::Follow(const Filter &filter, AppendListener &l) noexcept
 {
-	auto selection = MakeSelection(filter);
+	/* only new records are followed, and they are never in the
+	   ColdStore */
+	auto selection = MakeSelection(filter, false);
 	selection.AddAppendListener(l);
 	return selection;
 }
@@ -215,9 +1028,11 @@ Database::Select(const SiteIterator &_site, const Filter &filter) noexcept
 {
 	assert(_site);
 	assert(filter.sites.empty());
+	assert(filter.site_ids.empty());
 
 	auto &site = static_cast<PerSite &>(_site.lease.GetAnchor());
-	Selection selection(site.list, filter, _site.lease);
+	auto selection = MakeSelection(&site, Filter{filter},
+				       SharedLease{_site.lease}, false);
 	selection.Rewind();
 	return selection;
 }
@@ -4,18 +4,28 @@
 
 #pragma once
 
+#include "ColdStore.hxx"
+#include "DatabaseConfig.hxx"
 #include "FullRecordList.hxx"
+#include "DuplicateFilter.hxx"
+#include "Projection.hxx"
 #include "RList.hxx"
+#include "RateLimiter.hxx"
+#include "RingConfig.hxx"
+#include "Sampler.hxx"
+#include "SiteId.hxx"
 #include "SiteIterator.hxx"
 #include "system/LargeAllocation.hxx"
-#include "util/TokenBucket.hxx"
 #include "util/IntrusiveList.hxx"
 #include "util/IntrusiveHashSet.hxx"
 #include "util/SharedLease.hxx"
 
 #include <cassert>
+#include <deque>
+#include <optional>
 #include <span>
 #include <string>
+#include <vector>
 
 template<typename Clock> class ClockCache;
 struct Filter;
@@ -23,25 +33,180 @@ class Selection;
 class AppendListener;
 class AnyRecordList;
 
-class Database {
+class Database final : FreezeFilter {
+	/**
+	 * The memory for #all_records.  This may be larger than
+	 * #ring_limit to allow growing with Resize(); unused pages
+	 * are given back to the kernel by ReleaseUnusedPages().
+	 */
 	const LargeAllocation allocation;
 
-	const TokenBucketConfig per_site_message_rate_limit;
+	/**
+	 * The maximum amount of memory used by #all_records.  This is
+	 * not larger than the #allocation.
+	 */
+	std::size_t ring_limit;
+
+	/**
+	 * The maximum percentage of #ring_limit which may be
+	 * occupied by one site before its records are deleted
+	 * instead of being moved to the #ColdStore; zero disables
+	 * this.
+	 */
+	const unsigned max_site_share;
+
+	/**
+	 * #max_site_share converted to bytes (or zero if
+	 * disabled).  PerSite::hot_size is only maintained if this
+	 * is non-zero.
+	 */
+	std::size_t max_site_size = 0;
+
+	/**
+	 * Incremented by each FreezeFront() call; this invalidates
+	 * all PerSite::discarded_size values.
+	 */
+	unsigned freeze_serial = 0;
+
+	DuplicateFilter duplicate_filter;
+
+	RateLimiter rate_limiter;
+
+	Projection projection;
+
+	/**
+	 * Discards most HTTP_ACCESS datagrams if they fill the ring
+	 * too quickly (if enabled).
+	 */
+	Sampler sampler;
+
+	/**
+	 * Records which don't fit into #all_records are compressed
+	 * and moved here (if enabled).
+	 */
+	ColdStore cold;
 
 	uint64_t last_id = 0;
 
 	/**
-	 * A chronological list of all records.  This list "owns" the
-	 * allocated #Record instances.
+	 * A chronological list of all records (except for those in
+	 * #rings).  This list "owns" the allocated #Record instances.
 	 */
 	FullRecordList all_records;
 
+	/**
+	 * A separate ring for the records of one type (see
+	 * #RingConfig).  It has no #ColdStore; if it is full, the
+	 * oldest records are deleted.
+	 */
+	struct TypeRing {
+		const LargeAllocation allocation;
+
+		/**
+		 * A chronological list of all records of this type.
+		 * This list "owns" the allocated #Record instances.
+		 */
+		FullRecordList records;
+
+		/**
+		 * The position of this object in #rings.
+		 */
+		const std::size_t index;
+
+		const Net::Log::Type type;
+
+		/**
+		 * See RingConfig::max_age.
+		 */
+		const std::chrono::system_clock::duration max_age;
+
+		/**
+		 * The first record appended to #records by the
+		 * current EmplaceBatch() call (or nullptr if none).
+		 */
+		const Record *batch_first = nullptr;
+		uint64_t batch_first_id;
+
+		TypeRing(std::size_t _index, const RingConfig &config);
+
+		TypeRing(const TypeRing &) = delete;
+		TypeRing &operator=(const TypeRing &) = delete;
+	};
+
+	std::deque<TypeRing> rings;
+
+	/**
+	 * The ring which stores HTTP_ACCESS records (nullptr means
+	 * #all_records).  Only the traffic of this ring is observed
+	 * by the #sampler.
+	 */
+	TypeRing *sampled_ring = nullptr;
+
+	/**
+	 * #AppendListener instances which want to be notified about
+	 * new records in #all_records and in all #rings (see
+	 * Selection::AddList()).
+	 */
+	AppendListenerList merged_listeners;
+
+	struct PerSite;
+
+	/**
+	 * An interned site name.  It outlives the #PerSite as long as
+	 * a #ColdBlock refers to its #SiteId; after that, it is
+	 * deleted by DeleteUnusedSites() and its #SiteId may be
+	 * reused.  A #Filter keeps its sites alive with a lease on
+	 * their #PerSite instances (see InternFilterSites()).
+	 */
+	struct InternedSite final
+		: IntrusiveHashSetHook<IntrusiveHookMode::AUTO_UNLINK>
+	{
+		/**
+		 * The site name; empty if this slot is unused (see
+		 * #free_site_ids).
+		 */
+		std::string name;
+
+		const SiteId id;
+
+		/**
+		 * The #PerSite instance for this site or nullptr if
+		 * there is currently none.
+		 */
+		PerSite *per_site = nullptr;
+
+		InternedSite(std::string_view _name, SiteId _id) noexcept
+			:name(_name), id(_id) {}
+
+		struct GetName {
+			constexpr std::string_view operator()(const InternedSite &site) const noexcept {
+				return site.name;
+			}
+		};
+	};
+
+	/**
+	 * All #InternedSite instances, indexed by #SiteId.
+	 */
+	std::deque<InternedSite> interned_sites;
+
+	/**
+	 * Unused slots in #interned_sites which can be reused by
+	 * InternSite().
+	 */
+	std::vector<SiteId> free_site_ids;
+
+	IntrusiveHashSet<
+		InternedSite, 65536,
+		IntrusiveHashSetOperators<InternedSite, InternedSite::GetName,
+					  std::hash<std::string_view>,
+					  std::equal_to<std::string_view>>> interned_site_map;
+
 	struct PerSite final
-		: IntrusiveHashSetHook<IntrusiveHookMode::AUTO_UNLINK>,
-		  IntrusiveListHook<IntrusiveHookMode::AUTO_UNLINK>,
+		: IntrusiveListHook<IntrusiveHookMode::AUTO_UNLINK>,
 		  SharedAnchor
 	{
-		const std::string site;
+		InternedSite &site;
 
 		/**
 		 * A chronological list for each site.  This list does not
@@ -50,63 +215,220 @@ class Database {
 		 */
 		PerSiteRecordList list;
 
-		TokenBucket rate_limiter;
+		/**
+		 * The first record appended to #list by the current
+		 * EmplaceBatch() call (or nullptr if none); used to
+		 * invoke the #AppendListener instances after the
+		 * batch.
+		 */
+		const Record *batch_first = nullptr;
+		uint64_t batch_first_id;
+
+		/**
+		 * Like #list, but for the records in #rings (with the
+		 * same index).
+		 */
+		struct RingList {
+			PerSiteRecordList list;
+
+			/**
+			 * See PerSite::batch_first.
+			 */
+			const Record *batch_first = nullptr;
+			uint64_t batch_first_id;
+		};
+
+		std::vector<RingList> rings;
 
-		explicit PerSite(std::string_view _site) noexcept
-			:site(_site) {}
+		/**
+		 * Like Database::merged_listeners, but for the
+		 * records of this site.
+		 */
+		AppendListenerList merged_listeners;
+
+		/**
+		 * Has this site been added to #batch_sites already?
+		 */
+		bool in_batch = false;
+
+		/**
+		 * The memory occupied by this site's records in
+		 * #all_records (if #max_site_size is enabled).
+		 */
+		std::size_t hot_size = 0;
+
+		/**
+		 * The memory of this site's records which the
+		 * current ColdStore::Freeze() call has decided to
+		 * discard; they are still counted in #hot_size until
+		 * FreezeFront() pops them.  Only valid if
+		 * #discard_serial equals Database::freeze_serial.
+		 */
+		std::size_t discarded_size = 0;
+		unsigned discard_serial = 0;
+
+		/**
+		 * Counts this site's HTTP_ACCESS datagrams for
+		 * Sampler::Keep().
+		 */
+		uint_least32_t sample_counter = 0;
+
+		PerSite(InternedSite &_site, std::size_t n_rings) noexcept
+			:site(_site), rings(n_rings)
+		{
+			assert(site.per_site == nullptr);
+			site.per_site = this;
+		}
+
+		~PerSite() noexcept {
+			assert(site.per_site == this);
+			site.per_site = nullptr;
+		}
+
+		PerSite(const PerSite &) = delete;
+		PerSite &operator=(const PerSite &) = delete;
+
+		/**
+		 * Are all lists empty and without listeners?
+		 */
+		[[gnu::pure]]
+		bool AreListsExpendable() const noexcept {
+			if (!list.IsExpendable() || !merged_listeners.empty())
+				return false;
+
+			for (const auto &i : rings)
+				if (!i.list.IsExpendable())
+					return false;
+
+			return true;
+		}
 
 		bool IsExpendable() const noexcept {
-			return list.IsExpendable() && IsAbandoned();
+			return AreListsExpendable() && IsAbandoned();
 		}
 
-		void Compress() noexcept {
-			list.Compress();
+		void Clear() noexcept {
+			list.clear();
+			for (auto &i : rings)
+				i.list.clear();
 		}
 
-		bool CheckRateLimit(const TokenBucketConfig config,
-				    double now, double size) noexcept {
-			return rate_limiter.Check(config, now, size);
+		void Compress() noexcept {
+			list.Compress();
+			for (auto &i : rings)
+				i.list.Compress();
 		}
 
 		// virtual methods from SharedAnchor
 		void OnAbandoned() noexcept override;
-
-		struct GetSite {
-			constexpr std::string_view operator()(const PerSite &per_site) const noexcept {
-				return per_site.site;
-			}
-		};
 	};
 
-	IntrusiveHashSet<
-		PerSite, 65536,
-		IntrusiveHashSetOperators<PerSite, PerSite::GetSite,
-					  std::hash<std::string_view>,
-					  std::equal_to<std::string_view>>> per_site_records;
-
 	/**
 	 * A linked list of all sites; this can be used to iterate
 	 * incrementally over all known sites.
 	 */
 	IntrusiveList<PerSite> site_list;
 
+	/**
+	 * The sites which were modified by the current
+	 * EmplaceBatch() call.  This is a field only to reuse its
+	 * allocation.
+	 */
+	std::vector<PerSite *> batch_sites;
+
 public:
-	explicit Database(size_t max_size, double _per_site_message_rate_limit=-1);
+	/**
+	 * @param config the settings; see #DatabaseConfig for details
+	 * (DatabaseConfig::max_size reserves address space which
+	 * allows growing with Resize() later; no memory is used for
+	 * this until the database actually grows)
+	 */
+	explicit Database(const DatabaseConfig &config);
 	~Database() noexcept;
 
 	Database(const Database &) = delete;
 	Database &operator=(const Database &) = delete;
 
-	auto GetMemoryCapacity() const noexcept {
-		return allocation.get().size();
+	std::size_t GetMemoryCapacity() const noexcept {
+		std::size_t result = ring_limit + cold.GetMemoryCapacity();
+		for (const auto &i : rings)
+			result += i.allocation.get().size();
+		return result;
+	}
+
+	/**
+	 * The largest value which may be passed to Resize().  This
+	 * does not include the #rings.
+	 */
+	auto GetMaxMemoryCapacity() const noexcept {
+		return allocation.get().size() + cold.GetMemoryCapacity();
+	}
+
+	/**
+	 * Change the total size (like the #max_size constructor
+	 * parameter).  When shrinking, the oldest records are moved
+	 * to the #ColdStore or deleted, and the memory they occupied
+	 * is released.  This does not affect the #rings.
+	 *
+	 * @param max_size the new size; must not be larger than
+	 * GetMaxMemoryCapacity()
+	 */
+	void Resize(std::size_t max_size) noexcept;
+
+	std::size_t GetMemoryUsage() const noexcept {
+		std::size_t result = all_records.GetMemoryUsage() + cold.GetMemoryUsage();
+		for (const auto &i : rings)
+			result += i.records.GetMemoryUsage();
+		return result;
+	}
+
+	std::size_t GetRecordCount() const noexcept {
+		std::size_t result = all_records.size() + cold.GetRecordCount();
+		for (const auto &i : rings)
+			result += i.records.size();
+		return result;
+	}
+
+	/**
+	 * The number of records in the #ColdStore.
+	 */
+	auto GetColdRecordCount() const noexcept {
+		return cold.GetRecordCount();
+	}
+
+	/**
+	 * The number of records in the #SpillStore.
+	 */
+	auto GetSpilledRecordCount() const noexcept {
+		return cold.GetSpilledRecordCount();
+	}
+
+	const RateLimiter &GetRateLimiter() const noexcept {
+		return rate_limiter;
 	}
 
-	auto GetMemoryUsage() const noexcept {
-		return all_records.GetMemoryUsage();
+	/**
+	 * The number of duplicate datagrams discarded by
+	 * CheckEmplace() and EmplaceBatch().
+	 */
+	uint64_t GetDuplicateCount() const noexcept {
+		return duplicate_filter.GetSuppressedCount();
+	}
+
+	/**
+	 * The number of HTTP_ACCESS datagrams discarded by the
+	 * #Sampler in CheckEmplace() and EmplaceBatch().
+	 */
+	uint64_t GetSampledCount() const noexcept {
+		return sampler.GetDiscardedCount();
 	}
 
-	auto GetRecordCount() const noexcept {
-		return all_records.size();
+	/**
+	 * The number of datagrams which were stored with fewer
+	 * attributes because of a #ProjectionConfig.
+	 */
+	uint64_t GetProjectedCount() const noexcept {
+		return projection.GetProjectedCount();
 	}
 
 	void Clear() noexcept;
@@ -116,30 +438,156 @@ public:
 	 */
 	void Compress() noexcept;
 
-	void DeleteOlderThan(Net::Log::TimePoint t) noexcept {
-		while (!all_records.empty() &&
-		       all_records.front().IsOlderThanOrUnknown(t))
-			all_records.pop_front();
-	}
+	/**
+	 * Shall FreezeAhead() be called?
+	 */
+	[[gnu::pure]]
+	bool WantsFreeze() const noexcept;
+
+	/**
+	 * Move one #ColdBlock worth of old records to the #ColdStore
+	 * if #all_records is nearly full.  This is meant to be called
+	 * from a deferred event after new records have been added,
+	 * so compressing does not delay receiving datagrams.
+	 *
+	 * @return true if this method shall be called again
+	 */
+	bool FreezeAhead() noexcept;
+
+	/**
+	 * Delete records older than the given time stamp, except for
+	 * those in the #rings (see DeleteExpiredRingRecords()).
+	 */
+	void DeleteOlderThan(Net::Log::TimePoint t) noexcept;
+
+	/**
+	 * Does at least one of the #rings have a
+	 * RingConfig::max_age?
+	 */
+	[[gnu::pure]]
+	bool HasRingMaxAge() const noexcept;
+
+	/**
+	 * Delete records from the #rings which are older than their
+	 * RingConfig::max_age.
+	 */
+	void DeleteExpiredRingRecords(std::chrono::system_clock::time_point now) noexcept;
 
 	FullRecordList &GetAllRecords() noexcept {
 		return all_records;
 	}
 
+	const FullRecordList &GetAllRecords() const noexcept {
+		return all_records;
+	}
+
+	/**
+	 * The maximum value returned by GetRecordListCount().
+	 */
+	static constexpr std::size_t MAX_RECORD_LISTS = 1 + MAX_RINGS;
+
+	/**
+	 * The number of lists which own records: #all_records and
+	 * one per #RingConfig.
+	 */
+	std::size_t GetRecordListCount() const noexcept {
+		return 1 + rings.size();
+	}
+
+	/**
+	 * Returns one of the lists which own records: index 0 is
+	 * #all_records, the others are the #rings.  Record ids are
+	 * unique in all of them.
+	 */
+	const FullRecordList &GetRecordList(std::size_t i) const noexcept {
+		assert(i < GetRecordListCount());
+
+		return i == 0 ? all_records : rings[i - 1].records;
+	}
+
+	/**
+	 * Delete the oldest record of one of the lists returned by
+	 * GetRecordList() and give the pages behind it back to the
+	 * kernel right away.  This is used by MoveSnapshot(), which
+	 * shall not need twice as much memory.
+	 */
+	void ShiftRecord(std::size_t i) noexcept;
+
+	/**
+	 * See ColdStore::Shift().
+	 */
+	std::optional<ColdBlock> ShiftColdBlock() noexcept {
+		return cold.Shift();
+	}
+
+	/**
+	 * Add a #ColdBlock which was created by another process (see
+	 * ColdStore::Append()).  New records will get larger ids
+	 * than the ones in this block.  If the #ColdStore is
+	 * disabled, the block is discarded.
+	 */
+	void AppendColdBlock(ColdBlock &&block) noexcept;
+
+	/**
+	 * Returns the name of a site which is referred to by a
+	 * record or a #ColdBlock.
+	 */
+	std::string_view GetSiteName(SiteId id) const noexcept {
+		assert(id < interned_sites.size());
+
+		return interned_sites[id].name;
+	}
+
+	/**
+	 * Intern a site name with the #SiteId it had in another
+	 * process, so the #ColdBlock instances handed over from it
+	 * remain valid.  This must be done before new sites get
+	 * interned.
+	 *
+	 * Throws if the #SiteId is already in use for another site.
+	 */
+	void RestoreSite(SiteId id, std::string_view name);
+
+	/**
+	 * Returns the time stamp of the newest record which has one
+	 * or Net::Log::TimePoint{} if there is none.
+	 */
+	[[gnu::pure]]
+	Net::Log::TimePoint GetNewestTimestamp() const noexcept;
+
 	/**
 	 * Throws if parsing the buffer fails.
+	 *
+	 * @param weight_shift see SmallDatagram::weight_shift
 	 */
-	const Record &Emplace(std::span<const std::byte> raw);
+	const Record &Emplace(std::span<const std::byte> raw,
+			      unsigned weight_shift=0);
 
 	/**
 	 * Throws if parsing the buffer fails.
 	 *
 	 * @return a pointer to the new record or nullptr if a rate
-	 * limit was exceeded
+	 * limit policy was exceeded, if it is a duplicate or if it
+	 * was discarded by the #Sampler
 	 */
 	const Record *CheckEmplace(std::span<const std::byte> raw,
 				   const ClockCache<std::chrono::steady_clock> &clock);
 
+	/**
+	 * Add a batch of datagrams which have already been parsed.
+	 * This is cheaper than calling CheckEmplace() for each of
+	 * them, because each #AppendListener is invoked only once
+	 * per batch and consecutive datagrams of the same site share
+	 * one hash table lookup.
+	 *
+	 * @return the number of datagrams which were discarded
+	 * because a rate limit was exceeded (not including
+	 * duplicates and samples, see GetDuplicateCount() and
+	 * GetSampledCount())
+	 */
+	std::size_t EmplaceBatch(std::span<const ParsedDatagram> batch,
+				 const ClockCache<std::chrono::steady_clock> &clock);
+
 	[[gnu::pure]]
 	Selection Select(const Filter &filter) noexcept;
 
@@ -173,13 +621,177 @@ public:
 	Selection Select(const SiteIterator &site, const Filter &filter) noexcept;
 
 private:
+	/**
+	 * Look up the #InternedSite for the given name, and create
+	 * a new one if it does not exist yet.
+	 */
+	InternedSite &InternSite(std::string_view name) noexcept;
+
+	/**
+	 * Look up the #InternedSite for the given name without
+	 * creating one.
+	 *
+	 * @return the #InternedSite or nullptr if this site is not
+	 * known
+	 */
 	[[gnu::pure]]
-	PerSite &GetPerSite(std::string_view site) noexcept;
+	InternedSite *FindSite(std::string_view name) noexcept;
+
+	/**
+	 * Delete all #InternedSite instances which have no #PerSite
+	 * and are not referenced by the #ColdStore.
+	 */
+	void DeleteUnusedSites() noexcept;
+
+	/**
+	 * Look up the #PerSite for the given site, and create a new
+	 * one if it does not exist yet.
+	 */
+	PerSite &GetPerSite(InternedSite &site) noexcept;
 
-	auto &GetPerSiteRecords(std::string_view site) noexcept {
-		return GetPerSite(site).list;
+	PerSite &GetPerSite(std::string_view site) noexcept {
+		return GetPerSite(InternSite(site));
 	}
 
-	std::pair<AnyRecordList, SharedLease> GetList(Filter &filter) noexcept;
-	Selection MakeSelection(const Filter &filter) noexcept;
+	/**
+	 * Convert Filter::sites to Filter::site_ids and obtain a
+	 * lease on the #PerSite of each of them, which keeps their
+	 * #SiteId values valid.
+	 *
+	 * @param create create sites which are not known yet;
+	 * without this, unknown sites are omitted, because there
+	 * cannot be any records of them
+	 * @param leases the leases are added here (in the order of
+	 * Filter::site_ids)
+	 * @return false if the #Filter has sites, but none of them
+	 * is known (i.e. nothing can match)
+	 */
+	bool InternFilterSites(Filter &filter, bool create,
+			       std::vector<SharedLease> &leases) noexcept;
+
+	/**
+	 * Find the ring which stores records of the given type.
+	 *
+	 * @return the ring or nullptr if records of this type are
+	 * stored in #all_records
+	 */
+	[[gnu::pure]]
+	TypeRing *FindRing(Net::Log::Type type) noexcept {
+		for (auto &i : rings)
+			if (i.type == type)
+				return &i;
+
+		return nullptr;
+	}
+
+	/**
+	 * @param per_site if not nullptr, then return the list of
+	 * this site
+	 * @param ring if not nullptr, then return the list of this
+	 * ring instead of #all_records
+	 */
+	AnyRecordList GetList(PerSite *per_site, TypeRing *ring) noexcept;
+
+	/**
+	 * Create a #Selection which visits only those lists which may
+	 * contain records of the type selected by the #Filter.
+	 *
+	 * @param per_site if not nullptr, then visit only records of
+	 * this site
+	 * @param with_cold include records from the #ColdStore?
+	 */
+	Selection MakeSelection(PerSite *per_site,
+				Filter &&filter, SharedLease &&lease,
+				bool with_cold) noexcept;
+
+	/**
+	 * @param with_cold include records from the #ColdStore?
+	 */
+	Selection MakeSelection(const Filter &filter,
+				bool with_cold) noexcept;
+
+	/**
+	 * Append a new record to #all_records or to one of the
+	 * #rings (depending on its type) and to the #PerSite, and
+	 * invoke the #AppendListener instances.
+	 */
+	const Record &Append(PerSite &per_site,
+			     std::span<const std::byte> raw,
+			     const SmallDatagram &parsed);
+
+	/**
+	 * The number of bytes the #sampled_ring can hold.  For
+	 * #all_records, this includes an estimate for the #ColdStore
+	 * based on the current compression ratio.
+	 */
+	[[gnu::pure]]
+	std::size_t GetSampledCapacity() const noexcept;
+
+	/**
+	 * Apply the #sampler to a datagram which is about to be
+	 * stored, and set SmallDatagram::weight_shift.
+	 *
+	 * @param ring the ring the datagram would be stored in (see
+	 * FindRing())
+	 * @param size the number of bytes it would occupy
+	 * @param now the time the datagram was received
+	 * @return false if the datagram shall be discarded
+	 */
+	bool Sample(PerSite &per_site, const TypeRing *ring,
+		    SmallDatagram &parsed, std::size_t size,
+		    std::chrono::steady_clock::time_point now) noexcept;
+
+	/**
+	 * Move the oldest records to the #ColdStore (or delete
+	 * them).
+	 */
+	void FreezeFront() noexcept;
+
+	/**
+	 * Move old records to the #ColdStore (or delete them) if
+	 * there is not enough room in #all_records for a new one of
+	 * the given size.
+	 */
+	void MakeRoom(std::size_t size) noexcept;
+
+	/**
+	 * Give the pages of the #allocation (and of all #rings) which
+	 * are not occupied by records back to the kernel.
+	 */
+	void ReleaseUnusedPages() noexcept;
+
+	/**
+	 * Give the pages between the address of the (just deleted)
+	 * oldest record and the current front of #all_records to the
+	 * kernel.  This is called after each deletion while the
+	 * #ring_limit is smaller than the #allocation, because the
+	 * ring moves through the whole #allocation, and the resident
+	 * memory would otherwise grow to its size before the next
+	 * Compress() call.
+	 */
+	void ReleaseBehindFront(const std::byte *old_front) noexcept;
+
+	/**
+	 * Update #max_site_size after #ring_limit has changed.
+	 */
+	void UpdateMaxSiteSize() noexcept {
+		if (max_site_share > 0)
+			max_site_size = ring_limit / 100 * max_site_share;
+	}
+
+	/**
+	 * Account for a new record in PerSite::hot_size.
+	 */
+	void AddHotSize(PerSite &per_site, const Record &record) noexcept {
+		if (max_site_size > 0)
+			per_site.hot_size += sizeof(record) + record.GetRaw().size();
+	}
+
+	/**
+	 * Remove the oldest record from #all_records.
+	 */
+	void PopFront() noexcept;
+
+	// virtual methods from FreezeFilter
+	bool ShallDiscard(const Record &record) noexcept override;
 };
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ProjectionConfig.hxx"
+#include "RateLimitConfig.hxx"
+#include "RingConfig.hxx"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct DatabaseConfig {
+	size_t size = 16 * 1024 * 1024;
+
+	/**
+	 * The largest #size which may be configured when the
+	 * configuration is reloaded.  Zero means it is the same as
+	 * #size.
+	 */
+	size_t max_size = 0;
+
+	/**
+	 * A positive value means that records older than this
+	 * duration will be deleted.
+	 */
+	std::chrono::system_clock::duration max_age{};
+
+	/**
+	 * Flood protection policies.
+	 */
+	std::vector<RateLimitConfig> rate_limits;
+
+	/**
+	 * A positive value means that duplicate datagrams received
+	 * within this duration will be discarded.
+	 */
+	std::chrono::steady_clock::duration duplicate_window{};
+
+	/**
+	 * The maximum number of datagrams remembered for detecting
+	 * duplicates.
+	 */
+	std::size_t duplicate_capacity = 65536;
+
+	/**
+	 * Attributes to be removed from datagrams before they are
+	 * stored.
+	 */
+	std::vector<ProjectionConfig> projections;
+
+	/**
+	 * Separate rings for datagrams of certain types.  Their
+	 * sizes are not included in #size.
+	 */
+	std::vector<RingConfig> rings;
+
+	/**
+	 * A positive value means that HTTP_ACCESS datagrams are
+	 * sampled if the ring storing them would hold less history
+	 * than this duration.
+	 */
+	std::chrono::system_clock::duration min_coverage{};
+
+	/**
+	 * The portion of #size which is used for compressed
+	 * records.  Zero disables compression.
+	 */
+	std::size_t cold_size = 0;
+
+	/**
+	 * The maximum percentage of the uncompressed records one
+	 * site may occupy before its records are deleted instead of
+	 * being compressed.  Zero disables this.
+	 */
+	unsigned max_site_share = 0;
+
+	/**
+	 * If not empty, then compressed records which don't fit
+	 * into #cold_size are moved to files in this directory.
+	 */
+	std::string spill_directory;
+
+	/**
+	 * The maximum total size of the files in #spill_directory.
+	 */
+	std::size_t spill_size = 0;
+
+	/**
+	 * If not empty, then snapshots are written to this file
+	 * periodically and loaded at startup.
+	 */
+	std::string snapshot_path;
+
+	std::chrono::steady_clock::duration snapshot_interval = std::chrono::minutes{5};
+
+	/**
+	 * Hand over the records to the next process through the
+	 * systemd file descriptor store on exit?
+	 */
+	bool fd_store = false;
+};
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "DatagramBatch.hxx"
+#include "DatagramScanner.hxx"
+#include "DuplicateFilter.hxx"
+#include "ReceiverFilter.hxx"
+#include "SenderTable.hxx"
+#include "net/log/Parser.hxx" // for Net::Log::ProtocolError
+#include "net/log/Protocol.hxx"
+#include "time/Cast.hxx"
+#include "util/ByteOrder.hxx"
+#include "util/UnalignedBigEndian.hxx"
+
+#include <algorithm> // for std::fill_n()
+#include <array>
+#include <cstring> // for memcpy()
+
+#include <zlib.h> // for crc32()
+
+DatagramBatch::DatagramBatch(std::size_t _capacity) noexcept
+	:capacity(_capacity),
+	 received(new std::span<std::byte>[capacity]),
+	 receive_times(new Net::Log::TimePoint[capacity]),
+	 senders(new SenderAddress[capacity]),
+	 accepted(new bool[capacity]),
+	 datagrams(new ParsedDatagram[capacity])
+{
+	assert(capacity > 0);
+	assert(capacity <= MAX_CAPACITY);
+}
+
+static Net::Log::TimePoint
+ToTimePoint(const struct timespec &ts) noexcept
+{
+	using namespace std::chrono;
+	const auto d = seconds{ts.tv_sec} + nanoseconds{ts.tv_nsec};
+	return Net::Log::FromSystem(system_clock::time_point{duration_cast<system_clock::duration>(d)});
+}
+
+void
+DatagramBatch::HandleControlMessage(const struct cmsghdr &cmsg) noexcept
+{
+	if (cmsg.cmsg_level != SOL_SOCKET)
+		return;
+
+	switch (cmsg.cmsg_type) {
+	case SO_RXQ_OVFL:
+		if (cmsg.cmsg_len >= CMSG_LEN(sizeof(drop_counter)))
+			memcpy(&drop_counter, CMSG_DATA(&cmsg), sizeof(drop_counter));
+		break;
+
+	case SCM_TIMESTAMPNS:
+		if (cmsg.cmsg_len >= CMSG_LEN(sizeof(struct timespec))) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(&cmsg), sizeof(ts));
+			next_receive_time = ToTimePoint(ts);
+		}
+
+		break;
+	}
+}
+
+inline void
+DatagramBatch::AddTimestamp(ParsedDatagram &d, std::span<std::byte> raw,
+			    Net::Log::TimePoint timestamp) noexcept
+{
+	/* the datagram has already been verified by
+	   ParseSmallDatagram(), so the magic and the CRC are
+	   known to be there */
+
+	if (raw.size() + TIMESTAMP_ROOM > MAX_DATAGRAM_SIZE)
+		/* not enough room for the attribute; leave the
+		   datagram without a time stamp rather than having
+		   #parsed disagree with #raw */
+		return;
+
+	std::array<std::byte, TIMESTAMP_ROOM> attribute;
+	attribute[0] = static_cast<std::byte>(Net::Log::Attribute::TIMESTAMP);
+	const uint64_t be = ToBE64(timestamp.time_since_epoch().count());
+	memcpy(attribute.data() + 1, &be, sizeof(be));
+
+	d.fingerprint = DuplicateFilter::GetFingerprint(raw);
+
+	/* the receiver has reserved #TIMESTAMP_ROOM writable bytes
+	   after each datagram */
+	std::byte *end = raw.data() + raw.size();
+
+	if (ReadUnalignedBE32(raw.first<sizeof(uint32_t)>()) == Net::Log::MAGIC_V2) {
+		/* insert the attribute before the CRC and update the
+		   CRC incrementally (it covers only the
+		   attributes) */
+		end -= sizeof(uint32_t);
+		const uint32_t crc = crc32(ReadUnalignedBE32(raw.last<sizeof(uint32_t)>()),
+					   (const Bytef *)attribute.data(),
+					   attribute.size());
+
+		const uint32_t crc_be = ToBE32(crc);
+		memcpy(end + attribute.size(), &crc_be, sizeof(crc_be));
+	}
+
+	memcpy(end, attribute.data(), attribute.size());
+
+	/* the string references stay valid because the attribute
+	   was appended after all of them */
+	d.raw = {raw.data(), raw.size() + TIMESTAMP_ROOM};
+	d.parsed.timestamp = timestamp;
+}
+
+void
+DatagramBatch::Parse(SenderTable *sender_table,
+		     const ReceiverFilter *filter) noexcept
+{
+	n_datagrams = n_filtered = 0;
+
+	if (filter != nullptr && !filter->IsEnabled())
+		filter = nullptr;
+
+	if (sender_table != nullptr) {
+		const auto now = ToFloatSeconds(std::chrono::steady_clock::now().time_since_epoch());
+		n_rejected = sender_table->Check({senders.get(), n_received},
+						 now, accepted.get());
+	} else {
+		std::fill_n(accepted.get(), n_received, true);
+		n_rejected = 0;
+	}
+
+	for (std::size_t i = 0; i < n_received; ++i) {
+		if (!accepted[i])
+			continue;
+
+		const auto raw = received[i];
+
+		try {
+			auto &d = datagrams[n_datagrams] = {raw, ParseSmallDatagram(raw)};
+			if (filter != nullptr && !filter->Check(d.parsed, raw)) {
+				++n_filtered;
+				continue;
+			}
+
+			if (!d.parsed.HasTimestamp() &&
+			    receive_times[i] != Net::Log::TimePoint{})
+				AddTimestamp(d, raw, receive_times[i]);
+
+			++n_datagrams;
+		} catch (Net::Log::ProtocolError) {
+			/* malformed: omit this one, it will be
+			   accounted by GetMalformedCount() */
+		}
+	}
+}
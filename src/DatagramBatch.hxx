@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "SmallDatagram.hxx"
+#include "SenderAddress.hxx"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility> // for std::exchange()
+
+#include <sys/socket.h> // for CMSG_SPACE()
+#include <time.h> // for struct timespec
+
+class SenderTable;
+class ReceiverFilter;
+
+/**
+ * A batch of raw datagrams which get parsed into an array that can
+ * be passed to Database::EmplaceBatch().  This class does not own
+ * the raw datagram memory; that is up to the receiver which fills it
+ * (see #ReceiverBatch and #UringReceiver).
+ */
+class DatagramBatch {
+public:
+	static constexpr std::size_t DEFAULT_CAPACITY = 256;
+	static constexpr std::size_t MAX_CAPACITY = 1024;
+
+	/**
+	 * The size of the regular per-datagram receive buffer.
+	 * Larger datagrams need special treatment (see
+	 * #ReceiverBatch).
+	 */
+	static constexpr std::size_t SLOT_SIZE = 4096;
+
+	/**
+	 * The maximum size of a datagram (the maximum UDP payload is
+	 * a bit smaller).
+	 */
+	static constexpr std::size_t MAX_DATAGRAM_SIZE = 65536;
+
+	static_assert(MAX_DATAGRAM_SIZE - 1 <= UINT16_MAX,
+		      "SmallDatagram::StringRef needs 16 bit offsets");
+
+	/**
+	 * The number of writable bytes which receivers reserve after
+	 * each datagram, enough for a TIMESTAMP attribute (see
+	 * AddTimestamp()).
+	 */
+	static constexpr std::size_t TIMESTAMP_ROOM = 1 + sizeof(uint64_t);
+
+	/**
+	 * The buffer size needed for the ancillary data of one
+	 * datagram (SO_RXQ_OVFL and SO_TIMESTAMPNS); see
+	 * HandleControlMessage().
+	 */
+	static constexpr std::size_t CONTROL_SIZE =
+		CMSG_SPACE(sizeof(uint32_t)) +
+		CMSG_SPACE(sizeof(struct timespec));
+
+private:
+	const std::size_t capacity;
+
+	/**
+	 * The raw datagrams filled by Add().
+	 */
+	const std::unique_ptr<std::span<std::byte>[]> received;
+
+	/**
+	 * The kernel receive time (SO_TIMESTAMPNS) of each item in
+	 * #received; a default-initialized value means unknown.
+	 */
+	const std::unique_ptr<Net::Log::TimePoint[]> receive_times;
+
+	/**
+	 * The sender address of each item in #received.
+	 */
+	const std::unique_ptr<SenderAddress[]> senders;
+
+	/**
+	 * The result of SenderTable::Check() for each item in
+	 * #received.
+	 */
+	const std::unique_ptr<bool[]> accepted;
+
+	std::size_t n_received = 0;
+
+	/**
+	 * The number of datagrams in #received which were discarded
+	 * by the #SenderTable.
+	 */
+	std::size_t n_rejected = 0;
+
+	/**
+	 * The number of datagrams in #received which were dropped by
+	 * the #ReceiverFilter.
+	 */
+	std::size_t n_filtered = 0;
+
+	/**
+	 * The receive time from the most recent
+	 * HandleControlMessage() call; will be consumed by the next
+	 * Add() call.
+	 */
+	Net::Log::TimePoint next_receive_time{};
+
+	/**
+	 * The number of datagrams which were truncated by the
+	 * kernel because they were larger than the receive buffer;
+	 * they are not counted as malformed.
+	 */
+	std::size_t n_truncated = 0;
+
+	/**
+	 * The well-formed datagrams filled by Parse(); this is a
+	 * dense array which can be passed to
+	 * Database::EmplaceBatch() as-is.
+	 */
+	const std::unique_ptr<ParsedDatagram[]> datagrams;
+	std::size_t n_datagrams = 0;
+
+	/**
+	 * The most recent SO_RXQ_OVFL value (the total number of
+	 * datagrams dropped by the kernel on this socket); zero if
+	 * none was received in this batch.
+	 */
+	uint32_t drop_counter = 0;
+
+public:
+	explicit DatagramBatch(std::size_t _capacity) noexcept;
+
+	DatagramBatch(const DatagramBatch &) = delete;
+	DatagramBatch &operator=(const DatagramBatch &) = delete;
+
+	std::size_t GetCapacity() const noexcept {
+		return capacity;
+	}
+
+	void Clear() noexcept {
+		n_received = n_rejected = n_filtered = n_truncated = n_datagrams = 0;
+		next_receive_time = {};
+		drop_counter = 0;
+	}
+
+	bool IsFull() const noexcept {
+		return n_received + n_truncated >= capacity;
+	}
+
+	/**
+	 * Add a raw datagram.  The memory must remain valid until
+	 * this batch is cleared, and there must be #TIMESTAMP_ROOM
+	 * writable bytes after it.
+	 */
+	void Add(std::span<std::byte> raw,
+		 const SenderAddress &sender={}) noexcept {
+		assert(!IsFull());
+
+		receive_times[n_received] = std::exchange(next_receive_time, {});
+		senders[n_received] = sender;
+		received[n_received++] = raw;
+	}
+
+	/**
+	 * Account for a datagram which was truncated (and will
+	 * therefore not be parsed).
+	 */
+	void AddTruncated() noexcept {
+		assert(!IsFull());
+
+		next_receive_time = {};
+		++n_truncated;
+	}
+
+	/**
+	 * Evaluate one control message received with a datagram.
+	 * Unknown ones are ignored.  This must be called before
+	 * Add() for the datagram it belongs to.
+	 */
+	void HandleControlMessage(const struct cmsghdr &cmsg) noexcept;
+
+	/**
+	 * Parse all datagrams passed to Add().  Malformed datagrams
+	 * are omitted from GetDatagrams().  Datagrams without a time
+	 * stamp get their kernel receive time.
+	 *
+	 * @param sender_table if not nullptr, then all datagrams are
+	 * accounted in this table first, and those exceeding the
+	 * per-sender rate limit are discarded without parsing them
+	 * @param filter if not nullptr, then datagrams rejected by
+	 * this filter are dropped
+	 */
+	void Parse(SenderTable *sender_table=nullptr,
+		   const ReceiverFilter *filter=nullptr) noexcept;
+
+	/**
+	 * @return the number of datagrams received (including
+	 * malformed ones)
+	 */
+	std::size_t GetReceivedCount() const noexcept {
+		return n_received + n_truncated;
+	}
+
+	std::size_t GetMalformedCount() const noexcept {
+		return n_received - n_rejected - n_filtered - n_datagrams;
+	}
+
+	/**
+	 * @return the number of datagrams which were lost because
+	 * they were too large for the receive buffer
+	 */
+	std::size_t GetTruncatedCount() const noexcept {
+		return n_truncated;
+	}
+
+	/**
+	 * @return the number of datagrams discarded by the
+	 * #SenderTable
+	 */
+	std::size_t GetRejectedCount() const noexcept {
+		return n_rejected;
+	}
+
+	/**
+	 * @return the well-formed datagrams
+	 */
+	std::span<const ParsedDatagram> GetDatagrams() const noexcept {
+		return {datagrams.get(), n_datagrams};
+	}
+
+	uint32_t GetDropCounter() const noexcept {
+		return drop_counter;
+	}
+
+private:
+	/**
+	 * Attach a time stamp to a datagram which has none.  The
+	 * TIMESTAMP attribute is appended to the raw datagram in
+	 * place (into the #TIMESTAMP_ROOM reserved by the receiver),
+	 * so the time stamp is part of the #Record and will be seen
+	 * by clients.
+	 */
+	void AddTimestamp(ParsedDatagram &d, std::span<std::byte> raw,
+			  Net::Log::TimePoint timestamp) noexcept;
+};
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "DatagramScanner.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Protocol.hxx"
+#include "util/UnalignedBigEndian.hxx"
+
+#include <cstring> // for memchr()
+
+#include <zlib.h> // for crc32()
+
+namespace {
+
+/**
+ * A cursor over the attribute list of a raw datagram.  All methods
+ * return false if the datagram is truncated.
+ */
+class AttributeReader {
+	std::span<const std::byte> p;
+
+public:
+	explicit constexpr AttributeReader(std::span<const std::byte> _p) noexcept
+		:p(_p) {}
+
+	constexpr bool empty() const noexcept {
+		return p.empty();
+	}
+
+	const std::byte *data() const noexcept {
+		return p.data();
+	}
+
+	constexpr bool Skip(std::size_t size) noexcept {
+		if (p.size() < size)
+			return false;
+
+		p = p.subspan(size);
+		return true;
+	}
+
+	constexpr bool ReadByte(uint8_t &value) noexcept {
+		if (p.empty())
+			return false;
+
+		value = static_cast<uint8_t>(p.front());
+		p = p.subspan(1);
+		return true;
+	}
+
+	bool ReadBE16(uint16_t &value) noexcept {
+		if (p.size() < sizeof(value))
+			return false;
+
+		value = ReadUnalignedBE16(p.first<sizeof(value)>());
+		p = p.subspan(sizeof(value));
+		return true;
+	}
+
+	bool ReadBE64(uint64_t &value) noexcept {
+		if (p.size() < sizeof(value))
+			return false;
+
+		value = ReadUnalignedBE64(p.first<sizeof(value)>());
+		p = p.subspan(sizeof(value));
+		return true;
+	}
+
+	/**
+	 * Read a null-terminated string.
+	 */
+	bool ReadString(const char *&value) noexcept {
+		const auto *end = (const std::byte *)
+			memchr(p.data(), 0, p.size());
+		if (end == nullptr)
+			return false;
+
+		value = (const char *)p.data();
+		p = p.subspan(end + 1 - p.data());
+		return true;
+	}
+
+	bool SkipString() noexcept {
+		const char *dummy;
+		return ReadString(dummy);
+	}
+};
+
+/**
+ * Verify the CRC32 which follows the attributes of a version 2
+ * datagram.
+ */
+[[gnu::pure]]
+bool
+VerifyCrc(std::span<const std::byte> attributes,
+	  std::span<const std::byte, sizeof(uint32_t)> expected) noexcept
+{
+	const auto crc = crc32(0, (const Bytef *)attributes.data(),
+			       attributes.size());
+	return crc == ReadUnalignedBE32(expected);
+}
+
+}
+
+std::optional<SmallDatagram>
+ScanDatagram(std::span<const std::byte> raw) noexcept
+{
+	if (raw.size() < sizeof(uint32_t))
+		return std::nullopt;
+
+	auto attributes = raw.subspan(sizeof(uint32_t));
+
+	switch (ReadUnalignedBE32(raw.first<sizeof(uint32_t)>())) {
+	case Net::Log::MAGIC_V1:
+		break;
+
+	case Net::Log::MAGIC_V2:
+		/* strip and verify the CRC; the UDP checksum is
+		   optional with IPv4, so it cannot be relied on */
+		if (attributes.size() < sizeof(uint32_t))
+			return std::nullopt;
+
+		if (!VerifyCrc(attributes.first(attributes.size() - sizeof(uint32_t)),
+			       attributes.last<sizeof(uint32_t)>()))
+			return std::nullopt;
+
+		attributes = attributes.first(attributes.size() - sizeof(uint32_t));
+		break;
+
+	default:
+		return std::nullopt;
+	}
+
+	SmallDatagram d{};
+
+	AttributeReader r{attributes};
+	while (!r.empty()) {
+		uint8_t attribute;
+		r.ReadByte(attribute);
+
+		bool ok;
+		const char *s;
+		uint8_t u8;
+		uint16_t u16;
+		uint64_t u64;
+
+		using Net::Log::Attribute;
+		switch (static_cast<Attribute>(attribute)) {
+		case Attribute::NOP:
+			ok = true;
+			break;
+
+		case Attribute::TIMESTAMP:
+			ok = r.ReadBE64(u64);
+			d.timestamp = Net::Log::TimePoint{Net::Log::Duration{u64}};
+			break;
+
+		case Attribute::SITE:
+			ok = r.ReadString(s);
+			d.site = {s, raw};
+			break;
+
+		case Attribute::HOST:
+			ok = r.ReadString(s);
+			d.host = {s, raw};
+			break;
+
+		case Attribute::GENERATOR:
+			ok = r.ReadString(s);
+			d.generator = {s, raw};
+			break;
+
+		case Attribute::HTTP_URI:
+			ok = r.ReadString(s);
+			d.http_uri = {s, raw};
+			break;
+
+		case Attribute::REMOTE_HOST:
+		case Attribute::FORWARDED_TO:
+		case Attribute::HTTP_REFERER:
+		case Attribute::USER_AGENT:
+		case Attribute::CONTENT_TYPE:
+		case Attribute::ANALYTICS_ID:
+			ok = r.SkipString();
+			break;
+
+		case Attribute::HTTP_METHOD:
+			ok = r.ReadByte(u8);
+			d.http_method = static_cast<HttpMethod>(u8);
+			if (!http_method_is_valid(d.http_method))
+				return std::nullopt;
+			break;
+
+		case Attribute::HTTP_STATUS:
+			ok = r.ReadBE16(u16);
+			d.http_status = static_cast<HttpStatus>(u16);
+			if (!http_status_is_valid(d.http_status))
+				return std::nullopt;
+			break;
+
+		case Attribute::LENGTH:
+			ok = r.Skip(sizeof(uint64_t));
+			break;
+
+		case Attribute::TRAFFIC:
+			ok = r.Skip(2 * sizeof(uint64_t));
+			break;
+
+		case Attribute::DURATION:
+			ok = r.ReadBE64(u64);
+			d.duration = Net::Log::Duration{u64};
+			d.valid_duration = true;
+			break;
+
+		case Attribute::TYPE:
+			ok = r.ReadByte(u8);
+			d.type = static_cast<Net::Log::Type>(u8);
+			break;
+
+		default:
+			/* unknown attributes and those with more
+			   complex rules (e.g. MESSAGE) are left to
+			   the full parser */
+			return std::nullopt;
+		}
+
+		if (!ok)
+			return std::nullopt;
+	}
+
+	return d;
+}
+
+SmallDatagram
+ParseSmallDatagram(std::span<const std::byte> raw)
+{
+	if (auto d = ScanDatagram(raw))
+		return *d;
+
+	return {Net::Log::ParseDatagram(raw), raw};
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "SmallDatagram.hxx"
+
+#include <cstddef>
+#include <optional>
+#include <span>
+
+/**
+ * A lightweight single-pass scanner which fills a #SmallDatagram
+ * directly from the raw datagram, without constructing a full
+ * #Net::Log::Datagram.  Attributes which are not used by the Pond
+ * server are only checked for being well-formed, just enough to
+ * make sure that a later Net::Log::ParseDatagram() call (e.g. by a
+ * client) cannot read beyond the end.
+ *
+ * The CRC of version 2 datagrams is verified; a mismatch makes
+ * this function return std::nullopt, and the full parser rejects
+ * the datagram.
+ *
+ * @return the scanned datagram or std::nullopt if the scanner was
+ * unable to handle this datagram (e.g. because it contains an
+ * attribute unknown to the scanner or because it is malformed); in
+ * that case, the caller should use the full parser, which is the
+ * authority on what is valid
+ */
+[[gnu::pure]]
+std::optional<SmallDatagram>
+ScanDatagram(std::span<const std::byte> raw) noexcept;
+
+/**
+ * Parse a raw datagram into a #SmallDatagram.  This uses
+ * ScanDatagram() and falls back to Net::Log::ParseDatagram().
+ *
+ * Throws Net::Log::ProtocolError on error.
+ */
+SmallDatagram
+ParseSmallDatagram(std::span<const std::byte> raw);
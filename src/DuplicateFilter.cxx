@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "DuplicateFilter.hxx"
+
+DuplicateFilter::DuplicateFilter(Clock::duration _window,
+				 std::size_t _capacity) noexcept
+	:window(_window), capacity(_capacity)
+{
+	if (IsEnabled())
+		fingerprints.reserve(capacity);
+}
+
+inline void
+DuplicateFilter::Expire(Clock::time_point now) noexcept
+{
+	while (!items.empty() &&
+	       (items.size() >= capacity || items.front().time + window <= now)) {
+		fingerprints.erase(items.front().fingerprint);
+		items.pop_front();
+	}
+}
+
+bool
+DuplicateFilter::Check(uint64_t fingerprint, Clock::time_point now) noexcept
+{
+	Expire(now);
+
+	bool inserted = false;
+
+	try {
+		if (!fingerprints.insert(fingerprint).second) {
+			++n_suppressed;
+			return true;
+		}
+
+		inserted = true;
+		items.push_back({fingerprint, now});
+	} catch (...) {
+		/* out of memory: don't remember this datagram and
+		   accept it */
+		if (inserted)
+			fingerprints.erase(fingerprint);
+	}
+
+	return false;
+}
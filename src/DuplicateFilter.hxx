@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional> // for std::hash
+#include <span>
+#include <string_view>
+#include <unordered_set>
+
+/**
+ * Detects datagrams which were received more than once within a
+ * short time window (e.g. once via multicast and once via unicast).
+ * Datagrams are identified by a 64 bit hash of their raw contents.
+ */
+class DuplicateFilter {
+	using Clock = std::chrono::steady_clock;
+
+	const Clock::duration window;
+
+	/**
+	 * The maximum number of fingerprints in #items.
+	 */
+	const std::size_t capacity;
+
+	struct Item {
+		uint64_t fingerprint;
+		Clock::time_point time;
+	};
+
+	/**
+	 * All fingerprints in the window, oldest first.
+	 */
+	std::deque<Item> items;
+
+	/**
+	 * The same fingerprints as in #items, for fast lookups.
+	 */
+	std::unordered_set<uint64_t> fingerprints;
+
+	uint64_t n_suppressed = 0;
+
+public:
+	/**
+	 * @param _window duplicates received within this duration
+	 * will be detected; zero disables this filter
+	 * @param _capacity the maximum number of datagrams in the
+	 * window
+	 */
+	DuplicateFilter(Clock::duration _window, std::size_t _capacity) noexcept;
+
+	DuplicateFilter(const DuplicateFilter &) = delete;
+	DuplicateFilter &operator=(const DuplicateFilter &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return window > Clock::duration::zero();
+	}
+
+	/**
+	 * The number of duplicates detected by Check().
+	 */
+	uint64_t GetSuppressedCount() const noexcept {
+		return n_suppressed;
+	}
+
+	/**
+	 * Calculate the value which identifies a datagram in
+	 * Check().
+	 */
+	[[gnu::pure]]
+	static uint64_t GetFingerprint(std::span<const std::byte> raw) noexcept {
+		return std::hash<std::string_view>{}({(const char *)raw.data(), raw.size()});
+	}
+
+	/**
+	 * Check whether a datagram with the given fingerprint (see
+	 * GetFingerprint()) was seen already within the window, and
+	 * add it to the window if not.  If there is not enough
+	 * memory to add it, the datagram is not considered a
+	 * duplicate.
+	 *
+	 * @return true if this is a duplicate which shall be
+	 * discarded
+	 */
+	bool Check(uint64_t fingerprint, Clock::time_point now) noexcept;
+
+	bool Check(std::span<const std::byte> raw,
+		   Clock::time_point now) noexcept {
+		return Check(GetFingerprint(raw), now);
+	}
+
+	void Clear() noexcept {
+		items.clear();
+		fingerprints.clear();
+	}
+
+private:
+	void Expire(Clock::time_point now) noexcept;
+};
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "FdStore.hxx"
+#include "Snapshot.hxx"
+#include "system/Error.hxx"
+
+#include <systemd/sd-daemon.h>
+
+#include <cstdlib> // for free()
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <string.h> // for strcmp()
+#include <sys/mman.h> // for memfd_create()
+#include <unistd.h> // for close()
+
+/**
+ * The FDNAME of the database memfd in the file descriptor store.
+ */
+#define FD_NAME "database"
+
+namespace FdStore {
+
+UniqueFileDescriptor
+TakeDatabase()
+{
+	char **names;
+	const int n = sd_listen_fds_with_names(true, &names);
+	if (n < 0)
+		throw MakeErrno(-n, "sd_listen_fds_with_names() failed");
+
+	UniqueFileDescriptor result;
+
+	for (int i = 0; i < n; ++i) {
+		const int fd = SD_LISTEN_FDS_START + i;
+
+		if (!result.IsDefined() && names != nullptr &&
+		    strcmp(names[i], FD_NAME) == 0)
+			result = UniqueFileDescriptor{FileDescriptor{fd}};
+		else
+			/* we don't use socket activation; this is
+			   garbage from some earlier version */
+			close(fd);
+	}
+
+	if (names != nullptr) {
+		for (int i = 0; i < n; ++i)
+			free(names[i]);
+		free(names);
+	}
+
+	if (result.IsDefined())
+		/* the records will be part of the next memfd;
+		   this one is obsolete */
+		sd_notify(0, "FDSTOREREMOVE=1\nFDNAME=" FD_NAME);
+
+	return result;
+}
+
+void
+StoreDatabase(Database &db)
+{
+	UniqueFileDescriptor fd{FileDescriptor{memfd_create("pond-database",
+							    MFD_CLOEXEC|MFD_ALLOW_SEALING)}};
+	if (!fd.IsDefined())
+		throw MakeErrno("memfd_create() failed");
+
+	/* this deletes the records while copying them, so the
+	   memfd does not need additional memory */
+	MoveSnapshot(db, fd);
+
+	/* the next process shall not be able to corrupt it, e.g. if
+	   it crashes while loading */
+	fcntl(fd.Get(), F_ADD_SEALS,
+	      F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL);
+
+	const int fds[] = {fd.Get()};
+	const int result = sd_pid_notify_with_fds(0, false,
+						  "FDSTORE=1\nFDNAME=" FD_NAME,
+						  fds, 1);
+	if (result < 0)
+		throw MakeErrno(-result, "Failed to submit to the file descriptor store");
+
+	if (result == 0)
+		throw std::runtime_error{"No systemd notification socket"};
+}
+
+} // namespace FdStore
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+class Database;
+
+/**
+ * Functions which hand over the #Database contents to the next
+ * process through the systemd file descriptor store.  The records
+ * (including the compressed ones) are moved to a memfd (see
+ * MoveSnapshot()), which is kept by systemd while the service
+ * restarts.
+ */
+namespace FdStore {
+
+/**
+ * Take the database memfd from the file descriptor store (if there
+ * is one) and remove it from the store, so it is not handed over
+ * again after the next restart.  Other file descriptors are
+ * closed.
+ *
+ * Throws on error.
+ *
+ * @return the memfd or an undefined #UniqueFileDescriptor if there
+ * is none
+ */
+UniqueFileDescriptor
+TakeDatabase();
+
+/**
+ * Move all records to a new memfd and submit it to the file
+ * descriptor store.  The #Database is empty afterwards (or
+ * incomplete after an error).
+ *
+ * Throws on error.
+ */
+void
+StoreDatabase(Database &db);
+
+} // namespace FdStore
@@ -5,11 +5,11 @@
 #include "Filter.hxx"
 #include "SmallDatagram.hxx"
 #include "net/log/Datagram.hxx"
-#include "net/log/Parser.hxx"
 #include "util/StringCompare.hxx"
 #include "http/Method.hxx"
 #include "http/Status.hxx"
 
+#include <algorithm> // for std::binary_search()
 #include <utility> // for std::to_underlying()
 
 static std::string_view
@@ -25,6 +25,22 @@ MatchFilter(const char *value, const std::set<std::string, std::less<>> &filter)
 	return filter.empty() || (value != nullptr && filter.contains(NullableStringView(value)));
 }
 
+[[gnu::pure]]
+static bool
+MatchFilter(SiteId value, std::span<const SiteId> filter) noexcept
+{
+	return filter.empty() ||
+		std::binary_search(filter.begin(), filter.end(), value);
+}
+
+[[gnu::pure]]
+static bool
+MatchFilter(SmallDatagram::StringRef value, std::span<const std::byte> raw,
+	    const std::set<std::string, std::less<>> &filter) noexcept
+{
+	return filter.empty() || (!value.IsNull() && filter.contains(value.Get(raw)));
+}
+
 [[gnu::pure]]
 static bool
 MatchHttpUriStartsWith(std::string_view http_uri,
@@ -48,27 +64,30 @@ Filter::MatchMore(const Net::Log::Datagram &d) const noexcept
 }
 
 inline bool
-Filter::MatchMore(std::span<const std::byte> raw) const noexcept
+Filter::MatchMore(const SmallDatagram &d,
+		  std::span<const std::byte> raw) const noexcept
 {
 	if (!NeedMore())
 		return true;
 
-	try {
-		const auto d = Net::Log::ParseDatagram(raw);
-		return MatchMore(d);
-	} catch (...) {
-		return false;
-	}
+	return http_status(static_cast<uint16_t>(d.http_status)) &&
+		(http_methods == 0 || (http_methods & uint_least32_t{1} << std::to_underlying(d.http_method))) &&
+		(!http_method_unsafe || (d.http_method != HttpMethod{} && !IsSafeMethod(d.http_method))) &&
+		duration(d) &&
+		MatchFilter(d.host, raw, hosts) &&
+		MatchFilter(d.generator, raw, generators) &&
+		(http_uri.empty() || (!d.http_uri.IsNull() && http_uri == d.http_uri.Get(raw))) &&
+		MatchHttpUriStartsWith(d.http_uri.Get(raw), http_uri_starts_with);
 }
 
 bool
 Filter::operator()(const SmallDatagram &d, std::span<const std::byte> raw) const noexcept
 {
-	return MatchFilter(d.site, sites) &&
+	return MatchFilter(d.site_id, site_ids) &&
 		(type == Net::Log::Type::UNSPECIFIED ||
 		 type == d.type) &&
 		timestamp(d) &&
-		MatchMore(raw);
+		MatchMore(d, raw);
 }
 
 bool
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "SiteId.hxx"
 #include "net/log/Chrono.hxx"
 #include "net/log/Protocol.hxx"
 
@@ -12,6 +13,7 @@
 #include <string>
 #include <span>
 #include <set>
+#include <vector>
 
 enum class HttpMethod : uint_least8_t;
 struct SmallDatagram;
@@ -20,6 +22,14 @@ namespace Net { namespace Log { struct Datagram; }}
 struct Filter {
 	std::set<std::string, std::less<>> sites, hosts, generators;
 
+	/**
+	 * The #sites converted to a sorted list of #SiteId values by
+	 * the #Database.  Only these are used for matching a
+	 * #SmallDatagram, because comparing integers is cheaper than
+	 * comparing strings.
+	 */
+	std::vector<SiteId> site_ids;
+
 	std::string http_uri;
 	std::string http_uri_starts_with;
 
@@ -84,8 +94,7 @@ struct Filter {
 	bool http_method_unsafe = false;
 
 	bool HasOneSite() const noexcept {
-		return !sites.empty() &&
-			std::next(sites.begin()) == sites.end();
+		return site_ids.size() == 1;
 	}
 
 	[[gnu::pure]]
@@ -107,12 +116,20 @@ private:
 	}
 
 	/**
-	 * Match all filter attributes that cannot be checked with
-	 * #SmallDatagram.
+	 * Match all filter attributes except for site, type and
+	 * timestamp.
 	 */
 	[[gnu::pure]]
 	bool MatchMore(const Net::Log::Datagram &d) const noexcept;
 
+	/**
+	 * Like MatchMore(const Net::Log::Datagram &), but use the
+	 * pre-parsed attributes of a #SmallDatagram.
+	 *
+	 * @param raw the raw datagram which the string references
+	 * of #d point into
+	 */
 	[[gnu::pure]]
-	bool MatchMore(std::span<const std::byte> raw) const noexcept;
+	bool MatchMore(const SmallDatagram &d,
+		       std::span<const std::byte> raw) const noexcept;
 };
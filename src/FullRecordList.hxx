@@ -67,27 +67,34 @@ public:
 
 	template<typename... Args>
 	List::reference emplace_back(Args... args) {
-		auto &record =
-			list.emplace_back(std::forward<Args>(args)...);
-		skip_deque.UpdateNew(record);
-
+		auto &record = EmplaceBackQuiet(std::forward<Args>(args)...);
 		append_listeners.OnAppend(record);
-
 		return record;
 	}
 
-	template<typename C, typename... Args>
-	List::reference check_emplace_back(C &&check, Args... args) {
+	/**
+	 * Like emplace_back(), but don't invoke the #AppendListener
+	 * instances.  After a batch of these calls, the caller must
+	 * call NotifyAppend().
+	 */
+	template<typename... Args>
+	List::reference EmplaceBackQuiet(Args... args) {
 		auto &record =
-			list.check_emplace_back(std::forward<C>(check),
-						std::forward<Args>(args)...);
+			list.emplace_back(std::forward<Args>(args)...);
 		skip_deque.UpdateNew(record);
-
-		append_listeners.OnAppend(record);
-
 		return record;
 	}
 
+	/**
+	 * Invoke the #AppendListener instances after a batch of
+	 * EmplaceBackQuiet() calls.
+	 *
+	 * @param first the first record of the batch
+	 */
+	void NotifyAppend(const Record &first) noexcept {
+		append_listeners.OnAppend(first);
+	}
+
 	const Record *First() const noexcept {
 		return list.empty() ? nullptr : &list.front();
 	}
@@ -7,9 +7,10 @@
 #include "Listener.hxx"
 #include "Connection.hxx"
 #include "Protocol.hxx"
-#include "event/net/MultiUdpListener.hxx"
+#include "Snapshot.hxx"
 #include "net/SocketConfig.hxx"
 #include "net/StaticSocketAddress.hxx"
+#include "time/Cast.hxx"
 #include "util/ByteOrder.hxx"
 #include "util/DeleteDisposer.hxx"
 #include "util/PrintException.hxx"
@@ -22,10 +23,14 @@
 #endif
 
 #ifdef HAVE_LIBSYSTEMD
+#include "FdStore.hxx"
+
 #include <systemd/sd-daemon.h>
 #endif
 
+#include <algorithm> // for std::find_if(), std::sort()
 #include <cassert>
+#include <string> // for std::to_string()
 
 #include <sys/socket.h>
 #include <signal.h>
@@ -33,21 +38,87 @@
 
 static constexpr Event::Duration max_age_interval = std::chrono::minutes(1);
 
-Instance::Instance(const Config &config)
-	:shutdown_listener(event_loop, BIND_THIS_METHOD(OnExit)),
+Instance::Instance(const char *_config_path, const Config &config)
+	:config_path(_config_path),
+	 shutdown_listener(event_loop, BIND_THIS_METHOD(OnExit)),
 	 sighup_event(event_loop, SIGHUP, BIND_THIS_METHOD(OnReload)),
 	 max_age(config.database.max_age),
 	 max_age_timer(event_loop, BIND_THIS_METHOD(OnMaxAgeTimer)),
-	 database(config.database.size,
-		  config.database.per_site_message_rate_limit)
+	 database(config.database)
+#ifdef HAVE_LIBSYSTEMD
+	, fd_store(config.database.fd_store)
+#endif
 {
 	shutdown_listener.Enable();
 	sighup_event.Enable();
 	compress_timer.Schedule(COMPRESS_INTERVAL);
+
+	if (!config.database.snapshot_path.empty())
+		snapshot_writer = std::make_unique<SnapshotWriter>(event_loop, database,
+								   config.database.snapshot_path.c_str(),
+								   config.database.snapshot_interval);
 }
 
 Instance::~Instance() noexcept = default;
 
+#ifdef HAVE_LIBSYSTEMD
+
+inline bool
+Instance::TakeFromFdStore() noexcept
+{
+	try {
+		auto fd = FdStore::TakeDatabase();
+		if (!fd.IsDefined())
+			return false;
+
+		const auto n = LoadSnapshot(database, fd).n_records;
+		logger(2, "Took over ", std::to_string(n), " records");
+		return true;
+	} catch (...) {
+		logger(1, "Failed to take over the database: ",
+		       std::current_exception());
+		database.Clear();
+		return false;
+	}
+}
+
+#endif
+
+void
+Instance::RestoreDatabase(const DatabaseConfig &config) noexcept
+{
+#ifdef HAVE_LIBSYSTEMD
+	/* the handed over records are newer than the snapshot
+	   file, which can be skipped then; it is rewritten with
+	   these records */
+	if (fd_store && TakeFromFdStore()) {
+		if (snapshot_writer)
+			snapshot_writer->Start(0);
+		return;
+	}
+#endif
+
+	if (config.snapshot_path.empty())
+		return;
+
+	/* if loading fails, the file is rewritten */
+	uint64_t valid_size = 0;
+
+	try {
+		const auto loaded = LoadSnapshot(database,
+						 config.snapshot_path.c_str());
+		if (loaded.n_records >= 0)
+			logger(2, "Loaded ", std::to_string(loaded.n_records),
+			       " records from snapshot");
+		valid_size = loaded.size;
+	} catch (...) {
+		logger(1, "Failed to load snapshot: ", std::current_exception());
+		database.Clear();
+	}
+
+	snapshot_writer->Start(valid_size);
+}
+
 PondStatsPayload
 Instance::GetStats() const noexcept
 {
@@ -58,9 +129,44 @@ Instance::GetStats() const noexcept
 	s.n_received = ToBE64(n_received);
 	s.n_malformed = ToBE64(n_malformed);
 	s.n_discarded = ToBE64(n_discarded);
+	s.n_duplicates = ToBE64(database.GetDuplicateCount());
+	s.n_sampled = ToBE64(database.GetSampledCount());
+	s.n_truncated = ToBE64(n_truncated);
 	return s;
 }
 
+std::vector<SenderTable::Item>
+Instance::GetTopSenders(std::size_t n) const noexcept
+{
+	std::vector<SenderTable::Item> result;
+
+	for (const auto &i : receiver_stats) {
+		for (const auto &j : i.senders.GetTop(n)) {
+			/* the same sender may have sent to more than
+			   one receiver */
+			auto k = std::find_if(result.begin(), result.end(),
+					      [&j](const auto &r){
+						      return r.address == j.address;
+					      });
+			if (k == result.end()) {
+				result.push_back(j);
+			} else {
+				k->n_received += j.n_received;
+				k->n_discarded += j.n_discarded;
+			}
+		}
+	}
+
+	std::sort(result.begin(), result.end(), [](const auto &a, const auto &b){
+		return a.n_received > b.n_received;
+	});
+
+	if (result.size() > n)
+		result.resize(n);
+
+	return result;
+}
+
 #ifdef HAVE_AVAHI
 
 Avahi::Client &
@@ -110,20 +216,134 @@ Instance::DisableZeroconf() noexcept
 
 #endif // HAVE_AVAHI
 
+static void
+SetupReceiverSocket(SocketDescriptor s, const ReceiverConfig &config) noexcept
+{
+	const int buffer_size = config.receive_buffer_size;
+	s.SetOption(SOL_SOCKET, SO_RCVBUF,
+		    &buffer_size, sizeof(buffer_size));
+	s.SetOption(SOL_SOCKET, SO_RCVBUFFORCE,
+		    &buffer_size, sizeof(buffer_size));
+
+	/* ask the kernel to report the number of dropped datagrams
+	   as ancillary data */
+	static constexpr int one = 1;
+	s.SetOption(SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+
+	/* ask the kernel for the receive time; it will be attached
+	   to datagrams which don't have a time stamp */
+	s.SetOption(SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+}
+
+/**
+ * Attach the receiver's filter as a classic BPF program.  If the
+ * kernel rejects it (e.g. because it exceeds "optmem_max"), retry
+ * with smaller programs which walk fewer attributes.
+ *
+ * @return true on success
+ */
+static bool
+AttachReceiverFilter(SocketDescriptor s, const ReceiverFilter &filter) noexcept
+{
+	for (std::size_t max = BPF_MAXINSNS; max >= 256; max /= 2) {
+		auto program = filter.CompileBPF(max);
+		if (program.empty())
+			break;
+
+		const struct sock_fprog fprog{
+			.len = static_cast<unsigned short>(program.size()),
+			.filter = program.data(),
+		};
+
+		if (s.SetOption(SOL_SOCKET, SO_ATTACH_FILTER,
+				&fprog, sizeof(fprog)))
+			return true;
+	}
+
+	return false;
+}
+
+UniqueFileDescriptor
+Instance::LoadReceiverFilter(const ReceiverFilter &filter) noexcept
+{
+	if (!filter.IsEnabled())
+		return {};
+
+	try {
+		return filter.LoadEBPF();
+	} catch (...) {
+		logger(2, "Failed to load eBPF socket filter, falling back to classic BPF: ",
+		       std::current_exception());
+		return {};
+	}
+}
+
 void
-Instance::AddReceiver(const SocketConfig &config)
+Instance::SetupReceiverFilter(SocketDescriptor s,
+			      const ReceiverFilter &filter,
+			      FileDescriptor ebpf) noexcept
 {
-	UdpHandler &handler = *this;
-	receivers.emplace_front(event_loop,
-				config.Create(SOCK_DGRAM),
-				MultiReceiveMessage(256, MAX_DATAGRAM_SIZE),
-				handler);
-
-	static constexpr int buffer_size = 4 * 1024 * 1024;
-	receivers.front().GetSocket().SetOption(SOL_SOCKET, SO_RCVBUF,
-						&buffer_size, sizeof(buffer_size));
-	receivers.front().GetSocket().SetOption(SOL_SOCKET, SO_RCVBUFFORCE,
-						&buffer_size, sizeof(buffer_size));
+	if (!filter.IsEnabled())
+		return;
+
+	if (ebpf.IsDefined()) {
+		const int fd = ebpf.Get();
+		if (s.SetOption(SOL_SOCKET, SO_ATTACH_BPF, &fd, sizeof(fd)))
+			return;
+	}
+
+	if (!AttachReceiverFilter(s, filter))
+		logger(2, "Failed to attach socket filter, filtering in userspace");
+}
+
+void
+Instance::AddReceiver(const ReceiverConfig &config)
+{
+	ReceiverHandler &handler = *this;
+
+	auto &stats = receiver_stats.emplace_front(config.name,
+						   config.sender_rate_limit,
+						   config.filter);
+
+	/* the kernel needs a while to verify the eBPF program, so
+	   it is loaded only once for all sockets */
+	const auto ebpf = LoadReceiverFilter(stats.filter);
+
+	if (config.threads > 0) {
+		for (unsigned i = 0; i < config.threads; ++i) {
+			auto s = config.Create(SOCK_DGRAM);
+			SetupReceiverSocket(s, config);
+			SetupReceiverFilter(s, stats.filter, ebpf);
+			receiver_threads.emplace_front(event_loop, std::move(s),
+						       config.batch_size,
+						       stats, handler);
+		}
+
+		return;
+	}
+
+	auto s = config.Create(SOCK_DGRAM);
+	SetupReceiverSocket(s, config);
+	SetupReceiverFilter(s, stats.filter, ebpf);
+
+#ifdef HAVE_LIBURING
+	if (config.io_uring) {
+		try {
+			uring_receivers.emplace_front(event_loop, s,
+						      config.batch_size,
+						      stats, handler);
+			return;
+		} catch (...) {
+			/* the kernel may not support it or it may be
+			   forbidden by a seccomp filter */
+			logger(1, "Failed to set up io_uring receiver, falling back: ",
+			       std::current_exception());
+		}
+	}
+#endif
+
+	receivers.emplace_front(event_loop, std::move(s),
+				config.batch_size, stats, handler);
 }
 
 void
@@ -189,26 +409,50 @@ Instance::OnOperationFinished() noexcept
 void
 Instance::OnMaxAgeTimer() noexcept
 {
-	assert(max_age > std::chrono::system_clock::duration::zero());
+	const auto now = event_loop.SystemNow();
 
-	database.DeleteOlderThan(Net::Log::FromSystem(event_loop.SystemNow() - max_age));
+	if (max_age > std::chrono::system_clock::duration::zero())
+		database.DeleteOlderThan(Net::Log::FromSystem(now - max_age));
+
+	database.DeleteExpiredRingRecords(now);
 }
 
 void
 Instance::MaybeScheduleMaxAgeTimer() noexcept
 {
-	if (max_age > std::chrono::system_clock::duration::zero() &&
+	if ((max_age > std::chrono::system_clock::duration::zero() ||
+	     database.HasRingMaxAge()) &&
 	    !max_age_timer.IsPending())
 		max_age_timer.Schedule(max_age_interval);
 }
 
+inline void
+Instance::CompressSenders() noexcept
+{
+	const auto now = ToFloatSeconds(event_loop.SteadyNow().time_since_epoch());
+	constexpr auto max_idle = ToFloatSeconds(COMPRESS_INTERVAL);
+
+	for (auto &i : receiver_stats)
+		i.senders.Compress(now, max_idle);
+}
+
 inline void
 Instance::OnCompressTimer() noexcept
 {
 	database.Compress();
+	CompressSenders();
 	compress_timer.Schedule(COMPRESS_INTERVAL);
 }
 
+void
+Instance::OnFreeze() noexcept
+{
+	/* one block per event loop iteration, so receiving is not
+	   delayed by more than one compression */
+	if (database.FreezeAhead())
+		freeze_event.Schedule();
+}
+
 void
 Instance::OnExit() noexcept
 {
@@ -228,6 +472,7 @@ Instance::OnExit() noexcept
 
 	max_age_timer.Cancel();
 	compress_timer.Cancel();
+	freeze_event.Cancel();
 
 #ifdef HAVE_AVAHI
 	DisableZeroconf();
@@ -235,16 +480,67 @@ Instance::OnExit() noexcept
 #endif // HAVE_AVAHI
 
 	receivers.clear();
+	receiver_threads.clear();
+#ifdef HAVE_LIBURING
+	reap_uring_event.Cancel();
+	uring_receivers.clear();
+#endif
 
 	connections.clear_and_dispose(DeleteDisposer());
 
 	listeners.clear();
+
+	/* write the remaining records to the snapshot file */
+	if (snapshot_writer)
+		snapshot_writer->Stop();
+
+#ifdef HAVE_LIBSYSTEMD
+	/* now that all receivers are gone, hand over the database
+	   to the next process; this must be last, because it
+	   empties the database */
+	if (fd_store) {
+		try {
+			FdStore::StoreDatabase(database);
+		} catch (...) {
+			logger(1, "Failed to hand over the database: ",
+			       std::current_exception());
+		}
+	}
+#endif
+}
+
+inline void
+Instance::ReloadConfig() noexcept
+{
+	Config config;
+
+	try {
+		LoadConfigFile(config, config_path);
+		config.Check();
+	} catch (...) {
+		logger(1, "Failed to reload configuration: ",
+		       std::current_exception());
+		return;
+	}
+
+	/* only the database size can be changed at runtime */
+	std::size_t size = config.database.size;
+	if (size > database.GetMaxMemoryCapacity()) {
+		logger(1, "Database size exceeds max_size");
+		size = database.GetMaxMemoryCapacity();
+	}
+
+	/* this is a no-op if the size has not changed */
+	database.Resize(size);
 }
 
 void
 Instance::OnReload(int) noexcept
 {
+	ReloadConfig();
+
 	database.Compress();
+	CompressSenders();
 	compress_timer.Schedule(COMPRESS_INTERVAL);
 }
 
@@ -6,12 +6,16 @@
 
 #include "BlockingOperation.hxx"
 #include "Database.hxx"
+#include "BatchReceiver.hxx"
+#include "ReceiverThread.hxx"
+#include "ReceiverHandler.hxx"
+#include "ReceiverStats.hxx"
 #include "event/Loop.hxx"
 #include "event/ShutdownListener.hxx"
 #include "event/SignalEvent.hxx"
 #include "event/CoarseTimerEvent.hxx"
+#include "event/DeferEvent.hxx"
 #include "event/FarTimerEvent.hxx"
-#include "event/net/UdpHandler.hxx"
 #include "io/Logger.hxx"
 #include "util/IntrusiveList.hxx"
 #include "config.h"
@@ -20,34 +24,44 @@
 #include "lib/avahi/ErrorHandler.hxx"
 #endif
 
+#ifdef HAVE_LIBURING
+#include "UringReceiver.hxx"
+#endif
+
 #include <forward_list>
 #include <memory>
+#include <vector>
 
 #include <stdint.h>
 
 struct Config;
-struct SocketConfig;
+struct ReceiverConfig;
 struct ListenerConfig;
+struct DatabaseConfig;
 struct PondStatsPayload;
 class UniqueSocketDescriptor;
-class MultiUdpListener;
+class SocketDescriptor;
 class Listener;
 class Connection;
+class SnapshotWriter;
 namespace Avahi { class Client; class Publisher; struct Service; }
 
 class Instance final
-	: UdpHandler,
+	: ReceiverHandler,
 #ifdef HAVE_AVAHI
 	  Avahi::ErrorHandler,
 #endif
 	  public BlockingOperationHandler
 {
-	static constexpr size_t MAX_DATAGRAM_SIZE = 4096;
-
 	static constexpr Event::Duration COMPRESS_INTERVAL = std::chrono::minutes{20};
 
 	const RootLogger logger;
 
+	/**
+	 * The configuration file which is loaded again on SIGHUP.
+	 */
+	const char *const config_path;
+
 	EventLoop event_loop;
 
 	bool should_exit = false;
@@ -61,7 +75,24 @@ class Instance final
 	std::unique_ptr<Avahi::Publisher> avahi_publisher;
 #endif // HAVE_AVAHI
 
-	std::forward_list<MultiUdpListener> receivers;
+	/**
+	 * One item for each "receiver" block.  The receivers below
+	 * point into this list.
+	 */
+	std::forward_list<ReceiverStats> receiver_stats;
+
+	std::forward_list<BatchReceiver> receivers;
+	std::forward_list<ReceiverThread> receiver_threads;
+#ifdef HAVE_LIBURING
+	std::forward_list<UringReceiver> uring_receivers;
+
+	/**
+	 * Destroys #uring_receivers which have stopped (see
+	 * OnReceiverStopped()); this cannot be done from within
+	 * their own callback.
+	 */
+	DeferEvent reap_uring_event{event_loop, BIND_THIS_METHOD(OnReapUring)};
+#endif
 	std::forward_list<Listener> listeners;
 
 	IntrusiveList<Connection> connections;
@@ -77,7 +108,7 @@ class Instance final
 
 	/**
 	 * This timer deletes old records once a minute if a #max_age
-	 * was configured.
+	 * (or a RingConfig::max_age) was configured.
 	 */
 	CoarseTimerEvent max_age_timer;
 
@@ -86,15 +117,35 @@ class Instance final
 	 */
 	FarTimerEvent compress_timer{event_loop, BIND_THIS_METHOD(OnCompressTimer)};
 
+	/**
+	 * Call Database::FreezeAhead() after new records have been
+	 * added.
+	 */
+	DeferEvent freeze_event{event_loop, BIND_THIS_METHOD(OnFreeze)};
+
 	Database database;
 
+	/**
+	 * Writes snapshots of #database periodically (if configured).
+	 */
+	std::unique_ptr<SnapshotWriter> snapshot_writer;
+
+#ifdef HAVE_LIBSYSTEMD
+	/**
+	 * Hand over #database to the next process through the
+	 * systemd file descriptor store on exit?
+	 */
+	const bool fd_store;
+#endif
+
 	/**
 	 * @see struct PondStatsPayload
 	 */
 	uint64_t n_received = 0, n_malformed = 0, n_discarded = 0;
+	uint64_t n_truncated = 0;
 
 public:
-	explicit Instance(const Config &config);
+	Instance(const char *_config_path, const Config &config);
 	~Instance() noexcept;
 
 	const RootLogger &GetLogger() const noexcept {
@@ -116,6 +167,17 @@ public:
 	[[gnu::pure]]
 	PondStatsPayload GetStats() const noexcept;
 
+	const auto &GetReceiverStats() const noexcept {
+		return receiver_stats;
+	}
+
+	/**
+	 * Return the senders with the most received datagrams
+	 * (summed over all receivers), sorted by this number
+	 * (descending).
+	 */
+	std::vector<SenderTable::Item> GetTopSenders(std::size_t n) const noexcept;
+
 #ifdef HAVE_AVAHI
 	Avahi::Client &GetAvahiClient();
 
@@ -123,7 +185,15 @@ public:
 	void DisableZeroconf() noexcept;
 #endif // HAVE_AVAHI
 
-	void AddReceiver(const SocketConfig &config);
+	/**
+	 * Load the records handed over by the previous process (see
+	 * DatabaseConfig::fd_store) or the snapshot file (if
+	 * configured) into the database and begin writing new
+	 * snapshots.  Errors are logged.
+	 */
+	void RestoreDatabase(const DatabaseConfig &config) noexcept;
+
+	void AddReceiver(const ReceiverConfig &config);
 	void AddListener(const ListenerConfig &config);
 	void AddConnection(UniqueSocketDescriptor &&fd) noexcept;
 
@@ -142,24 +212,71 @@ public:
 	}
 
 private:
+	/**
+	 * Load the filter as an eBPF program (if one is configured),
+	 * to be passed to SetupReceiverFilter() for all sockets of
+	 * the receiver.
+	 *
+	 * @return the program or an undefined descriptor if there is
+	 * no filter or if the kernel has refused the program (which
+	 * is logged)
+	 */
+	UniqueFileDescriptor LoadReceiverFilter(const ReceiverFilter &filter) noexcept;
+
+	/**
+	 * Attach the filter to a receiver socket (if one is
+	 * configured), preferably the eBPF program, otherwise the
+	 * classic BPF program.  Failures are logged; in that case,
+	 * the filter is only applied in userspace.
+	 */
+	void SetupReceiverFilter(SocketDescriptor s,
+				 const ReceiverFilter &filter,
+				 FileDescriptor ebpf) noexcept;
+
 	void OnMaxAgeTimer() noexcept;
+
+	/**
+	 * Delete idle senders from all #SenderTable instances.
+	 */
+	void CompressSenders() noexcept;
+
 	void OnCompressTimer() noexcept;
 
+	void OnFreeze() noexcept;
+#ifdef HAVE_LIBURING
+	void OnReapUring() noexcept;
+#endif
+
 	/**
-	 * Schedule the #max_age_timer if a #max_age is configured
-	 * (but don't update the timer if it has already been
-	 * scheduled).
+	 * Schedule the #max_age_timer if a #max_age (or a
+	 * RingConfig::max_age) is configured (but don't update the
+	 * timer if it has already been scheduled).
 	 */
 	void MaybeScheduleMaxAgeTimer() noexcept;
 
+#ifdef HAVE_LIBSYSTEMD
+	/**
+	 * @return true if records were handed over by the previous
+	 * process
+	 */
+	bool TakeFromFdStore() noexcept;
+#endif
+
 	void OnExit() noexcept;
+	/**
+	 * Load the configuration file again and apply the settings
+	 * which can be changed at runtime.  Errors are logged.
+	 */
+	void ReloadConfig() noexcept;
+
 	void OnReload(int) noexcept;
 
-	/* virtual methods from UdpHandler */
-	bool OnUdpDatagram(std::span<const std::byte> payload,
-			   std::span<UniqueFileDescriptor> fds,
-			   SocketAddress address, int uid) override;
-	void OnUdpError(std::exception_ptr &&error) noexcept override;
+	/* virtual methods from ReceiverHandler */
+	void OnReceiverBatch(const DatagramBatch &batch) noexcept override;
+	void OnReceiverError(std::exception_ptr &&error) noexcept override;
+	void OnReceiverStopped(UniqueSocketDescriptor &&socket,
+			       std::size_t batch_size,
+			       ReceiverStats &stats) noexcept override;
 
 	/* virtual methods from BlockingOperationHandler */
 	void OnOperationFinished() noexcept override;
@@ -19,3 +19,21 @@ LightCursor::FixDeleted(uint64_t expected_id) noexcept
 	} else
 		return false;
 }
+
+void
+LightCursor::SeekAfter(uint64_t after_id) noexcept
+{
+	next = nullptr;
+
+	for (const Record *i = list.Last();
+	     i != nullptr && i->GetId() > after_id;
+	     i = list.Previous(*i))
+		next = i;
+}
+
+uint64_t
+LightCursor::GetLastId() const noexcept
+{
+	const auto *last = list.Last();
+	return last != nullptr ? last->GetId() : 0;
+}
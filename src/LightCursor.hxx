@@ -23,6 +23,8 @@ class LightCursor {
 	const Record *next = nullptr;
 
 public:
+	constexpr LightCursor() noexcept = default;
+
 	explicit constexpr LightCursor(const AnyRecordList &_list) noexcept
 		:list(_list) {}
 
@@ -45,6 +47,20 @@ public:
 		next = list.Last();
 	}
 
+	/**
+	 * Move to the first record whose id is larger than the given
+	 * one.  The list is searched backwards from its end, which is
+	 * cheap if only few records have been appended since.
+	 */
+	void SeekAfter(uint64_t after_id) noexcept;
+
+	/**
+	 * Returns the id of the last record in the list or 0 if the
+	 * list is empty.
+	 */
+	[[gnu::pure]]
+	uint64_t GetLastId() const noexcept;
+
 	/**
 	 * Opaque struct for Mark() and Restore().
 	 */
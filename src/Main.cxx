@@ -22,18 +22,25 @@
 #include <stdlib.h>
 
 static void
-Run(const Config &config)
+Run(const CommandLine &cmdline, const Config &config)
 {
 	SetupProcess();
 
-	Instance instance(config);
+	Instance instance(cmdline.config_path, config);
+
+	/* load the old records before the receivers are set up, so
+	   new records are appended after the old ones */
+	instance.RestoreDatabase(config.database);
 
 #ifdef HAVE_AVAHI
 	if (config.auto_clone)
+		/* if a snapshot was loaded, fetch only the records
+		   which were received after its newest one */
 		instance.SetBlockingOperation(std::make_unique<AutoCloneOperation>(instance,
 										   instance.GetDatabase(),
 										   instance.GetAvahiClient(),
-										   *config.GetZeroconfListener()));
+										   *config.GetZeroconfListener(),
+										   instance.GetDatabase().GetNewestTimestamp()));
 #endif // HAVE_AVAHI
 
 	for (const auto &i : config.receivers)
@@ -65,7 +72,7 @@ try {
 	LoadConfigFile(config, cmdline.config_path);
 	config.Check();
 
-	Run(config);
+	Run(cmdline, config);
 
 	return EXIT_SUCCESS;
 } catch (...) {
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Projection.hxx"
+#include "SmallDatagram.hxx"
+#include "DatagramScanner.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Serializer.hxx"
+
+/**
+ * The maximum size of a serialized datagram; the SmallDatagram
+ * offsets are 16 bit.
+ */
+static constexpr std::size_t BUFFER_SIZE = 65536;
+
+Projection::Projection(std::span<const ProjectionConfig> _rules) noexcept
+	:rules(_rules.begin(), _rules.end())
+{
+}
+
+inline uint_least64_t
+Projection::GetStripMask(Net::Log::Type type) const noexcept
+{
+	uint_least64_t mask = 0;
+	for (const auto &i : rules)
+		if (i.type == Net::Log::Type::UNSPECIFIED || i.type == type)
+			mask |= i.strip;
+	return mask;
+}
+
+/**
+ * Clear the attribute if its bit is set in the mask.
+ *
+ * @return true if the attribute was present
+ */
+template<typename T>
+static bool
+Strip(T &value, uint_least64_t mask, Net::Log::Attribute a) noexcept
+{
+	if ((mask & ProjectionConfig::Bit(a)) == 0 || value == T{})
+		return false;
+
+	value = {};
+	return true;
+}
+
+bool
+Projection::Apply(std::span<const std::byte> &raw,
+		  SmallDatagram &parsed) noexcept
+{
+	using Net::Log::Attribute;
+
+	const auto mask = GetStripMask(parsed.type);
+	if (mask == 0)
+		return false;
+
+	try {
+		auto d = Net::Log::ParseDatagram(raw);
+
+		bool modified = false;
+		modified |= Strip(d.remote_host, mask, Attribute::REMOTE_HOST);
+		modified |= Strip(d.forwarded_to, mask, Attribute::FORWARDED_TO);
+		modified |= Strip(d.http_referer, mask, Attribute::HTTP_REFERER);
+		modified |= Strip(d.user_agent, mask, Attribute::USER_AGENT);
+		modified |= Strip(d.message, mask, Attribute::MESSAGE);
+		modified |= Strip(d.analytics_id, mask, Attribute::ANALYTICS_ID);
+
+		if (!modified)
+			return false;
+
+		if (!buffer)
+			buffer.reset(new std::byte[BUFFER_SIZE]);
+
+		const std::span<const std::byte> new_raw{
+			buffer.get(),
+			Net::Log::Serialize({buffer.get(), BUFFER_SIZE}, d),
+		};
+
+		parsed = ParseSmallDatagram(new_raw);
+		raw = new_raw;
+	} catch (...) {
+		/* keep the original datagram */
+		return false;
+	}
+
+	++n_projected;
+	return true;
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ProjectionConfig.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+struct SmallDatagram;
+
+/**
+ * Removes bulky attributes which nobody is interested in (e.g.
+ * "User-Agent" and "Referer" of HTTP access log records) from
+ * datagrams before they are stored, so more records fit into the
+ * database.
+ */
+class Projection {
+	const std::vector<ProjectionConfig> rules;
+
+	/**
+	 * The buffer for the datagram generated by the most recent
+	 * Apply() call.  Allocated on demand.
+	 */
+	std::unique_ptr<std::byte[]> buffer;
+
+	uint64_t n_projected = 0;
+
+public:
+	explicit Projection(std::span<const ProjectionConfig> _rules) noexcept;
+
+	Projection(const Projection &) = delete;
+	Projection &operator=(const Projection &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return !rules.empty();
+	}
+
+	/**
+	 * The number of datagrams which were modified by Apply().
+	 */
+	uint64_t GetProjectedCount() const noexcept {
+		return n_projected;
+	}
+
+	/**
+	 * Remove the configured attributes from the given datagram.
+	 * If anything was removed, then both parameters are replaced
+	 * with the new datagram, which lives in an internal buffer
+	 * that remains valid until the next call.  Datagrams which
+	 * cannot be parsed or serialized are left unmodified.
+	 *
+	 * @return true if the datagram was modified
+	 */
+	bool Apply(std::span<const std::byte> &raw,
+		   SmallDatagram &parsed) noexcept;
+
+private:
+	[[gnu::pure]]
+	uint_least64_t GetStripMask(Net::Log::Type type) const noexcept;
+};
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "net/log/Protocol.hxx"
+
+#include <cstdint>
+
+/**
+ * Remove certain attributes from datagrams of a certain type before
+ * they are stored in the database.
+ */
+struct ProjectionConfig {
+	/**
+	 * Apply this projection only to datagrams of this type;
+	 * #UNSPECIFIED means all datagrams.
+	 */
+	Net::Log::Type type = Net::Log::Type::UNSPECIFIED;
+
+	/**
+	 * A bit mask of attributes to be removed; bit numbers are
+	 * #Net::Log::Attribute values.
+	 */
+	uint_least64_t strip = 0;
+
+	static constexpr uint_least64_t Bit(Net::Log::Attribute a) noexcept {
+		return uint_least64_t{1} << static_cast<unsigned>(a);
+	}
+};
@@ -162,6 +162,36 @@ enum class PondRequestCommand : uint16_t {
 	 * attribute.
 	 */
 	FILTER_HTTP_URI = 24,
+
+	/**
+	 * Request per-receiver statistics.  Returns one
+	 * #PondResponseCommand::RECEIVER_STATS for each receiver,
+	 * followed by #PondResponseCommand::END.
+	 */
+	RECEIVER_STATS = 25,
+
+	/**
+	 * Request flood protection statistics.  Returns one
+	 * #PondResponseCommand::RATE_LIMIT_STATS for each policy,
+	 * followed by #PondResponseCommand::END.
+	 */
+	RATE_LIMIT_STATS = 26,
+
+	/**
+	 * Request per-sender statistics.  Returns one
+	 * #PondResponseCommand::SENDER_STATS for each of the senders
+	 * with the most datagrams, followed by
+	 * #PondResponseCommand::END.
+	 */
+	SENDER_STATS = 27,
+
+	/**
+	 * Option for #QUERY: records which stand for several
+	 * datagrams (because the others were discarded by sampling)
+	 * are sent as #PondResponseCommand::WEIGHTED_LOG_RECORD
+	 * instead of #PondResponseCommand::LOG_RECORD.
+	 */
+	WEIGHTS = 28,
 };
 
 enum class PondResponseCommand : uint16_t {
@@ -189,6 +219,35 @@ enum class PondResponseCommand : uint16_t {
 	 * Payload is #PondStatsPayload.
 	 */
 	STATS = 4,
+
+	/**
+	 * Statistics of one receiver.  Response for
+	 * #PondRequestCommand::RECEIVER_STATS.  Payload is
+	 * #PondReceiverStatsPayload.
+	 */
+	RECEIVER_STATS = 5,
+
+	/**
+	 * Statistics of one flood protection policy.  Response for
+	 * #PondRequestCommand::RATE_LIMIT_STATS.  Payload is
+	 * #PondRateLimitStatsPayload.
+	 */
+	RATE_LIMIT_STATS = 6,
+
+	/**
+	 * Statistics of one sender.  Response for
+	 * #PondRequestCommand::SENDER_STATS.  Payload is
+	 * #PondSenderStatsPayload.
+	 */
+	SENDER_STATS = 7,
+
+	/**
+	 * Like #LOG_RECORD, but the serialized log record is preceded
+	 * by a 32 bit weight: the number of datagrams this record
+	 * stands for.  Only sent if the client has sent
+	 * #PondRequestCommand::WEIGHTS.
+	 */
+	WEIGHTED_LOG_RECORD = 8,
 };
 
 /**
@@ -261,6 +320,72 @@ struct PondStatsPayload {
 	 * limits).
 	 */
 	uint64_t n_discarded;
+
+	/**
+	 * The number of discarded duplicate datagrams.  This field
+	 * was added in version 0.42; older servers send a shorter
+	 * payload.
+	 */
+	uint64_t n_duplicates;
+
+	/**
+	 * The number of HTTP_ACCESS datagrams discarded by sampling
+	 * (database option "min_coverage").  This field was added
+	 * in version 0.42; older servers send a shorter payload.
+	 */
+	uint64_t n_sampled;
+
+	/**
+	 * The number of datagrams which were lost because they were
+	 * too large for the receive buffer.  This field was added in
+	 * version 0.42; older servers send a shorter payload.
+	 */
+	uint64_t n_truncated;
+};
+
+/**
+ * Payload for PondResponseCommand::RECEIVER_STATS.  It is followed
+ * by the receiver's "bind" setting (not null-terminated).
+ */
+struct PondReceiverStatsPayload {
+	/**
+	 * The number of datagrams received on this receiver.
+	 */
+	uint64_t n_received;
+
+	/**
+	 * The number of datagrams dropped by the kernel because the
+	 * socket's receive buffer was full (SO_RXQ_OVFL).
+	 */
+	uint64_t n_dropped;
+};
+
+/**
+ * Payload for PondResponseCommand::RATE_LIMIT_STATS.  It is followed
+ * by the policy's name (not null-terminated).
+ */
+struct PondRateLimitStatsPayload {
+	/**
+	 * The number of datagrams discarded by this policy.
+	 */
+	uint64_t n_discarded;
+};
+
+/**
+ * Payload for PondResponseCommand::SENDER_STATS.  It is followed by
+ * the sender's IP address as a string (not null-terminated).
+ */
+struct PondSenderStatsPayload {
+	/**
+	 * The number of datagrams received from this sender.
+	 */
+	uint64_t n_received;
+
+	/**
+	 * The number of datagrams discarded by the receiver's
+	 * "sender_rate_limit".
+	 */
+	uint64_t n_discarded;
 };
 
 /**
@@ -65,10 +65,28 @@ public:
 	}
 
 	void push_back(Record &record) noexcept {
+		PushBackQuiet(record);
+		append_listeners.OnAppend(record);
+	}
+
+	/**
+	 * Like push_back(), but don't invoke the #AppendListener
+	 * instances.  After a batch of these calls, the caller must
+	 * call NotifyAppend().
+	 */
+	void PushBackQuiet(Record &record) noexcept {
 		list.push_back(record);
 		skip_deque.UpdateNew(record);
+	}
 
-		append_listeners.OnAppend(record);
+	/**
+	 * Invoke the #AppendListener instances after a batch of
+	 * PushBackQuiet() calls.
+	 *
+	 * @param first the first record of the batch
+	 */
+	void NotifyAppend(const Record &first) noexcept {
+		append_listeners.OnAppend(first);
 	}
 
 	const Record *First() const noexcept {
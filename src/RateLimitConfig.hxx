@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "net/log/Protocol.hxx"
+#include "util/TokenBucket.hxx"
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Which datagram attribute is used to select a token bucket.
+ */
+enum class RateLimitKey : uint_least8_t {
+	/**
+	 * One token bucket for all matching datagrams.
+	 */
+	TYPE,
+
+	/**
+	 * One token bucket per site.
+	 */
+	SITE,
+
+	/**
+	 * One token bucket per generator.
+	 */
+	GENERATOR,
+
+	/**
+	 * One token bucket per host.
+	 */
+	HOST,
+};
+
+/**
+ * A flood protection policy: datagrams of the given type which
+ * exceed the token bucket's rate are discarded.
+ */
+struct RateLimitConfig {
+	/**
+	 * A human-readable name used in statistics.
+	 */
+	std::string name;
+
+	RateLimitKey key;
+
+	/**
+	 * Apply this policy only to datagrams of this type;
+	 * #UNSPECIFIED means all datagrams.
+	 */
+	Net::Log::Type type = Net::Log::Type::UNSPECIFIED;
+
+	TokenBucketConfig bucket;
+};
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "RateLimiter.hxx"
+#include "SmallDatagram.hxx"
+
+RateLimiter::RateLimiter(std::span<const RateLimitConfig> config)
+{
+	policies.reserve(config.size());
+	for (const auto &i : config)
+		policies.emplace_back(i);
+}
+
+inline bool
+RateLimiter::Policy::Check(Bucket &b, double now) noexcept
+{
+	b.last_used = now;
+	return b.bucket.Check(config.bucket, now, 1);
+}
+
+inline RateLimiter::Policy::Bucket &
+RateLimiter::Policy::GetStringBucket(std::string_view key) noexcept
+{
+	if (auto i = string_buckets.find(key); i != string_buckets.end())
+		return i->second;
+
+	if (string_buckets.size() >= MAX_STRING_BUCKETS)
+		return overflow_bucket;
+
+	return string_buckets.emplace(key, Bucket{}).first->second;
+}
+
+bool
+RateLimiter::Policy::Check(const SmallDatagram &d,
+			   std::span<const std::byte> raw,
+			   SiteId site_id, double now) noexcept
+{
+	if (config.type != Net::Log::Type::UNSPECIFIED && d.type != config.type)
+		/* this policy does not apply */
+		return true;
+
+	last_now = now;
+
+	bool result = true;
+
+	switch (config.key) {
+	case RateLimitKey::TYPE:
+		result = Check(type_bucket, now);
+		break;
+
+	case RateLimitKey::SITE:
+		if (d.site.IsNull())
+			return true;
+
+		result = Check(site_buckets[site_id], now);
+		break;
+
+	case RateLimitKey::GENERATOR:
+		if (d.generator.IsNull())
+			return true;
+
+		result = Check(GetStringBucket(d.generator.Get(raw)), now);
+		break;
+
+	case RateLimitKey::HOST:
+		if (d.host.IsNull())
+			return true;
+
+		result = Check(GetStringBucket(d.host.Get(raw)), now);
+		break;
+	}
+
+	if (!result)
+		++n_discarded;
+
+	return result;
+}
+
+void
+RateLimiter::Policy::Compress() noexcept
+{
+	/* after this duration, an idle token bucket is full again
+	   and thus equivalent to a new one */
+	const double idle = config.bucket.burst / config.bucket.rate;
+
+	const auto is_idle = [this, idle](const auto &i){
+		return last_now - i.second.last_used >= idle;
+	};
+
+	std::erase_if(site_buckets, is_idle);
+	std::erase_if(string_buckets, is_idle);
+}
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "RateLimitConfig.hxx"
+#include "SiteId.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct SmallDatagram;
+
+/**
+ * Applies a list of flood protection policies (#RateLimitConfig) to
+ * incoming datagrams.
+ */
+class RateLimiter {
+public:
+	class Policy {
+		/**
+		 * The maximum number of entries in #string_buckets.
+		 * Datagrams with more distinct values share
+		 * #overflow_bucket.
+		 */
+		static constexpr std::size_t MAX_STRING_BUCKETS = 65536;
+
+		const RateLimitConfig config;
+
+		struct Bucket {
+			TokenBucket bucket;
+
+			/**
+			 * The time of the most recent Check() call on
+			 * this bucket; used by Compress().
+			 */
+			double last_used = 0;
+		};
+
+		struct StringHash : std::hash<std::string_view> {
+			using is_transparent = void;
+		};
+
+		/**
+		 * The token bucket for #RateLimitKey::TYPE.
+		 */
+		Bucket type_bucket;
+
+		/**
+		 * The token buckets for #RateLimitKey::SITE.
+		 */
+		std::unordered_map<SiteId, Bucket> site_buckets;
+
+		/**
+		 * The token buckets for #RateLimitKey::GENERATOR and
+		 * #RateLimitKey::HOST.
+		 */
+		std::unordered_map<std::string, Bucket,
+				   StringHash, std::equal_to<>> string_buckets;
+
+		/**
+		 * The token bucket for all values which did not fit
+		 * into #string_buckets.  Sharing one bucket means a
+		 * flood of distinct values cannot bypass the limit,
+		 * at the cost of being too strict to those values
+		 * until Compress() makes room again.
+		 */
+		Bucket overflow_bucket;
+
+		/**
+		 * The most recent time passed to Check().
+		 */
+		double last_now = 0;
+
+		uint64_t n_discarded = 0;
+
+	public:
+		explicit Policy(const RateLimitConfig &_config) noexcept
+			:config(_config) {}
+
+		const std::string &GetName() const noexcept {
+			return config.name;
+		}
+
+		/**
+		 * The number of datagrams discarded by this policy.
+		 */
+		uint64_t GetDiscardedCount() const noexcept {
+			return n_discarded;
+		}
+
+		/**
+		 * @return false if the datagram exceeds the rate
+		 * limit and shall be discarded
+		 */
+		bool Check(const SmallDatagram &d,
+			   std::span<const std::byte> raw,
+			   SiteId site_id, double now) noexcept;
+
+		/**
+		 * Delete token buckets which have not been used for
+		 * so long that they are full again.
+		 */
+		void Compress() noexcept;
+
+		/**
+		 * Delete the token bucket of the given site.
+		 */
+		void ForgetSite(SiteId site_id) noexcept {
+			site_buckets.erase(site_id);
+		}
+
+	private:
+		bool Check(Bucket &bucket, double now) noexcept;
+
+		Bucket &GetStringBucket(std::string_view key) noexcept;
+	};
+
+private:
+	std::vector<Policy> policies;
+
+public:
+	explicit RateLimiter(std::span<const RateLimitConfig> config);
+
+	bool empty() const noexcept {
+		return policies.empty();
+	}
+
+	std::span<const Policy> GetPolicies() const noexcept {
+		return policies;
+	}
+
+	/**
+	 * Check the datagram against all policies.  The first one
+	 * which rejects it gets its discard counter incremented.
+	 *
+	 * @param raw the raw datagram which the string references
+	 * of #d point into
+	 * @param site_id the interned site of the datagram
+	 * @param now the current time in seconds
+	 * @return false if the datagram exceeds a rate limit and
+	 * shall be discarded
+	 */
+	bool Check(const SmallDatagram &d, std::span<const std::byte> raw,
+		   SiteId site_id, double now) noexcept {
+		for (auto &i : policies)
+			if (!i.Check(d, raw, site_id, now))
+				return false;
+
+		return true;
+	}
+
+	void Compress() noexcept {
+		for (auto &i : policies)
+			i.Compress();
+	}
+
+	/**
+	 * Forget all state about the given site, because its
+	 * #SiteId is going to be reused.
+	 */
+	void ForgetSite(SiteId site_id) noexcept {
+		for (auto &i : policies)
+			i.ForgetSite(site_id);
+	}
+};
@@ -3,51 +3,66 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "Instance.hxx"
-#include "event/net/UdpListener.hxx"
-#include "net/UniqueSocketDescriptor.hxx"
-#include "net/SocketConfig.hxx"
-#include "net/log/Parser.hxx"
+#include "DatagramBatch.hxx"
 #include "util/PrintException.hxx"
 
-bool
-Instance::OnUdpDatagram(std::span<const std::byte> payload,
-			std::span<UniqueFileDescriptor> fds,
-			SocketAddress address, int uid)
+void
+Instance::OnReceiverBatch(const DatagramBatch &batch) noexcept
 {
-	(void)fds;
-	(void)address;
-	(void)uid;
-
 	if (IsBlocked())
 		/* ignore incoming datagrams while the CLONE runs */
-		return true;
-
-	++n_received;
+		return;
 
-	if (payload.size() == MAX_DATAGRAM_SIZE) {
-		/* this datagram was probably truncated, so don't
-		   bother parsing it */
-		++n_malformed;
-		return true;
-	}
+	n_received += batch.GetReceivedCount();
+	n_malformed += batch.GetMalformedCount();
+	n_truncated += batch.GetTruncatedCount();
+	n_discarded += batch.GetRejectedCount();
+	n_discarded += database.EmplaceBatch(batch.GetDatagrams(),
+					     event_loop.GetSteadyClockCache());
 
-	try {
-		const auto *r =
-			database.CheckEmplace(payload,
-					      event_loop.GetSteadyClockCache());
-		if (r == nullptr)
-			++n_discarded;
-	} catch (Net::Log::ProtocolError) {
-		++n_malformed;
-	}
+	if (database.WantsFreeze())
+		freeze_event.Schedule();
 
 	MaybeScheduleMaxAgeTimer();
-
-	return true;
 }
 
 void
-Instance::OnUdpError(std::exception_ptr &&error) noexcept
+Instance::OnReceiverError(std::exception_ptr &&error) noexcept
 {
 	logger(1, "UDP receiver error: ", std::move(error));
 }
+
+void
+Instance::OnReceiverStopped(UniqueSocketDescriptor &&socket,
+			    std::size_t batch_size,
+			    ReceiverStats &stats) noexcept
+{
+#ifdef HAVE_LIBURING
+	reap_uring_event.Schedule();
+#endif
+
+	if (should_exit)
+		return;
+
+	logger(2, "Falling back to recvmmsg()");
+
+	try {
+		receivers.emplace_front(event_loop, std::move(socket),
+					batch_size, stats, *this);
+	} catch (...) {
+		logger(1, "Failed to set up UDP receiver: ",
+		       std::current_exception());
+	}
+}
+
+#ifdef HAVE_LIBURING
+
+void
+Instance::OnReapUring() noexcept
+{
+	uring_receivers.remove_if([](const auto &r){
+		return !r.IsActive();
+	});
+}
+
+#endif // HAVE_LIBURING
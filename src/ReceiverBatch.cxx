@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ReceiverBatch.hxx"
+#include "net/SocketDescriptor.hxx"
+#include "net/SocketError.hxx"
+
+#include <new> // for std::bad_alloc
+
+#include <string.h> // for memcpy()
+#include <sys/mman.h>
+
+static std::byte *
+MapOverflow(std::size_t size)
+{
+	/* MAP_NORESERVE: this is mostly untouched address space */
+	void *p = mmap(nullptr, size, PROT_READ|PROT_WRITE,
+		       MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		throw std::bad_alloc{};
+
+	return static_cast<std::byte *>(p);
+}
+
+ReceiverBatch::ReceiverBatch(std::size_t _capacity)
+	:DatagramBatch(_capacity),
+	 buffer(new std::byte[_capacity * SLOT_STRIDE]),
+	 control(new std::byte[_capacity * CONTROL_SIZE]),
+	 names(new struct sockaddr_in6[_capacity]),
+	 iov(new struct iovec[2 * _capacity]),
+	 msgs(new struct mmsghdr[_capacity]),
+	 overflow(MapOverflow(_capacity * OVERFLOW_STRIDE))
+{
+	for (std::size_t i = 0; i < _capacity; ++i) {
+		iov[2 * i] = {
+			.iov_base = GetSlot(i),
+			.iov_len = SLOT_SIZE,
+		};
+
+		iov[2 * i + 1] = {
+			.iov_base = GetOverflow(i) + SLOT_SIZE,
+			.iov_len = MAX_DATAGRAM_SIZE - SLOT_SIZE,
+		};
+
+		msgs[i] = {};
+		msgs[i].msg_hdr.msg_name = &names[i];
+		msgs[i].msg_hdr.msg_iov = &iov[2 * i];
+		msgs[i].msg_hdr.msg_iovlen = 2;
+		msgs[i].msg_hdr.msg_control = control.get() + i * CONTROL_SIZE;
+	}
+}
+
+ReceiverBatch::~ReceiverBatch() noexcept
+{
+	munmap(overflow, GetCapacity() * OVERFLOW_STRIDE);
+}
+
+inline void
+ReceiverBatch::ReleaseOverflow() noexcept
+{
+	if (n_dirty_overflow == 0)
+		return;
+
+	/* MADV_FREE is cheap; the kernel reclaims these pages only
+	   under memory pressure, and reuses them if another large
+	   datagram arrives first */
+	madvise(overflow, n_dirty_overflow * OVERFLOW_STRIDE, MADV_FREE);
+	n_dirty_overflow = 0;
+}
+
+bool
+ReceiverBatch::Receive(SocketDescriptor s)
+{
+	Clear();
+	ReleaseOverflow();
+
+	const std::size_t capacity = GetCapacity();
+
+	/* the kernel overwrites this with the actual length */
+	for (std::size_t i = 0; i < capacity; ++i) {
+		msgs[i].msg_hdr.msg_namelen = sizeof(names[i]);
+		msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+	}
+
+	int result = recvmmsg(s.Get(), msgs.get(), capacity,
+			      MSG_DONTWAIT|MSG_CMSG_CLOEXEC, nullptr);
+	if (result < 0) {
+		const auto e = GetSocketError();
+		if (IsSocketErrorReceiveWouldBlock(e))
+			return false;
+
+		throw MakeSocketError(e, "Failed to receive");
+	}
+
+	for (std::size_t i = 0; i < std::size_t(result); ++i) {
+		auto &msg = msgs[i].msg_hdr;
+		for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg))
+			HandleControlMessage(*cmsg);
+
+		const std::size_t length = msgs[i].msg_len;
+		const auto sender = SenderAddress::FromSocketAddress((const struct sockaddr *)msg.msg_name,
+								     msg.msg_namelen);
+
+		if (msg.msg_flags & MSG_TRUNC) {
+			/* larger than MAX_DATAGRAM_SIZE */
+			AddTruncated();
+		} else if (length <= SLOT_SIZE) {
+			Add({GetSlot(i), length}, sender);
+		} else {
+			/* copy the head in front of the tail which the
+			   kernel wrote to the overflow buffer */
+			std::byte *p = GetOverflow(i);
+			memcpy(p, GetSlot(i), SLOT_SIZE);
+			Add({p, length}, sender);
+			n_dirty_overflow = i + 1;
+		}
+	}
+
+	return result > 0;
+}
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "DatagramBatch.hxx"
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <utility> // for std::exchange()
+
+#include <netinet/in.h> // for struct sockaddr_in6
+#include <sys/socket.h> // for struct mmsghdr
+
+class SocketDescriptor;
+
+/**
+ * A buffer for a batch of datagrams received with recvmmsg().  The
+ * datagrams are parsed right after receiving them, which allows
+ * doing this in a worker thread (see #ReceiverThread); the main
+ * thread then only needs to copy the results into the #Database.
+ *
+ * Each datagram has a buffer of #SLOT_SIZE bytes.  Larger datagrams
+ * (up to #MAX_DATAGRAM_SIZE) continue in the datagram's own overflow
+ * buffer.  Both are followed by #TIMESTAMP_ROOM bytes which the
+ * kernel does not write to.  These are reserved as address space only; the kernel
+ * allocates pages only for the few large datagrams, and they are
+ * given back before the next batch is received.
+ */
+class ReceiverBatch final : public DatagramBatch {
+	static constexpr std::size_t SLOT_STRIDE = SLOT_SIZE + TIMESTAMP_ROOM;
+	static constexpr std::size_t OVERFLOW_STRIDE =
+		MAX_DATAGRAM_SIZE + TIMESTAMP_ROOM;
+
+	const std::unique_ptr<std::byte[]> buffer;
+
+	/**
+	 * Ancillary data buffers (#CONTROL_SIZE bytes for each
+	 * datagram).
+	 */
+	const std::unique_ptr<std::byte[]> control;
+
+	/**
+	 * The sender address of each datagram; this is large enough
+	 * for IPv4 and IPv6 addresses, which is all #SenderAddress
+	 * can represent.
+	 */
+	const std::unique_ptr<struct sockaddr_in6[]> names;
+
+	/**
+	 * Two for each datagram: the slot in #buffer and the tail in
+	 * its #overflow buffer.
+	 */
+	const std::unique_ptr<struct iovec[]> iov;
+	const std::unique_ptr<struct mmsghdr[]> msgs;
+
+	/**
+	 * An anonymous mapping with one overflow buffer of
+	 * #OVERFLOW_STRIDE bytes for each datagram.  The kernel
+	 * writes to the portion after #SLOT_SIZE; the first
+	 * #SLOT_SIZE bytes are used to assemble the complete
+	 * datagram.
+	 *
+	 * This is declared after the other buffers, so it is mapped
+	 * only after their allocations have succeeded (the
+	 * destructor would not run to unmap it).
+	 */
+	std::byte *const overflow;
+
+	/**
+	 * The number of overflow buffers (counted from the first
+	 * one) which may contain pages that were written by the
+	 * previous Receive() call.
+	 */
+	std::size_t n_dirty_overflow = 0;
+
+	/**
+	 * An error which occurred while receiving this batch.  It is
+	 * passed to the main thread together with the batch.
+	 */
+	std::exception_ptr error;
+
+public:
+	/**
+	 * Throws std::bad_alloc on error.
+	 */
+	explicit ReceiverBatch(std::size_t _capacity);
+
+	~ReceiverBatch() noexcept;
+
+	/**
+	 * Receive as many datagrams as possible (without blocking).
+	 * Discards the previous contents of this batch.
+	 *
+	 * Throws on error.
+	 *
+	 * @return false if no datagram was available
+	 */
+	bool Receive(SocketDescriptor s);
+
+	void SetError(std::exception_ptr &&_error) noexcept {
+		Clear();
+		error = std::move(_error);
+	}
+
+	std::exception_ptr StealError() noexcept {
+		return std::exchange(error, {});
+	}
+
+private:
+	std::byte *GetSlot(std::size_t i) const noexcept {
+		return buffer.get() + i * SLOT_STRIDE;
+	}
+
+	std::byte *GetOverflow(std::size_t i) const noexcept {
+		return overflow + i * OVERFLOW_STRIDE;
+	}
+
+	/**
+	 * Give the pages of the overflow buffers used by the
+	 * previous Receive() call back to the kernel.
+	 */
+	void ReleaseOverflow() noexcept;
+};
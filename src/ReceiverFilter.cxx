@@ -0,0 +1,897 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ReceiverFilter.hxx"
+#include "SmallDatagram.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm> // for std::none_of()
+#include <cassert>
+#include <cstdint>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+ReceiverFilter::ReceiverFilter(std::span<const ReceiverFilterRule> _rules) noexcept
+	:rules(_rules.begin(), _rules.end()),
+	 default_accept(std::none_of(rules.begin(), rules.end(),
+				     [](const auto &r){ return r.accept; }))
+{
+	assert(std::size_t(std::count_if(rules.begin(), rules.end(), [](const auto &r){
+		return !r.site_prefix.empty();
+	})) <= MAX_SITE_PREFIXES);
+}
+
+bool
+ReceiverFilter::Check(const SmallDatagram &d,
+		      std::span<const std::byte> raw) const noexcept
+{
+	const std::string_view site = d.site.Get(raw);
+
+	for (const auto &i : rules) {
+		const bool match = i.site_prefix.empty()
+			? d.type == i.type
+			: (!d.site.IsNull() && site.starts_with(i.site_prefix));
+		if (match)
+			return i.accept;
+	}
+
+	return default_accept;
+}
+
+namespace {
+
+/**
+ * A helper for generating classic BPF code with forward jumps to
+ * labels.  Conditional jumps in classic BPF have only 8 bit offsets,
+ * therefore they skip over an unconditional jump which has a 32 bit
+ * offset.
+ */
+class BpfBuilder {
+	std::vector<struct sock_filter> code;
+
+	static constexpr std::size_t UNBOUND = SIZE_MAX;
+
+	std::vector<std::size_t> labels;
+
+	struct Fixup {
+		std::size_t instruction, label;
+	};
+
+	std::vector<Fixup> fixups;
+
+public:
+	using Label = std::size_t;
+
+	std::size_t size() const noexcept {
+		return code.size();
+	}
+
+	Label NewLabel() noexcept {
+		labels.push_back(UNBOUND);
+		return labels.size() - 1;
+	}
+
+	void Bind(Label label) noexcept {
+		assert(labels[label] == UNBOUND);
+		labels[label] = code.size();
+	}
+
+	void Statement(uint16_t op, uint32_t k=0) noexcept {
+		code.push_back(BPF_STMT(op, k));
+	}
+
+	/**
+	 * Emit a conditional jump with explicit (short) offsets.
+	 */
+	void RawJump(uint16_t op, uint32_t k,
+		     uint8_t jt, uint8_t jf) noexcept {
+		code.push_back(BPF_JUMP(BPF_JMP|op, k, jt, jf));
+	}
+
+	void Jump(Label label) noexcept {
+		fixups.push_back({code.size(), label});
+		Statement(BPF_JMP|BPF_JA);
+	}
+
+	/**
+	 * Jump to the label if "A op k" is true.
+	 */
+	void JumpIf(uint16_t op, uint32_t k, Label label) noexcept {
+		RawJump(op|BPF_K, k, 0, 1);
+		Jump(label);
+	}
+
+	/**
+	 * Jump to the label if "A op X" is false.
+	 */
+	void JumpUnlessX(uint16_t op, Label label) noexcept {
+		RawJump(op|BPF_X, 0, 1, 0);
+		Jump(label);
+	}
+
+	std::vector<struct sock_filter> Finish() && noexcept {
+		for (const auto &i : fixups) {
+			assert(labels[i.label] != UNBOUND);
+			assert(labels[i.label] > i.instruction);
+
+			code[i.instruction].k = labels[i.label] - i.instruction - 1;
+		}
+
+		return std::move(code);
+	}
+};
+
+} // anonymous namespace
+
+/* scratch memory slots */
+static constexpr uint32_t M_END = 0;
+static constexpr uint32_t M_TYPE = 1;
+static constexpr uint32_t M_SEEN = 2;
+static constexpr uint32_t M_SITE_PREFIX = 3;
+
+/* bits in #M_SEEN */
+static constexpr uint32_t SEEN_TYPE = 0x1;
+static constexpr uint32_t SEEN_SITE = 0x2;
+
+static_assert(M_SITE_PREFIX + ReceiverFilter::MAX_SITE_PREFIXES <= BPF_MEMWORDS);
+
+/**
+ * The maximum length of a string attribute (including the null
+ * terminator) which can be skipped by the BPF program.  This is
+ * limited by the 8 bit jump offsets in SkipString().
+ */
+static constexpr uint32_t MAX_BPF_STRING = 64;
+
+static constexpr uint32_t
+AttributeCode(Net::Log::Attribute a) noexcept
+{
+	return static_cast<uint32_t>(a);
+}
+
+/**
+ * The attributes with a null-terminated string value known to the
+ * #DatagramScanner.
+ */
+static constexpr Net::Log::Attribute string_attributes[] = {
+	Net::Log::Attribute::HOST, Net::Log::Attribute::GENERATOR,
+	Net::Log::Attribute::HTTP_URI, Net::Log::Attribute::REMOTE_HOST,
+	Net::Log::Attribute::FORWARDED_TO, Net::Log::Attribute::HTTP_REFERER,
+	Net::Log::Attribute::USER_AGENT, Net::Log::Attribute::CONTENT_TYPE,
+	Net::Log::Attribute::ANALYTICS_ID,
+};
+
+/**
+ * The attributes with a fixed-size value known to the
+ * #DatagramScanner (except for TYPE, which is evaluated by the
+ * rules).
+ */
+static constexpr struct {
+	Net::Log::Attribute attribute;
+	uint32_t size;
+} fixed_attributes[] = {
+	{Net::Log::Attribute::NOP, 0},
+	{Net::Log::Attribute::HTTP_METHOD, 1},
+	{Net::Log::Attribute::HTTP_STATUS, 2},
+	{Net::Log::Attribute::TIMESTAMP, 8},
+	{Net::Log::Attribute::LENGTH, 8},
+	{Net::Log::Attribute::DURATION, 8},
+	{Net::Log::Attribute::TRAFFIC, 16},
+};
+
+/**
+ * Emit code which advances X over an attribute with a fixed-size
+ * value.
+ */
+static void
+SkipFixed(BpfBuilder &b, uint32_t value_size,
+	  BpfBuilder::Label next) noexcept
+{
+	b.Statement(BPF_MISC|BPF_TXA);
+	b.Statement(BPF_ALU|BPF_ADD|BPF_K, 1 + value_size);
+	b.Statement(BPF_MISC|BPF_TAX);
+	b.Jump(next);
+}
+
+/**
+ * Emit code which advances X over an attribute with a
+ * null-terminated string value.
+ *
+ * For each possible position of the null terminator, there is one
+ * load and one conditional jump into a chain of "add #1"
+ * instructions; the number of instructions executed in that chain
+ * reveals the position.
+ */
+static void
+SkipString(BpfBuilder &b, BpfBuilder::Label next,
+	   BpfBuilder::Label give_up) noexcept
+{
+	constexpr uint32_t n = MAX_BPF_STRING;
+
+	for (uint32_t i = 0; i < n; ++i) {
+		b.Statement(BPF_LD|BPF_B|BPF_IND, 1 + i);
+
+		/* jump to the i-th "add" below (the offset is
+		   relative to the next instruction) */
+		b.RawJump(BPF_JEQ|BPF_K, 0, 2 * (n - i) - 1 + i, 0);
+	}
+
+	/* no null terminator found: string is too long */
+	b.Jump(give_up);
+
+	/* after entering this chain at position i, A is n-i */
+	for (uint32_t i = 0; i < n; ++i)
+		b.Statement(BPF_ALU|BPF_ADD|BPF_K, 1);
+
+	/* X += i + 2 (the attribute code, the string and its null
+	   terminator) */
+	b.Statement(BPF_ALU|BPF_NEG);
+	b.Statement(BPF_ALU|BPF_ADD|BPF_K, n + 2);
+	b.Statement(BPF_ALU|BPF_ADD|BPF_X);
+	b.Statement(BPF_MISC|BPF_TAX);
+	b.Jump(next);
+}
+
+/**
+ * Emit code which compares the SITE attribute at X with a prefix
+ * and sets the given scratch memory slot to 1 on match.
+ */
+static void
+MatchSitePrefix(BpfBuilder &b, std::string_view prefix,
+		uint32_t slot) noexcept
+{
+	assert(!prefix.empty());
+	assert(prefix.size() <= ReceiverFilter::MAX_SITE_PREFIX_LENGTH);
+
+	/* each byte comparison jumps over the rest of this block on
+	   mismatch; the first mismatching byte is at most the null
+	   terminator, so this never reads beyond the string */
+	const std::size_t n = prefix.size();
+	for (std::size_t i = 0; i < n; ++i) {
+		b.Statement(BPF_LD|BPF_B|BPF_IND, 1 + i);
+		b.RawJump(BPF_JEQ|BPF_K, static_cast<uint8_t>(prefix[i]),
+			  0, 2 * (n - i - 1) + 2);
+	}
+
+	b.Statement(BPF_LD|BPF_IMM, 1);
+	b.Statement(BPF_ST, slot);
+}
+
+/**
+ * Emit code for one step of the attribute walk.  On entry, X points
+ * to the attribute code.
+ */
+static void
+WalkStep(BpfBuilder &b, std::span<const ReceiverFilterRule> rules,
+	 uint32_t decisive, BpfBuilder::Label next, BpfBuilder::Label eval,
+	 BpfBuilder::Label give_up) noexcept
+{
+	using Net::Log::Attribute;
+
+	/* end of the attribute list? */
+	b.Statement(BPF_LD|BPF_MEM, M_END);
+	b.JumpUnlessX(BPF_JGT, eval);
+
+	/* have all attributes needed by the rules been seen?  Then
+	   the rest does not need to be walked; this decides
+	   datagrams whose remaining strings are too long for
+	   SkipString() */
+	b.Statement(BPF_LD|BPF_MEM, M_SEEN);
+	b.JumpIf(BPF_JEQ, decisive, eval);
+
+	const auto type = b.NewLabel(), site = b.NewLabel(),
+		string = b.NewLabel(),
+		fixed0 = b.NewLabel(), fixed1 = b.NewLabel(),
+		fixed2 = b.NewLabel(), fixed8 = b.NewLabel(),
+		fixed16 = b.NewLabel();
+
+	b.Statement(BPF_LD|BPF_B|BPF_IND, 0);
+
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::TYPE), type);
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::SITE), site);
+
+	for (const auto a : string_attributes)
+		b.JumpIf(BPF_JEQ, AttributeCode(a), string);
+
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::NOP), fixed0);
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::HTTP_METHOD), fixed1);
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::HTTP_STATUS), fixed2);
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::TIMESTAMP), fixed8);
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::LENGTH), fixed8);
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::DURATION), fixed8);
+	b.JumpIf(BPF_JEQ, AttributeCode(Attribute::TRAFFIC), fixed16);
+
+	/* unknown attribute (or one with complex rules, e.g.
+	   MESSAGE) */
+	b.Jump(give_up);
+
+	b.Bind(type);
+	b.Statement(BPF_LD|BPF_B|BPF_IND, 1);
+	b.Statement(BPF_ST, M_TYPE);
+	b.Statement(BPF_LD|BPF_MEM, M_SEEN);
+	b.Statement(BPF_ALU|BPF_OR|BPF_K, SEEN_TYPE);
+	b.Statement(BPF_ST, M_SEEN);
+	SkipFixed(b, 1, next);
+
+	b.Bind(fixed0);
+	SkipFixed(b, 0, next);
+	b.Bind(fixed1);
+	SkipFixed(b, 1, next);
+	b.Bind(fixed2);
+	SkipFixed(b, 2, next);
+	b.Bind(fixed8);
+	SkipFixed(b, 8, next);
+	b.Bind(fixed16);
+	SkipFixed(b, 16, next);
+
+	b.Bind(site);
+	b.Statement(BPF_LD|BPF_MEM, M_SEEN);
+	b.Statement(BPF_ALU|BPF_OR|BPF_K, SEEN_SITE);
+	b.Statement(BPF_ST, M_SEEN);
+
+	uint32_t slot = M_SITE_PREFIX;
+	for (const auto &i : rules) {
+		if (!i.site_prefix.empty())
+			MatchSitePrefix(b, i.site_prefix, slot++);
+	}
+
+	/* fall through to skipping the SITE string */
+
+	b.Bind(string);
+	SkipString(b, next, give_up);
+}
+
+static std::vector<struct sock_filter>
+Compile(std::span<const ReceiverFilterRule> rules, bool default_accept,
+	   unsigned n_steps) noexcept
+{
+	/* accept the whole datagram */
+	static constexpr uint32_t ACCEPT = 0xffffffff;
+	static constexpr uint32_t DROP = 0;
+
+	BpfBuilder b;
+
+	const auto accept = b.NewLabel(), drop = b.NewLabel(),
+		eval = b.NewLabel(), v1 = b.NewLabel(), v2 = b.NewLabel(),
+		start = b.NewLabel();
+
+	/* the kernel rejects programs which read uninitialized
+	   scratch memory */
+	b.Statement(BPF_LD|BPF_IMM, 0);
+	for (uint32_t i = 0; i < M_SITE_PREFIX + ReceiverFilter::MAX_SITE_PREFIXES; ++i)
+		b.Statement(BPF_ST, i);
+
+	/* check the magic; datagrams which are too short or have an
+	   unknown magic are accepted and left to the parser, which
+	   counts them as malformed */
+	b.Statement(BPF_LD|BPF_W|BPF_LEN);
+	b.JumpIf(BPF_JGT, 8, start);
+	b.Jump(accept);
+
+	b.Bind(start);
+	b.Statement(BPF_LD|BPF_W|BPF_ABS, 0);
+	b.JumpIf(BPF_JEQ, Net::Log::MAGIC_V1, v1);
+	b.JumpIf(BPF_JEQ, Net::Log::MAGIC_V2, v2);
+	b.Jump(accept);
+
+	/* version 2 has a CRC after the attributes */
+	b.Bind(v2);
+	b.Statement(BPF_LD|BPF_W|BPF_LEN);
+	b.Statement(BPF_ALU|BPF_SUB|BPF_K, sizeof(uint32_t));
+	b.Statement(BPF_ST, M_END);
+	const auto walk = b.NewLabel();
+	b.Jump(walk);
+
+	b.Bind(v1);
+	b.Statement(BPF_LD|BPF_W|BPF_LEN);
+	b.Statement(BPF_ST, M_END);
+
+	b.Bind(walk);
+	b.Statement(BPF_LDX|BPF_IMM, sizeof(uint32_t));
+
+	/* the attributes which are needed to decide */
+	uint32_t decisive = 0;
+	for (const auto &i : rules)
+		decisive |= i.site_prefix.empty() ? SEEN_TYPE : SEEN_SITE;
+
+	for (unsigned i = 0; i < n_steps; ++i) {
+		const auto next = b.NewLabel();
+		WalkStep(b, rules, decisive, next, eval, accept);
+		b.Bind(next);
+	}
+
+	/* too many attributes */
+	b.Jump(accept);
+
+	/* the whole attribute list was walked: apply the rules */
+	b.Bind(eval);
+	uint32_t slot = M_SITE_PREFIX;
+	for (const auto &i : rules) {
+		if (i.site_prefix.empty()) {
+			b.Statement(BPF_LD|BPF_MEM, M_TYPE);
+			b.JumpIf(BPF_JEQ, static_cast<uint32_t>(i.type),
+				 i.accept ? accept : drop);
+		} else {
+			b.Statement(BPF_LD|BPF_MEM, slot++);
+			b.JumpIf(BPF_JEQ, 1, i.accept ? accept : drop);
+		}
+	}
+
+	b.Jump(default_accept ? accept : drop);
+
+	b.Bind(drop);
+	b.Statement(BPF_RET|BPF_K, DROP);
+
+	b.Bind(accept);
+	b.Statement(BPF_RET|BPF_K, ACCEPT);
+
+	return std::move(b).Finish();
+}
+
+std::vector<struct sock_filter>
+ReceiverFilter::CompileBPF(std::size_t max_instructions) const noexcept
+{
+	assert(IsEnabled());
+
+	/* walk as many attributes as the instruction limit allows */
+	for (unsigned n_steps = 32; n_steps > 0; --n_steps) {
+		auto program = Compile(rules, default_accept, n_steps);
+		if (program.size() <= max_instructions)
+			return program;
+	}
+
+	return {};
+}
+
+namespace {
+
+/**
+ * A helper for generating eBPF code with jumps to labels.  Unlike
+ * classic BPF, eBPF has 16 bit jump offsets which may be negative,
+ * therefore labels may be bound before or after the jumps to them.
+ */
+class EbpfBuilder {
+	std::vector<struct bpf_insn> code;
+
+	static constexpr uint8_t InvertCondition(uint8_t op) noexcept {
+		switch (op) {
+		case BPF_JEQ: return BPF_JNE;
+		case BPF_JNE: return BPF_JEQ;
+		case BPF_JGT: return BPF_JLE;
+		case BPF_JLE: return BPF_JGT;
+		case BPF_JGE: return BPF_JLT;
+		case BPF_JLT: return BPF_JGE;
+		case BPF_JSGT: return BPF_JSLE;
+		case BPF_JSLE: return BPF_JSGT;
+		case BPF_JSGE: return BPF_JSLT;
+		case BPF_JSLT: return BPF_JSGE;
+		}
+
+		assert(false);
+		return op;
+	}
+
+	static constexpr std::size_t UNBOUND = SIZE_MAX;
+
+	std::vector<std::size_t> labels;
+
+	struct Fixup {
+		std::size_t instruction, label;
+	};
+
+	std::vector<Fixup> fixups;
+
+public:
+	using Label = std::size_t;
+
+	Label NewLabel() noexcept {
+		labels.push_back(UNBOUND);
+		return labels.size() - 1;
+	}
+
+	void Bind(Label label) noexcept {
+		assert(labels[label] == UNBOUND);
+		labels[label] = code.size();
+	}
+
+	void Emit(uint8_t op, uint8_t dst, uint8_t src,
+		  int16_t off, int32_t imm) noexcept {
+		code.push_back({
+			.code = op,
+			.dst_reg = dst,
+			.src_reg = src,
+			.off = off,
+			.imm = imm,
+		});
+	}
+
+	/**
+	 * Emit an ALU instruction with an immediate operand.
+	 */
+	void Alu(uint8_t op, uint8_t dst, int32_t imm) noexcept {
+		Emit(BPF_ALU64|op|BPF_K, dst, 0, 0, imm);
+	}
+
+	/**
+	 * Emit an ALU instruction with a register operand.
+	 */
+	void AluX(uint8_t op, uint8_t dst, uint8_t src) noexcept {
+		Emit(BPF_ALU64|op|BPF_X, dst, src, 0, 0);
+	}
+
+	/**
+	 * Emit a 32 bit ALU instruction with a register operand (the
+	 * upper 32 bits of the destination are cleared).
+	 */
+	void Alu32X(uint8_t op, uint8_t dst, uint8_t src) noexcept {
+		Emit(BPF_ALU|op|BPF_X, dst, src, 0, 0);
+	}
+
+	void LoadImm64(uint8_t dst, uint64_t value) noexcept {
+		Emit(BPF_LD|BPF_DW|BPF_IMM, dst, 0, 0,
+		     static_cast<int32_t>(value));
+		Emit(0, 0, 0, 0, static_cast<int32_t>(value >> 32));
+	}
+
+	/**
+	 * Load one byte of the packet at the offset "src + imm" into
+	 * R0.  This requires the context pointer in R6 and clobbers
+	 * R1..R5.
+	 */
+	void LoadPacketByte(uint8_t src, int32_t imm) noexcept {
+		Emit(BPF_LD|BPF_B|BPF_IND, 0, src, 0, imm);
+	}
+
+	void Jump(Label label) noexcept {
+		fixups.push_back({code.size(), label});
+		Emit(BPF_JMP|BPF_JA, 0, 0, 0, 0);
+	}
+
+	/**
+	 * Jump to the label if "dst op imm" is true.
+	 */
+	void JumpIf(uint8_t op, uint8_t dst, int32_t imm, Label label) noexcept {
+		fixups.push_back({code.size(), label});
+		Emit(BPF_JMP|op|BPF_K, dst, 0, 0, imm);
+	}
+
+	/**
+	 * Jump to the label if "dst op src" is true.
+	 */
+	void JumpIfX(uint8_t op, uint8_t dst, uint8_t src, Label label) noexcept {
+		fixups.push_back({code.size(), label});
+		Emit(BPF_JMP|op|BPF_X, dst, src, 0, 0);
+	}
+
+	/**
+	 * Like JumpIf(), but the verifier explores the jump target
+	 * first.  Its stack of unexplored branches is limited, and
+	 * each conditional jump in a loop which is not taken pushes
+	 * one; this variant should be used for jumps out of the loop,
+	 * which end quickly and don't leave anything on that stack.
+	 */
+	void ExitIf(uint8_t op, uint8_t dst, int32_t imm, Label label) noexcept {
+		Emit(BPF_JMP|InvertCondition(op)|BPF_K, dst, 0, 1, imm);
+		Jump(label);
+	}
+
+	void ExitIfX(uint8_t op, uint8_t dst, uint8_t src, Label label) noexcept {
+		Emit(BPF_JMP|InvertCondition(op)|BPF_X, dst, src, 1, 0);
+		Jump(label);
+	}
+
+	void Return(int32_t value) noexcept {
+		Emit(BPF_ALU|BPF_MOV|BPF_K, BPF_REG_0, 0, 0, value);
+		Emit(BPF_JMP|BPF_EXIT, 0, 0, 0, 0);
+	}
+
+	std::vector<struct bpf_insn> Finish() && noexcept {
+		for (const auto &i : fixups) {
+			assert(labels[i.label] != UNBOUND);
+
+			const auto offset = static_cast<std::ptrdiff_t>(labels[i.label])
+				- static_cast<std::ptrdiff_t>(i.instruction) - 1;
+			assert(offset >= INT16_MIN && offset <= INT16_MAX);
+			code[i.instruction].off = static_cast<int16_t>(offset);
+		}
+
+		return std::move(code);
+	}
+};
+
+} // anonymous namespace
+
+/**
+ * The maximum number of loop iterations of the eBPF program.  This
+ * bounds the work of the kernel's verifier, which follows each
+ * iteration.
+ */
+static constexpr int32_t MAX_EBPF_ITERATIONS = 4096;
+
+/**
+ * The number of iterations charged for each attribute (each string
+ * byte costs one).  Each attribute leaves up to three branches on the
+ * verifier's stack, and this keeps that stack (limited to 8192
+ * entries) from overflowing.
+ */
+static constexpr int32_t ATTRIBUTE_ITERATIONS = 4;
+
+/* registers of the eBPF program (R6..R9 are preserved by
+   BPF_LD_IND) */
+static constexpr uint8_t R_CONTEXT = BPF_REG_6;
+static constexpr uint8_t R_POSITION = BPF_REG_7;
+static constexpr uint8_t R_END = BPF_REG_8;
+static constexpr uint8_t R_COUNTER = BPF_REG_9;
+
+/* stack slots of the eBPF program */
+static constexpr int16_t S_TYPE = -8;
+static constexpr int16_t S_SITE = -16;
+
+/**
+ * Build a bit mask of attribute codes for testing with a shift.
+ */
+static constexpr uint64_t
+AttributeBit(Net::Log::Attribute a) noexcept
+{
+	assert(AttributeCode(a) < 64);
+	return uint64_t{1} << AttributeCode(a);
+}
+
+static constexpr uint64_t
+StringAttributeMask() noexcept
+{
+	uint64_t mask = 0;
+	for (const auto a : string_attributes)
+		mask |= AttributeBit(a);
+	return mask;
+}
+
+/**
+ * @param size_bit if not negative, then include only attributes
+ * whose value size has this bit set
+ */
+static constexpr uint64_t
+FixedAttributeMask(int size_bit=-1) noexcept
+{
+	uint64_t mask = 0;
+	for (const auto &i : fixed_attributes)
+		if (size_bit < 0 || (i.size & (1U << size_bit)) != 0)
+			mask |= AttributeBit(i.attribute);
+	return mask;
+}
+
+/**
+ * Emit code which sets R1 to 1 if the attribute code in R0 is in the
+ * given mask (which must not be empty) and to 0 otherwise.
+ */
+static void
+TestAttributeMask(EbpfBuilder &b, uint64_t mask) noexcept
+{
+	b.LoadImm64(BPF_REG_1, mask);
+	b.AluX(BPF_RSH, BPF_REG_1, BPF_REG_0);
+	b.Alu(BPF_AND, BPF_REG_1, 1);
+}
+
+/**
+ * Emit code which makes the verifier forget the range of
+ * #R_POSITION without changing its value.  This must be done after
+ * each modification, before jumping back to the start of a loop.
+ *
+ * The verifier follows each loop iteration, and it can skip
+ * iterations only if it has already verified one with exactly the
+ * same register state; if the state differed depending on the path
+ * through the previous iterations, its work would grow
+ * exponentially.  It does not know that "x xor y xor y" equals x.
+ */
+static void
+ForgetRanges(EbpfBuilder &b) noexcept
+{
+	b.Alu32X(BPF_XOR, R_POSITION, R_END);
+	b.Alu32X(BPF_XOR, R_POSITION, R_END);
+}
+
+/**
+ * Emit code which sets R1 to the number of bytes between the
+ * position and the end of the attribute list.  Comparing this
+ * instead of the registers leaves the verifier's knowledge about
+ * #R_END alone (see ForgetRanges()).
+ */
+static void
+LoadRemaining(EbpfBuilder &b) noexcept
+{
+	b.AluX(BPF_MOV, BPF_REG_1, R_END);
+	b.AluX(BPF_SUB, BPF_REG_1, R_POSITION);
+}
+
+/**
+ * Emit code which evaluates a site prefix rule.  #R_POSITION points
+ * to the SITE value or is 0 if there is none.
+ */
+static void
+EvalSitePrefix(EbpfBuilder &b, std::string_view prefix,
+	       EbpfBuilder::Label match) noexcept
+{
+	assert(!prefix.empty());
+
+	const auto mismatch = b.NewLabel();
+	b.JumpIf(BPF_JEQ, R_POSITION, 0, mismatch);
+
+	/* the first mismatching byte is at most the null terminator,
+	   so this never reads beyond the string */
+	for (std::size_t i = 0; i < prefix.size(); ++i) {
+		b.LoadPacketByte(R_POSITION, i);
+		b.JumpIf(BPF_JNE, BPF_REG_0, static_cast<uint8_t>(prefix[i]),
+			 mismatch);
+	}
+
+	b.Jump(match);
+	b.Bind(mismatch);
+}
+
+std::vector<struct bpf_insn>
+ReceiverFilter::CompileEBPF() const noexcept
+{
+	assert(IsEnabled());
+
+	using Net::Log::Attribute;
+
+	static_assert(StringAttributeMask() != 0);
+	static_assert((StringAttributeMask() & FixedAttributeMask()) == 0);
+	static_assert(AttributeCode(Attribute::TYPE) < 64);
+	static_assert(AttributeCode(Attribute::SITE) < 64);
+
+	EbpfBuilder b;
+
+	const auto accept = b.NewLabel(), drop = b.NewLabel(),
+		eval = b.NewLabel(), walk = b.NewLabel(),
+		attribute = b.NewLabel(), type = b.NewLabel(),
+		site = b.NewLabel(), string = b.NewLabel();
+
+	b.AluX(BPF_MOV, R_CONTEXT, BPF_REG_1);
+
+	/* check the magic; datagrams which are too short or have an
+	   unknown magic are accepted and left to the parser, which
+	   counts them as malformed */
+	b.Emit(BPF_LDX|BPF_W|BPF_MEM, R_END, R_CONTEXT,
+	       offsetof(struct __sk_buff, len), 0);
+	b.JumpIf(BPF_JLE, R_END, 8, accept);
+
+	b.Emit(BPF_LD|BPF_W|BPF_ABS, 0, 0, 0, 0);
+	b.JumpIf(BPF_JEQ, BPF_REG_0, Net::Log::MAGIC_V1, walk);
+	b.JumpIf(BPF_JNE, BPF_REG_0, Net::Log::MAGIC_V2, accept);
+
+	/* version 2 has a CRC after the attributes */
+	b.Alu(BPF_SUB, R_END, sizeof(uint32_t));
+
+	b.Bind(walk);
+
+	/* "END xor END" is a zero which the verifier does not know;
+	   if it knew that there is no TYPE or no SITE, it would
+	   predict the comparisons in the rules, and the states which
+	   lead there would have to be verified separately (see
+	   ForgetRanges()) */
+	b.AluX(BPF_MOV, R_POSITION, R_END);
+	b.Alu32X(BPF_XOR, R_POSITION, R_END);
+	b.Alu32X(BPF_XOR, R_END, R_POSITION);
+	b.Emit(BPF_STX|BPF_DW|BPF_MEM, BPF_REG_10, R_POSITION, S_TYPE, 0);
+	b.Emit(BPF_STX|BPF_DW|BPF_MEM, BPF_REG_10, R_POSITION, S_SITE, 0);
+
+	/* the position starts after the magic */
+	b.Alu(BPF_ADD, R_POSITION, sizeof(uint32_t));
+	ForgetRanges(b);
+
+	b.Alu(BPF_MOV, R_COUNTER, MAX_EBPF_ITERATIONS);
+
+	/* the loop over all attributes; R0 is cleared because the
+	   verifier would otherwise consider its value from the
+	   previous iteration as part of the state */
+	b.Bind(attribute);
+	b.Alu(BPF_MOV, BPF_REG_0, 0);
+	LoadRemaining(b);
+	b.ExitIf(BPF_JEQ, BPF_REG_1, 0, eval);
+	b.ExitIf(BPF_JSLT, BPF_REG_1, 0, accept);
+	b.Alu(BPF_SUB, R_COUNTER, ATTRIBUTE_ITERATIONS);
+	b.ExitIf(BPF_JSLE, R_COUNTER, 0, accept);
+
+	/* R0 is the attribute code, and the position is advanced
+	   to its value */
+	b.LoadPacketByte(R_POSITION, 0);
+	b.Alu(BPF_ADD, R_POSITION, 1);
+	ForgetRanges(b);
+	b.JumpIf(BPF_JEQ, BPF_REG_0, AttributeCode(Attribute::TYPE), type);
+	b.JumpIf(BPF_JEQ, BPF_REG_0, AttributeCode(Attribute::SITE), site);
+
+	/* unknown attribute (or one with complex rules, e.g.
+	   MESSAGE) */
+	b.ExitIf(BPF_JGE, BPF_REG_0, 64, accept);
+
+	TestAttributeMask(b, StringAttributeMask());
+	b.JumpIf(BPF_JNE, BPF_REG_1, 0, string);
+
+	TestAttributeMask(b, FixedAttributeMask());
+	b.ExitIf(BPF_JEQ, BPF_REG_1, 0, accept);
+
+	/* skip the fixed-size value; its size is assembled from one
+	   mask per bit, without branches */
+	for (int bit = 0; bit < 8; ++bit) {
+		const uint64_t mask = FixedAttributeMask(bit);
+		if (mask == 0)
+			continue;
+
+		TestAttributeMask(b, mask);
+		b.Alu(BPF_LSH, BPF_REG_1, bit);
+		b.AluX(BPF_ADD, R_POSITION, BPF_REG_1);
+	}
+
+	ForgetRanges(b);
+	b.Jump(attribute);
+
+	b.Bind(type);
+	LoadRemaining(b);
+	b.ExitIf(BPF_JSLE, BPF_REG_1, 0, accept);
+	b.LoadPacketByte(R_POSITION, 0);
+	b.Emit(BPF_STX|BPF_DW|BPF_MEM, BPF_REG_10, BPF_REG_0, S_TYPE, 0);
+	b.Alu(BPF_ADD, R_POSITION, 1);
+	ForgetRanges(b);
+	b.Jump(attribute);
+
+	b.Bind(site);
+	b.Emit(BPF_STX|BPF_DW|BPF_MEM, BPF_REG_10, R_POSITION, S_SITE, 0);
+
+	/* the loop over the bytes of a string value */
+	b.Bind(string);
+	b.Alu(BPF_MOV, BPF_REG_0, 0);
+	LoadRemaining(b);
+	b.ExitIf(BPF_JSLE, BPF_REG_1, 0, accept);
+	b.Alu(BPF_SUB, R_COUNTER, 1);
+	b.ExitIf(BPF_JSLE, R_COUNTER, 0, accept);
+	b.LoadPacketByte(R_POSITION, 0);
+	b.Alu(BPF_ADD, R_POSITION, 1);
+	ForgetRanges(b);
+	b.JumpIf(BPF_JNE, BPF_REG_0, 0, string);
+	b.Jump(attribute);
+
+	/* the whole attribute list was walked: apply the rules */
+	b.Bind(eval);
+	b.Emit(BPF_LDX|BPF_DW|BPF_MEM, R_POSITION, BPF_REG_10, S_SITE, 0);
+	for (const auto &i : rules) {
+		const auto target = i.accept ? accept : drop;
+		if (i.site_prefix.empty()) {
+			b.Emit(BPF_LDX|BPF_DW|BPF_MEM, BPF_REG_0, BPF_REG_10,
+			       S_TYPE, 0);
+			b.JumpIf(BPF_JEQ, BPF_REG_0,
+				 static_cast<int32_t>(i.type), target);
+		} else
+			EvalSitePrefix(b, i.site_prefix, target);
+	}
+
+	b.Jump(default_accept ? accept : drop);
+
+	b.Bind(drop);
+	b.Return(0);
+
+	/* accept the whole datagram */
+	b.Bind(accept);
+	b.Return(-1);
+
+	return std::move(b).Finish();
+}
+
+UniqueFileDescriptor
+ReceiverFilter::LoadEBPF() const
+{
+	const auto program = CompileEBPF();
+
+	union bpf_attr attr{};
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns = reinterpret_cast<uintptr_t>(program.data());
+	attr.insn_cnt = program.size();
+	attr.license = reinterpret_cast<uintptr_t>("BSD");
+
+	const int fd = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+	if (fd < 0)
+		throw MakeErrno("Failed to load eBPF program");
+
+	return UniqueFileDescriptor{FileDescriptor{fd}};
+}
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ReceiverFilterConfig.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include <linux/bpf.h> // for struct bpf_insn
+#include <linux/filter.h> // for struct sock_filter
+
+struct SmallDatagram;
+
+/**
+ * Decides which datagrams shall be accepted by a receiver, according
+ * to a list of #ReceiverFilterRule instances.  The first matching
+ * rule wins.  If no rule matches, the datagram is dropped if there is
+ * at least one "accept" rule, and accepted otherwise.
+ *
+ * The rules can be compiled to an eBPF or a classic BPF program which
+ * lets the kernel drop most unwanted datagrams before they are
+ * received.  These programs accept everything they cannot decide,
+ * therefore Check() must still be applied to all received datagrams.
+ */
+class ReceiverFilter {
+	std::vector<ReceiverFilterRule> rules;
+
+	/**
+	 * What happens with datagrams which match no rule?
+	 */
+	bool default_accept = true;
+
+public:
+	/**
+	 * The maximum number of rules with a site prefix (limited by
+	 * the BPF scratch memory).
+	 */
+	static constexpr std::size_t MAX_SITE_PREFIXES = 8;
+
+	/**
+	 * The maximum length of a site prefix.
+	 */
+	static constexpr std::size_t MAX_SITE_PREFIX_LENGTH = 64;
+
+	explicit ReceiverFilter(std::span<const ReceiverFilterRule> _rules) noexcept;
+
+	bool IsEnabled() const noexcept {
+		return !rules.empty();
+	}
+
+	/**
+	 * @param raw the raw datagram which the string references of
+	 * #d point into
+	 * @return true if the datagram shall be accepted
+	 */
+	[[gnu::pure]]
+	bool Check(const SmallDatagram &d,
+		   std::span<const std::byte> raw) const noexcept;
+
+	/**
+	 * Compile the rules to a classic BPF program for
+	 * SO_ATTACH_FILTER.
+	 *
+	 * The program walks the attribute list of each datagram
+	 * (without loops, because classic BPF has none, which limits
+	 * the number of attributes and the length of strings it can
+	 * handle) until it has seen all attributes needed by the
+	 * rules.  It drops only datagrams which do not pass the
+	 * rules; all others are accepted and left to Check().  This
+	 * is the fallback for kernels which refuse LoadEBPF().
+	 *
+	 * @param max_instructions the maximum size of the program;
+	 * the more instructions, the more attributes can be walked
+	 * @return the program or an empty vector if the limit is too
+	 * small
+	 */
+	std::vector<struct sock_filter> CompileBPF(std::size_t max_instructions=BPF_MAXINSNS) const noexcept;
+
+	/**
+	 * Compile the rules to an eBPF program.  Unlike the classic
+	 * BPF program, it walks the attribute list in a bounded
+	 * loop, which decides all datagrams except for those with
+	 * unknown attributes or more than a few kilobytes.
+	 */
+	std::vector<struct bpf_insn> CompileEBPF() const noexcept;
+
+	/**
+	 * Compile the rules with CompileEBPF() and load the program
+	 * into the kernel, for SO_ATTACH_BPF.
+	 *
+	 * Throws on error, e.g. if the kernel does not support
+	 * bounded loops or if the process lacks CAP_BPF.
+	 */
+	UniqueFileDescriptor LoadEBPF() const;
+};
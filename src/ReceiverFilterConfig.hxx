@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "net/log/Protocol.hxx"
+
+#include <string>
+
+/**
+ * One rule of a receiver's datagram filter.  It matches either a
+ * type or a site prefix.
+ */
+struct ReceiverFilterRule {
+	/**
+	 * Accept (true) or drop (false) matching datagrams?
+	 */
+	bool accept;
+
+	/**
+	 * If not #UNSPECIFIED, then this rule matches datagrams of
+	 * this type.
+	 */
+	Net::Log::Type type = Net::Log::Type::UNSPECIFIED;
+
+	/**
+	 * If not empty, then this rule matches datagrams whose site
+	 * begins with this string.
+	 */
+	std::string site_prefix{};
+};
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <cstddef>
+#include <exception>
+
+class DatagramBatch;
+class UniqueSocketDescriptor;
+struct ReceiverStats;
+
+/**
+ * Handler for the receivers: #BatchReceiver, #ReceiverThread and
+ * #UringReceiver.
+ */
+class ReceiverHandler {
+public:
+	/**
+	 * A batch of datagrams has been received and parsed.  This
+	 * method is called in the main thread.
+	 */
+	virtual void OnReceiverBatch(const DatagramBatch &batch) noexcept = 0;
+
+	virtual void OnReceiverError(std::exception_ptr &&error) noexcept = 0;
+
+	/**
+	 * A receiver has given up on its socket after a permanent
+	 * error (see #UringReceiver) and the handler may continue
+	 * receiving on it with a different implementation.  The
+	 * receiver must not be destroyed inside this method.
+	 */
+	virtual void OnReceiverStopped(UniqueSocketDescriptor &&socket,
+				       std::size_t batch_size,
+				       ReceiverStats &stats) noexcept = 0;
+};
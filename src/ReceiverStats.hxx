@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ReceiverFilter.hxx"
+#include "SenderTable.hxx"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+/**
+ * Statistics of one "receiver" block (which may consist of several
+ * sockets).  Only accessed in the main thread (except for
+ * #senders, which has its own lock).
+ *
+ * @see struct PondReceiverStatsPayload
+ */
+struct ReceiverStats {
+	/**
+	 * The "bind" setting of the receiver.
+	 */
+	std::string name;
+
+	/**
+	 * Per-sender counters and rate limits.  This is used by
+	 * receiver threads.
+	 */
+	SenderTable senders;
+
+	/**
+	 * The userspace part of the receiver's filter; this is used
+	 * by receiver threads.
+	 */
+	const ReceiverFilter filter;
+
+	uint64_t n_received = 0;
+
+	/**
+	 * The number of datagrams dropped by the kernel because the
+	 * socket's receive buffer was full.
+	 */
+	uint64_t n_dropped = 0;
+
+	ReceiverStats(std::string_view _name,
+		      TokenBucketConfig sender_rate_limit,
+		      std::span<const ReceiverFilterRule> filter_rules) noexcept
+		:name(_name), senders(sender_rate_limit),
+		 filter(filter_rules) {}
+};
+
+/**
+ * Converts the SO_RXQ_OVFL values of one socket (which are
+ * cumulative 32 bit counters) to deltas.
+ */
+class DropCounter {
+	uint32_t last = 0;
+
+public:
+	/**
+	 * @param value a SO_RXQ_OVFL value or zero if none was
+	 * received
+	 * @return the number of drops since the previous call
+	 */
+	uint32_t Update(uint32_t value) noexcept {
+		if (value == 0)
+			return 0;
+
+		/* unsigned arithmetic handles wraparound */
+		const uint32_t delta = value - last;
+		last = value;
+		return delta;
+	}
+};
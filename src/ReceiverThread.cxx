@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ReceiverThread.hxx"
+#include "ReceiverHandler.hxx"
+
+#include <poll.h>
+#include <pthread.h>
+
+ReceiverThread::ReceiverThread(EventLoop &event_loop,
+			       UniqueSocketDescriptor &&_socket,
+			       std::size_t batch_size,
+			       ReceiverStats &_stats,
+			       ReceiverHandler &_handler)
+	:socket(std::move(_socket)), handler(_handler), stats(_stats),
+	 wake_main_event(event_loop, BIND_THIS_METHOD(OnWakeMain),
+			 wake_main.Get())
+{
+	for (auto &i : batches) {
+		i = std::make_unique<ReceiverBatch>(batch_size);
+		free_batches.Push(i.get());
+	}
+
+	wake_main_event.ScheduleRead();
+
+	thread = std::thread{&ReceiverThread::Run, this};
+}
+
+ReceiverThread::~ReceiverThread() noexcept
+{
+	should_exit.store(true, std::memory_order_relaxed);
+	wake_worker.Write();
+	thread.join();
+
+	wake_main_event.Cancel();
+}
+
+void
+ReceiverThread::Run() noexcept
+{
+	pthread_setname_np(pthread_self(), "receiver");
+
+	ReceiverBatch *batch = nullptr;
+
+	while (!should_exit.load(std::memory_order_relaxed)) {
+		if (batch == nullptr)
+			free_batches.Pop(batch);
+
+		std::array<struct pollfd, 2> pfds{{
+			{.fd = wake_worker.Get().Get(), .events = POLLIN, .revents = 0},
+
+			/* don't poll the socket while all batches
+			   are owned by the main thread (poll()
+			   ignores negative file descriptors) */
+			{.fd = batch != nullptr ? socket.Get() : -1, .events = POLLIN, .revents = 0},
+		}};
+
+		if (poll(pfds.data(), pfds.size(), -1) < 0)
+			/* probably EINTR */
+			continue;
+
+		if (pfds[0].revents != 0)
+			wake_worker.Read();
+
+		if (batch == nullptr || pfds[1].revents == 0)
+			continue;
+
+		try {
+			if (!batch->Receive(socket))
+				continue;
+
+			batch->Parse(&stats.senders, &stats.filter);
+		} catch (...) {
+			batch->SetError(std::current_exception());
+		}
+
+		/* this cannot fail because the queue is large enough
+		   for all batches */
+		filled_batches.Push(batch);
+		batch = nullptr;
+
+		wake_main.Write();
+	}
+}
+
+void
+ReceiverThread::OnWakeMain(unsigned) noexcept
+{
+	wake_main.Read();
+
+	bool returned = false;
+
+	ReceiverBatch *batch;
+	while (filled_batches.Pop(batch)) {
+		if (auto error = batch->StealError()) {
+			handler.OnReceiverError(std::move(error));
+		} else {
+			stats.n_received += batch->GetReceivedCount();
+			stats.n_dropped += drop_counter.Update(batch->GetDropCounter());
+
+			handler.OnReceiverBatch(*batch);
+		}
+
+		free_batches.Push(batch);
+		returned = true;
+	}
+
+	if (returned)
+		wake_worker.Write();
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "ReceiverBatch.hxx"
+#include "ReceiverStats.hxx"
+#include "event/PipeEvent.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/EventFD.hxx"
+#include "util/SPSCQueue.hxx"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+class ReceiverHandler;
+
+/**
+ * A worker thread which receives and parses datagrams on its own
+ * socket (usually one of several bound with SO_REUSEPORT).  The
+ * resulting batches are passed to the main thread (which owns the
+ * #Database) through a lock-free queue.
+ */
+class ReceiverThread final {
+	/**
+	 * The number of batches which can be in flight.  If the main
+	 * thread lags behind, the worker thread stops receiving and
+	 * leaves the datagrams in the socket buffer.
+	 */
+	static constexpr std::size_t N_BATCHES = 4;
+
+	const UniqueSocketDescriptor socket;
+
+	ReceiverHandler &handler;
+
+	/**
+	 * Only accessed by the main thread, except for
+	 * ReceiverStats::senders.
+	 */
+	ReceiverStats &stats;
+	DropCounter drop_counter;
+
+	std::array<std::unique_ptr<ReceiverBatch>, N_BATCHES> batches;
+
+	/**
+	 * Batches filled by the worker thread, to be consumed by the
+	 * main thread.
+	 */
+	SPSCQueue<ReceiverBatch *, N_BATCHES> filled_batches;
+
+	/**
+	 * Batches which were consumed by the main thread and can be
+	 * refilled by the worker thread.
+	 */
+	SPSCQueue<ReceiverBatch *, N_BATCHES> free_batches;
+
+	/**
+	 * Wakes up the worker thread after a batch has been returned
+	 * to #free_batches or when the thread shall exit.
+	 */
+	EventFD wake_worker;
+
+	/**
+	 * Wakes up the main thread after a batch has been added to
+	 * #filled_batches.
+	 */
+	EventFD wake_main;
+	PipeEvent wake_main_event;
+
+	std::atomic_bool should_exit{false};
+
+	std::thread thread;
+
+public:
+	/**
+	 * Throws on error.
+	 */
+	ReceiverThread(EventLoop &event_loop, UniqueSocketDescriptor &&_socket,
+		       std::size_t batch_size,
+		       ReceiverStats &_stats,
+		       ReceiverHandler &_handler);
+	~ReceiverThread() noexcept;
+
+	ReceiverThread(const ReceiverThread &) = delete;
+	ReceiverThread &operator=(const ReceiverThread &) = delete;
+
+private:
+	/**
+	 * The worker thread's main function.
+	 */
+	void Run() noexcept;
+
+	void OnWakeMain(unsigned events) noexcept;
+};
@@ -3,16 +3,14 @@
 // author: Max Kellermann <mk@cm4all.com>
 
 #include "Record.hxx"
-#include "net/log/Parser.hxx"
-
-#include <algorithm>
 
 #include <string.h>
 
-Record::Record(uint64_t _id, std::span<const std::byte> _raw)
-	:id(_id), raw_size(_raw.size())
+Record::Record(uint64_t _id, std::span<const std::byte> _raw,
+	       const SmallDatagram &_parsed, SiteId site_id) noexcept
+	:id(_id), parsed(_parsed), raw_size(_raw.size())
 {
 	memcpy((void *)(this + 1), _raw.data(), raw_size);
 
-	parsed = Net::Log::ParseDatagram(GetRaw());
+	parsed.site_id = site_id;
 }
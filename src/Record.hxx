@@ -18,15 +18,23 @@ public:
 private:
 	uint64_t id;
 
-	const size_t raw_size;
-
+	/**
+	 * This may overlap with the tail padding of #SmallDatagram,
+	 * which allows #raw_size to be stored there.
+	 */
+	[[no_unique_address]]
 	SmallDatagram parsed;
 
+	const uint32_t raw_size;
+
 public:
 	/**
-	 * Throws Net::Log::ProtocolError on error.
+	 * @param _parsed the parsed datagram; its string references
+	 * point inside #_raw
+	 * @param site_id the interned site name
 	 */
-	Record(uint64_t _id, std::span<const std::byte> _raw);
+	Record(uint64_t _id, std::span<const std::byte> _raw,
+	       const SmallDatagram &_parsed, SiteId site_id) noexcept;
 
 	Record(const Record &) = delete;
 	Record &operator=(const Record &) = delete;
@@ -43,6 +51,14 @@ public:
 		return parsed;
 	}
 
+	/**
+	 * How many datagrams does this record stand for?  This is
+	 * larger than 1 if others were discarded by sampling.
+	 */
+	uint_least32_t GetWeight() const noexcept {
+		return uint_least32_t{1} << parsed.weight_shift;
+	}
+
 	bool IsOlderThan(Net::Log::TimePoint t) const noexcept {
 		return parsed.HasTimestamp() && parsed.timestamp < t;
 	}
@@ -55,3 +71,7 @@ public:
 		return !parsed.HasTimestamp() || parsed.timestamp < t;
 	}
 };
+
+/* the #IntrusiveListHook, the id and #SmallDatagram with #raw_size
+   in its tail padding */
+static_assert(sizeof(Record) <= 2 * sizeof(void *) + 8 + 48);
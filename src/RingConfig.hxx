@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "net/log/Protocol.hxx"
+
+#include <chrono>
+#include <cstddef>
+
+/**
+ * The maximum number of #RingConfig instances in one database.
+ */
+static constexpr std::size_t MAX_RINGS = 3;
+
+/**
+ * Store datagrams of a certain type in a separate ring, which has
+ * its own size and maximum age.  This allows keeping rare records
+ * (e.g. errors) longer than frequent ones (e.g. access logs).
+ */
+struct RingConfig {
+	Net::Log::Type type = Net::Log::Type::UNSPECIFIED;
+
+	std::size_t size = 0;
+
+	/**
+	 * A positive value means that records in this ring older
+	 * than this duration will be deleted.
+	 */
+	std::chrono::system_clock::duration max_age{};
+};
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Sampler.hxx"
+
+#include <algorithm> // for std::min()
+#include <cassert>
+
+bool
+Sampler::Add(Clock::time_point now, bool access,
+	     std::size_t size) noexcept
+{
+	if (window_start == Clock::time_point{})
+		/* this is the first datagram */
+		window_start = now;
+
+	(access ? access_size : other_size) += size;
+
+	if (now < window_start + WINDOW)
+		return false;
+
+	window_end = now;
+	return true;
+}
+
+unsigned
+Sampler::FindShift(double budget) const noexcept
+{
+	unsigned result = 0;
+	while (result < MAX_SHIFT &&
+	       double(other_size + (access_size >> result)) > budget)
+		++result;
+
+	return result;
+}
+
+void
+Sampler::Update(std::size_t capacity) noexcept
+{
+	assert(IsEnabled());
+	assert(window_end > window_start);
+
+	using FloatDuration = std::chrono::duration<double>;
+
+	/* the number of bytes which may be added per window if the
+	   ring shall last for "min_coverage" */
+	const double budget = double(capacity)
+		* FloatDuration{window_end - window_start}.count()
+		/ FloatDuration{min_coverage}.count();
+
+	if (const unsigned needed = FindShift(budget); needed >= shift)
+		shift = needed;
+	else
+		/* sample less only if the traffic has decreased
+		   noticeably, to avoid oscillation */
+		shift = std::min(shift, FindShift(budget * 0.75));
+
+	window_start = window_end;
+	access_size = other_size = 0;
+}
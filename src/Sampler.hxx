@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "net/log/Chrono.hxx"
+
+#include <chrono>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Decides how many HTTP_ACCESS datagrams are stored when they arrive
+ * faster than the ring can keep them for a configured minimum
+ * duration.  It measures how many bytes are added to the ring per
+ * window (according to the receive time, because the time stamps
+ * of senders with a skewed clock cannot be trusted), estimates how
+ * long the ring lasts at this rate and, if that is shorter than
+ * the minimum coverage, stores only one of 2^#shift access
+ * datagrams per site.  Other datagram types are never sampled, but
+ * they count as ring traffic.
+ */
+class Sampler {
+public:
+	using Clock = std::chrono::steady_clock;
+
+private:
+	/**
+	 * The sampling rate is adjusted after each window of this
+	 * duration.
+	 */
+	static constexpr Clock::duration WINDOW = std::chrono::seconds{10};
+
+	/**
+	 * The largest #shift value, i.e. at least one of 1024 access
+	 * datagrams is stored.
+	 */
+	static constexpr unsigned MAX_SHIFT = 10;
+
+	const Net::Log::Duration min_coverage;
+
+	Clock::time_point window_start{}, window_end{};
+
+	/**
+	 * The number of bytes of HTTP_ACCESS datagrams and of other
+	 * datagrams offered to the ring in the current window (before
+	 * sampling).
+	 */
+	std::size_t access_size = 0, other_size = 0;
+
+	/**
+	 * The base-2 logarithm of the current sampling rate.
+	 */
+	unsigned shift = 0;
+
+	uint64_t n_discarded = 0;
+
+public:
+	/**
+	 * @param _min_coverage the ring shall hold at least this
+	 * much history; zero disables sampling
+	 */
+	explicit Sampler(Net::Log::Duration _min_coverage) noexcept
+		:min_coverage(_min_coverage) {}
+
+	Sampler(const Sampler &) = delete;
+	Sampler &operator=(const Sampler &) = delete;
+
+	bool IsEnabled() const noexcept {
+		return min_coverage > Net::Log::Duration::zero();
+	}
+
+	/**
+	 * The number of datagrams discarded by Keep().
+	 */
+	uint64_t GetDiscardedCount() const noexcept {
+		return n_discarded;
+	}
+
+	/**
+	 * Account for a datagram which is going to be stored in the
+	 * ring (before sampling).
+	 *
+	 * @param now the time the datagram was received
+	 * @param access is this a HTTP_ACCESS datagram?
+	 * @param size the number of bytes it occupies in the ring
+	 * @return true if the current window is complete; the caller
+	 * shall call Update()
+	 */
+	bool Add(Clock::time_point now, bool access,
+		 std::size_t size) noexcept;
+
+	/**
+	 * Adjust the sampling rate according to the traffic of the
+	 * current window and begin a new window.
+	 *
+	 * @param capacity the number of bytes the ring can hold
+	 */
+	void Update(std::size_t capacity) noexcept;
+
+	/**
+	 * Decide whether a HTTP_ACCESS datagram shall be stored.
+	 *
+	 * @param counter a per-site counter of access datagrams;
+	 * counting per site makes the choice deterministic and keeps
+	 * every site's share
+	 * @return the base-2 logarithm of the weight of the stored
+	 * record or -1 if the datagram shall be discarded
+	 */
+	int Keep(uint_least32_t &counter) noexcept {
+		if ((counter++ & ((uint_least32_t{1} << shift) - 1)) != 0) {
+			++n_discarded;
+			return -1;
+		}
+
+		return shift;
+	}
+
+private:
+	/**
+	 * Find the smallest shift which lets the traffic of the
+	 * current window fit into the given number of bytes.
+	 */
+	[[gnu::pure]]
+	unsigned FindShift(double budget) const noexcept;
+};
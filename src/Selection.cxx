@@ -4,6 +4,10 @@
 
 #include "Selection.hxx"
 #include "Record.hxx"
+#include "AppendListener.hxx"
+
+#include <algorithm> // for std::max()
+#include <limits>
 
 /**
  * Stop searching for matching time stamps for this duration after the
@@ -12,32 +16,198 @@
  */
 static constexpr Net::Log::Duration until_offset = std::chrono::seconds(10);
 
+inline void
+Selection::PickOldest() noexcept
+{
+	if (n_cursors == 1)
+		return;
+
+	const Record *oldest = nullptr;
+	for (std::size_t i = 0; i < n_cursors; ++i) {
+		const auto *record = GetListRecord(i);
+		if (record != nullptr &&
+		    (oldest == nullptr || record->GetId() < oldest->GetId())) {
+			oldest = record;
+			current = i;
+		}
+	}
+}
+
+inline void
+Selection::PickNewest() noexcept
+{
+	if (n_cursors == 1)
+		return;
+
+	const Record *newest = nullptr;
+	for (std::size_t i = 0; i < n_cursors; ++i) {
+		const auto *record = GetListRecord(i);
+		if (record != nullptr &&
+		    (newest == nullptr || record->GetId() > newest->GetId())) {
+			newest = record;
+			current = i;
+		}
+	}
+}
+
+uint64_t
+Selection::GetNewestId() const noexcept
+{
+	uint64_t result = 0;
+	for (std::size_t i = 0; i < n_cursors; ++i)
+		result = std::max(result, cursors[i].GetLastId());
+	return result;
+}
+
+inline void
+Selection::RewindList(std::size_t i) noexcept
+{
+	auto &cursor = cursors[i];
+
+	if (filter.timestamp.HasSince()) {
+		if (const auto *record = cursor.TimeLowerBound(filter.timestamp.since))
+			cursor.SetNext(*record);
+	} else
+		cursor.Rewind();
+}
+
+inline void
+Selection::NextInList(std::size_t i) noexcept
+{
+	if (i == 0 && cold) {
+		cold.Next(filter);
+		if (!cold && !cold.IsPending())
+			/* end of the cold store: continue with the
+			   list, which contains only newer records */
+			RewindList(0);
+	} else
+		++cursors[i];
+}
+
+inline void
+Selection::PreviousInList(std::size_t i) noexcept
+{
+	if (i == 0 && cold) {
+		cold.Previous(filter);
+	} else {
+		auto &cursor = cursors[i];
+		--cursor;
+		if (i == 0 && !cursor && cold.IsEnabled())
+			cold.SeekLast(filter);
+	}
+}
+
+inline void
+Selection::Next() noexcept
+{
+	NextInList(current);
+	PickOldest();
+}
+
+inline void
+Selection::Previous() noexcept
+{
+	PreviousInList(current);
+	PickNewest();
+}
+
+inline void
+Selection::SeekOthersAfter(uint64_t id) noexcept
+{
+	for (std::size_t i = 0; i < n_cursors; ++i) {
+		if (i == current)
+			continue;
+
+		if (GetListRecord(i) == nullptr) {
+			/* all records of this list have been visited
+			   (or it has none at all): start over */
+			if (i != 0 || !cold.IsEnabled() || !cold.Rewind(filter))
+				RewindList(i);
+		}
+
+		/* the records after the current one are usually
+		   newer, because they have been visited already, so
+		   this loop is short */
+		while (true) {
+			/* this is a rare case (a reverse search over
+			   several lists), therefore the cold store
+			   is not searched step by step here */
+			if (i == 0)
+				FinishCold();
+
+			const Record *record = GetListRecord(i);
+			if (record == nullptr || record->GetId() >= id)
+				break;
+
+			NextInList(i);
+		}
+	}
+}
+
+inline void
+Selection::ResumeCold() noexcept
+{
+	const bool forward = cold.IsPendingForward();
+	cold.Resume(filter);
+
+	if (forward && !cold && !cold.IsPending())
+		/* end of the cold store: continue with the list,
+		   which contains only newer records */
+		RewindList(0);
+}
+
+inline void
+Selection::FinishCold() noexcept
+{
+	while (cold.IsPending())
+		ResumeCold();
+}
+
 inline bool
 Selection::IsDefined() const noexcept
 {
-	return cursor && (!cursor->GetParsed().HasTimestamp() ||
-			  cursor->GetParsed().timestamp - until_offset <= filter.timestamp.until);
+	const auto *record = Current();
+	return record != nullptr &&
+		(!record->GetParsed().HasTimestamp() ||
+		 record->GetParsed().timestamp - until_offset <= filter.timestamp.until);
 }
 
 inline Selection::UpdateResult
 Selection::SkipMismatches(unsigned max_steps) noexcept
 {
-	while (IsDefined()) {
+	while (true) {
+		if (cold.IsPending()) {
+			/* each step decompresses at most a few
+			   blocks */
+			if (max_steps-- == 0)
+				return UpdateResult::AGAIN;
+
+			ResumeCold();
+			PickOldest();
+			continue;
+		}
+
+		if (!IsDefined())
+			break;
+
 		if (max_steps-- == 0)
 			return UpdateResult::AGAIN;
 
-		if (filter(cursor->GetParsed(), cursor->GetRaw())) {
+		const auto &record = *Current();
+		if (filter(record.GetParsed(), record.GetRaw())) {
 			// found a match
 			state = State::MATCH;
 			return UpdateResult::READY;
 		}
 
-		++cursor;
+		Next();
 	}
 
-	/* no match found - clear the cursor so our "bool" operator
+	/* no match found - clear the cursors so our "bool" operator
 	   returns false */
-	cursor.Clear();
+	cold.Clear();
+	for (std::size_t i = 0; i < n_cursors; ++i)
+		cursors[i].Clear();
 	state = State::END;
 	return UpdateResult::END;
 }
@@ -45,29 +215,49 @@ Selection::SkipMismatches(unsigned max_steps) noexcept
 inline bool
 Selection::IsDefinedReverse() const noexcept
 {
-	return cursor && (!cursor->GetParsed().HasTimestamp() ||
-			  cursor->GetParsed().timestamp + until_offset >= filter.timestamp.since);
+	const auto *record = Current();
+	return record != nullptr &&
+		(!record->GetParsed().HasTimestamp() ||
+		 record->GetParsed().timestamp + until_offset >= filter.timestamp.since);
 }
 
 inline Selection::UpdateResult
 Selection::ReverseSkipMismatches(unsigned max_steps) noexcept
 {
-	while (IsDefinedReverse()) {
+	while (true) {
+		if (cold.IsPending()) {
+			if (max_steps-- == 0)
+				return UpdateResult::AGAIN;
+
+			ResumeCold();
+			PickNewest();
+			continue;
+		}
+
+		if (!IsDefinedReverse())
+			break;
+
 		if (max_steps-- == 0)
 			return UpdateResult::AGAIN;
 
-		if (filter(cursor->GetParsed(), cursor->GetRaw())) {
+		const auto &record = *Current();
+		if (filter(record.GetParsed(), record.GetRaw())) {
 			// found a match
+			if (n_cursors > 1)
+				SeekOthersAfter(record.GetId());
+
 			state = State::MATCH;
 			return UpdateResult::READY;
 		}
 
-		--cursor;
+		Previous();
 	}
 
-	/* no match found - clear the cursor so our "bool" operator
+	/* no match found - clear the cursors so our "bool" operator
 	   returns false */
-	cursor.Clear();
+	cold.Clear();
+	for (std::size_t i = 0; i < n_cursors; ++i)
+		cursors[i].Clear();
 	state = State::END;
 	return UpdateResult::END;
 }
@@ -75,9 +265,26 @@ Selection::ReverseSkipMismatches(unsigned max_steps) noexcept
 bool
 Selection::FixDeleted() noexcept
 {
-	if (!cursor.FixDeleted())
+	bool deleted = false;
+
+	for (std::size_t i = 0; i < n_cursors; ++i) {
+		/* the ColdCursor keeps its block alive, it never
+		   points to a deleted record */
+		if (i == 0 && (cold || cold.IsPending()))
+			continue;
+
+		if (cursors[i].FixDeleted())
+			deleted = true;
+	}
+
+	if (!deleted)
 		return false;
 
+	if (state == State::MISMATCH_REVERSE)
+		PickNewest();
+	else
+		PickOldest();
+
 	if (state == State::MATCH)
 		state = State::MISMATCH;
 	return true;
@@ -86,44 +293,94 @@ Selection::FixDeleted() noexcept
 void
 Selection::Rewind() noexcept
 {
-	assert(!cursor);
+	assert(!cold);
 
-	if (filter.timestamp.HasSince()) {
-		const auto *record = cursor.TimeLowerBound(filter.timestamp.since);
-		if (record == nullptr)
-			return;
+	bool found = false;
+	for (std::size_t i = 0; i < n_cursors; ++i) {
+		assert(!cursors[i]);
 
-		cursor.SetNext(*record);
-	} else
-		cursor.Rewind();
+		if (i == 0 && cold.IsEnabled() && cold.Rewind(filter)) {
+			found = true;
+			continue;
+		}
+
+		RewindList(i);
+		if (cursors[i])
+			found = true;
+	}
+
+	if (!found)
+		return;
 
+	PickOldest();
 	state = State::MISMATCH;
 }
 
 void
 Selection::SeekLast() noexcept
 {
-	assert(!cursor);
+	assert(!cold);
+
+	bool found = false;
+	for (std::size_t i = 0; i < n_cursors; ++i) {
+		auto &cursor = cursors[i];
+		assert(!cursor);
+
+		if (const auto *record = cursor.LastUntil(filter.timestamp.until)) {
+			cursor.SetNext(*record);
+			found = true;
+		} else if (i == 0 && cold.IsEnabled() && cold.SeekLast(filter))
+			found = true;
+	}
 
-	const auto *record = cursor.LastUntil(filter.timestamp.until);
-	if (record == nullptr)
+	if (!found)
 		return;
 
-	cursor.SetNext(*record);
+	PickNewest();
 	state = State::MISMATCH_REVERSE;
 }
 
+void
+Selection::AddAppendListener(AppendListener &l) noexcept
+{
+	if (merged_listeners == nullptr) {
+		cursors.front().AddAppendListener(l);
+		return;
+	}
+
+	/* only records appended after this call are interesting
+	   for OnAppend() */
+	follow_id = GetNewestId();
+	merged_listeners->Add(l);
+}
+
 bool
 Selection::OnAppend(const Record &record) noexcept
 {
-	assert(!cursor);
+	assert(!cold);
 
-	if (!filter(record.GetParsed(), record.GetRaw()))
-		return false;
+	if (merged_listeners != nullptr) {
+		/* the given record may belong to any of the lists;
+		   look for new records in all of them */
+		const uint64_t newest_id = GetNewestId();
 
-	cursor.OnAppend(record);
-	state = State::MATCH;
-	return true;
+		for (std::size_t i = 0; i < n_cursors; ++i) {
+			assert(!cursors[i]);
+			cursors[i].SeekAfter(follow_id);
+		}
+
+		follow_id = newest_id;
+		PickOldest();
+	} else {
+		/* the given record may be the first of a batch; the
+		   others follow it in the list, so look for a match
+		   among all of them (this is bounded by the batch
+		   size) */
+		cursors.front().OnAppend(record);
+	}
+
+	state = State::MISMATCH;
+	return SkipMismatches(std::numeric_limits<unsigned>::max()) == UpdateResult::READY;
 }
 
 Selection::UpdateResult
@@ -137,7 +394,7 @@ Selection::Update(unsigned max_steps) noexcept
 		return ReverseSkipMismatches(max_steps);
 
 	case State::MATCH:
-		assert(cursor);
+		assert(Current() != nullptr);
 		return UpdateResult::READY;
 
 	case State::END:
@@ -151,7 +408,7 @@ Selection::Update(unsigned max_steps) noexcept
 Selection &
 Selection::operator++() noexcept
 {
-	cursor.operator++();
+	Next();
 	state = State::MISMATCH;
 	return *this;
 }
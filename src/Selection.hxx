@@ -4,27 +4,84 @@
 
 #pragma once
 
+#include "ColdCursor.hxx"
 #include "Cursor.hxx"
 #include "Filter.hxx"
 #include "util/SharedLease.hxx"
 
+#include <array>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class AppendListenerList;
 
 /**
- * A wrapper for #Cursor which applies a #Filter.
+ * A wrapper for #Cursor which applies a #Filter.  It may merge
+ * records from several lists (see AddList()), ordered by their id.
  */
 class Selection {
-	Cursor cursor;
+public:
+	/**
+	 * The maximum number of lists which can be merged.
+	 */
+	static constexpr std::size_t MAX_LISTS = 4;
+
+private:
+	/**
+	 * Iterates over the compressed records in the #ColdStore;
+	 * while it points to a record, the first cursor is cleared.
+	 * These records are older than those in the first list.
+	 */
+	ColdCursor cold;
+
+	/**
+	 * One cursor for each list.  Only the first #n_cursors
+	 * elements are used.
+	 */
+	std::array<Cursor, MAX_LISTS> cursors;
+
+	std::size_t n_cursors = 1;
+
+	/**
+	 * The index of the cursor (or #cold if that is set and this
+	 * is zero) which points to the current record.  This is
+	 * always zero if there is only one list.
+	 */
+	std::size_t current = 0;
+
+	/**
+	 * If there are several lists, then the #AppendListener is
+	 * registered here, because it needs to be notified about new
+	 * records in all of them.
+	 */
+	AppendListenerList *merged_listeners = nullptr;
+
+	/**
+	 * The id of the newest record which existed when the
+	 * #AppendListener was registered in #merged_listeners.
+	 * OnAppend() looks only for records newer than this.
+	 */
+	uint64_t follow_id = 0;
 
 	Filter filter;
 
 	/**
 	 * A lease for the #Datbase::PerSite that may be referenced by
-	 * #cursor.  The lease ensures that the object does not get
+	 * #cursors.  The lease ensures that the object does not get
 	 * freed as long as this #Selection exists.
 	 */
 	SharedLease lease;
 
+	/**
+	 * Leases for the #Database::PerSite instances of all sites
+	 * in Filter::site_ids.  They ensure that these #SiteId
+	 * values do not get reused for other sites as long as this
+	 * #Selection exists.
+	 */
+	std::vector<SharedLease> site_leases;
+
 	enum class State {
 		/**
 		 * At a mismatch currently (or unknown); need to call
@@ -54,21 +111,61 @@ public:
 	/**
 	 * Construct an empty instance.
 	 */
-	Selection() noexcept
-		:cursor(AnyRecordList{}) {}
+	Selection() noexcept = default;
 
 	template<typename F, typename L>
 	Selection(const AnyRecordList &_list, F &&_filter,
 		  L &&_lease) noexcept
-		:cursor(_list),
+		:cursors{Cursor{_list}},
 		 filter(std::forward<F>(_filter)),
 		 lease(std::forward<L>(_lease)) {}
 
+	/**
+	 * Merge the records of another list into this selection.
+	 * Its records must not be in any of the other lists.  This
+	 * must be called before Rewind() or SeekLast().
+	 *
+	 * @param _merged_listeners an #AppendListenerList which is
+	 * notified about new records in all lists of this selection
+	 */
+	void AddList(const AnyRecordList &list,
+		     AppendListenerList &_merged_listeners) noexcept {
+		assert(n_cursors < MAX_LISTS);
+		assert(merged_listeners == nullptr ||
+		       merged_listeners == &_merged_listeners);
+
+		cursors[n_cursors++] = Cursor{list};
+		merged_listeners = &_merged_listeners;
+	}
+
+	void AddSiteLeases(std::vector<SharedLease> &&_site_leases) noexcept {
+		site_leases = std::move(_site_leases);
+	}
+
+	/**
+	 * Include records from the given #ColdStore before those in
+	 * the first list.  This must be called before Rewind() or
+	 * SeekLast().
+	 *
+	 * @param site if not ColdStore::ANY_SITE, then only records
+	 * of this site are selected from the #ColdStore (the
+	 * #Filter does not check the site if the list is a
+	 * #PerSiteRecordList)
+	 */
+	void SetColdStore(const ColdStore &store, SiteId site) noexcept {
+		assert(!cold);
+		assert(!cursors.front());
+
+		cold = {store, site};
+	}
+
 	/**
 	 * Opaque struct for Mark() and Restore().
 	 */
 	struct Marker {
-		Cursor::Marker cursor;
+		ColdCursor::Marker cold;
+		std::array<Cursor::Marker, MAX_LISTS> cursors;
+		std::size_t current;
 		State state;
 	};
 
@@ -77,14 +174,20 @@ public:
 	 * using Restore().
 	 */
 	Marker Mark() const noexcept {
-		return {cursor.Mark(), state};
+		Marker marker{cold.Mark(), {}, current, state};
+		for (std::size_t i = 0; i < n_cursors; ++i)
+			marker.cursors[i] = cursors[i].Mark();
+		return marker;
 	}
 
 	/**
 	 * Restore a position saved by Mark().
 	 */
-	void Restore(Marker marker) noexcept {
-		cursor.Restore(marker.cursor);
+	void Restore(const Marker &marker) noexcept {
+		cold.Restore(marker.cold);
+		for (std::size_t i = 0; i < n_cursors; ++i)
+			cursors[i].Restore(marker.cursors[i]);
+		current = marker.current;
 		state = marker.state;
 	}
 
@@ -107,9 +210,12 @@ public:
 	 */
 	void SeekLast() noexcept;
 
-	void AddAppendListener(AppendListener &l) noexcept {
-		cursor.AddAppendListener(l);
-	}
+	/**
+	 * Register an #AppendListener which gets notified when new
+	 * records are appended.  This must only be called at the end
+	 * of the selection.
+	 */
+	void AddAppendListener(AppendListener &l) noexcept;
 
 	enum class UpdateResult {
 		/**
@@ -144,13 +250,13 @@ public:
 	const Record &operator*() const noexcept {
 		assert(state == State::MATCH);
 
-		return *cursor;
+		return *Current();
 	}
 
 	const Record *operator->() const noexcept {
 		assert(state == State::MATCH);
 
-		return cursor.operator->();
+		return Current();
 	}
 
 	/**
@@ -159,11 +265,98 @@ public:
 	Selection &operator++() noexcept;
 
 	/**
-	 * @return true if the record matched the filter
+	 * Records were appended to the list; look for a match
+	 * beginning at the given record.
+	 *
+	 * @param record the first new record
+	 * @return true if a new record matched the filter
 	 */
 	bool OnAppend(const Record &record) noexcept;
 
 private:
+	/**
+	 * @return the current record of the given list (for the
+	 * first one, this may be from #cold) or nullptr if there is
+	 * none
+	 */
+	const Record *GetListRecord(std::size_t i) const noexcept {
+		if (i == 0 && cold)
+			return &*cold;
+		else if (cursors[i])
+			return cursors[i].operator->();
+		else
+			return nullptr;
+	}
+
+	/**
+	 * @return the current record or nullptr if there is none
+	 */
+	const Record *Current() const noexcept {
+		return GetListRecord(current);
+	}
+
+	/**
+	 * Point #current to the list whose record is the oldest one.
+	 */
+	void PickOldest() noexcept;
+
+	/**
+	 * Point #current to the list whose record is the newest one.
+	 */
+	void PickNewest() noexcept;
+
+	/**
+	 * Returns the id of the newest record in all lists.
+	 */
+	[[gnu::pure]]
+	uint64_t GetNewestId() const noexcept;
+
+	/**
+	 * Move the given cursor to the first record of its list.
+	 */
+	void RewindList(std::size_t i) noexcept;
+
+	/**
+	 * Skip to the next record of the given list, from #cold to
+	 * the first cursor.
+	 */
+	void NextInList(std::size_t i) noexcept;
+
+	/**
+	 * Skip to the previous record of the given list, from the
+	 * first cursor to #cold.
+	 */
+	void PreviousInList(std::size_t i) noexcept;
+
+	/**
+	 * Continue a suspended search in #cold (see
+	 * ColdCursor::IsPending()).
+	 */
+	void ResumeCold() noexcept;
+
+	/**
+	 * Like ResumeCold(), but continue until #cold has either
+	 * found a record or has reached its end.
+	 */
+	void FinishCold() noexcept;
+
+	/**
+	 * Skip to the next record.
+	 */
+	void Next() noexcept;
+
+	/**
+	 * Skip to the previous record.
+	 */
+	void Previous() noexcept;
+
+	/**
+	 * After moving backwards, prepare all lists except the
+	 * #current one for moving forward again: seek to their first
+	 * record which is newer than the given one.
+	 */
+	void SeekOthersAfter(uint64_t id) noexcept;
+
 	[[gnu::pure]]
 	bool IsDefined() const noexcept;
 
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "SenderAddress.hxx"
+
+#include <functional> // for std::hash
+#include <string_view>
+
+#include <arpa/inet.h> // for inet_ntop()
+#include <netinet/in.h>
+#include <string.h> // for memcpy()
+
+SenderAddress
+SenderAddress::FromSocketAddress(const struct sockaddr *address,
+				 socklen_t size) noexcept
+{
+	SenderAddress result;
+
+	if (address == nullptr)
+		return result;
+
+	switch (address->sa_family) {
+	case AF_INET:
+		if (size >= sizeof(struct sockaddr_in)) {
+			const auto &sin = *(const struct sockaddr_in *)(const void *)address;
+
+			/* convert to an IPv4-mapped IPv6 address */
+			result.ip[10] = result.ip[11] = std::byte{0xff};
+			memcpy(result.ip.data() + 12, &sin.sin_addr,
+			       sizeof(sin.sin_addr));
+		}
+
+		break;
+
+	case AF_INET6:
+		if (size >= sizeof(struct sockaddr_in6)) {
+			const auto &sin6 = *(const struct sockaddr_in6 *)(const void *)address;
+			memcpy(result.ip.data(), &sin6.sin6_addr, result.ip.size());
+		}
+
+		break;
+	}
+
+	return result;
+}
+
+std::string
+SenderAddress::ToString() const noexcept
+{
+	struct in6_addr addr;
+	memcpy(&addr, ip.data(), sizeof(addr));
+
+	char buffer[INET6_ADDRSTRLEN];
+	const char *s = IN6_IS_ADDR_V4MAPPED(&addr)
+		? inet_ntop(AF_INET, ip.data() + 12, buffer, sizeof(buffer))
+		: inet_ntop(AF_INET6, ip.data(), buffer, sizeof(buffer));
+	if (s == nullptr)
+		return {};
+
+	return s;
+}
+
+std::size_t
+SenderAddress::Hash::operator()(const SenderAddress &a) const noexcept
+{
+	return std::hash<std::string_view>{}({(const char *)a.ip.data(), a.ip.size()});
+}
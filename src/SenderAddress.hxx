@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+#include <sys/socket.h> // for socklen_t
+
+/**
+ * The IP address a datagram was received from, in a compact form
+ * suitable as a hash table key.
+ */
+struct SenderAddress {
+	/**
+	 * An IPv6 address; IPv4 addresses are stored as IPv4-mapped
+	 * IPv6 addresses.  All zero if the address is unknown or not
+	 * an IP address.
+	 */
+	std::array<std::byte, 16> ip{};
+
+	[[gnu::pure]]
+	static SenderAddress FromSocketAddress(const struct sockaddr *address,
+					       socklen_t size) noexcept;
+
+	constexpr bool operator==(const SenderAddress &) const noexcept = default;
+
+	[[gnu::pure]]
+	bool IsDefined() const noexcept {
+		return *this != SenderAddress{};
+	}
+
+	/**
+	 * Format the address as a string (IPv4 in dotted notation).
+	 */
+	[[gnu::pure]]
+	std::string ToString() const noexcept;
+
+	struct Hash {
+		[[gnu::pure]]
+		std::size_t operator()(const SenderAddress &a) const noexcept;
+	};
+};
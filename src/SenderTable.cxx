@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "SenderTable.hxx"
+
+#include <algorithm> // for std::partial_sort()
+
+inline SenderTable::Sender &
+SenderTable::GetSender(const SenderAddress &address, double now) noexcept
+{
+	if (auto i = senders.find(address); i != senders.end())
+		return i->second;
+
+	if (senders.size() >= MAX_SENDERS)
+		return overflow;
+
+	try {
+		return senders.emplace(address, Sender{.last_seen = now}).first->second;
+	} catch (...) {
+		/* out of memory */
+		return overflow;
+	}
+}
+
+std::size_t
+SenderTable::Check(std::span<const SenderAddress> addresses,
+		   double now, bool *accepted) noexcept
+{
+	const bool limit = rate_limit.rate > 0;
+	std::size_t n_discarded = 0;
+
+	const std::scoped_lock lock{mutex};
+
+	for (std::size_t i = 0; i < addresses.size(); ++i) {
+		accepted[i] = true;
+
+		const auto &address = addresses[i];
+		if (!address.IsDefined())
+			continue;
+
+		auto &sender = GetSender(address, now);
+		++sender.n_received;
+		sender.last_seen = now;
+
+		if (limit && !sender.bucket.Check(rate_limit, now, 1)) {
+			++sender.n_discarded;
+			++n_discarded;
+			accepted[i] = false;
+		}
+	}
+
+	return n_discarded;
+}
+
+void
+SenderTable::Compress(double now, double max_idle) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	std::erase_if(senders, [now, max_idle](const auto &i){
+		return i.second.last_seen + max_idle < now;
+	});
+}
+
+std::vector<SenderTable::Item>
+SenderTable::GetTop(std::size_t n) const noexcept
+{
+	std::vector<Item> result;
+
+	{
+		const std::scoped_lock lock{mutex};
+		result.reserve(senders.size());
+		for (const auto &[address, sender] : senders)
+			result.push_back({address, sender.n_received, sender.n_discarded});
+	}
+
+	const auto middle = result.begin() + std::min(n, result.size());
+	std::partial_sort(result.begin(), middle, result.end(),
+			  [](const Item &a, const Item &b){
+				  return a.n_received > b.n_received;
+			  });
+	result.erase(middle, result.end());
+	return result;
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "SenderAddress.hxx"
+#include "util/TokenBucket.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Counts the datagrams received from each sender address and
+ * optionally applies a per-sender rate limit.  This is done before
+ * datagrams get parsed, so a single noisy sender cannot waste much
+ * CPU time or memory.
+ *
+ * This object is thread-safe; it may be used by receiver threads
+ * and the main thread at the same time.
+ */
+class SenderTable {
+public:
+	/**
+	 * The maximum number of senders in #senders.  Datagrams from
+	 * more senders are charged to #overflow.
+	 */
+	static constexpr std::size_t MAX_SENDERS = 65536;
+
+private:
+	/**
+	 * A rate of zero disables the rate limit.
+	 */
+	const TokenBucketConfig rate_limit;
+
+	struct Sender {
+		TokenBucket bucket;
+
+		uint64_t n_received = 0, n_discarded = 0;
+
+		/**
+		 * The time of the most recent datagram; used by
+		 * Compress().
+		 */
+		double last_seen;
+	};
+
+	mutable std::mutex mutex;
+
+	std::unordered_map<SenderAddress, Sender, SenderAddress::Hash> senders;
+
+	/**
+	 * Shared by all senders which did not fit into #senders.
+	 * Sharing one token bucket means a flood of distinct (maybe
+	 * spoofed) addresses cannot bypass the rate limit, at the
+	 * cost of being too strict to those senders until Compress()
+	 * makes room again.
+	 */
+	Sender overflow{};
+
+	Sender &GetSender(const SenderAddress &address, double now) noexcept;
+
+public:
+	struct Item {
+		SenderAddress address;
+		uint64_t n_received, n_discarded;
+	};
+
+	explicit SenderTable(TokenBucketConfig _rate_limit) noexcept
+		:rate_limit(_rate_limit) {}
+
+	SenderTable(const SenderTable &) = delete;
+	SenderTable &operator=(const SenderTable &) = delete;
+
+	/**
+	 * Account datagrams received from the given senders and check
+	 * them against the rate limit.
+	 *
+	 * @param now the current time in seconds
+	 * @param accepted for each sender, false is written if the
+	 * datagram exceeds the rate limit and shall be discarded
+	 * @return the number of discarded datagrams
+	 */
+	std::size_t Check(std::span<const SenderAddress> addresses,
+			  double now, bool *accepted) noexcept;
+
+	/**
+	 * Delete senders which have not sent anything for the given
+	 * duration.
+	 */
+	void Compress(double now, double max_idle) noexcept;
+
+	/**
+	 * Return the senders with the most received datagrams,
+	 * sorted by this number (descending).
+	 */
+	std::vector<Item> GetTop(std::size_t n) const noexcept;
+};
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * An interned site name.  The #Database assigns one to each site
+ * name it sees, and it remains valid as long as records of this
+ * site exist or a #Filter refers to it; after that, it may be
+ * reused for another site.  Comparing these is cheaper than
+ * comparing strings.
+ */
+using SiteId = uint_least32_t;
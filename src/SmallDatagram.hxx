@@ -4,26 +4,132 @@
 
 #pragma once
 
+#include "SiteId.hxx"
 #include "net/log/Datagram.hxx"
 
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
 /**
  * A smaller version of #Net::Log::Datagram with only the attributes
- * used by the Pond server.
+ * used by the Pond server.  It is stored in each #Record, which
+ * allows applying a #Filter without parsing the raw datagram again.
  */
 struct SmallDatagram {
+	/**
+	 * A reference to a string inside the raw datagram.  It is
+	 * smaller than a pointer and remains valid when the raw
+	 * datagram gets copied.  16 bit integers are enough because
+	 * datagrams cannot be larger than 64 kB.
+	 */
+	struct StringRef {
+		/**
+		 * The offset within the raw datagram; 0 means the
+		 * attribute is not present (there can be no string at
+		 * offset 0, because each datagram begins with a magic
+		 * number).
+		 */
+		uint16_t offset = 0;
+
+		uint16_t size = 0;
+
+		StringRef() = default;
+
+		StringRef(const char *s,
+			  std::span<const std::byte> raw) noexcept {
+			if (s != nullptr) {
+				offset = s - (const char *)raw.data();
+				size = std::string_view{s}.size();
+			}
+		}
+
+		StringRef(std::string_view s,
+			  std::span<const std::byte> raw) noexcept {
+			if (s.data() != nullptr) {
+				offset = s.data() - (const char *)raw.data();
+				size = s.size();
+			}
+		}
+
+		constexpr bool IsNull() const noexcept {
+			return offset == 0;
+		}
+
+		std::string_view Get(std::span<const std::byte> raw) const noexcept {
+			return {(const char *)raw.data() + offset, size};
+		}
+	};
+
 	Net::Log::TimePoint timestamp;
 
-	const char *site;
+	Net::Log::Duration duration;
+
+	StringRef site, host, generator, http_uri;
+
+	/**
+	 * The interned #site; this is assigned by the #Database when
+	 * a #Record is constructed.
+	 */
+	SiteId site_id = 0;
+
+	HttpStatus http_status = {};
+
+	HttpMethod http_method = {};
 
 	Net::Log::Type type = Net::Log::Type::UNSPECIFIED;
 
+	bool valid_duration = false;
+
+	/**
+	 * The base-2 logarithm of the sampling weight: this record
+	 * stands for 2^weight_shift datagrams, because the others
+	 * were discarded by the #Sampler.  This is assigned by the
+	 * #Database.
+	 */
+	uint_least8_t weight_shift = 0;
+
 	SmallDatagram() = default;
 
-	constexpr SmallDatagram(const Net::Log::Datagram &src) noexcept
-		:timestamp(src.timestamp), site(src.site),
-		 type(src.type) {}
+	/**
+	 * @param raw the raw datagram which was parsed into #src
+	 */
+	SmallDatagram(const Net::Log::Datagram &src,
+		      std::span<const std::byte> raw) noexcept
+		:timestamp(src.timestamp),
+		 duration(src.duration),
+		 site(src.site, raw),
+		 host(src.host, raw), generator(src.generator, raw),
+		 http_uri(src.http_uri, raw),
+		 http_status(src.http_status),
+		 http_method(src.http_method),
+		 type(src.type),
+		 valid_duration(src.valid_duration) {}
 
 	constexpr bool HasTimestamp() const noexcept {
 		return timestamp != Net::Log::TimePoint();
 	}
 };
+
+/**
+ * A raw datagram together with its parsed #SmallDatagram.
+ */
+struct ParsedDatagram {
+	std::span<const std::byte> raw;
+
+	/**
+	 * The parsed datagram; its string references point inside
+	 * #raw.
+	 */
+	SmallDatagram parsed;
+
+	/**
+	 * If not zero, then #raw was modified after it was received
+	 * (see DatagramBatch::AddTimestamp()), and this is the
+	 * DuplicateFilter::GetFingerprint() of the datagram as it was
+	 * received.  Copies of the datagram get different receive
+	 * times, so #raw cannot be used to detect them.
+	 */
+	uint64_t fingerprint = 0;
+};
@@ -0,0 +1,792 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Snapshot.hxx"
+#include "Database.hxx"
+#include "ColdDictionary.hxx"
+#include "lib/fmt/RuntimeError.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "net/log/Parser.hxx" // for Net::Log::ProtocolError
+#include "system/Error.hxx"
+
+#include <algorithm> // for std::fill()
+#include <array>
+#include <cstdint> // for SIZE_MAX
+#include <exception> // for std::throw_with_nested()
+#include <memory>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h> // for rename()
+#include <string.h> // for memcpy(), memmove()
+#include <unistd.h> // for pread(), write(), ftruncate()
+
+/**
+ * The first bytes of a snapshot file; followed by records, each
+ * consisting of a 32 bit size (host byte order) and the raw
+ * datagram.  The upper 8 bits of the size contain
+ * SmallDatagram::weight_shift.
+ */
+static constexpr std::byte SNAPSHOT_MAGIC[8] = {
+	std::byte{'P'}, std::byte{'o'}, std::byte{'n'}, std::byte{'d'},
+	std::byte{'S'}, std::byte{'n'}, std::byte{'p'}, std::byte{'1'},
+};
+
+/**
+ * The first bytes of a file written by MoveSnapshot(); followed by
+ * the #ColdBlock instances, each consisting of a #ColdBlockHeader,
+ * the dictionary (if ColdBlockHeader::dictionary is
+ * #DICTIONARY_NEW), a #ColdSiteHeader and the name of each site
+ * and the compressed data.  A header with zero records terminates
+ * this list; it is followed by a regular snapshot (beginning with
+ * #SNAPSHOT_MAGIC).  All numbers are in host byte order.
+ */
+static constexpr std::byte COLD_MAGIC[8] = {
+	std::byte{'P'}, std::byte{'o'}, std::byte{'n'}, std::byte{'d'},
+	std::byte{'C'}, std::byte{'l'}, std::byte{'d'}, std::byte{'1'},
+};
+
+/**
+ * Values for ColdBlockHeader::dictionary.
+ */
+enum : uint8_t {
+	/**
+	 * The block was compressed without a dictionary.
+	 */
+	DICTIONARY_NONE,
+
+	/**
+	 * The block uses the same dictionary as the previous one.
+	 */
+	DICTIONARY_SAME,
+
+	/**
+	 * The header is followed by a new dictionary of
+	 * ColdBlockHeader::dictionary_size bytes.
+	 */
+	DICTIONARY_NEW,
+};
+
+struct ColdBlockHeader {
+	uint64_t first_id, last_id;
+
+	/**
+	 * See ColdBlock::oldest and ColdBlock::newest
+	 * (Net::Log::Duration::rep).
+	 */
+	int64_t oldest, newest;
+
+	uint32_t n_records, raw_size, data_size;
+
+	uint32_t types;
+
+	/**
+	 * The number of #ColdSiteHeader instances.
+	 */
+	uint32_t n_sites;
+
+	uint32_t dictionary_size;
+
+	uint8_t has_timestamps, dictionary;
+
+	uint8_t reserved[2];
+
+	/**
+	 * See ColdBlock::columns_size; zero in files written by older
+	 * versions.
+	 */
+	uint32_t columns_size;
+};
+
+static_assert(sizeof(ColdBlockHeader) == 64, "Wrong size");
+
+/**
+ * Describes one element of ColdBlock::sites; it is followed by the
+ * site name (not null-terminated).
+ */
+struct ColdSiteHeader {
+	uint32_t id, length;
+};
+
+/**
+ * Sanity limits for loading #ColdBlock instances.
+ */
+static constexpr std::size_t MAX_COLD_DATA_SIZE = 64 * 1024 * 1024;
+static constexpr std::size_t MAX_SITE_LENGTH = 65535;
+
+/**
+ * Datagrams cannot be larger than this.
+ */
+static constexpr std::size_t MAX_RECORD_SIZE = 65535;
+
+/**
+ * The position of SmallDatagram::weight_shift in the record size.
+ */
+static constexpr unsigned WEIGHT_SHIFT_BIT = 24;
+
+static constexpr std::size_t READ_BUFFER_SIZE = 1024 * 1024;
+
+/**
+ * How many bytes are written in one step of the event loop?
+ */
+static constexpr std::size_t STEP_SIZE = 1024 * 1024;
+
+/**
+ * Read exactly the given number of bytes.
+ *
+ * Throws on error or if the file ends early.
+ */
+static void
+ReadFull(FileDescriptor fd, std::span<std::byte> dest, off_t offset)
+{
+	while (!dest.empty()) {
+		const ssize_t nbytes = pread(fd.Get(), dest.data(), dest.size(),
+					     offset);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read snapshot");
+
+		if (nbytes == 0)
+			throw std::runtime_error{"Truncated snapshot file"};
+
+		dest = dest.subspan(nbytes);
+		offset += nbytes;
+	}
+}
+
+/**
+ * Read a struct and advance the offset.
+ *
+ * Throws on error or if the file ends early.
+ */
+template<typename T>
+static void
+ReadStruct(FileDescriptor fd, T &dest, off_t &offset)
+{
+	ReadFull(fd, std::as_writable_bytes(std::span{&dest, 1}), offset);
+	offset += sizeof(dest);
+}
+
+/**
+ * Load one #ColdBlock (after its #ColdBlockHeader) which was
+ * written by MoveSnapshot().
+ *
+ * Throws on error.
+ *
+ * @param dictionary the dictionary of the previous block; will be
+ * updated
+ */
+static ColdBlock
+LoadColdBlock(Database &db, FileDescriptor fd, off_t &offset,
+	      const ColdBlockHeader &header,
+	      std::shared_ptr<const ColdDictionary> &dictionary)
+{
+	if (header.data_size > MAX_COLD_DATA_SIZE ||
+	    header.columns_size > header.data_size ||
+	    header.dictionary_size > ColdDictionary::MAX_SIZE)
+		throw std::runtime_error{"Corrupt snapshot file"};
+
+	ColdBlock block;
+	block.first_id = header.first_id;
+	block.last_id = header.last_id;
+	block.oldest = Net::Log::TimePoint{Net::Log::Duration{header.oldest}};
+	block.newest = Net::Log::TimePoint{Net::Log::Duration{header.newest}};
+	block.has_timestamps = header.has_timestamps != 0;
+	block.types = header.types;
+	block.n_records = header.n_records;
+	block.raw_size = header.raw_size;
+	block.columns_size = header.columns_size;
+
+	switch (header.dictionary) {
+	case DICTIONARY_NONE:
+		break;
+
+	case DICTIONARY_SAME:
+		if (dictionary == nullptr)
+			throw std::runtime_error{"Corrupt snapshot file"};
+
+		block.dictionary = dictionary;
+		break;
+
+	case DICTIONARY_NEW:
+		{
+			std::vector<std::byte> data(header.dictionary_size);
+			ReadFull(fd, data, offset);
+			offset += data.size();
+
+			dictionary = std::make_shared<const ColdDictionary>(std::move(data));
+			block.dictionary = dictionary;
+		}
+
+		break;
+
+	default:
+		throw std::runtime_error{"Corrupt snapshot file"};
+	}
+
+	block.sites.reserve(header.n_sites);
+	for (uint32_t i = 0; i < header.n_sites; ++i) {
+		ColdSiteHeader site;
+		ReadStruct(fd, site, offset);
+
+		if (site.length > MAX_SITE_LENGTH)
+			throw std::runtime_error{"Corrupt snapshot file"};
+
+		std::string name(site.length, '\0');
+		ReadFull(fd, std::as_writable_bytes(std::span{name}), offset);
+		offset += name.size();
+
+		/* the compressed records refer to the SiteId, which
+		   must therefore remain the same */
+		db.RestoreSite(site.id, name);
+		block.sites.push_back(site.id);
+	}
+
+	block.data.reset(new std::byte[header.data_size]);
+	block.data_size = header.data_size;
+	ReadFull(fd, {block.data.get(), block.data_size}, offset);
+	offset += block.data_size;
+
+	return block;
+}
+
+/**
+ * Load the #ColdBlock instances written by MoveSnapshot() (if the
+ * file begins with #COLD_MAGIC).
+ *
+ * Throws on error.
+ *
+ * @param n_records will be incremented by the number of loaded
+ * records
+ * @return the file offset of the regular snapshot after the
+ * #ColdBlock instances
+ */
+static off_t
+LoadColdBlocks(Database &db, FileDescriptor fd, int64_t &n_records)
+{
+	std::byte magic[sizeof(COLD_MAGIC)];
+	const ssize_t nbytes = pread(fd.Get(), magic, sizeof(magic), 0);
+	if (nbytes < 0)
+		throw MakeErrno("Failed to read snapshot");
+
+	if (std::size_t(nbytes) < sizeof(magic) ||
+	    memcmp(magic, COLD_MAGIC, sizeof(magic)) != 0)
+		return 0;
+
+	off_t offset = sizeof(magic);
+	std::shared_ptr<const ColdDictionary> dictionary;
+	uint64_t last_id = 0;
+
+	while (true) {
+		ColdBlockHeader header;
+		ReadStruct(fd, header, offset);
+
+		if (header.n_records == 0)
+			return offset;
+
+		/* the ColdStore relies on ascending ids */
+		if (header.first_id <= last_id ||
+		    header.last_id < header.first_id)
+			throw std::runtime_error{"Corrupt snapshot file"};
+
+		last_id = header.last_id;
+
+		auto block = LoadColdBlock(db, fd, offset, header, dictionary);
+		n_records += block.n_records;
+		db.AppendColdBlock(std::move(block));
+	}
+}
+
+LoadedSnapshot
+LoadSnapshot(Database &db, FileDescriptor fd)
+{
+	const std::unique_ptr<std::byte[]> buffer{new std::byte[READ_BUFFER_SIZE]};
+	std::size_t fill = 0;
+	bool header = false;
+	LoadedSnapshot result{.n_records = 0};
+
+	off_t offset = LoadColdBlocks(db, fd, result.n_records);
+	const off_t start = offset;
+
+	while (true) {
+		/* using pread() because the file offset of a handed
+		   over file descriptor is not at the beginning */
+		const ssize_t nbytes = pread(fd.Get(), buffer.get() + fill,
+					     READ_BUFFER_SIZE - fill, offset);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read snapshot");
+
+		if (nbytes == 0)
+			/* a partial record at the end (after a crash)
+			   is ignored */
+			break;
+
+		fill += nbytes;
+		offset += nbytes;
+
+		std::span<const std::byte> src{buffer.get(), fill};
+
+		if (!header) {
+			if (src.size() < sizeof(SNAPSHOT_MAGIC))
+				continue;
+
+			if (memcmp(src.data(), SNAPSHOT_MAGIC,
+				   sizeof(SNAPSHOT_MAGIC)) != 0)
+				throw std::runtime_error{"Not a snapshot file"};
+
+			src = src.subspan(sizeof(SNAPSHOT_MAGIC));
+			header = true;
+			result.size = start + sizeof(SNAPSHOT_MAGIC);
+		}
+
+		while (src.size() >= sizeof(uint32_t)) {
+			uint32_t size;
+			memcpy(&size, src.data(), sizeof(size));
+
+			const unsigned weight_shift = size >> WEIGHT_SHIFT_BIT;
+			size &= (uint32_t{1} << WEIGHT_SHIFT_BIT) - 1;
+			if (size > MAX_RECORD_SIZE)
+				throw std::runtime_error{"Corrupt snapshot file"};
+
+			if (src.size() < sizeof(size) + size)
+				break;
+
+			try {
+				db.Emplace(src.subspan(sizeof(size), size),
+					   weight_shift);
+				++result.n_records;
+			} catch (const Net::Log::ProtocolError &) {
+				/* skip malformed records */
+			}
+
+			src = src.subspan(sizeof(size) + size);
+			result.size += sizeof(size) + size;
+		}
+
+		memmove(buffer.get(), src.data(), src.size());
+		fill = src.size();
+	}
+
+	return result;
+}
+
+LoadedSnapshot
+LoadSnapshot(Database &db, const char *path)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path, O_RDONLY)) {
+		if (errno == ENOENT)
+			return {};
+
+		throw FmtErrno("Failed to open {:?}", path);
+	}
+
+	try {
+		return LoadSnapshot(db, fd);
+	} catch (...) {
+		std::throw_with_nested(FmtRuntimeError("Failed to load {:?}", path));
+	}
+}
+
+/**
+ * Append a record to the buffer in the snapshot file format.
+ */
+static void
+AppendRecord(std::vector<std::byte> &buffer, const Record &record) noexcept
+{
+	const auto raw = record.GetRaw();
+	const uint32_t size = raw.size() |
+		(uint32_t{record.GetParsed().weight_shift} << WEIGHT_SHIFT_BIT);
+	const auto *p = reinterpret_cast<const std::byte *>(&size);
+	buffer.insert(buffer.end(), p, p + sizeof(size));
+	buffer.insert(buffer.end(), raw.begin(), raw.end());
+}
+
+/**
+ * Write the whole buffer to the file and clear it.
+ *
+ * Throws on error.
+ *
+ * @return the number of bytes written
+ */
+static std::size_t
+WriteBuffer(FileDescriptor fd, std::vector<std::byte> &buffer)
+{
+	std::span<const std::byte> src{buffer};
+
+	while (!src.empty()) {
+		const ssize_t nbytes = write(fd.Get(), src.data(), src.size());
+		if (nbytes < 0)
+			throw MakeErrno("Failed to write snapshot");
+
+		src = src.subspan(nbytes);
+	}
+
+	const std::size_t size = buffer.size();
+	buffer.clear();
+	return size;
+}
+
+/**
+ * Find the record with the smallest id.
+ *
+ * @return an index into the given array or SIZE_MAX if all elements
+ * are nullptr
+ */
+[[gnu::pure]]
+static std::size_t
+FindOldest(std::span<const Record *const> records) noexcept
+{
+	std::size_t result = SIZE_MAX;
+
+	for (std::size_t i = 0; i < records.size(); ++i)
+		if (records[i] != nullptr &&
+		    (result == SIZE_MAX ||
+		     records[i]->GetId() < records[result]->GetId()))
+			result = i;
+
+	return result;
+}
+
+void
+WriteSnapshot(const Database &db, FileDescriptor fd)
+{
+	std::vector<std::byte> buffer;
+	buffer.reserve(READ_BUFFER_SIZE + MAX_RECORD_SIZE + sizeof(uint32_t));
+	buffer.insert(buffer.end(),
+		      std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC));
+
+	/* merge all lists, so the records get their original order
+	   back when the snapshot is loaded */
+	const std::size_t n = db.GetRecordListCount();
+	std::array<const Record *, Database::MAX_RECORD_LISTS> next;
+	for (std::size_t i = 0; i < n; ++i)
+		next[i] = db.GetRecordList(i).First();
+
+	for (std::size_t i; (i = FindOldest({next.data(), n})) != SIZE_MAX;) {
+		AppendRecord(buffer, *next[i]);
+		next[i] = db.GetRecordList(i).Next(*next[i]);
+
+		if (buffer.size() >= READ_BUFFER_SIZE)
+			WriteBuffer(fd, buffer);
+	}
+
+	WriteBuffer(fd, buffer);
+}
+
+static void
+AppendBytes(std::vector<std::byte> &buffer,
+	    std::span<const std::byte> src) noexcept
+{
+	buffer.insert(buffer.end(), src.begin(), src.end());
+}
+
+template<typename T>
+static void
+AppendStruct(std::vector<std::byte> &buffer, const T &src) noexcept
+{
+	AppendBytes(buffer, std::as_bytes(std::span{&src, 1}));
+}
+
+/**
+ * Append a #ColdBlock to the buffer in the format described at
+ * #COLD_MAGIC.
+ *
+ * @param dictionary the dictionary of the previous block; will be
+ * updated
+ */
+static void
+AppendColdBlock(std::vector<std::byte> &buffer, const Database &db,
+		const ColdBlock &block,
+		std::shared_ptr<const ColdDictionary> &dictionary) noexcept
+{
+	ColdBlockHeader header{
+		.first_id = block.first_id,
+		.last_id = block.last_id,
+		.oldest = static_cast<int64_t>(block.oldest.time_since_epoch().count()),
+		.newest = static_cast<int64_t>(block.newest.time_since_epoch().count()),
+		.n_records = static_cast<uint32_t>(block.n_records),
+		.raw_size = static_cast<uint32_t>(block.raw_size),
+		.data_size = static_cast<uint32_t>(block.data_size),
+		.types = block.types,
+		.n_sites = static_cast<uint32_t>(block.sites.size()),
+		.dictionary_size = 0,
+		.has_timestamps = static_cast<uint8_t>(block.has_timestamps),
+		.dictionary = DICTIONARY_NONE,
+		.reserved = {},
+		.columns_size = static_cast<uint32_t>(block.columns_size),
+	};
+
+	const bool new_dictionary = block.dictionary != nullptr &&
+		block.dictionary != dictionary;
+	if (new_dictionary) {
+		header.dictionary = DICTIONARY_NEW;
+		header.dictionary_size = block.dictionary->get().size();
+		dictionary = block.dictionary;
+	} else if (block.dictionary != nullptr)
+		header.dictionary = DICTIONARY_SAME;
+
+	AppendStruct(buffer, header);
+
+	if (new_dictionary)
+		AppendBytes(buffer, block.dictionary->get());
+
+	for (const SiteId id : block.sites) {
+		const auto name = db.GetSiteName(id);
+		AppendStruct(buffer, ColdSiteHeader{
+				.id = id,
+				.length = static_cast<uint32_t>(name.size()),
+			});
+		AppendBytes(buffer, std::as_bytes(std::span{name}));
+	}
+
+	AppendBytes(buffer, {block.data.get(), block.data_size});
+}
+
+void
+MoveSnapshot(Database &db, FileDescriptor fd)
+{
+	std::vector<std::byte> buffer;
+	buffer.reserve(READ_BUFFER_SIZE + MAX_RECORD_SIZE + sizeof(uint32_t));
+	AppendBytes(buffer, COLD_MAGIC);
+
+	/* each block is freed after it has been copied to the
+	   buffer */
+	std::shared_ptr<const ColdDictionary> dictionary;
+	while (const auto block = db.ShiftColdBlock()) {
+		AppendColdBlock(buffer, db, *block, dictionary);
+
+		if (buffer.size() >= READ_BUFFER_SIZE)
+			WriteBuffer(fd, buffer);
+	}
+
+	AppendStruct(buffer, ColdBlockHeader{});
+	AppendBytes(buffer, SNAPSHOT_MAGIC);
+
+	/* merge all lists (like WriteSnapshot()), and delete each
+	   record after it has been copied to the buffer */
+	const std::size_t n = db.GetRecordListCount();
+	std::array<const Record *, Database::MAX_RECORD_LISTS> next;
+	for (std::size_t i = 0; i < n; ++i)
+		next[i] = db.GetRecordList(i).First();
+
+	for (std::size_t i; (i = FindOldest({next.data(), n})) != SIZE_MAX;) {
+		AppendRecord(buffer, *next[i]);
+		db.ShiftRecord(i);
+		next[i] = db.GetRecordList(i).First();
+
+		if (buffer.size() >= READ_BUFFER_SIZE)
+			WriteBuffer(fd, buffer);
+	}
+
+	WriteBuffer(fd, buffer);
+}
+
+SnapshotWriter::SnapshotWriter(EventLoop &event_loop, Database &_db,
+			       const char *_path,
+			       Event::Duration _interval) noexcept
+	:logger("snapshot"), db(_db),
+	 path(_path), tmp_path(path + ".tmp"),
+	 /* allow the file to contain some records which have been
+	    evicted already, to avoid rewriting it too often */
+	 max_file_size(2 * db.GetMemoryCapacity()),
+	 interval(_interval),
+	 timer(event_loop, BIND_THIS_METHOD(OnTimer)),
+	 defer_step(event_loop, BIND_THIS_METHOD(OnStep)),
+	 positions(db.GetRecordListCount())
+{
+}
+
+SnapshotWriter::~SnapshotWriter() noexcept = default;
+
+void
+SnapshotWriter::Start(uint64_t valid_size) noexcept
+{
+	if (valid_size > 0) {
+		for (std::size_t i = 0; i < positions.size(); ++i) {
+			if (const Record *r = db.GetRecordList(i).Last()) {
+				positions[i].last = r;
+				positions[i].last_id = r->GetId();
+			}
+		}
+	}
+
+	/* a zero size makes Open() rewrite the file */
+	file_size = valid_size;
+
+	timer.Schedule(interval);
+}
+
+inline bool
+SnapshotWriter::HasEvicted() const noexcept
+{
+	if (positions.size() == 1) {
+		/* the ids in a single list are consecutive */
+		const Record *first = db.GetRecordList(0).First();
+		return first != nullptr &&
+			first->GetId() > positions.front().last_id + 1;
+	}
+
+	/* with several lists, the ids in each of them have gaps, and
+	   only the eviction of the last written record can be
+	   detected */
+	for (std::size_t i = 0; i < positions.size(); ++i) {
+		const Record *first = db.GetRecordList(i).First();
+		if (first != nullptr && positions[i].last != nullptr &&
+		    first->GetId() > positions[i].last_id)
+			return true;
+	}
+
+	return false;
+}
+
+inline void
+SnapshotWriter::Open()
+{
+	/* rewrite the whole file if it is too large or if records
+	   have been evicted (or deleted by a CLONE) before they
+	   could be written */
+	rewriting = file_size == 0 || file_size > max_file_size ||
+		HasEvicted();
+
+	if (rewriting) {
+		if (!fd.Open(tmp_path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0600))
+			throw FmtErrno("Failed to create {:?}", tmp_path);
+
+		file_size = 0;
+		std::fill(positions.begin(), positions.end(), Position{});
+
+		buffer.insert(buffer.end(),
+			      std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC));
+	} else {
+		if (!fd.Open(path.c_str(), O_WRONLY|O_APPEND))
+			throw FmtErrno("Failed to open {:?}", path);
+
+		/* discard a partial record at the end (after a
+		   crash or a failed write) */
+		if (ftruncate(fd.Get(), file_size) < 0)
+			throw FmtErrno("Failed to truncate {:?}", path);
+	}
+}
+
+inline const Record *
+SnapshotWriter::GetNext(std::size_t i) const noexcept
+{
+	const auto &list = db.GetRecordList(i);
+	const Record *first = list.First();
+	if (first == nullptr)
+		return nullptr;
+
+	const auto &position = positions[i];
+	if (position.last == nullptr || first->GetId() > position.last_id)
+		/* "last" has been evicted */
+		return first;
+
+	/* eviction is FIFO, and since there is an older record,
+	   "last" is still valid */
+	return list.Next(*position.last);
+}
+
+void
+SnapshotWriter::Flush()
+{
+	file_size += WriteBuffer(fd, buffer);
+}
+
+inline void
+SnapshotWriter::Finish()
+{
+	fd.Close();
+
+	if (rewriting && rename(tmp_path.c_str(), path.c_str()) < 0)
+		throw FmtErrno("Failed to rename {:?} to {:?}",
+			       tmp_path, path);
+
+	rewriting = false;
+}
+
+bool
+SnapshotWriter::Step(std::size_t max_size)
+{
+	/* merge all lists, so the records are written in their
+	   original order */
+	const std::size_t n = positions.size();
+	std::array<const Record *, Database::MAX_RECORD_LISTS> next;
+	for (std::size_t i = 0; i < n; ++i)
+		next[i] = GetNext(i);
+
+	for (std::size_t i; (i = FindOldest({next.data(), n})) != SIZE_MAX;) {
+		if (buffer.size() >= max_size) {
+			Flush();
+			return false;
+		}
+
+		const Record &record = *next[i];
+		AppendRecord(buffer, record);
+
+		positions[i].last = &record;
+		positions[i].last_id = record.GetId();
+		next[i] = db.GetRecordList(i).Next(record);
+	}
+
+	Flush();
+	Finish();
+	return true;
+}
+
+void
+SnapshotWriter::Abort() noexcept
+{
+	logger(1, "Failed to write snapshot: ", std::current_exception());
+
+	/* start over with a new file next time */
+	buffer.clear();
+	fd.Close();
+	file_size = 0;
+	rewriting = false;
+}
+
+void
+SnapshotWriter::Stop() noexcept
+{
+	timer.Cancel();
+	defer_step.Cancel();
+
+	/* write the remaining records now, without splitting the
+	   work into steps, because the event loop is about to
+	   finish */
+	try {
+		if (!fd.IsDefined())
+			Open();
+
+		Step(SIZE_MAX);
+	} catch (...) {
+		Abort();
+	}
+}
+
+void
+SnapshotWriter::OnTimer() noexcept
+try {
+	Open();
+	OnStep();
+} catch (...) {
+	Abort();
+	timer.Schedule(interval);
+}
+
+void
+SnapshotWriter::OnStep() noexcept
+try {
+	if (!Step(STEP_SIZE)) {
+		/* continue in the next event loop iteration */
+		defer_step.Schedule();
+		return;
+	}
+
+	timer.Schedule(interval);
+} catch (...) {
+	Abort();
+	timer.Schedule(interval);
+}
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "event/CoarseTimerEvent.hxx"
+#include "event/DeferEvent.hxx"
+#include "io/Logger.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Database;
+class Record;
+
+/**
+ * The result of LoadSnapshot().
+ */
+struct LoadedSnapshot {
+	/**
+	 * The number of records which were loaded or -1 if the file
+	 * does not exist.
+	 */
+	int64_t n_records = -1;
+
+	/**
+	 * The file offset after the last complete record.  Anything
+	 * after it is a partial record (e.g. after a crash), and
+	 * new records must not be appended after it (see
+	 * SnapshotWriter::Start()).
+	 */
+	uint64_t size = 0;
+};
+
+/**
+ * Load the records from a snapshot file written by
+ * #SnapshotWriter, WriteSnapshot() or MoveSnapshot() into the
+ * #Database.
+ *
+ * Throws on error.
+ */
+LoadedSnapshot
+LoadSnapshot(Database &db, FileDescriptor fd);
+
+/**
+ * Like above, but open the file by its path.
+ */
+LoadedSnapshot
+LoadSnapshot(Database &db, const char *path);
+
+/**
+ * Write all (uncompressed) records of the #Database to the file in
+ * the snapshot format (blocking).
+ *
+ * Throws on error.
+ */
+void
+WriteSnapshot(const Database &db, FileDescriptor fd);
+
+/**
+ * Move all records of the #Database to the file (blocking): first
+ * the compressed blocks of the #ColdStore (which are still in
+ * memory), then the uncompressed records.  Everything is deleted
+ * from the #Database as soon as it has been written, so the memory
+ * is not needed twice while handing over the database to another
+ * process (see FdStore::StoreDatabase()).  LoadSnapshot() can read
+ * the file.
+ *
+ * Throws on error; the #Database may then be incomplete.
+ */
+void
+MoveSnapshot(Database &db, FileDescriptor fd);
+
+/**
+ * Writes the records of the #Database to a snapshot file
+ * periodically, which allows a restarted daemon to begin with the
+ * previous contents (see LoadSnapshot()).
+ *
+ * Snapshots are incremental: only records which were added since
+ * the previous snapshot are appended to the file.  The file is
+ * rewritten from scratch when it has grown too large or when
+ * records were evicted before they could be written.
+ *
+ * The work is split into small steps which run in the event loop,
+ * so neither receivers nor clients are blocked for long; only
+ * Stop() writes everything at once.  The file is not fsync()ed; it
+ * survives a daemon crash or restart, but not necessarily a kernel
+ * crash.
+ *
+ * Only the uncompressed records are written; those in the
+ * #ColdStore are not part of the snapshot.
+ */
+class SnapshotWriter {
+	const LLogger logger;
+
+	Database &db;
+
+	const std::string path, tmp_path;
+
+	/**
+	 * If the file becomes larger than this, it is rewritten.
+	 */
+	const std::size_t max_file_size;
+
+	const Event::Duration interval;
+
+	CoarseTimerEvent timer;
+
+	/**
+	 * Schedules the next step of a snapshot in progress.
+	 */
+	DeferEvent defer_step;
+
+	/**
+	 * The file which is being written.  This is #tmp_path
+	 * while the whole file is being rewritten.
+	 */
+	UniqueFileDescriptor fd;
+
+	std::size_t file_size = 0;
+
+	/**
+	 * The last record of one Database::GetRecordList() which
+	 * was written to the file.
+	 */
+	struct Position {
+		/**
+		 * The record (or nullptr if none).  This pointer is
+		 * only valid if the record has not yet been evicted,
+		 * i.e. if the list's first record's id is not larger
+		 * than #last_id.
+		 */
+		const Record *last = nullptr;
+		uint64_t last_id = 0;
+	};
+
+	/**
+	 * One #Position for each Database::GetRecordList().
+	 */
+	std::vector<Position> positions;
+
+	bool rewriting = false;
+
+	std::vector<std::byte> buffer;
+
+public:
+	SnapshotWriter(EventLoop &event_loop, Database &_db,
+		       const char *_path,
+		       Event::Duration _interval) noexcept;
+	~SnapshotWriter() noexcept;
+
+	SnapshotWriter(const SnapshotWriter &) = delete;
+	SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+	/**
+	 * Begin writing periodic snapshots.  All records which are
+	 * currently in the #Database are assumed to be in the file
+	 * already (after LoadSnapshot()).
+	 *
+	 * @param valid_size the size of the file after the last
+	 * complete record (see LoadedSnapshot::size); the rest is
+	 * truncated before new records are appended; zero rewrites
+	 * the whole file (e.g. because loading it has failed or
+	 * because the records did not come from the file)
+	 */
+	void Start(uint64_t valid_size) noexcept;
+
+	/**
+	 * Stop writing periodic snapshots, and write all records
+	 * which are not yet in the file (blocking).
+	 */
+	void Stop() noexcept;
+
+private:
+	/**
+	 * Open the file for appending or (if it has grown too large)
+	 * begin rewriting it.  Before appending, everything after
+	 * #file_size is truncated.
+	 *
+	 * Throws on error.
+	 */
+	void Open();
+
+	/**
+	 * Have records been evicted before they were written?
+	 */
+	[[gnu::pure]]
+	bool HasEvicted() const noexcept;
+
+	/**
+	 * Determine the first record of the given
+	 * Database::GetRecordList() which needs to be written.
+	 */
+	[[gnu::pure]]
+	const Record *GetNext(std::size_t i) const noexcept;
+
+	/**
+	 * Write the buffer to the file.
+	 *
+	 * Throws on error.
+	 */
+	void Flush();
+
+	void Finish();
+
+	/**
+	 * Write records to the file until the buffer has grown
+	 * to the given size.
+	 *
+	 * Throws on error.
+	 *
+	 * @return true if the snapshot is complete, false if there
+	 * are more records to be written
+	 */
+	bool Step(std::size_t max_size);
+
+	/**
+	 * Log the current exception and discard the snapshot in
+	 * progress.
+	 */
+	void Abort() noexcept;
+
+	void OnTimer() noexcept;
+	void OnStep() noexcept;
+};
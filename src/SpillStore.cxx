@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "SpillStore.hxx"
+#include "io/FileAt.hxx"
+#include "io/Open.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm> // for std::min()
+#include <cassert>
+#include <stdexcept>
+
+#include <fcntl.h> // for O_TMPFILE, AT_FDCWD
+#include <sys/mman.h>
+#include <unistd.h> // for pwrite(), ftruncate()
+
+/**
+ * The maximum size of one segment file.
+ */
+static constexpr std::size_t MAX_SEGMENT_SIZE = 64 * 1024 * 1024;
+
+/**
+ * The minimum number of segments; each rotation deletes only a
+ * small fraction of the spilled records.
+ */
+static constexpr std::size_t MIN_SEGMENTS = 4;
+
+/**
+ * How much data following the requested range is scheduled for
+ * read-ahead by SpillStore::Read().
+ */
+static constexpr std::size_t READ_AHEAD = 1024 * 1024;
+
+static constexpr std::size_t PAGE_SIZE = 4096;
+
+SpillStore::Segment::~Segment() noexcept
+{
+	munmap(const_cast<std::byte *>(mapping.data()), mapping.size());
+}
+
+SpillStore::SpillStore(const char *path, std::size_t max_size)
+	:directory(OpenDirectoryPath({FileDescriptor{AT_FDCWD}, path})),
+	 segment_size(std::min(MAX_SEGMENT_SIZE,
+			       max_size / MIN_SEGMENTS & ~(PAGE_SIZE - 1))),
+	 max_segments(max_size / segment_size)
+{
+	assert(max_segments >= MIN_SEGMENTS);
+}
+
+SpillStore::~SpillStore() noexcept = default;
+
+void
+SpillStore::Clear() noexcept
+{
+	segments.clear();
+}
+
+void
+SpillStore::AddSegment()
+{
+	/* an anonymous file is deleted automatically when it is
+	   closed, so there are no stale files after a crash */
+	UniqueFileDescriptor fd;
+	if (!fd.Open(directory, ".", O_TMPFILE|O_RDWR, 0600))
+		throw MakeErrno("Failed to create spill file");
+
+	if (ftruncate(fd.Get(), segment_size) < 0)
+		throw MakeErrno("Failed to resize spill file");
+
+	void *p = mmap(nullptr, segment_size, PROT_READ, MAP_SHARED,
+		       fd.Get(), 0);
+	if (p == MAP_FAILED)
+		throw MakeErrno("Failed to map spill file");
+
+	if (segments.size() >= max_segments)
+		segments.pop_front();
+
+	segments.emplace_back(next_number++, std::move(fd),
+			      std::span{static_cast<const std::byte *>(p),
+					segment_size});
+}
+
+SpillStore::Location
+SpillStore::Append(std::span<const std::byte> data)
+{
+	if (data.size() > segment_size)
+		throw std::invalid_argument{"Too much data for a spill segment"};
+
+	if (segments.empty() ||
+	    segments.back().fill + data.size() > segment_size)
+		AddSegment();
+
+	auto &segment = segments.back();
+
+	ssize_t nbytes = pwrite(segment.fd.Get(), data.data(), data.size(),
+				segment.fill);
+	if (nbytes < 0)
+		throw MakeErrno("Failed to write spill file");
+
+	if (static_cast<std::size_t>(nbytes) != data.size())
+		throw std::runtime_error{"Short write to spill file"};
+
+	const Location location{
+		segment.number,
+		static_cast<uint_least32_t>(segment.fill),
+	};
+
+	segment.fill += data.size();
+	return location;
+}
+
+std::span<const std::byte>
+SpillStore::Read(Location location, std::size_t size) const noexcept
+{
+	if (location.segment < GetOldestSegment() ||
+	    location.segment >= next_number)
+		return {};
+
+	const auto &segment = segments[location.segment - GetOldestSegment()];
+	assert(segment.number == location.segment);
+	assert(location.offset + size <= segment.fill);
+
+	/* start reading this block and the following ones
+	   asynchronously; this is only a hint, errors are
+	   irrelevant */
+	const std::size_t begin = location.offset & ~(PAGE_SIZE - 1);
+	const std::size_t end = std::min(location.offset + size + READ_AHEAD,
+					 segment.fill);
+	madvise(const_cast<std::byte *>(segment.mapping.data()) + begin,
+		end - begin, MADV_WILLNEED);
+
+	return segment.mapping.subspan(location.offset, size);
+}
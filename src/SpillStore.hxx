@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <span>
+
+/**
+ * Stores compressed #ColdBlock data in rotating segment files after
+ * it has been evicted from memory.  The segments are anonymous
+ * files (O_TMPFILE) in the configured directory which are mapped
+ * into memory for reading, therefore the data is only read when
+ * needed and is cached by the kernel's page cache.
+ *
+ * When the configured size is exceeded, the oldest segment is
+ * deleted; the caller is responsible for forgetting the blocks
+ * which were stored in it (see GetOldestSegment()).
+ */
+class SpillStore {
+	/**
+	 * A file in #directory.  It has a fixed size, and it is
+	 * filled from the beginning.
+	 */
+	struct Segment {
+		const uint_least32_t number;
+
+		const UniqueFileDescriptor fd;
+
+		/**
+		 * A read-only mapping of the whole file.
+		 */
+		const std::span<const std::byte> mapping;
+
+		/**
+		 * The number of bytes which have been written.
+		 */
+		std::size_t fill = 0;
+
+		Segment(uint_least32_t _number, UniqueFileDescriptor &&_fd,
+			std::span<const std::byte> _mapping) noexcept
+			:number(_number), fd(std::move(_fd)), mapping(_mapping) {}
+
+		~Segment() noexcept;
+
+		Segment(const Segment &) = delete;
+		Segment &operator=(const Segment &) = delete;
+	};
+
+	const UniqueFileDescriptor directory;
+
+	const std::size_t segment_size;
+
+	/**
+	 * The maximum number of segments.
+	 */
+	const std::size_t max_segments;
+
+	/**
+	 * All segments, oldest first.  The last one is being
+	 * filled.
+	 */
+	std::deque<Segment> segments;
+
+	uint_least32_t next_number = 0;
+
+public:
+	/**
+	 * The position of data in the #SpillStore.
+	 */
+	struct Location {
+		uint_least32_t segment;
+		uint_least32_t offset;
+	};
+
+	/**
+	 * Throws on error.
+	 *
+	 * @param path the directory where segment files will be
+	 * created
+	 * @param max_size the maximum total size of all segment
+	 * files
+	 */
+	SpillStore(const char *path, std::size_t max_size);
+
+	~SpillStore() noexcept;
+
+	SpillStore(const SpillStore &) = delete;
+	SpillStore &operator=(const SpillStore &) = delete;
+
+	/**
+	 * The maximum size of data which can be passed to Append().
+	 */
+	std::size_t GetMaxDataSize() const noexcept {
+		return segment_size;
+	}
+
+	/**
+	 * The total size of all segment files.
+	 */
+	std::size_t GetDiskUsage() const noexcept {
+		return segments.size() * segment_size;
+	}
+
+	/**
+	 * Delete all segments.
+	 */
+	void Clear() noexcept;
+
+	/**
+	 * Append data to the newest segment.  If there is not
+	 * enough room, a new segment is created, which may cause
+	 * the oldest one to be deleted.
+	 *
+	 * Throws on error.
+	 */
+	Location Append(std::span<const std::byte> data);
+
+	/**
+	 * Returns the number of the oldest segment which still
+	 * exists.  Data in older segments has been deleted.
+	 */
+	[[gnu::pure]]
+	uint_least32_t GetOldestSegment() const noexcept {
+		return segments.empty() ? next_number : segments.front().number;
+	}
+
+	/**
+	 * Obtain a pointer to data which was stored by Append().
+	 * This also schedules asynchronous read-ahead for the
+	 * following data, because queries usually read many
+	 * consecutive blocks.
+	 *
+	 * @return the data or an empty span if it has been deleted
+	 */
+	std::span<const std::byte> Read(Location location,
+					std::size_t size) const noexcept;
+
+private:
+	void AddSegment();
+};
@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "UringReceiver.hxx"
+#include "ReceiverHandler.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm> // for std::min()
+#include <bit> // for std::bit_ceil()
+#include <cerrno>
+#include <stdexcept>
+
+UringReceiver::UringReceiver(EventLoop &event_loop,
+			     UniqueSocketDescriptor &_socket,
+			     std::size_t batch_size,
+			     ReceiverStats &_stats,
+			     ReceiverHandler &_handler)
+	:handler(_handler), stats(_stats),
+	 n_buffers(std::bit_ceil(batch_size)),
+	 buffers(new std::byte[n_buffers * BUFFER_STRIDE]),
+	 event(event_loop, BIND_THIS_METHOD(OnEventFd), event_fd.Get()),
+	 batch(batch_size),
+	 batch_buffers(new unsigned short[batch_size])
+{
+	msg.msg_namelen = sizeof(struct sockaddr_in6);
+	msg.msg_controllen = DatagramBatch::CONTROL_SIZE;
+
+	if (int error = io_uring_queue_init(N_ENTRIES, &ring, 0); error < 0)
+		throw MakeErrno(-error, "io_uring_queue_init() failed");
+
+	int error;
+	buffer_ring = io_uring_setup_buf_ring(&ring, n_buffers, BUFFER_GROUP,
+					      0, &error);
+	if (buffer_ring == nullptr) {
+		io_uring_queue_exit(&ring);
+		throw MakeErrno(-error, "io_uring_setup_buf_ring() failed");
+	}
+
+	try {
+		const int mask = io_uring_buf_ring_mask(n_buffers);
+		for (unsigned i = 0; i < n_buffers; ++i)
+			io_uring_buf_ring_add(buffer_ring,
+					      buffers.get() + i * BUFFER_STRIDE,
+					      BUFFER_SIZE, i, mask, i);
+		io_uring_buf_ring_advance(buffer_ring, n_buffers);
+
+		if (error = io_uring_register_eventfd(&ring, event_fd.Get().Get());
+		    error < 0)
+			throw MakeErrno(-error, "io_uring_register_eventfd() failed");
+
+		Arm(_socket);
+
+		/* kernels without multishot "recvmsg" (Linux < 6.0)
+		   fail the operation right inside io_uring_submit();
+		   detect this now, so the caller can fall back to
+		   recvmmsg() */
+		struct io_uring_cqe *cqe;
+		if (io_uring_peek_cqe(&ring, &cqe) == 0 &&
+		    !(cqe->flags & IORING_CQE_F_MORE) &&
+		    cqe->res < 0 && cqe->res != -ENOBUFS) {
+			const int e = -cqe->res;
+			io_uring_cqe_seen(&ring, cqe);
+			throw MakeErrno(e, "Multishot recvmsg failed");
+		}
+	} catch (...) {
+		io_uring_free_buf_ring(&ring, buffer_ring, n_buffers, BUFFER_GROUP);
+		io_uring_queue_exit(&ring);
+		throw;
+	}
+
+	/* take ownership only after everything has succeeded, so the
+	   caller can fall back to another receiver */
+	socket = std::move(_socket);
+
+	event.ScheduleRead();
+}
+
+UringReceiver::~UringReceiver() noexcept
+{
+	event.Cancel();
+
+	io_uring_free_buf_ring(&ring, buffer_ring, n_buffers, BUFFER_GROUP);
+
+	/* this cancels the pending "recvmsg" operation */
+	io_uring_queue_exit(&ring);
+}
+
+void
+UringReceiver::Arm(SocketDescriptor s)
+{
+	auto *sqe = io_uring_get_sqe(&ring);
+	if (sqe == nullptr)
+		throw std::runtime_error{"io_uring submission queue is full"};
+
+	io_uring_prep_recvmsg_multishot(sqe, s.Get(), &msg, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+
+	if (int error = io_uring_submit(&ring); error < 0)
+		throw MakeErrno(-error, "io_uring_submit() failed");
+}
+
+void
+UringReceiver::Stop() noexcept
+{
+	event.Cancel();
+
+	/* hand the socket to the handler, which can continue
+	   receiving with recvmmsg() */
+	handler.OnReceiverStopped(std::move(socket), batch.GetCapacity(),
+				  stats);
+}
+
+void
+UringReceiver::ReturnBuffers(std::span<const unsigned short> ids) noexcept
+{
+	const int mask = io_uring_buf_ring_mask(n_buffers);
+
+	int offset = 0;
+	for (const unsigned short id : ids)
+		io_uring_buf_ring_add(buffer_ring,
+				      buffers.get() + id * BUFFER_STRIDE,
+				      BUFFER_SIZE, id, mask, offset++);
+
+	io_uring_buf_ring_advance(buffer_ring, offset);
+}
+
+void
+UringReceiver::OnEventFd(unsigned) noexcept
+{
+	event_fd.Read();
+
+	bool rearm = false, failed = false;
+
+	while (true) {
+		batch.Clear();
+
+		std::size_t n_batch_buffers = 0;
+		unsigned n_cqes = 0;
+
+		unsigned head;
+		struct io_uring_cqe *cqe;
+		io_uring_for_each_cqe(&ring, head, cqe) {
+			if (batch.IsFull())
+				break;
+
+			++n_cqes;
+
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				/* the multishot operation has
+				   terminated; after running out of
+				   buffers, it can simply be submitted
+				   again, but any other error would
+				   just repeat itself */
+				if (cqe->res >= 0 || cqe->res == -ENOBUFS)
+					rearm = true;
+				else
+					failed = true;
+			}
+
+			if (cqe->res < 0) {
+				if (cqe->res != -ENOBUFS)
+					handler.OnReceiverError(std::make_exception_ptr(MakeErrno(-cqe->res, "Failed to receive")));
+				continue;
+			}
+
+			if (!(cqe->flags & IORING_CQE_F_BUFFER))
+				continue;
+
+			const unsigned short id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			batch_buffers[n_batch_buffers++] = id;
+
+			auto *out = io_uring_recvmsg_validate(buffers.get() + id * BUFFER_STRIDE,
+							      cqe->res, &msg);
+			if (out == nullptr || (out->flags & MSG_TRUNC) != 0) {
+				batch.AddTruncated();
+				continue;
+			}
+
+			for (auto *cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &msg);
+			     cmsg != nullptr;
+			     cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &msg, cmsg))
+				batch.HandleControlMessage(*cmsg);
+
+			batch.Add({
+					static_cast<std::byte *>(io_uring_recvmsg_payload(out, &msg)),
+					io_uring_recvmsg_payload_length(out, cqe->res, &msg),
+				},
+				SenderAddress::FromSocketAddress(static_cast<const struct sockaddr *>(io_uring_recvmsg_name(out)),
+								 std::min<socklen_t>(out->namelen, msg.msg_namelen)));
+		}
+
+		if (n_cqes == 0)
+			break;
+
+		io_uring_cq_advance(&ring, n_cqes);
+
+		if (batch.GetReceivedCount() > 0) {
+			stats.n_received += batch.GetReceivedCount();
+			stats.n_dropped += drop_counter.Update(batch.GetDropCounter());
+
+			batch.Parse(&stats.senders, &stats.filter);
+			handler.OnReceiverBatch(batch);
+		}
+
+		/* the handler has copied the datagrams, so the
+		   buffers can be reused now */
+		ReturnBuffers({batch_buffers.get(), n_batch_buffers});
+	}
+
+	if (failed) {
+		Stop();
+		return;
+	}
+
+	if (rearm) {
+		try {
+			Arm(socket);
+		} catch (...) {
+			handler.OnReceiverError(std::current_exception());
+			Stop();
+		}
+	}
+}
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include "DatagramBatch.hxx"
+#include "ReceiverStats.hxx"
+#include "event/PipeEvent.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/EventFD.hxx"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+
+#include <liburing.h>
+#include <netinet/in.h> // for struct sockaddr_in6
+
+class ReceiverHandler;
+
+/**
+ * Receives datagrams with a multishot io_uring "recvmsg" operation
+ * and a ring of provided buffers.  Once armed, the kernel fills the
+ * buffers without any system call from userspace; the completions
+ * are collected when the ring's eventfd becomes readable, and the
+ * buffers are handed back after the #ReceiverHandler has copied the
+ * batch into the #Database.
+ *
+ * Unlike #ReceiverBatch, this class cannot receive datagrams larger
+ * than DatagramBatch::SLOT_SIZE, because all provided buffers have
+ * the same size; those are counted as truncated.
+ */
+class UringReceiver final {
+	static constexpr unsigned N_ENTRIES = 16;
+
+	/**
+	 * Each provided buffer begins with a struct
+	 * io_uring_recvmsg_out header, followed by the sender
+	 * address, the ancillary data and the payload.
+	 */
+	static constexpr std::size_t BUFFER_SIZE =
+		sizeof(struct io_uring_recvmsg_out) +
+		sizeof(struct sockaddr_in6) +
+		DatagramBatch::CONTROL_SIZE +
+		DatagramBatch::SLOT_SIZE;
+
+	/**
+	 * The distance between two provided buffers; the kernel
+	 * fills only #BUFFER_SIZE bytes, and the rest is reserved
+	 * for DatagramBatch::AddTimestamp().
+	 */
+	static constexpr std::size_t BUFFER_STRIDE =
+		BUFFER_SIZE + DatagramBatch::TIMESTAMP_ROOM;
+
+	static constexpr int BUFFER_GROUP = 0;
+
+	ReceiverHandler &handler;
+
+	ReceiverStats &stats;
+	DropCounter drop_counter;
+
+	/**
+	 * The number of provided buffers; the kernel requires a
+	 * power of two.
+	 */
+	const unsigned n_buffers;
+
+	struct io_uring ring;
+
+	struct io_uring_buf_ring *buffer_ring;
+
+	const std::unique_ptr<std::byte[]> buffers;
+
+	/**
+	 * The template for the multishot "recvmsg" operation; it
+	 * only describes the layout of each buffer (the sizes of the
+	 * sender address and the ancillary data).
+	 */
+	struct msghdr msg{};
+
+	EventFD event_fd;
+	PipeEvent event;
+
+	DatagramBatch batch;
+
+	/**
+	 * The ids of the buffers referenced by #batch; they are
+	 * returned to the kernel after the batch has been handled.
+	 */
+	const std::unique_ptr<unsigned short[]> batch_buffers;
+
+	UniqueSocketDescriptor socket;
+
+public:
+	/**
+	 * Throws on error (e.g. if io_uring is not available).  In
+	 * that case, the socket is left in #_socket.
+	 */
+	UringReceiver(EventLoop &event_loop, UniqueSocketDescriptor &_socket,
+		      std::size_t batch_size,
+		      ReceiverStats &_stats,
+		      ReceiverHandler &_handler);
+	~UringReceiver() noexcept;
+
+	UringReceiver(const UringReceiver &) = delete;
+	UringReceiver &operator=(const UringReceiver &) = delete;
+
+	/**
+	 * Returns false if the multishot operation has failed
+	 * permanently and the socket has been handed to
+	 * ReceiverHandler::OnReceiverStopped().  This object can
+	 * then be destroyed.
+	 */
+	bool IsActive() const noexcept {
+		return socket.IsDefined();
+	}
+
+private:
+	/**
+	 * Submit the multishot "recvmsg" operation.
+	 *
+	 * Throws on error.
+	 */
+	void Arm(SocketDescriptor s);
+
+	/**
+	 * Give up after a permanent error and pass the socket to
+	 * ReceiverHandler::OnReceiverStopped().
+	 */
+	void Stop() noexcept;
+
+	void ReturnBuffers(std::span<const unsigned short> ids) noexcept;
+
+	void OnEventFd(unsigned events) noexcept;
+};
@@ -23,6 +23,7 @@
 #include "util/ByteOrder.hxx"
 #include "util/NumberParser.hxx"
 #include "util/ScopeExit.hxx"
+#include "util/SpanCast.hxx"
 #include "util/StaticFifoBuffer.hxx"
 #include "util/StringSplit.hxx"
 #include "util/IterableSplitString.hxx"
@@ -35,9 +36,11 @@
 #include <fmt/core.h>
 
 #include <concepts>
+#include <cstddef> // for offsetof()
 #include <span>
 
 #include <stdlib.h>
+#include <string.h> // for memcpy()
 #include <poll.h>
 
 using std::string_view_literals::operator""sv;
@@ -453,6 +456,10 @@ Query(const PondServerSpecification &server, std::span<const char *const> args)
 	if (options.last)
 		client.Send(id, PondRequestCommand::LAST);
 
+	if (options.accumulate.enabled)
+		/* count sampled records with their weight */
+		client.Send(id, PondRequestCommand::WEIGHTS);
+
 	client.Send(id, PondRequestCommand::COMMIT);
 
 	struct pollfd pfds[] = {
@@ -512,7 +519,29 @@ Query(const PondServerSpecification &server, std::span<const char *const> args)
 
 			break;
 
+		case PondResponseCommand::WEIGHTED_LOG_RECORD:
+			{
+				std::span<const std::byte> p = d.payload;
+				if (p.size() < sizeof(uint32_t))
+					throw "Wrong response payload size";
+
+				uint32_t weight;
+				memcpy(&weight, p.data(), sizeof(weight));
+
+				try {
+					result_writer.Write(p.subspan(sizeof(weight)),
+							    FromBE32(weight));
+				} catch (Net::Log::ProtocolError) {
+					fmt::print(stderr, "Failed to parse log record\n");
+				}
+			}
+
+			break;
+
 		case PondResponseCommand::STATS:
+		case PondResponseCommand::RECEIVER_STATS:
+		case PondResponseCommand::RATE_LIMIT_STATS:
+		case PondResponseCommand::SENDER_STATS:
 			throw "Unexpected response packet";
 		}
 	}
@@ -520,6 +549,151 @@ Query(const PondServerSpecification &server, std::span<const char *const> args)
 	result_writer.Finish();
 }
 
+static void
+ReceiverStats(PondClient &client)
+{
+	const auto id = client.MakeId();
+	client.Send(id, PondRequestCommand::RECEIVER_STATS);
+
+	while (true) {
+		const auto d = client.Receive();
+		if (d.id != id)
+			continue;
+
+		switch (d.command) {
+		case PondResponseCommand::ERROR:
+			/* this is an old server which doesn't know
+			   RECEIVER_STATS */
+			return;
+
+		case PondResponseCommand::END:
+			return;
+
+		case PondResponseCommand::RECEIVER_STATS:
+			{
+				std::span<const std::byte> p = d.payload;
+				if (p.size() < sizeof(PondReceiverStatsPayload))
+					throw "Wrong response payload size";
+
+				PondReceiverStatsPayload rs;
+				memcpy(&rs, p.data(), sizeof(rs));
+				const auto name = ToStringView(p.subspan(sizeof(rs)));
+
+				fmt::print("receiver[{}].n_received={}\n"
+					   "receiver[{}].n_dropped={}\n",
+					   name, FromBE64(rs.n_received),
+					   name, FromBE64(rs.n_dropped));
+			}
+
+			break;
+
+		case PondResponseCommand::NOP:
+		case PondResponseCommand::LOG_RECORD:
+		case PondResponseCommand::WEIGHTED_LOG_RECORD:
+		case PondResponseCommand::STATS:
+		case PondResponseCommand::RATE_LIMIT_STATS:
+		case PondResponseCommand::SENDER_STATS:
+			throw "Unexpected response packet";
+		}
+	}
+}
+
+static void
+RateLimitStats(PondClient &client)
+{
+	const auto id = client.MakeId();
+	client.Send(id, PondRequestCommand::RATE_LIMIT_STATS);
+
+	while (true) {
+		const auto d = client.Receive();
+		if (d.id != id)
+			continue;
+
+		switch (d.command) {
+		case PondResponseCommand::ERROR:
+			/* this is an old server which doesn't know
+			   RATE_LIMIT_STATS */
+			return;
+
+		case PondResponseCommand::END:
+			return;
+
+		case PondResponseCommand::RATE_LIMIT_STATS:
+			{
+				std::span<const std::byte> p = d.payload;
+				if (p.size() < sizeof(PondRateLimitStatsPayload))
+					throw "Wrong response payload size";
+
+				PondRateLimitStatsPayload rs;
+				memcpy(&rs, p.data(), sizeof(rs));
+				const auto name = ToStringView(p.subspan(sizeof(rs)));
+
+				fmt::print("rate_limit[{}].n_discarded={}\n",
+					   name, FromBE64(rs.n_discarded));
+			}
+
+			break;
+
+		case PondResponseCommand::NOP:
+		case PondResponseCommand::LOG_RECORD:
+		case PondResponseCommand::WEIGHTED_LOG_RECORD:
+		case PondResponseCommand::STATS:
+		case PondResponseCommand::RECEIVER_STATS:
+		case PondResponseCommand::SENDER_STATS:
+			throw "Unexpected response packet";
+		}
+	}
+}
+
+static void
+SenderStats(PondClient &client)
+{
+	const auto id = client.MakeId();
+	client.Send(id, PondRequestCommand::SENDER_STATS);
+
+	while (true) {
+		const auto d = client.Receive();
+		if (d.id != id)
+			continue;
+
+		switch (d.command) {
+		case PondResponseCommand::ERROR:
+			/* this is an old server which doesn't know
+			   SENDER_STATS */
+			return;
+
+		case PondResponseCommand::END:
+			return;
+
+		case PondResponseCommand::SENDER_STATS:
+			{
+				std::span<const std::byte> p = d.payload;
+				if (p.size() < sizeof(PondSenderStatsPayload))
+					throw "Wrong response payload size";
+
+				PondSenderStatsPayload ss;
+				memcpy(&ss, p.data(), sizeof(ss));
+				const auto address = ToStringView(p.subspan(sizeof(ss)));
+
+				fmt::print("sender[{}].n_received={}\n"
+					   "sender[{}].n_discarded={}\n",
+					   address, FromBE64(ss.n_received),
+					   address, FromBE64(ss.n_discarded));
+			}
+
+			break;
+
+		case PondResponseCommand::NOP:
+		case PondResponseCommand::LOG_RECORD:
+		case PondResponseCommand::WEIGHTED_LOG_RECORD:
+		case PondResponseCommand::STATS:
+		case PondResponseCommand::RECEIVER_STATS:
+		case PondResponseCommand::RATE_LIMIT_STATS:
+			throw "Unexpected response packet";
+		}
+	}
+}
+
 static void
 Stats(const PondServerSpecification &server, std::span<const char *const> args)
 {
@@ -540,8 +714,10 @@ Stats(const PondServerSpecification &server, std::span<const char *const> args)
 	const PondStatsPayload &stats = *(const PondStatsPayload *)
 		(const void *)payload.data();
 
-	if (payload.size() < sizeof(PondStatsPayload))
-		// TODO: backwards compatibility, allow smaller payloads
+	/* older servers don't send "n_duplicates" and the
+	   attributes after it (these are printed only if present,
+	   see below); anything smaller is malformed */
+	if (payload.size() < offsetof(PondStatsPayload, n_duplicates))
 		throw "Wrong response payload size";
 
 	fmt::print("memory_capacity={}\n"
@@ -557,6 +733,22 @@ Stats(const PondServerSpecification &server, std::span<const char *const> args)
 		   FromBE64(stats.n_received),
 		   FromBE64(stats.n_malformed),
 		   FromBE64(stats.n_discarded));
+
+	if (payload.size() >= offsetof(PondStatsPayload, n_sampled))
+		fmt::print("n_duplicates={}\n",
+			   FromBE64(stats.n_duplicates));
+
+	if (payload.size() >= offsetof(PondStatsPayload, n_truncated))
+		fmt::print("n_sampled={}\n",
+			   FromBE64(stats.n_sampled));
+
+	if (payload.size() >= sizeof(PondStatsPayload))
+		fmt::print("n_truncated={}\n",
+			   FromBE64(stats.n_truncated));
+
+	ReceiverStats(client);
+	RateLimitStats(client);
+	SenderStats(client);
 }
 
 template<typename B>
@@ -651,7 +843,11 @@ Clone(const PondServerSpecification &server, std::span<const char *const> args)
 			return;
 
 		case PondResponseCommand::LOG_RECORD:
+		case PondResponseCommand::WEIGHTED_LOG_RECORD:
 		case PondResponseCommand::STATS:
+		case PondResponseCommand::RECEIVER_STATS:
+		case PondResponseCommand::RATE_LIMIT_STATS:
+		case PondResponseCommand::SENDER_STATS:
 			throw "Unexpected response packet";
 		}
 	}
@@ -193,7 +193,7 @@ ResultWriter::LookupGeoIP(const char *address) const noexcept
 #endif // HAVE_LIBGEOIP
 
 void
-ResultWriter::Append(Net::Log::Datagram &&d)
+ResultWriter::Append(Net::Log::Datagram &&d, uint_least32_t weight)
 {
 	if (age_only) [[unlikely]] {
 		if (!d.HasTimestamp())
@@ -236,9 +236,9 @@ ResultWriter::Append(Net::Log::Datagram &&d)
 			break;
 		}
 
-		auto [it, inserted] = accumulate_map.emplace(value, 1);
+		auto [it, inserted] = accumulate_map.emplace(value, weight);
 		if (!inserted)
-			++it->second;
+			it->second += weight;
 
 		return;
 	}
@@ -305,7 +305,8 @@ ResultWriter::Append(Net::Log::Datagram &&d)
 }
 
 void
-ResultWriter::Write(std::span<const std::byte> payload)
+ResultWriter::Write(std::span<const std::byte> payload,
+		    uint_least32_t weight)
 {
 	if (per_site.IsDefined()) {
 		auto d = Net::Log::ParseDatagram(payload);
@@ -364,7 +365,7 @@ ResultWriter::Write(std::span<const std::byte> payload)
 			/* skip this site */
 			return;
 
-		Append(std::move(d));
+		Append(std::move(d), weight);
 	} else if (socket.IsDefined()) {
 		/* if fd2 is a packet socket, send raw
 		   datagrams to it */
@@ -376,7 +377,7 @@ ResultWriter::Write(std::span<const std::byte> payload)
 		output_stream->Write(ReferenceAsBytes(header));
 		output_stream->Write(payload);
 	} else
-		Append(Net::Log::ParseDatagram(payload));
+		Append(Net::Log::ParseDatagram(payload), weight);
 }
 
 void
@@ -121,7 +121,13 @@ public:
 		return buffer_fill == 0;
 	}
 
-	void Write(std::span<const std::byte> payload);
+	/**
+	 * @param weight the number of datagrams this record stands
+	 * for (see PondResponseCommand::WEIGHTED_LOG_RECORD); only
+	 * used by #accumulate_params
+	 */
+	void Write(std::span<const std::byte> payload,
+		   uint_least32_t weight=1);
 
 	/**
 	 * Flushes pending data.
@@ -146,5 +152,5 @@ private:
 	const char *LookupGeoIP(const char *address) const noexcept;
 #endif
 
-	void Append(Net::Log::Datagram &&d);
+	void Append(Net::Log::Datagram &&d, uint_least32_t weight=1);
 };
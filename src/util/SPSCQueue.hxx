@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * A bounded lock-free queue for exactly one producer thread and one
+ * consumer thread.
+ *
+ * @param T a trivially copyable type (e.g. a pointer)
+ * @param N the capacity; must be a power of two
+ */
+template<typename T, std::size_t N>
+class SPSCQueue {
+	static_assert(N > 0 && (N & (N - 1)) == 0,
+		      "Capacity must be a power of two");
+
+	static constexpr std::size_t MASK = N - 1;
+
+	/**
+	 * Keep #head and #tail on separate cache lines to avoid
+	 * false sharing.  (Not using
+	 * std::hardware_destructive_interference_size because GCC
+	 * warns about its use in headers.)
+	 */
+	static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+	std::array<T, N> items;
+
+	/**
+	 * The index of the next item to be popped.  Written only by
+	 * the consumer.
+	 */
+	alignas(CACHE_LINE_SIZE)
+	std::atomic_size_t head{0};
+
+	/**
+	 * The index of the next item to be pushed.  Written only by
+	 * the producer.
+	 */
+	alignas(CACHE_LINE_SIZE)
+	std::atomic_size_t tail{0};
+
+public:
+	SPSCQueue() noexcept = default;
+
+	SPSCQueue(const SPSCQueue &) = delete;
+	SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+	/**
+	 * Append an item.  May only be called by the producer
+	 * thread.
+	 *
+	 * @return false if the queue is full
+	 */
+	bool Push(T value) noexcept {
+		const std::size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) >= N)
+			return false;
+
+		items[t & MASK] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Remove the oldest item.  May only be called by the
+	 * consumer thread.
+	 *
+	 * @return false if the queue is empty
+	 */
+	bool Pop(T &value) noexcept {
+		const std::size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+
+		value = items[h & MASK];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
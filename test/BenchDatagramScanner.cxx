@@ -0,0 +1,81 @@
+/*
+ * Compare the cost of ParseSmallDatagram() (the lightweight
+ * scanner used by the receiver) with the previous approach, a full
+ * Net::Log::ParseDatagram() call.
+ */
+
+#include "DatagramScanner.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Parser.hxx"
+#include "http/Method.hxx"
+#include "http/Status.hxx"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <chrono>
+
+static constexpr unsigned N_ITERATIONS = 10'000'000;
+
+static void
+Report(const char *name, std::chrono::steady_clock::duration d)
+{
+	const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d);
+	fmt::print("{}: {:.1f} ns/datagram\n",
+		   name, double(ns.count()) / N_ITERATIONS);
+}
+
+static void
+Bench(const char *name, std::span<const std::byte> raw)
+{
+	fmt::print("{} ({} bytes)\n", name, raw.size());
+
+	unsigned checksum = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < N_ITERATIONS; ++i) {
+		const SmallDatagram d{Net::Log::ParseDatagram(raw), raw};
+		checksum += static_cast<unsigned>(d.type);
+	}
+	Report("  ParseDatagram", std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < N_ITERATIONS; ++i) {
+		const auto d = ParseSmallDatagram(raw);
+		checksum += static_cast<unsigned>(d.type);
+	}
+	Report("  ParseSmallDatagram", std::chrono::steady_clock::now() - start);
+
+	/* print the checksum so the compiler cannot optimize the
+	   loops away */
+	fmt::print("  (checksum {})\n", checksum);
+}
+
+int
+main() noexcept
+try {
+	Net::Log::Datagram d;
+	d.timestamp = Net::Log::FromSystem(std::chrono::system_clock::now());
+	d.remote_host = "2001:db8::1";
+	d.host = "www.example.com";
+	d.site = "example-site-12345";
+	d.forwarded_to = "[2001:db8::2]:8080";
+	d.http_uri = "/wp-content/themes/example/style.css?ver=6.4.2";
+	d.http_referer = "https://www.example.com/blog/2024/01/some-article/";
+	d.user_agent = "Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0";
+	d.http_method = HttpMethod::GET;
+	d.http_status = HttpStatus::OK;
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	d.length = 12345;
+	d.valid_length = true;
+	d.duration = std::chrono::microseconds{1234};
+	d.valid_duration = true;
+
+	std::array<std::byte, 4096> buffer;
+	Bench("HTTP_ACCESS",
+	      std::span{buffer}.first(Net::Log::Serialize(buffer, d)));
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	return EXIT_FAILURE;
+}
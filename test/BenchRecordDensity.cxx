@@ -0,0 +1,74 @@
+/*
+ * Measure how many typical access log records fit into the
+ * #Database and how much memory each one needs in addition to the
+ * raw datagram.
+ */
+
+#include "Database.hxx"
+#include "net/log/Serializer.hxx"
+#include "http/Method.hxx"
+#include "http/Status.hxx"
+#include "util/PrintException.hxx"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <chrono>
+#include <string>
+
+static constexpr std::size_t DATABASE_SIZE = 256 * 1024 * 1024;
+
+int
+main() noexcept
+try {
+	Database db{DatabaseConfig{.size = DATABASE_SIZE}};
+
+	Net::Log::Datagram d;
+	d.timestamp = Net::Log::FromSystem(std::chrono::system_clock::now());
+	d.remote_host = "2001:db8::1";
+	d.host = "www.example.com";
+	d.site = "example-site-12345";
+	d.http_method = HttpMethod::GET;
+	d.http_status = HttpStatus::OK;
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	d.length = 12345;
+	d.valid_length = true;
+	d.duration = std::chrono::microseconds{1234};
+	d.valid_duration = true;
+
+	std::array<std::byte, 4096> buffer;
+	std::string uri;
+
+	/* insert more datagrams than the database can hold, so
+	   the oldest ones get evicted and the database is full
+	   afterwards; the URI length varies so the datagrams are
+	   150..250 bytes */
+	std::size_t raw_total = 0, n_total = 0;
+	for (unsigned i = 0; n_total < 2 * DATABASE_SIZE / 150; ++i) {
+		uri.assign("/img/");
+		uri.append(4 + i % 100, 'x');
+		d.http_uri = uri.c_str();
+
+		const std::size_t size = Net::Log::Serialize(buffer, d);
+		db.Emplace(std::span{buffer}.first(size));
+
+		raw_total += size;
+		++n_total;
+	}
+
+	const std::size_t n = db.GetRecordCount();
+	const double raw_average = double(raw_total) / n_total;
+	const double per_record = double(db.GetMemoryUsage()) / n;
+
+	fmt::print("sizeof(Record): {} bytes\n", sizeof(Record));
+	fmt::print("average datagram: {:.1f} bytes\n", raw_average);
+	fmt::print("memory per record: {:.1f} bytes ({:.1f} bytes overhead)\n",
+		   per_record, per_record - raw_average);
+	fmt::print("records per GB: {:.0f}\n",
+		   double(n) * (1024 * 1024 * 1024) / db.GetMemoryCapacity());
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
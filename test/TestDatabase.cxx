@@ -1,16 +1,30 @@
 #include "Database.hxx"
+#include "ColdDictionary.hxx"
 #include "Filter.hxx"
 #include "Selection.hxx"
 #include "AppendListener.hxx"
+#include "DatagramBatch.hxx"
+#include "DatagramScanner.hxx"
 #include "net/log/Serializer.hxx"
 #include "net/log/Parser.hxx"
 #include "time/ClockCache.hxx"
+#include "http/Method.hxx"
+#include "http/Status.hxx"
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <array>
+#include <memory>
 #include <optional>
 #include <vector>
 
+#include <stdio.h> // for fopen()
+#include <string.h> // for memcpy()
+#include <sys/socket.h>
+#include <stdlib.h> // for mkdtemp()
+#include <unistd.h> // for rmdir(), sysconf()
+
 using std::string_view_literals::operator""sv;
 
 static constexpr auto
@@ -28,6 +42,12 @@ GetFullParsed(const Record &record)
 	return Net::Log::ParseDatagram(record.GetRaw());
 }
 
+static std::string_view
+GetSite(const Record &record)
+{
+	return record.GetParsed().site.Get(record.GetRaw());
+}
+
 static const Record &
 Push(Database &db, const Net::Log::Datagram &src)
 {
@@ -47,7 +67,7 @@ CheckPush(Database &db, const Net::Log::Datagram &src,
 
 TEST(Database, Basic)
 {
-	Database db(64 * 1024);
+	Database db{DatabaseConfig{.size = 64 * 1024}};
 	EXPECT_TRUE(db.GetAllRecords().empty());
 
 	Net::Log::Datagram d;
@@ -102,7 +122,7 @@ TEST(Database, Basic)
  */
 TEST(Database, MaxSteps)
 {
-	Database db(64 * 1024);
+	Database db{DatabaseConfig{.size = 64 * 1024}};
 	EXPECT_TRUE(db.GetAllRecords().empty());
 
 	// Add many records with different generator values
@@ -208,9 +228,86 @@ TEST(Database, MaxSteps)
 	}
 }
 
+/**
+ * Test filters on attributes which are not used for indexing (these
+ * use the pre-parsed attributes stored in each #Record).
+ */
+TEST(Database, FilterAttributes)
+{
+	Database db{DatabaseConfig{.size = 64 * 1024}};
+
+	{
+		Net::Log::Datagram d;
+		d.timestamp = MakeTimestamp(1);
+		d.host = "a.example.com";
+		d.http_uri = "/foo";
+		d.http_method = HttpMethod::GET;
+		d.http_status = HttpStatus::OK;
+		Push(db, d);
+
+		d.timestamp = MakeTimestamp(2);
+		d.host = "b.example.com";
+		d.http_uri = "/foo/bar";
+		d.http_method = HttpMethod::POST;
+		d.http_status = HttpStatus::NOT_FOUND;
+		Push(db, d);
+	}
+
+	Push(db, {.timestamp = MakeTimestamp(3), .generator = "gen"});
+
+	{
+		Net::Log::Datagram d;
+		d.timestamp = MakeTimestamp(4);
+		d.host = "a.example.com";
+		d.http_uri = "/bar";
+		d.http_status = HttpStatus::INTERNAL_SERVER_ERROR;
+		d.duration = std::chrono::seconds{2};
+		d.valid_duration = true;
+		Push(db, d);
+	}
+
+	const auto Collect = [&db](const Filter &filter){
+		std::vector<Net::Log::TimePoint> result;
+		for (auto selection = db.Select(filter);
+		     selection.Update(1024) == Selection::UpdateResult::READY;
+		     ++selection)
+			result.push_back(selection->GetParsed().timestamp);
+		return result;
+	};
+
+	using V = std::vector<Net::Log::TimePoint>;
+
+	EXPECT_EQ(Collect({.hosts={"a.example.com"}}),
+		  (V{MakeTimestamp(1), MakeTimestamp(4)}));
+	EXPECT_EQ(Collect({.hosts={"c.example.com"}}), V{});
+	EXPECT_EQ(Collect({.generators={"gen"}}), V{MakeTimestamp(3)});
+	EXPECT_EQ(Collect({.http_uri="/foo"}), V{MakeTimestamp(1)});
+	EXPECT_EQ(Collect({.http_uri_starts_with="/foo"}),
+		  (V{MakeTimestamp(1), MakeTimestamp(2)}));
+
+	{
+		Filter filter;
+		filter.http_status.begin = 400;
+		filter.http_status.end = 600;
+		EXPECT_EQ(Collect(filter), (V{MakeTimestamp(2), MakeTimestamp(4)}));
+	}
+
+	{
+		Filter filter;
+		filter.duration.longer = std::chrono::seconds{1};
+		EXPECT_EQ(Collect(filter), V{MakeTimestamp(4)});
+	}
+
+	{
+		Filter filter;
+		filter.http_method_unsafe = true;
+		EXPECT_EQ(Collect(filter), V{MakeTimestamp(2)});
+	}
+}
+
 TEST(Database, PerSite)
 {
-	Database db{64 * 1024};
+	Database db{DatabaseConfig{.size = 64 * 1024}};
 	EXPECT_TRUE(db.GetAllRecords().empty());
 
 	EXPECT_FALSE(db.GetFirstSite());
@@ -227,7 +324,7 @@ TEST(Database, PerSite)
 		auto a = db.Select(i, {});
 		ASSERT_EQ(a.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(a->GetParsed().timestamp, MakeTimestamp(1));
-		EXPECT_STREQ(a->GetParsed().site, "a");
+		EXPECT_EQ(GetSite(*a), "a");
 
 		i = db.GetNextSite(i);
 		ASSERT_TRUE(i);
@@ -235,7 +332,7 @@ TEST(Database, PerSite)
 		auto b = db.Select(i, {});
 		ASSERT_EQ(b.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(b->GetParsed().timestamp, MakeTimestamp(1));
-		EXPECT_STREQ(b->GetParsed().site, "b");
+		EXPECT_EQ(GetSite(*b), "b");
 
 		i = db.GetNextSite(i);
 		ASSERT_FALSE(i);
@@ -284,14 +381,14 @@ TEST(Database, PerSite)
 		auto a = db.Select(i, {});
 		ASSERT_EQ(a.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(a->GetParsed().timestamp, MakeTimestamp(1));
-		EXPECT_STREQ(a->GetParsed().site, "a");
+		EXPECT_EQ(GetSite(*a), "a");
 
 		i = db.GetNextSite(i);
 
 		auto b = db.Select(i, {});
 		ASSERT_EQ(b.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(b->GetParsed().timestamp, MakeTimestamp(1));
-		EXPECT_STREQ(b->GetParsed().site, "b");
+		EXPECT_EQ(GetSite(*b), "b");
 
 		i = db.GetNextSite(i);
 		ASSERT_TRUE(i);
@@ -299,7 +396,7 @@ TEST(Database, PerSite)
 		auto cc = db.Select(i, {});
 		ASSERT_EQ(cc.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(cc->GetParsed().timestamp, MakeTimestamp(9));
-		EXPECT_STREQ(cc->GetParsed().site, "c");
+		EXPECT_EQ(GetSite(*cc), "c");
 
 		i = db.GetNextSite(i);
 		ASSERT_FALSE(i);
@@ -343,7 +440,7 @@ TEST(Database, PerSite)
 		auto a = db.Select(i, {});
 		ASSERT_EQ(a.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(a->GetParsed().timestamp, MakeTimestamp(11));
-		EXPECT_STREQ(a->GetParsed().site, "a");
+		EXPECT_EQ(GetSite(*a), "a");
 
 		i = db.GetNextSite(i);
 		ASSERT_TRUE(i);
@@ -351,7 +448,7 @@ TEST(Database, PerSite)
 		auto cc = db.Select(i, {});
 		ASSERT_EQ(cc.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(cc->GetParsed().timestamp, MakeTimestamp(11));
-		EXPECT_STREQ(cc->GetParsed().site, "c");
+		EXPECT_EQ(GetSite(*cc), "c");
 
 		i = db.GetNextSite(i);
 		ASSERT_FALSE(i);
@@ -397,7 +494,7 @@ TEST(Database, PerSite)
 		auto a = db.Select(i, {});
 		ASSERT_EQ(a.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(a->GetParsed().timestamp, MakeTimestamp(19));
-		EXPECT_STREQ(a->GetParsed().site, "a");
+		EXPECT_EQ(GetSite(*a), "a");
 
 		i = db.GetNextSite(i);
 		ASSERT_TRUE(i);
@@ -436,7 +533,19 @@ IsRateLimited(Database &db, const Net::Log::Datagram &src,
 
 TEST(Database, PerSiteRateLimit)
 {
-	Database db(256 * 1024, 10);
+	const std::vector<RateLimitConfig> rate_limits{
+		{
+			.name = "site http_error",
+			.key = RateLimitKey::SITE,
+			.type = Net::Log::Type::HTTP_ERROR,
+			.bucket = {.rate = 10, .burst = 100},
+		},
+	};
+
+	Database db{DatabaseConfig{
+		.size = 256 * 1024,
+		.rate_limits = rate_limits,
+	}};
 	EXPECT_TRUE(db.GetAllRecords().empty());
 
 	const std::chrono::steady_clock::time_point zero;
@@ -495,6 +604,112 @@ TEST(Database, PerSiteRateLimit)
 	EXPECT_FALSE(IsRateLimited(db, d, clock, 256));
 }
 
+TEST(Database, RateLimitPolicies)
+{
+	const std::vector<RateLimitConfig> rate_limits{
+		{
+			.name = "generator http_access",
+			.key = RateLimitKey::GENERATOR,
+			.type = Net::Log::Type::HTTP_ACCESS,
+			.bucket = {.rate = 1, .burst = 4},
+		},
+		{
+			.name = "type *",
+			.key = RateLimitKey::TYPE,
+			.bucket = {.rate = 1, .burst = 16},
+		},
+	};
+
+	Database db{DatabaseConfig{
+		.size = 256 * 1024,
+		.rate_limits = rate_limits,
+	}};
+
+	const std::chrono::steady_clock::time_point zero;
+	const std::chrono::steady_clock::time_point start = zero + std::chrono::hours(42);
+	ClockCache<std::chrono::steady_clock> clock;
+	clock.Mock(start);
+
+	Net::Log::Datagram d;
+	d.timestamp = MakeTimestamp(1);
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	d.generator = "a";
+
+	/* each generator has its own burst */
+	EXPECT_FALSE(IsRateLimited(db, d, clock, 4));
+	EXPECT_TRUE(IsRateLimited(db, d, clock, 1));
+
+	d.generator = "b";
+	EXPECT_FALSE(IsRateLimited(db, d, clock, 4));
+	EXPECT_TRUE(IsRateLimited(db, d, clock, 1));
+
+	/* other types are not affected by the generator policy, but
+	   the global burst is exhausted after 8 more */
+	d.type = Net::Log::Type::HTTP_ERROR;
+	EXPECT_FALSE(IsRateLimited(db, d, clock, 8));
+	EXPECT_TRUE(IsRateLimited(db, d, clock, 1));
+
+	const auto policies = db.GetRateLimiter().GetPolicies();
+	ASSERT_EQ(policies.size(), 2u);
+	EXPECT_EQ(policies[0].GetName(), "generator http_access");
+	EXPECT_EQ(policies[0].GetDiscardedCount(), 2u);
+	EXPECT_EQ(policies[1].GetDiscardedCount(), 1u);
+
+	/* after one second, one more is allowed */
+	clock.Mock(start + std::chrono::seconds(1));
+	EXPECT_FALSE(IsRateLimited(db, d, clock, 1));
+	EXPECT_TRUE(IsRateLimited(db, d, clock, 1));
+	EXPECT_EQ(policies[1].GetDiscardedCount(), 2u);
+}
+
+TEST(Database, Duplicates)
+{
+	Database db{DatabaseConfig{
+		.size = 256 * 1024,
+		.duplicate_window = std::chrono::seconds{2},
+		.duplicate_capacity = 4,
+	}};
+
+	const std::chrono::steady_clock::time_point zero;
+	const std::chrono::steady_clock::time_point start = zero + std::chrono::hours(42);
+	ClockCache<std::chrono::steady_clock> clock;
+	clock.Mock(start);
+
+	Net::Log::Datagram a;
+	a.timestamp = MakeTimestamp(1);
+	a.site = "a";
+
+	Net::Log::Datagram b;
+	b.timestamp = MakeTimestamp(1);
+	b.site = "b";
+
+	EXPECT_NE(CheckPush(db, a, clock), nullptr);
+	EXPECT_NE(CheckPush(db, b, clock), nullptr);
+	EXPECT_EQ(CheckPush(db, a, clock), nullptr);
+	EXPECT_EQ(CheckPush(db, b, clock), nullptr);
+	EXPECT_EQ(db.GetRecordCount(), 2u);
+	EXPECT_EQ(db.GetDuplicateCount(), 2u);
+
+	/* a different timestamp is not a duplicate */
+	a.timestamp = MakeTimestamp(2);
+	EXPECT_NE(CheckPush(db, a, clock), nullptr);
+
+	/* after the window has passed, it is accepted again */
+	clock.Mock(start + std::chrono::seconds{2});
+	EXPECT_NE(CheckPush(db, a, clock), nullptr);
+	EXPECT_EQ(CheckPush(db, a, clock), nullptr);
+
+	/* the capacity is limited; the oldest fingerprint gets
+	   evicted */
+	for (unsigned i = 3; i < 7; ++i) {
+		b.timestamp = MakeTimestamp(i);
+		EXPECT_NE(CheckPush(db, b, clock), nullptr);
+	}
+
+	EXPECT_NE(CheckPush(db, a, clock), nullptr);
+	EXPECT_EQ(db.GetDuplicateCount(), 3u);
+}
+
 struct TestAppendListener : public AppendListener {
 	std::vector<const Record *> records;
 
@@ -506,7 +721,7 @@ struct TestAppendListener : public AppendListener {
 
 TEST(Database, AppendListener)
 {
-	Database db(64 * 1024);
+	Database db{DatabaseConfig{.size = 64 * 1024}};
 	TestAppendListener listener;
 
 	// Register listener with site filter
@@ -525,9 +740,9 @@ TEST(Database, AppendListener)
 	// Verify AppendListener was invoked only for matching site
 	EXPECT_EQ(listener.records.size(), 2u);
 	EXPECT_EQ(listener.records[0]->GetParsed().timestamp, MakeTimestamp(1));
-	EXPECT_STREQ(listener.records[0]->GetParsed().site, "test_site");
+	EXPECT_EQ(GetSite(*listener.records[0]), "test_site");
 	EXPECT_EQ(listener.records[1]->GetParsed().timestamp, MakeTimestamp(3));
-	EXPECT_STREQ(listener.records[1]->GetParsed().site, "test_site");
+	EXPECT_EQ(GetSite(*listener.records[1]), "test_site");
 
 	// Clear the vector
 	listener.records.clear();
@@ -542,17 +757,295 @@ TEST(Database, AppendListener)
 	// Verify AppendListener was invoked again for matching site
 	EXPECT_EQ(listener.records.size(), 2u);
 	EXPECT_EQ(listener.records[0]->GetParsed().timestamp, MakeTimestamp(10));
-	EXPECT_STREQ(listener.records[0]->GetParsed().site, "test_site");
+	EXPECT_EQ(GetSite(*listener.records[0]), "test_site");
 	EXPECT_EQ(listener.records[1]->GetParsed().timestamp, MakeTimestamp(12));
-	EXPECT_STREQ(listener.records[1]->GetParsed().site, "test_site");
+	EXPECT_EQ(GetSite(*listener.records[1]), "test_site");
 
 	// Clear the vector again
 	listener.records.clear();
 }
 
+TEST(Database, MultiSite)
+{
+	Database db{DatabaseConfig{.size = 64 * 1024}};
+
+	/* "c" is not yet known when the query is started */
+	Filter filter;
+	filter.sites = {"a", "c"};
+
+	{
+		TestAppendListener listener;
+		auto follow = db.Follow(filter, listener);
+
+		for (unsigned i = 1; i <= 4; ++i) {
+			Push(db, {.timestamp = MakeTimestamp(i), .site = "a"});
+			Push(db, {.timestamp = MakeTimestamp(i), .site = "b"});
+			Push(db, {.timestamp = MakeTimestamp(i), .site = "c"});
+			Push(db, {.timestamp = MakeTimestamp(i)});
+		}
+
+		/* the listener is invoked for all records, and the
+		   Selection applies the filter */
+		ASSERT_EQ(listener.records.size(), 16u);
+		ASSERT_TRUE(follow.OnAppend(*listener.records.front()));
+
+		unsigned n = 0;
+		for (; follow.Update(1024) == Selection::UpdateResult::READY;
+		     ++follow) {
+			EXPECT_TRUE(GetSite(*follow) == "a" || GetSite(*follow) == "c");
+			++n;
+		}
+
+		EXPECT_EQ(n, 8u);
+
+		n = 0;
+		for (auto s = db.Select(filter);
+		     s.Update(1024) == Selection::UpdateResult::READY; ++s) {
+			EXPECT_TRUE(GetSite(*s) == "a" || GetSite(*s) == "c");
+			++n;
+		}
+
+		EXPECT_EQ(n, 8u);
+	}
+
+	/* deleting all records deletes the PerSite instances, but the
+	   site ids remain valid */
+	db.Clear();
+	Push(db, {.timestamp = MakeTimestamp(5), .site = "c"});
+
+	unsigned n = 0;
+	for (auto s = db.Select(filter);
+	     s.Update(1024) == Selection::UpdateResult::READY; ++s) {
+		EXPECT_EQ(GetSite(*s), "c");
+		++n;
+	}
+
+	EXPECT_EQ(n, 1u);
+}
+
+static unsigned
+CountSites(Database &db) noexcept
+{
+	unsigned n = 0;
+	for (auto i = db.GetFirstSite(); i; i = db.GetNextSite(i))
+		++n;
+	return n;
+}
+
+TEST(Database, UnknownSites)
+{
+	Database db{DatabaseConfig{.size = 64 * 1024}};
+
+	Push(db, {.timestamp = MakeTimestamp(1), .site = "a"});
+	EXPECT_EQ(CountSites(db), 1u);
+
+	/* querying unknown sites does not create them */
+	EXPECT_EQ(db.Select({.sites={"x"}}).Update(1), Selection::UpdateResult::END);
+	EXPECT_EQ(db.SelectLast({.sites={"x", "y"}}).Update(1), Selection::UpdateResult::END);
+	EXPECT_EQ(CountSites(db), 1u);
+
+	{
+		auto s = db.Select({.sites={"a", "x"}});
+		ASSERT_EQ(s.Update(1), Selection::UpdateResult::READY);
+		EXPECT_EQ(GetSite(*s), "a");
+		++s;
+		EXPECT_EQ(s.Update(1), Selection::UpdateResult::END);
+	}
+
+	/* following a site creates it, because its records may
+	   arrive later; it is deleted when the follower goes away */
+	{
+		TestAppendListener listener;
+		auto follow = db.Follow({.sites={"c"}}, listener);
+		EXPECT_EQ(CountSites(db), 2u);
+
+		db.Compress();
+		EXPECT_EQ(CountSites(db), 2u);
+
+		Push(db, {.timestamp = MakeTimestamp(2), .site = "c"});
+		ASSERT_FALSE(listener.records.empty());
+		ASSERT_TRUE(follow.OnAppend(*listener.records.front()));
+		ASSERT_EQ(follow.Update(1), Selection::UpdateResult::READY);
+		EXPECT_EQ(GetSite(*follow), "c");
+	}
+
+	/* after all records are gone, the site ids are reused, and
+	   the old names must not match the new sites */
+	db.Clear();
+	db.Compress();
+	EXPECT_EQ(CountSites(db), 0u);
+
+	Push(db, {.timestamp = MakeTimestamp(3), .site = "d"});
+	Push(db, {.timestamp = MakeTimestamp(4), .site = "e"});
+
+	EXPECT_EQ(db.Select({.sites={"a"}}).Update(1), Selection::UpdateResult::END);
+	EXPECT_EQ(db.Select({.sites={"a", "c"}}).Update(1), Selection::UpdateResult::END);
+
+	{
+		auto s = db.Select({.sites={"e"}});
+		ASSERT_EQ(s.Update(1), Selection::UpdateResult::READY);
+		EXPECT_EQ(GetSite(*s), "e");
+		++s;
+		EXPECT_EQ(s.Update(1), Selection::UpdateResult::END);
+	}
+}
+
+/**
+ * Serializes datagrams and collects them for Database::EmplaceBatch().
+ */
+class TestBatch {
+	std::vector<std::unique_ptr<std::byte[]>> buffers;
+	std::vector<ParsedDatagram> datagrams;
+
+public:
+	void Add(const Net::Log::Datagram &src) {
+		std::byte buffer[16384];
+		size_t size = Net::Log::Serialize(buffer, src);
+
+		auto &copy = buffers.emplace_back(new std::byte[size]);
+		std::copy_n(buffer, size, copy.get());
+
+		const std::span<const std::byte> raw{copy.get(), size};
+		datagrams.push_back({raw, ParseSmallDatagram(raw)});
+	}
+
+	std::size_t Emplace(Database &db,
+			    const ClockCache<std::chrono::steady_clock> &clock) const {
+		return db.EmplaceBatch(datagrams, clock);
+	}
+};
+
+TEST(Database, EmplaceBatch)
+{
+	ClockCache<std::chrono::steady_clock> clock;
+	Database db{DatabaseConfig{.size = 64 * 1024}};
+
+	TestAppendListener all_listener, site_listener;
+	auto all_selection = db.Follow({}, all_listener);
+
+	Filter filter;
+	filter.sites.insert("test_site");
+	auto site_selection = db.Follow(filter, site_listener);
+
+	TestBatch batch;
+	batch.Add({.timestamp = MakeTimestamp(1), .site = "other_site"});
+	batch.Add({.timestamp = MakeTimestamp(2), .site = "test_site"});
+	batch.Add({.timestamp = MakeTimestamp(3), .site = "test_site"});
+	batch.Add({.timestamp = MakeTimestamp(4), .site = "other_site"});
+	batch.Add({.timestamp = MakeTimestamp(5), .site = "test_site"});
+	EXPECT_EQ(batch.Emplace(db, clock), 0u);
+	EXPECT_EQ(db.GetRecordCount(), 5u);
+
+	/* each listener was invoked only once, with the first
+	   matching record of the batch */
+	ASSERT_EQ(all_listener.records.size(), 1u);
+	EXPECT_EQ(all_listener.records[0]->GetParsed().timestamp, MakeTimestamp(1));
+	ASSERT_EQ(site_listener.records.size(), 1u);
+	EXPECT_EQ(site_listener.records[0]->GetParsed().timestamp, MakeTimestamp(2));
+
+	/* the other records of the batch follow the first one */
+	unsigned n = 0;
+	for (auto s = db.Select(filter);
+	     s.Update(1024) == Selection::UpdateResult::READY; ++s) {
+		EXPECT_EQ(GetSite(*s), "test_site");
+		++n;
+	}
+
+	EXPECT_EQ(n, 3u);
+
+	/* an empty batch doesn't invoke the listeners */
+	EXPECT_EQ(TestBatch{}.Emplace(db, clock), 0u);
+	EXPECT_EQ(all_listener.records.size(), 1u);
+	EXPECT_EQ(site_listener.records.size(), 1u);
+}
+
+TEST(Database, EmplaceBatchEvict)
+{
+	ClockCache<std::chrono::steady_clock> clock;
+	Database db{DatabaseConfig{.size = 64 * 1024}};
+
+	TestAppendListener listener;
+	Filter filter;
+	filter.sites.insert("test_site");
+	auto selection = db.Follow(filter, listener);
+
+	const std::string uri(2048, 'x');
+
+	/* this batch is larger than the database (even after
+	   rounding up to the huge page size), which means its first
+	   records get evicted by the following ones */
+	constexpr unsigned n = 2048;
+	TestBatch batch;
+	for (unsigned i = 0; i < n; ++i) {
+		Net::Log::Datagram d{.timestamp = MakeTimestamp(i), .site = "test_site"};
+		d.http_uri = uri.c_str();
+		batch.Add(d);
+	}
+
+	EXPECT_EQ(batch.Emplace(db, clock), 0u);
+	EXPECT_LT(db.GetRecordCount(), n);
+
+	/* the listener gets the oldest surviving record */
+	ASSERT_EQ(listener.records.size(), 1u);
+	EXPECT_EQ(listener.records[0], db.GetAllRecords().First());
+}
+
+/**
+ * Pass a SCM_TIMESTAMPNS control message to
+ * DatagramBatch::HandleControlMessage().
+ */
+static void
+HandleTimestamp(DatagramBatch &batch, const struct timespec &ts)
+{
+	alignas(struct cmsghdr) std::array<std::byte, DatagramBatch::CONTROL_SIZE> buffer{};
+	auto &cmsg = *reinterpret_cast<struct cmsghdr *>(buffer.data());
+	cmsg.cmsg_level = SOL_SOCKET;
+	cmsg.cmsg_type = SCM_TIMESTAMPNS;
+	cmsg.cmsg_len = CMSG_LEN(sizeof(ts));
+	memcpy(CMSG_DATA(&cmsg), &ts, sizeof(ts));
+
+	batch.HandleControlMessage(cmsg);
+}
+
+TEST(Database, EmplaceBatchDuplicates)
+{
+	ClockCache<std::chrono::steady_clock> clock;
+	Database db{DatabaseConfig{
+		.size = 64 * 1024,
+		.duplicate_window = std::chrono::seconds{2},
+	}};
+
+	/* two copies of a datagram without a time stamp (e.g. one
+	   received via multicast, one via unicast) */
+	Net::Log::Datagram d;
+	d.site = "example";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+
+	std::array<std::byte, 4096> buffer1, buffer2;
+	const std::size_t size = Net::Log::Serialize(buffer1, d);
+	std::copy_n(buffer1.begin(), size, buffer2.begin());
+
+	DatagramBatch batch{4};
+	HandleTimestamp(batch, {1700000000, 1000});
+	batch.Add({buffer1.data(), size});
+	HandleTimestamp(batch, {1700000000, 2000});
+	batch.Add({buffer2.data(), size});
+	batch.Parse();
+
+	/* they got different receive times */
+	const auto datagrams = batch.GetDatagrams();
+	ASSERT_EQ(datagrams.size(), 2U);
+	EXPECT_NE(datagrams[0].parsed.timestamp, datagrams[1].parsed.timestamp);
+
+	/* but they are still recognized as duplicates */
+	EXPECT_EQ(db.EmplaceBatch(datagrams, clock), 0U);
+	EXPECT_EQ(db.GetRecordCount(), 1U);
+	EXPECT_EQ(db.GetDuplicateCount(), 1U);
+}
+
 TEST(Database, MarkRestore)
 {
-	Database db(64 * 1024);
+	Database db{DatabaseConfig{.size = 64 * 1024}};
 
 	// Add several records with different sites
 	Push(db, {.timestamp = MakeTimestamp(1), .site = "site_a"});
@@ -574,7 +1067,7 @@ TEST(Database, MarkRestore)
 	for (unsigned expected_ts : {1, 3, 4}) {
 		ASSERT_EQ(selection.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(expected_ts));
-		EXPECT_STREQ(selection->GetParsed().site, "site_a");
+		EXPECT_EQ(GetSite(*selection), "site_a");
 
 		// Mark the current position
 		markers.push_back(selection.Mark());
@@ -591,6 +1084,796 @@ TEST(Database, MarkRestore)
 		selection.Restore(markers[i]);
 		ASSERT_EQ(selection.Update(1), Selection::UpdateResult::READY);
 		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(expected_timestamps[i]));
-		EXPECT_STREQ(selection->GetParsed().site, "site_a");
+		EXPECT_EQ(GetSite(*selection), "site_a");
+	}
+}
+
+TEST(Database, Projection)
+{
+	const std::vector<ProjectionConfig> projections{
+		{
+			.type = Net::Log::Type::HTTP_ACCESS,
+			.strip = ProjectionConfig::Bit(Net::Log::Attribute::USER_AGENT) |
+				ProjectionConfig::Bit(Net::Log::Attribute::HTTP_REFERER),
+		},
+	};
+
+	Database db{DatabaseConfig{
+		.size = 64 * 1024,
+		.projections = projections,
+	}};
+	EXPECT_EQ(db.GetProjectedCount(), 0U);
+
+	Net::Log::Datagram d;
+	d.timestamp = MakeTimestamp(1);
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	d.site = "foo";
+	d.http_uri = "/index.html"sv;
+	d.http_referer = "https://example.com/"sv;
+	d.user_agent = "Mozilla/5.0"sv;
+	d.http_status = HttpStatus::OK;
+
+	/* the attributes are stripped */
+	const auto &a = Push(db, d);
+	EXPECT_EQ(db.GetProjectedCount(), 1U);
+	EXPECT_EQ(GetSite(a), "foo");
+	EXPECT_EQ(a.GetParsed().timestamp, MakeTimestamp(1));
+
+	const auto full_a = GetFullParsed(a);
+	EXPECT_EQ(full_a.http_uri, "/index.html"sv);
+	EXPECT_EQ(full_a.http_referer.data(), nullptr);
+	EXPECT_EQ(full_a.user_agent.data(), nullptr);
+	EXPECT_EQ(full_a.http_status, HttpStatus::OK);
+
+	/* a different type is not affected */
+	d.type = Net::Log::Type::HTTP_ERROR;
+	const auto &b = Push(db, d);
+	EXPECT_EQ(db.GetProjectedCount(), 1U);
+
+	const auto full_b = GetFullParsed(b);
+	EXPECT_EQ(full_b.http_referer, "https://example.com/"sv);
+	EXPECT_EQ(full_b.user_agent, "Mozilla/5.0"sv);
+
+	/* nothing to strip: the datagram is stored as-is */
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	d.http_referer = {};
+	d.user_agent = {};
+	Push(db, d);
+	EXPECT_EQ(db.GetProjectedCount(), 1U);
+}
+
+TEST(Database, Cold)
+{
+	/* 1 MB for uncompressed records, 2 MB for compressed ones */
+	Database db{DatabaseConfig{
+		.size = 3 * 1024 * 1024,
+		.cold_size = 2 * 1024 * 1024,
+	}};
+
+	static constexpr unsigned N = 20000;
+
+	for (unsigned i = 0; i < N; ++i)
+		Push(db, {
+			.timestamp = MakeTimestamp(i),
+			.site = (i % 3) == 0 ? "foo" : "bar",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+
+	/* some records have been compressed, but none was lost */
+	EXPECT_GT(db.GetColdRecordCount(), 0U);
+	EXPECT_LT(db.GetColdRecordCount(), N);
+	EXPECT_EQ(db.GetRecordCount(), N);
+
+	/* iterate over all records, first the compressed ones, then
+	   the others */
+	{
+		auto selection = db.Select(Filter{});
+		for (unsigned i = 0; i < N; ++i) {
+			ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+			EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+			EXPECT_EQ(GetSite(*selection), (i % 3) == 0 ? "foo" : "bar");
+			++selection;
+		}
+
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+	}
+
+	/* filter by site; this uses the PerSiteRecordList for the
+	   uncompressed records */
+	{
+		Filter filter;
+		filter.sites.emplace("foo");
+
+		auto selection = db.Select(filter);
+		for (unsigned i = 0; i < N; i += 3) {
+			ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+			EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+			EXPECT_EQ(GetSite(*selection), "foo");
+			++selection;
+		}
+
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+	}
+
+	/* filter by time stamp */
+	{
+		Filter filter;
+		filter.timestamp.since = MakeTimestamp(100);
+		filter.timestamp.until = MakeTimestamp(109);
+
+		auto selection = db.Select(filter);
+		for (unsigned i = 100; i < 110; ++i) {
+			ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+			EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+			++selection;
+		}
+
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+	}
+
+	/* the last record is not compressed, but seeking backwards
+	   reaches the compressed ones */
+	{
+		Filter filter;
+		filter.timestamp.until = MakeTimestamp(5);
+
+		auto selection = db.SelectLast(filter);
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(5));
+	}
+
+	/* deleting old records affects the compressed ones, too */
+	db.DeleteOlderThan(MakeTimestamp(N));
+	EXPECT_EQ(db.GetRecordCount(), 0U);
+
+	db.Clear();
+	EXPECT_EQ(db.GetRecordCount(), 0U);
+}
+
+TEST(Database, FreezeAhead)
+{
+	/* 1 MB for uncompressed records, 2 MB for compressed ones */
+	Database db{DatabaseConfig{
+		.size = 3 * 1024 * 1024,
+		.cold_size = 2 * 1024 * 1024,
+	}};
+
+	EXPECT_FALSE(db.WantsFreeze());
+	EXPECT_FALSE(db.FreezeAhead());
+
+	unsigned n = 0;
+	while (!db.WantsFreeze()) {
+		ASSERT_LT(n, 100000U);
+		Push(db, {
+			.timestamp = MakeTimestamp(n++),
+			.site = "foo",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+	}
+
+	/* nothing was compressed while adding records */
+	EXPECT_EQ(db.GetColdRecordCount(), 0U);
+
+	while (db.FreezeAhead()) {}
+
+	EXPECT_FALSE(db.WantsFreeze());
+	EXPECT_GT(db.GetColdRecordCount(), 0U);
+	EXPECT_EQ(db.GetRecordCount(), n);
+}
+
+TEST(Database, ColdSteps)
+{
+	Database db{DatabaseConfig{
+		.size = 3 * 1024 * 1024,
+		.cold_size = 2 * 1024 * 1024,
+	}};
+
+	static constexpr unsigned N = 20000;
+
+	Net::Log::Datagram d;
+	d.site = "foo";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+
+	for (unsigned i = 0; i < N; ++i) {
+		d.timestamp = MakeTimestamp(i);
+		d.http_uri = (i % 1000) == 999 ? "/match" : "/other";
+		Push(db, d);
+	}
+
+	ASSERT_GT(db.GetColdRecordCount(), 1000U);
+
+	/* with a small number of steps, the search through the
+	   compressed blocks is suspended, but no record is lost or
+	   reordered */
+	Filter filter;
+	filter.http_uri = "/match";
+
+	auto selection = db.Select(filter);
+	unsigned n_again = 0;
+	for (unsigned i = 999; i < N; i += 1000, ++selection) {
+		Selection::UpdateResult result;
+		while ((result = selection.Update(1)) == Selection::UpdateResult::AGAIN)
+			++n_again;
+
+		ASSERT_EQ(result, Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+	}
+
+	while (selection.Update(1) == Selection::UpdateResult::AGAIN) {}
+	EXPECT_EQ(selection.Update(1), Selection::UpdateResult::END);
+	EXPECT_GT(n_again, 0U);
+}
+
+TEST(Database, ColdDictionary)
+{
+	Database db{DatabaseConfig{
+		.size = 3 * 1024 * 1024,
+		.cold_size = 2 * 1024 * 1024,
+	}};
+
+	static constexpr unsigned N = 20000;
+
+	Net::Log::Datagram d;
+	d.site = "foo";
+	d.host = "www.example.com";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+
+	for (unsigned i = 0; i < N; ++i) {
+		d.timestamp = MakeTimestamp(i);
+		d.user_agent = (i % 2) == 0 ? "Mozilla/5.0 (X11; Linux x86_64)" : "curl/8.0";
+		Push(db, d);
+	}
+
+	EXPECT_GT(db.GetColdRecordCount(), 0U);
+	EXPECT_EQ(db.GetRecordCount(), N);
+
+	/* the compressed records are restored exactly */
+	auto selection = db.Select(Filter{});
+	for (unsigned i = 0; i < db.GetColdRecordCount(); ++i) {
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+		EXPECT_EQ(selection->GetParsed().host.Get(selection->GetRaw()), "www.example.com"sv);
+
+		EXPECT_STREQ(GetFullParsed(*selection).user_agent, (i % 2) == 0 ? "Mozilla/5.0 (X11; Linux x86_64)" : "curl/8.0");
+		++selection;
+	}
+}
+
+static ColdBlock
+MakeColdBlock(uint64_t id, std::shared_ptr<const ColdDictionary> dictionary)
+{
+	ColdBlock block;
+	block.first_id = block.last_id = id;
+	block.n_records = 1;
+	block.data_size = 16;
+	block.data.reset(new std::byte[block.data_size]);
+	block.dictionary = std::move(dictionary);
+	return block;
+}
+
+TEST(ColdStore, DictionaryMemory)
+{
+	ColdStore store{1024 * 1024};
+
+	const auto dictionary = std::make_shared<const ColdDictionary>(std::vector<std::byte>(1000));
+	const std::size_t dictionary_size = dictionary->GetMemoryUsage();
+	const std::size_t block_size = MakeColdBlock(1, nullptr).GetMemoryUsage();
+
+	/* the dictionary is accounted once, no matter how many
+	   blocks refer to it */
+	store.Append(MakeColdBlock(1, dictionary));
+	EXPECT_EQ(store.GetMemoryUsage(), block_size + dictionary_size);
+
+	store.Append(MakeColdBlock(2, dictionary));
+	EXPECT_EQ(store.GetMemoryUsage(), 2 * block_size + dictionary_size);
+
+	store.Append(MakeColdBlock(3, nullptr));
+	EXPECT_EQ(store.GetMemoryUsage(), 3 * block_size + dictionary_size);
+
+	/* it remains accounted after the block which introduced it
+	   has been removed */
+	ASSERT_TRUE(store.Shift());
+	EXPECT_EQ(store.GetMemoryUsage(), 2 * block_size + dictionary_size);
+
+	/* until its last user is gone */
+	ASSERT_TRUE(store.Shift());
+	EXPECT_EQ(store.GetMemoryUsage(), block_size);
+
+	ASSERT_TRUE(store.Shift());
+	EXPECT_EQ(store.GetMemoryUsage(), 0U);
+}
+
+TEST(Database, ColdScan)
+{
+	Database db{DatabaseConfig{
+		.size = 3 * 1024 * 1024,
+		.cold_size = 2 * 1024 * 1024,
+	}};
+
+	static constexpr unsigned N = 20000;
+
+	Net::Log::Datagram d;
+	d.site = "foo";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+
+	for (unsigned i = 0; i < N; ++i) {
+		d.timestamp = MakeTimestamp(i);
+		if (i % 10 == 0) {
+			d.http_status = HttpStatus::INTERNAL_SERVER_ERROR;
+			d.duration = std::chrono::seconds{2};
+			d.valid_duration = true;
+		} else {
+			d.http_status = HttpStatus::OK;
+			d.valid_duration = false;
+		}
+
+		Push(db, d);
+	}
+
+	EXPECT_GT(db.GetColdRecordCount(), 0U);
+
+	/* the columns of compressed blocks are scanned, but the
+	   results must be the same as for uncompressed records */
+
+	{
+		Filter filter;
+		filter.http_status.begin = 500;
+		filter.http_status.end = 600;
+
+		auto selection = db.Select(filter);
+		for (unsigned i = 0; i < N; i += 10) {
+			ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+			EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+			++selection;
+		}
+
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+	}
+
+	{
+		Filter filter;
+		filter.duration.longer = std::chrono::seconds{1};
+
+		auto selection = db.SelectLast(filter);
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(N - 10));
+	}
+
+	{
+		Filter filter;
+		filter.type = Net::Log::Type::HTTP_ERROR;
+
+		auto selection = db.Select(filter);
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+	}
+}
+
+TEST(Database, Spill)
+{
+	char directory[] = "/tmp/TestDatabase.XXXXXX";
+	ASSERT_NE(mkdtemp(directory), nullptr);
+
+	{
+		Database db{DatabaseConfig{
+			.size = 2 * 1024 * 1024 + 256 * 1024,
+			.cold_size = 256 * 1024,
+			.spill_directory = directory,
+			.spill_size = 64 * 1024 * 1024,
+		}};
+
+		static constexpr unsigned N = 300000;
+
+		Net::Log::Datagram d;
+		d.type = Net::Log::Type::HTTP_ACCESS;
+
+		for (unsigned i = 0; i < N; ++i) {
+			d.timestamp = MakeTimestamp(i);
+			d.site = (i % 3) == 0 ? "foo" : "bar";
+			Push(db, d);
+		}
+
+		/* old blocks have been moved to disk, but no record
+		   was lost */
+		EXPECT_GT(db.GetSpilledRecordCount(), 0U);
+		EXPECT_EQ(db.GetRecordCount(), N);
+
+		/* records are read back from disk transparently */
+		{
+			auto selection = db.Select(Filter{});
+			for (unsigned i = 0; i < N; ++i) {
+				ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+				EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+				++selection;
+			}
+
+			ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+		}
+
+		{
+			Filter filter;
+			filter.sites.emplace("foo");
+			filter.timestamp.since = MakeTimestamp(3000);
+
+			auto selection = db.Select(filter);
+			ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+			EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(3000));
+			EXPECT_EQ(GetSite(*selection), "foo");
+		}
+
+		db.Clear();
+		EXPECT_EQ(db.GetRecordCount(), 0U);
+		EXPECT_EQ(db.GetSpilledRecordCount(), 0U);
+	}
+
+	/* the segment files are anonymous; nothing is left behind */
+	EXPECT_EQ(rmdir(directory), 0);
+}
+
+TEST(Database, Resize)
+{
+	/* 4 MB now, but room for growing to 16 MB */
+	Database db{DatabaseConfig{
+		.size = 4 * 1024 * 1024,
+		.max_size = 16 * 1024 * 1024,
+	}};
+	EXPECT_EQ(db.GetMemoryCapacity(), 4 * 1024 * 1024U);
+	EXPECT_EQ(db.GetMaxMemoryCapacity(), 16 * 1024 * 1024U);
+
+	static constexpr unsigned N = 100000;
+
+	for (unsigned i = 0; i < N; ++i)
+		Push(db, {
+			.timestamp = MakeTimestamp(i),
+			.site = "foo",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+
+	/* old records were evicted at the configured size, not at
+	   the size of the allocation */
+	const auto n_small = db.GetRecordCount();
+	EXPECT_GT(n_small, 0U);
+	EXPECT_LT(n_small, N);
+	EXPECT_LE(db.GetMemoryUsage(), db.GetMemoryCapacity());
+
+	/* growing keeps all records and makes room for more */
+	db.Resize(16 * 1024 * 1024);
+	EXPECT_EQ(db.GetMemoryCapacity(), 16 * 1024 * 1024U);
+	EXPECT_EQ(db.GetRecordCount(), n_small);
+
+	for (unsigned i = N; i < 2 * N; ++i)
+		Push(db, {
+			.timestamp = MakeTimestamp(i),
+			.site = "foo",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+
+	EXPECT_GT(db.GetRecordCount(), n_small);
+
+	/* shrinking deletes the oldest records */
+	db.Resize(4 * 1024 * 1024);
+	EXPECT_LE(db.GetMemoryUsage(), db.GetMemoryCapacity());
+	EXPECT_LE(db.GetRecordCount(), n_small);
+
+	/* the newest records are still there */
+	{
+		Filter filter;
+		filter.sites.emplace("foo");
+
+		auto selection = db.SelectLast(filter);
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(2 * N - 1));
+	}
+
+	db.Clear();
+	EXPECT_EQ(db.GetRecordCount(), 0U);
+}
+
+/**
+ * Returns the resident memory of this process in bytes.
+ */
+static std::size_t
+GetResidentSize() noexcept
+{
+	std::size_t size = 0, resident = 0;
+	if (FILE *f = fopen("/proc/self/statm", "r")) {
+		if (fscanf(f, "%zu %zu", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+TEST(Database, ReservedResident)
+{
+	/* 4 MB, but room for growing to 64 MB */
+	Database db{DatabaseConfig{
+		.size = 4 * 1024 * 1024,
+		.max_size = 64 * 1024 * 1024,
+	}};
+
+	const std::size_t before = GetResidentSize();
+	if (before == 0)
+		GTEST_SKIP() << "/proc/self/statm not available";
+
+	/* enough records to move the ring through the whole
+	   reservation several times */
+	for (unsigned i = 0; i < 2000000; ++i)
+		Push(db, {
+			.timestamp = MakeTimestamp(i),
+			.site = "foo",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+
+	/* the pages behind the oldest record have been released
+	   all the time, not only by Compress() */
+	EXPECT_LT(GetResidentSize(), before + 24 * 1024 * 1024);
+}
+
+TEST(Database, MaxSiteShare)
+{
+	/* 2 MB for uncompressed records, 2 MB for compressed ones;
+	   one site may occupy at most 50% of the uncompressed
+	   records */
+	Database db{DatabaseConfig{
+		.size = 4 * 1024 * 1024,
+		.cold_size = 2 * 1024 * 1024,
+		.max_site_share = 50,
+	}};
+
+	static constexpr unsigned N = 200000;
+
+	/* "big" floods the database, "small" sends every tenth
+	   datagram */
+	for (unsigned i = 0; i < N; ++i)
+		Push(db, {
+			.timestamp = MakeTimestamp(i),
+			.site = (i % 10) == 0 ? "small" : "big",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+
+	/* records of "big" were deleted instead of being
+	   compressed */
+	EXPECT_GT(db.GetColdRecordCount(), 0U);
+	EXPECT_LT(db.GetRecordCount(), N);
+
+	/* but all records of "small" were kept */
+	Filter filter;
+	filter.sites.emplace("small");
+
+	auto selection = db.Select(filter);
+	for (unsigned i = 0; i < N; i += 10) {
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+		EXPECT_EQ(GetSite(*selection), "small");
+		++selection;
+	}
+
+	ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+}
+
+TEST(Database, MaxSiteShareAccounting)
+{
+	/* 2 MB for uncompressed records, 2 MB for compressed ones;
+	   one site may occupy at most 1 MB of the uncompressed
+	   records */
+	Database db{DatabaseConfig{
+		.size = 4 * 1024 * 1024,
+		.cold_size = 2 * 1024 * 1024,
+		.max_site_share = 50,
+	}};
+
+	unsigned n = 0;
+
+	/* "big" exceeds its share only by a little */
+	while (db.GetMemoryUsage() < 1400 * 1024)
+		Push(db, {
+			.timestamp = MakeTimestamp(n++),
+			.site = "big",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+
+	/* "small" fills the rest until the first records are
+	   evicted from the ring */
+	while (db.GetRecordCount() == n)
+		Push(db, {
+			.timestamp = MakeTimestamp(n++),
+			.site = "small",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+
+	/* only the excess of "big" was deleted, the rest of the
+	   block was compressed */
+	EXPECT_GT(db.GetColdRecordCount(), 0U);
+}
+
+TEST(Database, Rings)
+{
+	/* a small main ring for access logs, a separate ring for
+	   errors */
+	const std::vector<RingConfig> rings{
+		{.type = Net::Log::Type::HTTP_ERROR, .size = 1024 * 1024},
+	};
+
+	Database db{DatabaseConfig{
+		.size = 256 * 1024,
+		.rings = rings,
+	}};
+
+	TestAppendListener listener;
+	auto follow = db.Follow({}, listener);
+
+	static constexpr unsigned N = 100000;
+
+	/* access logs flood the database, every 1000th datagram is
+	   an error */
+	for (unsigned i = 0; i < N; ++i)
+		Push(db, {
+			.timestamp = MakeTimestamp(i),
+			.site = "a",
+			.type = (i % 1000) == 0
+				? Net::Log::Type::HTTP_ERROR
+				: Net::Log::Type::HTTP_ACCESS,
+		});
+
+	/* the merged listener was notified */
+	EXPECT_FALSE(listener.records.empty());
+
+	/* access logs were evicted */
+	EXPECT_LT(db.GetRecordCount(), N);
+
+	/* but all errors were kept, and a type filter finds them in
+	   their ring */
+	Filter filter;
+	filter.type = Net::Log::Type::HTTP_ERROR;
+
+	auto selection = db.Select(filter);
+	for (unsigned i = 0; i < N; i += 1000) {
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+		++selection;
+	}
+
+	ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+
+	/* the same with a site filter */
+	filter.sites.emplace("a");
+	selection = db.Select(filter);
+	for (unsigned i = 0; i < N; i += 1000) {
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+		++selection;
+	}
+
+	ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+
+	/* without a type filter, both rings are merged in the order
+	   the datagrams were received */
+	unsigned n_errors = 0, n_total = 0;
+	uint64_t last_id = 0;
+	for (selection = db.Select({});
+	     selection.Update(1024 * 1024) == Selection::UpdateResult::READY;
+	     ++selection) {
+		EXPECT_GT(selection->GetId(), last_id);
+		last_id = selection->GetId();
+
+		if (selection->GetParsed().type == Net::Log::Type::HTTP_ERROR)
+			++n_errors;
+		++n_total;
+	}
+
+	EXPECT_EQ(n_errors, N / 1000);
+	EXPECT_EQ(n_total, db.GetRecordCount());
+
+	/* the newest record was seen last */
+	listener.records.clear();
+	Push(db, {
+		.timestamp = MakeTimestamp(N),
+		.site = "a",
+		.type = Net::Log::Type::HTTP_ERROR,
+	});
+	ASSERT_FALSE(listener.records.empty());
+	EXPECT_EQ(listener.records.back()->GetParsed().timestamp, MakeTimestamp(N));
+}
+
+TEST(Database, Sampling)
+{
+	const std::chrono::steady_clock::time_point start =
+		std::chrono::steady_clock::time_point{} + std::chrono::hours(42);
+	ClockCache<std::chrono::steady_clock> clock;
+
+	/* 4 MB shall last for 24 hours */
+	Database db{DatabaseConfig{
+		.size = 4 * 1024 * 1024,
+		.min_coverage = std::chrono::hours{24},
+	}};
+
+	/* 1000 datagrams per second for 100 seconds; every 100th one
+	   is an error */
+	static constexpr unsigned N = 100000;
+	unsigned n_access = 0, n_errors = 0;
+
+	for (unsigned i = 0; i < N; ++i) {
+		clock.Mock(start + std::chrono::milliseconds{i});
+
+		const bool error = (i % 100) == 0;
+		const auto *record = CheckPush(db, {
+			.timestamp = MakeTimestamp(0) +
+				std::chrono::duration_cast<Net::Log::Duration>(std::chrono::milliseconds{i}),
+			.site = (i % 2) == 0 ? "a" : "b",
+			.type = error
+				? Net::Log::Type::HTTP_ERROR
+				: Net::Log::Type::HTTP_ACCESS,
+		}, clock);
+
+		if (error) {
+			/* errors are never sampled */
+			ASSERT_NE(record, nullptr);
+			EXPECT_EQ(record->GetWeight(), 1U);
+			++n_errors;
+		} else
+			++n_access;
 	}
+
+	/* most access datagrams were discarded */
+	EXPECT_GT(db.GetSampledCount(), n_access / 2);
+	EXPECT_EQ(db.GetRecordCount() + db.GetSampledCount(), N);
+
+	/* but their weights add up to the original number */
+	uint64_t access_weight = 0;
+	unsigned n_weighted = 0;
+	unsigned n_error_records = 0;
+	for (auto s = db.Select({});
+	     s.Update(1024 * 1024) == Selection::UpdateResult::READY; ++s) {
+		if (s->GetParsed().type == Net::Log::Type::HTTP_ERROR) {
+			++n_error_records;
+			continue;
+		}
+
+		access_weight += s->GetWeight();
+		if (s->GetWeight() > 1)
+			++n_weighted;
+	}
+
+	EXPECT_EQ(n_error_records, n_errors);
+	EXPECT_GT(n_weighted, 0U);
+	EXPECT_NEAR(double(access_weight), double(n_access), 4 * 1024);
+}
+
+TEST(Database, SamplingSkewedSender)
+{
+	const std::chrono::steady_clock::time_point start =
+		std::chrono::steady_clock::time_point{} + std::chrono::hours(42);
+	ClockCache<std::chrono::steady_clock> clock;
+
+	/* 4 MB shall last for 24 hours */
+	Database db{DatabaseConfig{
+		.size = 4 * 1024 * 1024,
+		.min_coverage = std::chrono::hours{24},
+	}};
+
+	/* 1000 datagrams per second for 100 seconds; the clock of
+	   host "b" is one hour behind, which must not disturb the
+	   sampling windows */
+	static constexpr unsigned N = 100000;
+
+	for (unsigned i = 0; i < N; ++i) {
+		clock.Mock(start + std::chrono::milliseconds{i});
+
+		const bool skewed = (i % 2) != 0;
+		auto timestamp = MakeTimestamp(0) +
+			std::chrono::duration_cast<Net::Log::Duration>(std::chrono::milliseconds{i});
+		if (skewed)
+			timestamp -= std::chrono::hours{1};
+
+		CheckPush(db, {
+			.timestamp = timestamp,
+			.site = skewed ? "b" : "a",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		}, clock);
+	}
+
+	/* most access datagrams were discarded */
+	EXPECT_GT(db.GetSampledCount(), N / 2);
+	EXPECT_EQ(db.GetRecordCount() + db.GetSampledCount(), N);
 }
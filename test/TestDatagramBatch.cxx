@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "DatagramBatch.hxx"
+#include "DatagramScanner.hxx"
+#include "ReceiverBatch.hxx"
+#include "SenderTable.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Parser.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h> // for htonl()
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using std::string_view_literals::operator""sv;
+
+static std::span<std::byte>
+SerializeSpan(std::span<std::byte> buffer, const Net::Log::Datagram &d)
+{
+	return buffer.first(Net::Log::Serialize(buffer, d));
+}
+
+/**
+ * Pass a SCM_TIMESTAMPNS control message to
+ * DatagramBatch::HandleControlMessage().
+ */
+static void
+HandleTimestamp(DatagramBatch &batch, const struct timespec &ts)
+{
+	alignas(struct cmsghdr) std::array<std::byte, DatagramBatch::CONTROL_SIZE> buffer{};
+	auto &cmsg = *reinterpret_cast<struct cmsghdr *>(buffer.data());
+	cmsg.cmsg_level = SOL_SOCKET;
+	cmsg.cmsg_type = SCM_TIMESTAMPNS;
+	cmsg.cmsg_len = CMSG_LEN(sizeof(ts));
+	memcpy(CMSG_DATA(&cmsg), &ts, sizeof(ts));
+
+	batch.HandleControlMessage(cmsg);
+}
+
+TEST(DatagramBatch, ReceiveTime)
+{
+	Net::Log::Datagram d;
+	d.site = "example";
+	d.http_uri = "/";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+
+	std::array<std::byte, 4096> buffer1;
+	const auto without_timestamp = SerializeSpan(buffer1, d);
+
+	std::array<std::byte, 4096> buffer3;
+	const auto receive_timestamp = SerializeSpan(buffer3, d);
+
+	d.timestamp = Net::Log::TimePoint{Net::Log::Duration{1234567890}};
+	std::array<std::byte, 4096> buffer2;
+	const auto with_timestamp = SerializeSpan(buffer2, d);
+
+	static constexpr struct timespec ts{1700000000, 123456789};
+	const auto receive_time = Net::Log::FromSystem(std::chrono::system_clock::from_time_t(ts.tv_sec) +
+						       std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds{ts.tv_nsec}));
+
+	DatagramBatch batch{4};
+
+	/* no receive time known: no time stamp */
+	batch.Add(without_timestamp);
+
+	/* the receive time is attached */
+	HandleTimestamp(batch, ts);
+	batch.Add(receive_timestamp);
+
+	/* the datagram's own time stamp wins */
+	HandleTimestamp(batch, ts);
+	batch.Add(with_timestamp);
+
+	batch.Parse();
+
+	const auto datagrams = batch.GetDatagrams();
+	ASSERT_EQ(datagrams.size(), 3U);
+
+	EXPECT_FALSE(datagrams[0].parsed.HasTimestamp());
+	EXPECT_EQ(datagrams[0].raw.data(), without_timestamp.data());
+
+	EXPECT_TRUE(datagrams[1].parsed.HasTimestamp());
+	EXPECT_EQ(datagrams[1].parsed.timestamp, receive_time);
+	EXPECT_EQ(datagrams[1].parsed.site.Get(datagrams[1].raw), "example"sv);
+
+	/* the time stamp was appended to the raw datagram in place,
+	   and its CRC is still valid */
+	EXPECT_EQ(datagrams[1].raw.data(), receive_timestamp.data());
+	EXPECT_EQ(datagrams[1].raw.size(),
+		  receive_timestamp.size() + DatagramBatch::TIMESTAMP_ROOM);
+
+	const auto scanned = ScanDatagram(datagrams[1].raw);
+	ASSERT_TRUE(scanned);
+	EXPECT_EQ(scanned->timestamp, receive_time);
+
+	const auto full = Net::Log::ParseDatagram(datagrams[1].raw);
+	EXPECT_EQ(full.timestamp, receive_time);
+	EXPECT_EQ(full.site, "example"sv);
+	EXPECT_EQ(full.http_uri, "/"sv);
+
+	EXPECT_EQ(datagrams[2].parsed.timestamp, d.timestamp);
+	EXPECT_EQ(datagrams[2].raw.data(), with_timestamp.data());
+}
+
+static SenderAddress
+MakeSenderAddress(uint32_t n)
+{
+	struct sockaddr_in sin{};
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0xc0000200 + n);
+	return SenderAddress::FromSocketAddress((const struct sockaddr *)&sin,
+						sizeof(sin));
+}
+
+TEST(DatagramBatch, SenderRateLimit)
+{
+	Net::Log::Datagram d;
+	d.site = "example";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+
+	std::array<std::byte, 4096> buffer;
+	const auto raw = SerializeSpan(buffer, d);
+
+	const auto noisy = MakeSenderAddress(1), quiet = MakeSenderAddress(2);
+	EXPECT_EQ(noisy.ToString(), "192.0.2.1");
+
+	SenderTable senders{TokenBucketConfig{.rate = 1, .burst = 4}};
+
+	DatagramBatch batch{16};
+	for (unsigned i = 0; i < 10; ++i)
+		batch.Add(raw, noisy);
+	batch.Add(raw, quiet);
+
+	batch.Parse(&senders);
+
+	EXPECT_EQ(batch.GetReceivedCount(), 11U);
+	EXPECT_EQ(batch.GetMalformedCount(), 0U);
+	EXPECT_EQ(batch.GetRejectedCount(), 6U);
+	EXPECT_EQ(batch.GetDatagrams().size(), 5U);
+
+	const auto top = senders.GetTop(1);
+	ASSERT_EQ(top.size(), 1U);
+	EXPECT_EQ(top.front().address, noisy);
+	EXPECT_EQ(top.front().n_received, 10U);
+	EXPECT_EQ(top.front().n_discarded, 6U);
+
+	EXPECT_EQ(senders.GetTop(10).size(), 2U);
+}
+
+TEST(SenderTable, Full)
+{
+	SenderTable senders{TokenBucketConfig{.rate = 1, .burst = 4}};
+
+	std::vector<SenderAddress> addresses;
+	addresses.reserve(SenderTable::MAX_SENDERS);
+	for (uint32_t i = 0; i < SenderTable::MAX_SENDERS; ++i)
+		addresses.push_back(MakeSenderAddress(i));
+
+	auto accepted = std::make_unique<bool[]>(addresses.size());
+	EXPECT_EQ(senders.Check(addresses, 0, accepted.get()), 0U);
+
+	/* a flood from more senders which do not fit into the table
+	   shares one token bucket */
+	addresses.clear();
+	for (uint32_t i = 0; i < 10; ++i)
+		addresses.push_back(MakeSenderAddress(SenderTable::MAX_SENDERS + i));
+
+	EXPECT_EQ(senders.Check(addresses, 0, accepted.get()), 6U);
+	for (unsigned i = 0; i < addresses.size(); ++i)
+		EXPECT_EQ(accepted[i], i < 4);
+
+	/* after Compress() has made room, new senders get their own
+	   bucket again */
+	senders.Compress(100, 10);
+	EXPECT_EQ(senders.Check(addresses, 100, accepted.get()), 0U);
+	EXPECT_EQ(senders.GetTop(100).size(), 10U);
+}
+
+TEST(ReceiverBatch, LargeDatagrams)
+{
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+
+	static constexpr unsigned N = 16;
+
+	/* more large datagrams than fit into one slot each, all
+	   received with one recvmmsg() call */
+	std::array<std::size_t, N> sizes;
+	for (unsigned i = 0; i < N; ++i) {
+		const std::string message(10000 + i, 'x');
+
+		Net::Log::Datagram d;
+		d.site = "example";
+		d.message = message;
+		d.type = Net::Log::Type::HTTP_ERROR;
+
+		std::array<std::byte, 16384> buffer;
+		const auto raw = SerializeSpan(buffer, d);
+		ASSERT_EQ(send(fds[0], raw.data(), raw.size(), 0),
+			  ssize_t(raw.size()));
+		sizes[i] = raw.size();
+	}
+
+	ReceiverBatch batch{N};
+	ASSERT_TRUE(batch.Receive(SocketDescriptor{fds[1]}));
+	batch.Parse();
+
+	EXPECT_EQ(batch.GetReceivedCount(), N);
+	EXPECT_EQ(batch.GetTruncatedCount(), 0U);
+	EXPECT_EQ(batch.GetMalformedCount(), 0U);
+
+	const auto datagrams = batch.GetDatagrams();
+	ASSERT_EQ(datagrams.size(), N);
+	for (unsigned i = 0; i < N; ++i)
+		EXPECT_EQ(datagrams[i].raw.size(), sizes[i]);
+
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,165 @@
+#include "DatagramScanner.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Parser.hxx"
+#include "http/Method.hxx"
+#include "http/Status.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::copy()
+#include <array>
+
+using std::string_view_literals::operator""sv;
+
+static std::span<const std::byte>
+SerializeSpan(std::span<std::byte> buffer, const Net::Log::Datagram &d)
+{
+	return buffer.first(Net::Log::Serialize(buffer, d));
+}
+
+static void
+ExpectEqual(const SmallDatagram &a, const SmallDatagram &b,
+	    std::span<const std::byte> raw)
+{
+	EXPECT_EQ(a.timestamp, b.timestamp);
+
+	EXPECT_EQ(a.site.IsNull(), b.site.IsNull());
+	EXPECT_EQ(a.site.Get(raw), b.site.Get(raw));
+	EXPECT_EQ(a.host.IsNull(), b.host.IsNull());
+	EXPECT_EQ(a.host.Get(raw), b.host.Get(raw));
+	EXPECT_EQ(a.generator.IsNull(), b.generator.IsNull());
+	EXPECT_EQ(a.generator.Get(raw), b.generator.Get(raw));
+	EXPECT_EQ(a.http_uri.IsNull(), b.http_uri.IsNull());
+	EXPECT_EQ(a.http_uri.Get(raw), b.http_uri.Get(raw));
+	EXPECT_EQ(a.http_status, b.http_status);
+	EXPECT_EQ(a.http_method, b.http_method);
+	EXPECT_EQ(a.type, b.type);
+	EXPECT_EQ(a.valid_duration, b.valid_duration);
+	if (a.valid_duration)
+		EXPECT_EQ(a.duration, b.duration);
+}
+
+TEST(DatagramScanner, Access)
+{
+	Net::Log::Datagram d;
+	d.timestamp = Net::Log::TimePoint{Net::Log::Duration{1234567890}};
+	d.remote_host = "192.0.2.1";
+	d.host = "www.example.com";
+	d.site = "example";
+	d.generator = "gen";
+	d.forwarded_to = "192.0.2.2:80";
+	d.http_uri = "/index.html";
+	d.http_referer = "https://www.example.com/";
+	d.user_agent = "Mozilla/5.0";
+	d.http_method = HttpMethod::GET;
+	d.http_status = HttpStatus::OK;
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	d.duration = std::chrono::milliseconds{42};
+	d.valid_duration = true;
+
+	std::array<std::byte, 4096> buffer;
+	const auto raw = SerializeSpan(buffer, d);
+
+	const auto scanned = ScanDatagram(raw);
+	ASSERT_TRUE(scanned);
+	ExpectEqual(*scanned, SmallDatagram{Net::Log::ParseDatagram(raw), raw}, raw);
+
+	EXPECT_EQ(scanned->site.Get(raw), "example"sv);
+	EXPECT_EQ(scanned->host.Get(raw), "www.example.com"sv);
+	EXPECT_EQ(scanned->http_uri.Get(raw), "/index.html"sv);
+	EXPECT_TRUE(scanned->generator.Get(raw) == "gen"sv);
+}
+
+TEST(DatagramScanner, Empty)
+{
+	std::array<std::byte, 4096> buffer;
+	const auto raw = SerializeSpan(buffer, {});
+
+	const auto scanned = ScanDatagram(raw);
+	ASSERT_TRUE(scanned);
+	ExpectEqual(*scanned, SmallDatagram{Net::Log::ParseDatagram(raw), raw}, raw);
+	EXPECT_FALSE(scanned->HasTimestamp());
+	EXPECT_TRUE(scanned->site.IsNull());
+	EXPECT_TRUE(scanned->host.IsNull());
+}
+
+TEST(DatagramScanner, Fallback)
+{
+	Net::Log::Datagram d;
+	d.site = "example";
+	d.type = Net::Log::Type::HTTP_ERROR;
+	d.message = "Something went wrong"sv;
+
+	std::array<std::byte, 4096> buffer;
+	const auto raw = SerializeSpan(buffer, d);
+
+	/* the scanner may leave MESSAGE to the full parser, but
+	   ParseSmallDatagram() must handle it either way */
+	const auto parsed = ParseSmallDatagram(raw);
+	EXPECT_EQ(parsed.site.Get(raw), "example"sv);
+	EXPECT_EQ(parsed.type, Net::Log::Type::HTTP_ERROR);
+}
+
+static bool
+IsInside(SmallDatagram::StringRef s, std::span<const std::byte> raw) noexcept
+{
+	return s.IsNull() || std::size_t{s.offset} + s.size < raw.size();
+}
+
+TEST(DatagramScanner, Malformed)
+{
+	Net::Log::Datagram d;
+	d.site = "example";
+	d.host = "www.example.com";
+	d.http_uri = "/";
+
+	std::array<std::byte, 4096> buffer;
+	const auto raw = SerializeSpan(buffer, d);
+
+	/* the CRC check rejects truncated datagrams, but whatever
+	   the scanner accepts must never reference memory beyond
+	   the end */
+	for (std::size_t size = 0; size < raw.size(); ++size) {
+		const auto truncated = raw.first(size);
+		const auto scanned = ScanDatagram(truncated);
+		if (!scanned)
+			continue;
+
+		EXPECT_TRUE(IsInside(scanned->site, truncated));
+		EXPECT_TRUE(IsInside(scanned->host, truncated));
+		EXPECT_TRUE(IsInside(scanned->http_uri, truncated));
+	}
+
+	/* a datagram without magic is always rejected */
+	EXPECT_FALSE(ScanDatagram(raw.subspan(4)));
+	EXPECT_THROW(ParseSmallDatagram(raw.subspan(4)),
+		     Net::Log::ProtocolError);
+}
+
+TEST(DatagramScanner, Crc)
+{
+	Net::Log::Datagram d;
+	d.site = "example";
+	d.http_uri = "/index.html";
+	d.type = Net::Log::Type::HTTP_ACCESS;
+
+	std::array<std::byte, 4096> buffer;
+	const auto raw = SerializeSpan(buffer, d);
+
+	/* the scanner handles this datagram by itself */
+	ASSERT_TRUE(ScanDatagram(raw));
+
+	/* a corrupt datagram is rejected by the scanner and by the
+	   full parser */
+	std::array<std::byte, 4096> copy;
+	std::copy(raw.begin(), raw.end(), copy.begin());
+	const std::span<const std::byte> corrupt{copy.data(), raw.size()};
+
+	for (std::size_t i = 4; i < raw.size(); ++i) {
+		copy[i] ^= std::byte{0x20};
+		EXPECT_FALSE(ScanDatagram(corrupt));
+		EXPECT_THROW(ParseSmallDatagram(corrupt),
+			     Net::Log::ProtocolError);
+		copy[i] = raw[i];
+	}
+}
@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "ReceiverFilter.hxx"
+#include "DatagramScanner.hxx"
+#include "net/log/Protocol.hxx"
+#include "net/log/Serializer.hxx"
+#include "net/log/Datagram.hxx"
+#include "http/Method.hxx"
+#include "http/Status.hxx"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <string>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <zlib.h> // for crc32()
+
+using namespace Net::Log;
+
+namespace {
+
+/**
+ * Build raw datagrams without the libcommon serializer, to control
+ * the order of attributes exactly.
+ */
+class RawDatagram {
+	std::string s;
+
+public:
+	explicit RawDatagram(uint32_t magic=MAGIC_V2) noexcept {
+		for (int i = 3; i >= 0; --i)
+			s.push_back(static_cast<char>(magic >> (8 * i)));
+	}
+
+	RawDatagram &&String(Attribute a, std::string_view value) && noexcept {
+		s.push_back(static_cast<char>(a));
+		s.append(value);
+		s.push_back('\0');
+		return std::move(*this);
+	}
+
+	RawDatagram &&Fixed(Attribute a, std::size_t size) && noexcept {
+		s.push_back(static_cast<char>(a));
+		s.append(size, '\x01');
+		return std::move(*this);
+	}
+
+	RawDatagram &&WithType(Type type) && noexcept {
+		s.push_back(static_cast<char>(Attribute::TYPE));
+		s.push_back(static_cast<char>(type));
+		return std::move(*this);
+	}
+
+	/**
+	 * Finish a version 2 datagram by appending the CRC.
+	 */
+	std::string V2() && noexcept {
+		const uint32_t crc = crc32(0, (const Bytef *)s.data() + 4,
+					   s.size() - 4);
+		for (int i = 3; i >= 0; --i)
+			s.push_back(static_cast<char>(crc >> (8 * i)));
+		return std::move(s);
+	}
+
+	std::string V1() && noexcept {
+		return std::move(s);
+	}
+};
+
+class SocketPair {
+	int fds[2];
+
+public:
+	SocketPair() {
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
+			throw std::runtime_error{"socketpair() failed"};
+	}
+
+	~SocketPair() noexcept {
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	bool Attach(std::span<const struct sock_filter> program) noexcept {
+		const struct sock_fprog fprog{
+			.len = static_cast<unsigned short>(program.size()),
+			.filter = const_cast<struct sock_filter *>(program.data()),
+		};
+
+		return setsockopt(fds[1], SOL_SOCKET, SO_ATTACH_FILTER,
+				  &fprog, sizeof(fprog)) == 0;
+	}
+
+	bool Attach(FileDescriptor ebpf) noexcept {
+		const int fd = ebpf.Get();
+		return setsockopt(fds[1], SOL_SOCKET, SO_ATTACH_BPF,
+				  &fd, sizeof(fd)) == 0;
+	}
+
+	/**
+	 * Send a datagram through the filter.
+	 *
+	 * @return true if the datagram was accepted by the filter
+	 */
+	bool Pass(std::string_view datagram) {
+		static constexpr std::string_view marker = "MARK";
+
+		send(fds[0], datagram.data(), datagram.size(), 0);
+		send(fds[0], marker.data(), marker.size(), 0);
+
+		std::array<char, 4096> buffer;
+		auto nbytes = recv(fds[1], buffer.data(), buffer.size(), 0);
+		if (std::string_view{buffer.data(), std::size_t(nbytes)} == marker)
+			return false;
+
+		EXPECT_EQ(std::size_t(nbytes), datagram.size());
+
+		/* consume the marker */
+		recv(fds[1], buffer.data(), buffer.size(), 0);
+		return true;
+	}
+};
+
+static const ReceiverFilterRule rules[] = {
+	{.accept = false, .site_prefix = "test-"},
+	{.accept = true, .type = Type::HTTP_ERROR},
+	{.accept = true, .type = Type::JOB},
+};
+
+static bool
+Check(const ReceiverFilter &filter, std::string_view raw)
+{
+	const std::span<const std::byte> r{(const std::byte *)raw.data(), raw.size()};
+	return filter.Check(ParseSmallDatagram(r), r);
+}
+
+/**
+ * Serialize a HTTP_ACCESS datagram the way a web server would send
+ * it, with strings much longer than the classic BPF program can
+ * skip.
+ */
+static std::string
+MakeAccessDatagram(const char *site, Type type=Type::HTTP_ACCESS)
+{
+	Datagram d;
+	d.timestamp = FromSystem(std::chrono::system_clock::now());
+	d.remote_host = "2001:db8::1";
+	d.host = "www.example.com";
+	d.site = site;
+	d.forwarded_to = "[2001:db8::2]:8080";
+	d.http_uri = "/wp-content/themes/example/style.css?ver=6.4.2";
+	d.http_referer = "https://www.example.com/blog/2024/01/some-article/";
+	d.user_agent = "Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0";
+	d.http_method = HttpMethod::GET;
+	d.http_status = HttpStatus::OK;
+	d.type = type;
+	d.length = 12345;
+	d.valid_length = true;
+	d.duration = std::chrono::microseconds{1234};
+	d.valid_duration = true;
+
+	std::array<std::byte, 4096> buffer;
+	return std::string{(const char *)buffer.data(), Serialize(buffer, d)};
+}
+
+} // anonymous namespace
+
+TEST(ReceiverFilter, Check)
+{
+	const ReceiverFilter filter{rules};
+	ASSERT_TRUE(filter.IsEnabled());
+
+	EXPECT_FALSE(Check(filter, RawDatagram{}.String(Attribute::SITE, "foo").WithType(Type::HTTP_ACCESS).V2()));
+	EXPECT_TRUE(Check(filter, RawDatagram{}.String(Attribute::SITE, "foo").WithType(Type::HTTP_ERROR).V2()));
+	EXPECT_TRUE(Check(filter, RawDatagram{}.WithType(Type::JOB).V2()));
+	EXPECT_FALSE(Check(filter, RawDatagram{}.String(Attribute::SITE, "test-foo").WithType(Type::HTTP_ERROR).V2()));
+	EXPECT_FALSE(Check(filter, RawDatagram{}.String(Attribute::SITE, "foo").V2()));
+
+	/* no "accept" rule: accept by default */
+	static const ReceiverFilterRule drop_rules[] = {
+		{.accept = false, .type = Type::SSH},
+	};
+
+	const ReceiverFilter drop_filter{drop_rules};
+	EXPECT_TRUE(Check(drop_filter, RawDatagram{}.WithType(Type::HTTP_ACCESS).V2()));
+	EXPECT_FALSE(Check(drop_filter, RawDatagram{}.WithType(Type::SSH).V2()));
+}
+
+TEST(ReceiverFilter, BPF)
+{
+	const ReceiverFilter filter{rules};
+	const auto program = filter.CompileBPF();
+	ASSERT_FALSE(program.empty());
+	ASSERT_LE(program.size(), std::size_t{BPF_MAXINSNS});
+
+	SocketPair sp;
+	ASSERT_TRUE(sp.Attach(program));
+
+	/* decided by the kernel */
+	EXPECT_FALSE(sp.Pass(RawDatagram{}
+			     .Fixed(Attribute::TIMESTAMP, 8)
+			     .String(Attribute::REMOTE_HOST, "192.0.2.1")
+			     .String(Attribute::SITE, "foo")
+			     .Fixed(Attribute::HTTP_METHOD, 1)
+			     .String(Attribute::HTTP_URI, "/")
+			     .Fixed(Attribute::HTTP_STATUS, 2)
+			     .Fixed(Attribute::TRAFFIC, 16)
+			     .WithType(Type::HTTP_ACCESS).V2()));
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::SITE, "foo").WithType(Type::HTTP_ERROR).V2()));
+	EXPECT_TRUE(sp.Pass(RawDatagram{MAGIC_V1}.WithType(Type::JOB).String(Attribute::SITE, "foo").V1()));
+	EXPECT_FALSE(sp.Pass(RawDatagram{MAGIC_V1}.String(Attribute::SITE, "foo").WithType(Type::HTTP_ACCESS).V1()));
+	EXPECT_FALSE(sp.Pass(RawDatagram{}.String(Attribute::SITE, "test-foo").WithType(Type::HTTP_ERROR).V2()));
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::SITE, "test").WithType(Type::HTTP_ERROR).V2()));
+	EXPECT_FALSE(sp.Pass(RawDatagram{}.String(Attribute::SITE, "foo").V2()));
+	EXPECT_FALSE(sp.Pass(RawDatagram{}.String(Attribute::HOST, std::string(63, 'h')).WithType(Type::HTTP_ACCESS).V2()));
+
+	/* undecidable in the kernel; left to userspace */
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::HTTP_URI, std::string(200, 'u')).WithType(Type::HTTP_ACCESS).V2()));
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::MESSAGE, "foo").WithType(Type::HTTP_ACCESS).V2()));
+	EXPECT_TRUE(sp.Pass("garbage"));
+}
+
+TEST(ReceiverFilter, BPFTypeOnly)
+{
+	/* with only type rules, the program can decide as soon as it
+	   has seen the TYPE attribute */
+	static const ReceiverFilterRule type_rules[] = {
+		{.accept = true, .type = Type::HTTP_ERROR},
+		{.accept = true, .type = Type::JOB},
+	};
+
+	const ReceiverFilter filter{type_rules};
+	const auto program = filter.CompileBPF();
+
+	SocketPair sp;
+	ASSERT_TRUE(sp.Attach(program));
+
+	EXPECT_FALSE(sp.Pass(RawDatagram{}.WithType(Type::HTTP_ACCESS).String(Attribute::HTTP_URI, std::string(200, 'u')).V2()));
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.WithType(Type::JOB).String(Attribute::HTTP_URI, std::string(200, 'u')).V2()));
+
+	/* undecidable in the kernel; left to userspace */
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::HTTP_URI, std::string(200, 'u')).WithType(Type::HTTP_ACCESS).V2()));
+}
+
+TEST(ReceiverFilter, EBPF)
+{
+	const ReceiverFilter filter{rules};
+
+	UniqueFileDescriptor ebpf;
+	try {
+		ebpf = filter.LoadEBPF();
+	} catch (...) {
+		GTEST_SKIP() << "eBPF not available";
+	}
+
+	SocketPair sp;
+	ASSERT_TRUE(sp.Attach(ebpf));
+
+	/* realistic access log datagrams are decided by the kernel */
+	EXPECT_FALSE(sp.Pass(MakeAccessDatagram("foo")));
+	EXPECT_TRUE(sp.Pass(MakeAccessDatagram("foo", Type::HTTP_ERROR)));
+	EXPECT_FALSE(sp.Pass(MakeAccessDatagram("test-foo", Type::HTTP_ERROR)));
+
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::SITE, "foo").WithType(Type::HTTP_ERROR).V2()));
+	EXPECT_TRUE(sp.Pass(RawDatagram{MAGIC_V1}.WithType(Type::JOB).String(Attribute::SITE, "foo").V1()));
+	EXPECT_FALSE(sp.Pass(RawDatagram{MAGIC_V1}.String(Attribute::SITE, "foo").WithType(Type::HTTP_ACCESS).V1()));
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::SITE, "test").WithType(Type::HTTP_ERROR).V2()));
+	EXPECT_FALSE(sp.Pass(RawDatagram{}.String(Attribute::SITE, "foo").V2()));
+	EXPECT_FALSE(sp.Pass(RawDatagram{}.String(Attribute::HTTP_URI, std::string(2000, 'u')).WithType(Type::HTTP_ACCESS).V2()));
+
+	/* undecidable in the kernel; left to userspace */
+	EXPECT_TRUE(sp.Pass(RawDatagram{}.String(Attribute::MESSAGE, "foo").WithType(Type::HTTP_ACCESS).V2()));
+	EXPECT_TRUE(sp.Pass("garbage"));
+}
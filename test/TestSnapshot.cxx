@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <mk@cm4all.com>
+
+#include "Snapshot.hxx"
+#include "Database.hxx"
+#include "Filter.hxx"
+#include "Selection.hxx"
+#include "event/Loop.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "net/log/Serializer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include <fcntl.h>
+#include <stdlib.h> // for mkstemp()
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr auto
+MakeTimestamp(unsigned t)
+{
+	/* start at this offset to avoid integer underflows */
+	constexpr Net::Log::Duration offset = std::chrono::hours{24};
+
+	return Net::Log::TimePoint(offset + Net::Log::Duration(t));
+}
+
+static void
+Push(Database &db, unsigned i)
+{
+	std::byte buffer[16384];
+	size_t size = Net::Log::Serialize(buffer, {
+			.timestamp = MakeTimestamp(i),
+			.site = (i % 3) == 0 ? "foo" : "bar",
+			.http_uri = "/index.html",
+			.type = Net::Log::Type::HTTP_ACCESS,
+		});
+	db.Emplace({buffer, size});
+}
+
+/**
+ * Check that the #Database contains exactly the records pushed
+ * with the given numbers.
+ */
+static void
+ExpectRecords(Database &db, unsigned n)
+{
+	auto selection = db.Select(Filter{});
+	for (unsigned i = 0; i < n; ++i, ++selection) {
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+	}
+
+	EXPECT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+}
+
+[[gnu::pure]]
+static uint64_t
+GetFileSize(const char *path) noexcept
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+TEST(Snapshot, RoundTrip)
+{
+	char path[] = "/tmp/TestSnapshot.XXXXXX";
+	const int tmp_fd = mkstemp(path);
+	ASSERT_GE(tmp_fd, 0);
+	close(tmp_fd);
+
+	static constexpr std::size_t DB_SIZE = 1024 * 1024;
+	static constexpr unsigned N = 100;
+
+	/* write a snapshot and load it into another database */
+	{
+		Database db{DatabaseConfig{.size = DB_SIZE}};
+		for (unsigned i = 0; i < N; ++i)
+			Push(db, i);
+
+		UniqueFileDescriptor fd;
+		ASSERT_TRUE(fd.Open(path, O_WRONLY|O_TRUNC));
+		WriteSnapshot(db, fd);
+	}
+
+	const uint64_t complete_size = GetFileSize(path);
+
+	{
+		Database db{DatabaseConfig{.size = DB_SIZE}};
+		const auto loaded = LoadSnapshot(db, path);
+		EXPECT_EQ(loaded.n_records, int64_t{N});
+		EXPECT_EQ(loaded.size, complete_size);
+		ExpectRecords(db, N);
+	}
+
+	/* simulate a crash in the middle of writing a record */
+	{
+		UniqueFileDescriptor fd;
+		ASSERT_TRUE(fd.Open(path, O_WRONLY|O_APPEND));
+
+		const uint32_t size = 200;
+		const std::byte partial[64]{};
+		ASSERT_EQ(write(fd.Get(), &size, sizeof(size)), ssize_t(sizeof(size)));
+		ASSERT_EQ(write(fd.Get(), partial, sizeof(partial)), ssize_t(sizeof(partial)));
+	}
+
+	ASSERT_GT(GetFileSize(path), complete_size);
+
+	/* the partial record is ignored, and new records are
+	   appended after the last complete one */
+	{
+		EventLoop event_loop;
+		Database db{DatabaseConfig{.size = DB_SIZE}};
+
+		const auto loaded = LoadSnapshot(db, path);
+		EXPECT_EQ(loaded.n_records, int64_t{N});
+		EXPECT_EQ(loaded.size, complete_size);
+
+		SnapshotWriter writer{event_loop, db, path, std::chrono::minutes{1}};
+		writer.Start(loaded.size);
+
+		for (unsigned i = N; i < 2 * N; ++i)
+			Push(db, i);
+
+		writer.Stop();
+	}
+
+	{
+		Database db{DatabaseConfig{.size = DB_SIZE}};
+		const auto loaded = LoadSnapshot(db, path);
+		EXPECT_EQ(loaded.n_records, int64_t{2 * N});
+		EXPECT_EQ(loaded.size, GetFileSize(path));
+		ExpectRecords(db, 2 * N);
+	}
+
+	/* without a valid size (e.g. after a failed load), the file
+	   is rewritten from scratch */
+	{
+		EventLoop event_loop;
+		Database db{DatabaseConfig{.size = DB_SIZE}};
+		for (unsigned i = 0; i < N; ++i)
+			Push(db, i);
+
+		SnapshotWriter writer{event_loop, db, path, std::chrono::minutes{1}};
+		writer.Start(0);
+		writer.Stop();
+	}
+
+	{
+		Database db{DatabaseConfig{.size = DB_SIZE}};
+		const auto loaded = LoadSnapshot(db, path);
+		EXPECT_EQ(loaded.n_records, int64_t{N});
+		EXPECT_EQ(loaded.size, complete_size);
+		ExpectRecords(db, N);
+	}
+
+	EXPECT_EQ(unlink(path), 0);
+}
+
+TEST(Snapshot, Move)
+{
+	char path[] = "/tmp/TestSnapshot.XXXXXX";
+	UniqueFileDescriptor fd{FileDescriptor{mkstemp(path)}};
+	ASSERT_TRUE(fd.IsDefined());
+	unlink(path);
+
+	/* 1 MB for uncompressed records, 2 MB for compressed ones */
+	static constexpr std::size_t DB_SIZE = 3 * 1024 * 1024;
+	static constexpr std::size_t COLD_SIZE = 2 * 1024 * 1024;
+	static constexpr unsigned N = 20000;
+
+	{
+		Database db{DatabaseConfig{.size = DB_SIZE, .cold_size = COLD_SIZE}};
+		for (unsigned i = 0; i < N; ++i)
+			Push(db, i);
+
+		ASSERT_GT(db.GetColdRecordCount(), 0U);
+		ASSERT_EQ(db.GetRecordCount(), N);
+
+		MoveSnapshot(db, fd);
+
+		/* the records were deleted while being written */
+		EXPECT_EQ(db.GetRecordCount(), 0U);
+	}
+
+	/* the compressed records are loaded without decompressing
+	   them */
+	Database db{DatabaseConfig{.size = DB_SIZE, .cold_size = COLD_SIZE}};
+	const auto loaded = LoadSnapshot(db, fd);
+	EXPECT_EQ(loaded.n_records, int64_t{N});
+	EXPECT_GT(db.GetColdRecordCount(), 0U);
+	EXPECT_EQ(db.GetRecordCount(), N);
+	ExpectRecords(db, N);
+
+	/* the site ids of the compressed records are still valid */
+	Filter filter;
+	filter.sites.emplace("foo");
+
+	auto selection = db.Select(filter);
+	for (unsigned i = 0; i < N; i += 3, ++selection) {
+		ASSERT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::READY);
+		EXPECT_EQ(selection->GetParsed().timestamp, MakeTimestamp(i));
+	}
+
+	EXPECT_EQ(selection.Update(1024 * 1024), Selection::UpdateResult::END);
+
+	/* new records are appended after the loaded ones */
+	Push(db, N);
+	ExpectRecords(db, N + 1);
+}